@@ -0,0 +1,96 @@
+#ifndef FACIALAUTH_BACKEND_H
+#define FACIALAUTH_BACKEND_H
+
+//
+// Boundary between pam_facial_auth.so and the OpenCV-backed engine in
+// libfacialauth.so. The PAM module only includes this header (and the
+// IPC/probe ones) and dlopen()s the engine when an attempt will really
+// run, so processes that merely load the PAM stack never map OpenCV.
+//
+
+#include "facialauth_trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Default config path
+#ifndef FACIALAUTH_DEFAULT_CONFIG
+#define FACIALAUTH_DEFAULT_CONFIG "/etc/security/pam_facial.conf"
+#endif
+
+// Where the front end looks for the engine (set by CMake at install time)
+#ifndef FACIALAUTH_BACKEND_PATH
+#define FACIALAUTH_BACKEND_PATH "libfacialauth.so"
+#endif
+
+//
+// Outcome of one verification attempt
+//
+enum FaAttemptStatus {
+    FA_ATTEMPT_NONE = 0,
+    FA_ATTEMPT_ACCEPT,
+    FA_ATTEMPT_REJECT,
+    FA_ATTEMPT_NO_FACE,
+    FA_ATTEMPT_TIMEOUT,         // auth_timeout_ms ran out
+    FA_ATTEMPT_CAMERA_ERROR,
+    FA_ATTEMPT_ERROR,           // model / detector / recognizer failure
+    FA_ATTEMPT_CANCELLED
+};
+
+//
+// Per-attempt control shared with the caller. Setting cancel from another
+// thread makes the running attempt stop at the next stage boundary
+// (camera open, capture, detection, embedding) and return false; so does
+// passing the deadline. If no deadline is set, fa_test_user() starts one
+// from cfg.auth_timeout_ms.
+//
+struct FacialAuthAttempt
+{
+    std::atomic<bool> cancel{false};
+
+    std::chrono::steady_clock::time_point started{};    // set by fa_test_user()
+    std::chrono::steady_clock::time_point deadline{};   // epoch = none
+    FaAttemptStatus status = FA_ATTEMPT_NONE;
+
+    FaTrace trace;              // enabled from cfg.trace
+};
+
+// ----------------------------------------------------------
+// dlopen() entry point
+// ----------------------------------------------------------
+
+#define FA_BACKEND_ABI      3u
+#define FA_BACKEND_SYMBOL   "fa_backend_test_user"
+#define FA_BACKEND_LOG_MAX  4096
+
+struct FaBackendRequest
+{
+    uint32_t           abi;             // FA_BACKEND_ABI
+    const char        *user;
+    const char        *config_path;     // null: FACIALAUTH_DEFAULT_CONFIG
+    int                ignore_failure;  // PAM ignore_failure option
+    FacialAuthAttempt *attempt;         // may be null
+};
+
+struct FaBackendResult
+{
+    int  accepted;
+    int  ignore_failure;                // option or config key
+    char log[FA_BACKEND_LOG_MAX];
+};
+
+//
+// Loads the config and runs one in-process attempt. Returns false only
+// when the request could not be served at all (ABI mismatch, bad config);
+// a rejected face is true with accepted == 0. Outcome details are in
+// req->attempt->status when an attempt was passed.
+//
+typedef bool (*fa_backend_test_user_fn)(const FaBackendRequest *req,
+                                        FaBackendResult *res);
+
+extern "C" bool fa_backend_test_user(const FaBackendRequest *req,
+                                     FaBackendResult *res);
+
+#endif // FACIALAUTH_BACKEND_H
@@ -0,0 +1,71 @@
+#ifndef FACIALAUTH_CONFIG_H
+#define FACIALAUTH_CONFIG_H
+
+//
+// Compiled form of the config file and root's binary cache of it under
+// FACIALAUTH_RUNDIR. The loader in libfacialauth writes and reads it; the
+// PAM front end's probe reads it too, so a login parses the text file
+// only when the cache is missing or stale. No OpenCV here.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 64-bit FNV-1a
+uint64_t fa_fnv1a64(const void *data, size_t len,
+                    uint64_t h = 0xcbf29ce484222325ULL);
+
+// "yes", "true" or "1", any case
+bool fa_parse_bool(const std::string &v);
+
+// Identity of the config file as cached: any change invalidates the cache.
+struct FaConfigStamp
+{
+    uint64_t dev   = 0;
+    uint64_t ino   = 0;
+    int64_t  sec   = 0;
+    int64_t  nsec  = 0;
+    int64_t  size  = 0;
+
+    bool operator==(const FaConfigStamp &o) const {
+        return dev == o.dev && ino == o.ino && sec == o.sec &&
+               nsec == o.nsec && size == o.size;
+    }
+};
+
+bool fa_config_stamp(const std::string &path, FaConfigStamp &st);
+
+//
+// One validated "key = value" line. id is the loader's key table index,
+// only meaningful with the schema hash the cache was written with.
+//
+struct FaConfigEntry
+{
+    uint16_t    id = 0;
+    std::string key;      // as written in the file
+    std::string subkey;   // detect_/recognize_ suffix
+    std::string value;
+};
+
+std::string fa_config_cache_path(const std::string &cfg_path);
+
+// Root only; anyone else returns without writing.
+void fa_write_config_cache(const std::string &cfg_path,
+                           const FaConfigStamp &stamp,
+                           uint64_t schema,
+                           const std::vector<FaConfigEntry> &entries,
+                           const std::string &log);
+
+//
+// false unless the cache is root-owned, not group/world-writable, intact
+// and written for stamp. On success log holds the compile log.
+//
+bool fa_read_config_cache(const std::string &cfg_path,
+                          const FaConfigStamp &stamp,
+                          uint64_t &schema,
+                          std::vector<FaConfigEntry> &entries,
+                          std::string &log);
+
+#endif // FACIALAUTH_CONFIG_H
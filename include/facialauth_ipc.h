@@ -0,0 +1,99 @@
+#ifndef FACIALAUTH_IPC_H
+#define FACIALAUTH_IPC_H
+
+//
+// Wire protocol between pam_facial_auth.so and facial_authd.
+// Deliberately free of OpenCV so the PAM client stays small.
+//
+
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+#ifndef FACIALAUTH_RUNDIR
+#define FACIALAUTH_RUNDIR "/run/pam_facial_auth"
+#endif
+
+#ifndef FACIALAUTH_DEFAULT_SOCKET
+#define FACIALAUTH_DEFAULT_SOCKET FACIALAUTH_RUNDIR "/facial_authd.sock"
+#endif
+
+#define FA_IPC_MAGIC    0x46414431u   // "FAD1"
+#define FA_IPC_VERSION  1u
+
+#define FA_IPC_USER_MAX 256
+#define FA_IPC_PATH_MAX 1024
+#define FA_IPC_LOG_MAX  4096
+
+// Default time the PAM client waits for the daemon's answer, used when
+// the config sets no auth_timeout_ms
+#define FA_IPC_DEFAULT_TIMEOUT_MS 10000
+
+// Added to auth_timeout_ms for config reload and model load in the daemon
+#define FA_IPC_TIMEOUT_MARGIN_MS  2000
+
+enum FaIpcStatus : int32_t {
+    FA_IPC_ACCEPT   = 0,   // face matched
+    FA_IPC_REJECT   = 1,   // face did not match
+    FA_IPC_ERROR    = 2,   // camera / model / detector failure
+    FA_IPC_DENIED   = 3,   // peer not allowed to ask for this user
+    FA_IPC_TIMEOUT  = 4,   // auth_timeout_ms ran out before a decision
+    FA_IPC_BUSY     = 5    // camera in use or peer over its rate limit
+};
+
+// Reply flags
+#define FA_IPC_FLAG_IGNORE_FAILURE 0x1u
+
+struct FaIpcRequest
+{
+    uint32_t magic;
+    uint32_t version;
+    double   threshold;                 // root peers only; < 0: configured
+    char     user[FA_IPC_USER_MAX];
+    char     config[FA_IPC_PATH_MAX];   // honored for root peers only
+};
+
+struct FaIpcReply
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t  status;                    // FaIpcStatus
+    uint32_t flags;
+    int32_t  best_label;
+    double   best_conf;
+    char     log[FA_IPC_LOG_MAX];
+};
+
+// Result of fa_ipc_authenticate()
+enum FaIpcClientResult {
+    FA_IPC_CLIENT_OK = 0,       // reply received
+    FA_IPC_CLIENT_NO_DAEMON,    // socket missing / nobody listening
+    FA_IPC_CLIENT_FAILED,       // untrusted peer, timeout or protocol error
+    FA_IPC_CLIENT_CANCELLED     // cancel_fd became readable while waiting
+};
+
+//
+// Client side: send one request and wait up to timeout_ms for the reply.
+// The daemon must be running as root (checked via SO_PEERCRED).
+// If cancel_fd >= 0, the wait is abandoned as soon as it becomes readable.
+//
+FaIpcClientResult fa_ipc_authenticate(const std::string &socket_path,
+                                      const FaIpcRequest &req,
+                                      FaIpcReply &reply,
+                                      int timeout_ms,
+                                      std::string &err,
+                                      int cancel_fd = -1);
+
+//
+// Helpers shared by both ends
+//
+void fa_ipc_copy(char *dst, size_t cap, const std::string &src);
+
+bool fa_ipc_read_full(int fd, void *buf, size_t len, int timeout_ms,
+                      int cancel_fd = -1);
+bool fa_ipc_write_full(int fd, const void *buf, size_t len);
+
+bool fa_ipc_peer_cred(int fd, pid_t &pid, uid_t &uid, gid_t &gid);
+
+#endif // FACIALAUTH_IPC_H
@@ -0,0 +1,91 @@
+#ifndef FACIALAUTH_LBPH_H
+#define FACIALAUTH_LBPH_H
+
+//
+// Native LBPH: the features and distance of OpenCV's LBPHFaceRecognizer,
+// plus a binary model store (<model>.lbph) written next to the XML model
+// by facial_training. Its histogram rows are mmap()ed and scanned in
+// place, so a login never parses megabytes of XML. No OpenCV here.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct FaLbphParams
+{
+    int radius    = 1;
+    int neighbors = 8;
+    int grid_x    = 8;
+    int grid_y    = 8;
+
+    size_t bins() const { return (size_t)grid_x * grid_y * ((size_t)1 << neighbors); }
+};
+
+enum FaLbphDtype : uint32_t {
+    FA_LBPH_F32 = 0,    // rows as trained
+    FA_LBPH_U16 = 1     // cell histograms lie in [0,1]: 16-bit fixed point
+};
+
+// <model_path>.lbph
+std::string fa_lbph_path(const std::string &model_path);
+
+// Spatial LBP histogram of an 8-bit gray image: params.bins() floats.
+void fa_lbph_histogram(const uint8_t *img, int width, int height, size_t stride,
+                       const FaLbphParams &params, float *out);
+
+// "avx2", "neon" or "scalar": the kernels selected for this CPU.
+const char *fa_lbph_kernel_name();
+
+//
+// Writes `rows` histograms stored back to back in hist. source_size and
+// source_mtime_ns identify the XML model the store mirrors: once they no
+// longer match, FaLbphModel::open() refuses the store.
+//
+bool fa_lbph_write(const std::string &path,
+                   const FaLbphParams &params,
+                   double threshold,
+                   const float *hist,
+                   const int32_t *labels,
+                   size_t rows,
+                   FaLbphDtype dtype,
+                   int64_t source_size,
+                   int64_t source_mtime_ns,
+                   std::string &log);
+
+class FaLbphModel
+{
+public:
+    FaLbphModel() = default;
+    ~FaLbphModel();
+
+    FaLbphModel(const FaLbphModel &) = delete;
+    FaLbphModel &operator=(const FaLbphModel &) = delete;
+
+    // false if the store is missing, corrupt or stale.
+    bool open(const std::string &path,
+              int64_t source_size,
+              int64_t source_mtime_ns,
+              std::string &log);
+
+    // Nearest row; label is -1 when its distance exceeds the threshold.
+    void predict(const uint8_t *img, int width, int height, size_t stride,
+                 int &label, double &dist) const;
+
+    size_t rows() const { return rows_; }
+    double threshold() const { return threshold_; }
+    const FaLbphParams &params() const { return params_; }
+
+private:
+    void          *map_     = nullptr;
+    size_t         map_len_ = 0;
+
+    FaLbphParams   params_;
+    FaLbphDtype    dtype_     = FA_LBPH_F32;
+    double         threshold_ = 0.0;
+    size_t         rows_      = 0;
+    const int32_t *labels_    = nullptr;
+    const void    *data_      = nullptr;
+};
+
+#endif // FACIALAUTH_LBPH_H
@@ -0,0 +1,58 @@
+#ifndef FACIALAUTH_LOG_H
+#define FACIALAUTH_LOG_H
+
+//
+// Leveled diagnostics. FA_LOG() checks the level before evaluating its
+// arguments, formats into a stack buffer only when the sink will take the
+// message, and never allocates. Statements above FACIALAUTH_LOG_MAX_LEVEL
+// are compiled out. The default sink is syslog (authpriv), right for PAM
+// and facial_authd; the CLIs switch to stderr.
+//
+// This is for operator diagnostics. The std::string &log parameters of the
+// fa_* API still carry the failure reason back to the caller.
+//
+
+#include <atomic>
+
+enum FaLogLevel {
+    FA_LOG_ERROR = 0,
+    FA_LOG_WARN  = 1,
+    FA_LOG_INFO  = 2,
+    FA_LOG_DEBUG = 3
+};
+
+#ifndef FACIALAUTH_LOG_MAX_LEVEL
+#define FACIALAUTH_LOG_MAX_LEVEL FA_LOG_DEBUG
+#endif
+
+typedef void (*FaLogSink)(FaLogLevel level, const char *msg, void *ctx);
+
+void fa_log_set_sink(FaLogSink sink, void *ctx);
+void fa_log_set_level(FaLogLevel level);
+
+// Ready-made sinks
+void fa_log_sink_syslog(FaLogLevel level, const char *msg, void *ctx);
+void fa_log_sink_stderr(FaLogLevel level, const char *msg, void *ctx);
+
+void fa_log_write(FaLogLevel level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+extern std::atomic<int> g_fa_log_level;
+
+static inline bool fa_log_enabled(FaLogLevel level)
+{
+    return (int)level <= g_fa_log_level.load(std::memory_order_relaxed);
+}
+
+#define FA_LOG(level, ...)                                              \
+    do {                                                                \
+        if ((level) <= FACIALAUTH_LOG_MAX_LEVEL && fa_log_enabled(level)) \
+            fa_log_write((level), __VA_ARGS__);                         \
+    } while (0)
+
+#define FA_ERR(...)  FA_LOG(FA_LOG_ERROR, __VA_ARGS__)
+#define FA_WARN(...) FA_LOG(FA_LOG_WARN,  __VA_ARGS__)
+#define FA_INFO(...) FA_LOG(FA_LOG_INFO,  __VA_ARGS__)
+#define FA_DBG(...)  FA_LOG(FA_LOG_DEBUG, __VA_ARGS__)
+
+#endif // FACIALAUTH_LOG_H
@@ -0,0 +1,60 @@
+#ifndef FACIALAUTH_METRICS_H
+#define FACIALAUTH_METRICS_H
+
+//
+// Process-wide counters and fixed-bucket latency histograms. Updates are
+// relaxed atomic increments. A login only spools its samples as a small
+// delta file (fa_metrics_spool); fa_metrics_flush(), run on a timer by
+// facial_authd, merges the spool and its own samples into a Prometheus
+// textfile-collector file (flock + write to temp + rename). No OpenCV here.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum FaMetricResult {
+    FA_RESULT_ACCEPT = 0,
+    FA_RESULT_REJECT,
+    FA_RESULT_NO_FACE,
+    FA_RESULT_TIMEOUT,
+    FA_RESULT_CAMERA_ERROR,
+    FA_RESULT_ERROR,
+    FA_RESULT_CANCELLED,
+    FA_RESULT_COUNT
+};
+
+enum FaMetricStage {
+    FA_METRIC_NONE = -1,
+    FA_METRIC_CAMERA_OPEN = 0,
+    FA_METRIC_DETECT,
+    FA_METRIC_EMBED,
+    FA_METRIC_TOTAL,
+    FA_METRIC_STAGE_COUNT
+};
+
+// Counts one finished attempt.
+void fa_metrics_result(FaMetricResult r);
+
+// Adds one latency sample to the stage histogram.
+void fa_metrics_observe(FaMetricStage stage, int64_t dur_us);
+
+// <basedir>/metrics/facial_auth.prom
+std::string fa_metrics_path(const std::string &basedir);
+
+//
+// Merges the spooled deltas and the samples recorded since the previous
+// successful flush into path. Never waits for the lock: returns false
+// (and keeps the samples for the next flush) if another process holds
+// it or the file cannot be written, e.g. when running unprivileged.
+//
+bool fa_metrics_flush(const std::string &path, std::string &log);
+
+// Writes this process's new samples as one delta file next to path, for
+// the next flush to merge: no lock, no read of the main file.
+bool fa_metrics_spool(const std::string &path, std::string &log);
+
+// Deltas waiting in the spool of path.
+size_t fa_metrics_spooled(const std::string &path);
+
+#endif // FACIALAUTH_METRICS_H
@@ -0,0 +1,87 @@
+#ifndef FACIALAUTH_POOL_H
+#define FACIALAUTH_POOL_H
+
+//
+// CPU budget for the threads that run an attempt: an optional CPU set and
+// nice increment (cpu_set / nice in the config), and a fixed pool of
+// worker threads created once per engine and reused by every attempt.
+// Inside sshd or gdm the attempt shares the machine with everything else,
+// so latency under load matters more than best-case latency.
+// No OpenCV here.
+//
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct FaCpuPolicy
+{
+    std::vector<int> cpus;      // empty: any CPU
+    int              nice = 0;  // added to the thread's nice value
+
+    bool empty() const { return cpus.empty() && nice == 0; }
+};
+
+// "0-3,6" -> {0,1,2,3,6}. An empty spec means no restriction.
+bool fa_parse_cpu_set(const std::string &spec, std::vector<int> &cpus,
+                      std::string &log);
+
+// Applies the policy to the calling thread only. A raised nice value
+// cannot be lowered again without CAP_SYS_NICE, so call it only on
+// threads we own (pool and training workers).
+bool fa_apply_cpu_policy(const FaCpuPolicy &p, std::string &log);
+
+//
+// Applies the CPU set to the calling thread for its lifetime and restores
+// the previous affinity afterwards: the PAM host's thread is borrowed, not
+// kept. The nice value is left alone, since a screen locker running as
+// the user could not restore it.
+//
+class FaCpuScope
+{
+public:
+    explicit FaCpuScope(const FaCpuPolicy &p);
+    ~FaCpuScope();
+
+    FaCpuScope(const FaCpuScope &) = delete;
+    FaCpuScope &operator=(const FaCpuScope &) = delete;
+
+private:
+    bool                 active_ = false;
+    bool                 have_mask_ = false;
+    std::vector<uint8_t> mask_;         // cpu_set_t bytes
+};
+
+class FaThreadPool
+{
+public:
+    // Workers start at once and apply policy to themselves.
+    FaThreadPool(size_t threads, const FaCpuPolicy &policy);
+    ~FaThreadPool();
+
+    FaThreadPool(const FaThreadPool &) = delete;
+    FaThreadPool &operator=(const FaThreadPool &) = delete;
+
+    std::future<void> submit(std::function<void()> fn);
+
+    size_t size() const { return workers_.size(); }
+
+private:
+    void run();
+
+    std::mutex                               mutex_;
+    std::condition_variable                  cv_;
+    std::deque<std::packaged_task<void()>>   tasks_;
+    bool                                     stop_ = false;
+    FaCpuPolicy                              policy_;
+    std::vector<std::thread>                 workers_;
+};
+
+#endif // FACIALAUTH_POOL_H
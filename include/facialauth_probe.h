@@ -0,0 +1,36 @@
+#ifndef FACIALAUTH_PROBE_H
+#define FACIALAUTH_PROBE_H
+
+//
+// Cheap pre-checks run by the PAM front end before anything heavy is
+// loaded: is the user enrolled, is there a camera, is this a local
+// session. No OpenCV here.
+//
+
+#include <string>
+
+struct FaProbeConfig
+{
+    std::string basedir;
+    std::string device;
+    bool fallback_device = false;
+    int  auth_timeout_ms = 5000;
+};
+
+// Reads only the keys above, from root's compiled cache when it is fresh
+// (see facialauth_config.h), else from the text; unknown keys are skipped
+// silently.
+bool fa_probe_config(const std::string &path,
+                     FaProbeConfig &cfg,
+                     std::string &log);
+
+// <basedir>/models/<user>.xml (shared with fa_user_model_path)
+std::string fa_model_path(const std::string &basedir,
+                          const std::string &user);
+
+bool fa_probe_model(const FaProbeConfig &cfg, const std::string &user);
+
+// True if the configured device (or a fallback /dev/videoN) exists.
+bool fa_probe_camera(const FaProbeConfig &cfg);
+
+#endif // FACIALAUTH_PROBE_H
@@ -0,0 +1,167 @@
+#ifndef FACIALAUTH_QUEUE_H
+#define FACIALAUTH_QUEUE_H
+
+//
+// Bounded lock-free queue between pipeline stages (D. Vyukov's bounded
+// MPMC ring). Each stage link has one producer and one consumer, but the
+// producer may also pop: push_drop_oldest() discards the stalest entries
+// instead of blocking, so a slow consumer always sees the freshest frame.
+// No OpenCV here.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+template <typename T>
+class FaBoundedQueue
+{
+public:
+    // capacity is rounded up to a power of two (at least 2).
+    explicit FaBoundedQueue(size_t capacity)
+    {
+        size_t n = 2;
+        while (n < capacity)
+            n <<= 1;
+        mask_  = n - 1;
+        cells_.reset(new Cell[n]);
+        for (size_t i = 0; i < n; ++i)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    FaBoundedQueue(const FaBoundedQueue &) = delete;
+    FaBoundedQueue &operator=(const FaBoundedQueue &) = delete;
+
+    bool try_push(T &&v)
+    {
+        size_t pos = enq_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &c = cells_[pos & mask_];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enq_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;                       // full
+            } else {
+                pos = enq_.load(std::memory_order_relaxed);
+            }
+        }
+        Cell &c = cells_[pos & mask_];
+        c.data = std::move(v);
+        c.seq.store(pos + 1, std::memory_order_release);
+        note_push();
+        return true;
+    }
+
+    bool try_pop(T &out)
+    {
+        size_t pos = deq_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &c = cells_[pos & mask_];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (deq_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;                       // empty
+            } else {
+                pos = deq_.load(std::memory_order_relaxed);
+            }
+        }
+        Cell &c = cells_[pos & mask_];
+        out = std::move(c.data);
+        c.data = T();
+        c.seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Never blocks: while full, the oldest entry is popped and dropped.
+    void push_drop_oldest(T &&v)
+    {
+        while (!try_push(std::move(v))) {
+            T stale;
+            if (try_pop(stale))
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    //
+    // Waits for an entry: spins briefly, then sleeps in short steps.
+    // false once the queue is closed and drained, or when *stop is set.
+    //
+    bool pop_wait(T &out, const std::atomic<bool> *stop = nullptr)
+    {
+        for (unsigned spin = 0;; ++spin) {
+            if (try_pop(out))
+                return true;
+            if (stop && stop->load(std::memory_order_relaxed))
+                return false;
+            if (closed_.load(std::memory_order_acquire))
+                return try_pop(out);
+            if (spin < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    // No more pushes: consumers drain what is left, then stop.
+    void close() { closed_.store(true, std::memory_order_release); }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    size_t size() const
+    {
+        size_t e = enq_.load(std::memory_order_relaxed);
+        size_t d = deq_.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+
+    // Statistics: entries pushed, dropped, and queue depth seen by pushes.
+    uint64_t pushed() const   { return pushed_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const  { return dropped_.load(std::memory_order_relaxed); }
+    size_t   max_depth() const { return max_depth_.load(std::memory_order_relaxed); }
+    double   mean_depth() const
+    {
+        uint64_t n = pushed();
+        return n ? (double)depth_sum_.load(std::memory_order_relaxed) / n : 0.0;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T                   data;
+    };
+
+    void note_push()
+    {
+        size_t d = size();
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+        depth_sum_.fetch_add(d, std::memory_order_relaxed);
+        size_t m = max_depth_.load(std::memory_order_relaxed);
+        while (d > m && !max_depth_.compare_exchange_weak(m, d, std::memory_order_relaxed))
+            ;
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t                  mask_ = 0;
+
+    alignas(64) std::atomic<size_t> enq_{0};
+    alignas(64) std::atomic<size_t> deq_{0};
+
+    std::atomic<bool>     closed_{false};
+    std::atomic<uint64_t> pushed_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> depth_sum_{0};
+    std::atomic<size_t>   max_depth_{0};
+};
+
+#endif // FACIALAUTH_QUEUE_H
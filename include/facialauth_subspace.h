@@ -0,0 +1,82 @@
+#ifndef FACIALAUTH_SUBSPACE_H
+#define FACIALAUTH_SUBSPACE_H
+
+//
+// Native Eigenfaces/Fisherfaces prediction: the mean, projection basis
+// and projected training set of an Eigen/Fisher model in a binary store
+// (<model>.proj) written next to the XML model by facial_training. A
+// login mmap()s it, projects the probe with one matrix-vector product
+// and scans the projections in place. No OpenCV here.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// <model_path>.proj
+std::string fa_subspace_path(const std::string &model_path);
+
+//
+// mean has dim floats; basis is dim x components, row-major (the layout
+// of BasicFaceRecognizer::getEigenVectors()); proj holds rows projections
+// of components floats back to back. source_size and source_mtime_ns
+// identify the XML model the store mirrors, as for fa_lbph_write().
+//
+bool fa_subspace_write(const std::string &path,
+                       size_t dim,
+                       size_t components,
+                       const float *mean,
+                       const float *basis,
+                       const float *proj,
+                       const int32_t *labels,
+                       size_t rows,
+                       double threshold,
+                       int64_t source_size,
+                       int64_t source_mtime_ns,
+                       std::string &log);
+
+class FaSubspaceModel
+{
+public:
+    FaSubspaceModel() = default;
+    ~FaSubspaceModel();
+
+    FaSubspaceModel(const FaSubspaceModel &) = delete;
+    FaSubspaceModel &operator=(const FaSubspaceModel &) = delete;
+
+    // false if the store is missing, corrupt or stale.
+    bool open(const std::string &path,
+              int64_t source_size,
+              int64_t source_mtime_ns,
+              std::string &log);
+
+    //
+    // Nearest projection by L2 distance, as BasicFaceRecognizer::predict().
+    // label is -1 when that distance exceeds the threshold. false if the
+    // image does not have the training size (width * height != dim()).
+    //
+    bool predict(const uint8_t *img, int width, int height, size_t stride,
+                 int &label, double &dist) const;
+
+    size_t dim() const { return dim_; }
+    size_t components() const { return components_; }
+    size_t rows() const { return rows_; }
+    double threshold() const { return threshold_; }
+
+private:
+    void          *map_     = nullptr;
+    size_t         map_len_ = 0;
+
+    size_t         dim_        = 0;
+    size_t         dim_stride_ = 0;
+    size_t         components_ = 0;
+    size_t         comp_stride_ = 0;
+    size_t         rows_       = 0;
+    double         threshold_  = 0.0;
+    const int32_t *labels_     = nullptr;
+    const float   *mean_       = nullptr;
+    const float   *basis_      = nullptr;
+    const float   *proj_       = nullptr;
+};
+
+#endif // FACIALAUTH_SUBSPACE_H
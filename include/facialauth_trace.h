@@ -0,0 +1,83 @@
+#ifndef FACIALAUTH_TRACE_H
+#define FACIALAUTH_TRACE_H
+
+//
+// Per-attempt stage timings. Each attempt owns one FaTrace; stages are
+// recorded with monotonic timestamps relative to the first span and the
+// whole trace is emitted once, as a single JSON object, when the attempt
+// is decided. No OpenCV here.
+//
+
+#include "facialauth_metrics.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct FaTraceEvent
+{
+    const char *stage;          // static string
+    int         frame;          // -1: not tied to a frame
+    int64_t     start_us;       // since FaTrace::t0
+    int64_t     dur_us;
+    double      score;          // NaN: none
+};
+
+struct FaTrace
+{
+    bool enabled = false;
+
+    std::chrono::steady_clock::time_point t0{};
+    std::vector<FaTraceEvent> events;
+    int frames = 0;
+};
+
+//
+// Scoped timer: records [construction, destruction) as one event and, if
+// metric is set, as a sample of that latency histogram. Does nothing when
+// there is neither an enabled trace nor a metric.
+//
+class FaTraceSpan
+{
+public:
+    FaTraceSpan(FaTrace *trace, const char *stage, int frame = -1,
+                FaMetricStage metric = FA_METRIC_NONE);
+    ~FaTraceSpan();
+
+    FaTraceSpan(const FaTraceSpan &) = delete;
+    FaTraceSpan &operator=(const FaTraceSpan &) = delete;
+
+    void set_score(double s) { score_ = s; }
+
+private:
+    FaTrace    *trace_;
+    const char *stage_;
+    int           frame_;
+    FaMetricStage metric_;
+    double        score_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Event timed by the caller (e.g. before the trace was enabled).
+void fa_trace_add(FaTrace *trace, const char *stage, int frame,
+                  std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end,
+                  double score);
+
+// Point event (decision) with zero duration.
+void fa_trace_mark(FaTrace *trace, const char *stage, double score);
+
+std::string fa_trace_json(const FaTrace &trace,
+                          const std::string &user,
+                          const char *method,
+                          const char *status,
+                          double score);
+
+//
+// Appends the JSON line to file (mode 0600, O_APPEND) or, if file is
+// empty, logs it as one LOG_AUTHPRIV record.
+//
+void fa_trace_emit(const std::string &json, const std::string &file);
+
+#endif // FACIALAUTH_TRACE_H
@@ -0,0 +1,62 @@
+#ifndef FACIALAUTH_USDT_H
+#define FACIALAUTH_USDT_H
+
+//
+// USDT static tracepoints (provider "facialauth"). With sys/sdt.h each
+// probe is a single nop plus an ELF note until a tracer attaches, e.g.
+//
+//   bpftrace -e 'usdt:/usr/lib64/security/libfacialauth.so:facialauth:detect_exit
+//                { @us = hist(arg3); }'
+//
+// Without sys/sdt.h (or with -DENABLE_USDT=OFF) everything compiles away,
+// including the timestamps taken only to feed probe arguments.
+//
+
+#include <cstdint>
+
+#if defined(FACIALAUTH_USDT) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define FA_HAVE_USDT 1
+#  endif
+#endif
+
+#ifdef FA_HAVE_USDT
+
+#include <chrono>
+
+#define FA_PROBE1(name, a)             DTRACE_PROBE1(facialauth, name, a)
+#define FA_PROBE2(name, a, b)          DTRACE_PROBE2(facialauth, name, a, b)
+#define FA_PROBE3(name, a, b, c)       DTRACE_PROBE3(facialauth, name, a, b, c)
+#define FA_PROBE4(name, a, b, c, d)    DTRACE_PROBE4(facialauth, name, a, b, c, d)
+
+static inline int64_t fa_usdt_now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#else
+
+#define FA_PROBE1(name, a)             do { } while (0)
+#define FA_PROBE2(name, a, b)          do { } while (0)
+#define FA_PROBE3(name, a, b, c)       do { } while (0)
+#define FA_PROBE4(name, a, b, c, d)    do { } while (0)
+
+static inline int64_t fa_usdt_now_us() { return 0; }
+
+#endif
+
+//
+// Probe list (arguments in order):
+//
+//   frame_arrival   width, height, read_us
+//   detect_entry    width, height
+//   detect_exit     face_width, face_height (0 = no face), detector, dur_us
+//   sface_entry     width, height
+//   sface_exit      ok, dur_us
+//   gallery_match   gallery_size, best_sim * 1e6, dur_us
+//   pam_decision    pam_status, concurrent, dur_us
+//
+
+#endif // FACIALAUTH_USDT_H
@@ -8,11 +8,50 @@
 #include <opencv2/core.hpp>
 #include <opencv2/objdetect.hpp>
 #include <opencv2/dnn.hpp>
+#include <opencv2/videoio.hpp>
+#include <opencv2/face.hpp>
+
+#include "facialauth_backend.h"
+#include "facialauth_lbph.h"
+#include "facialauth_pool.h"
+#include "facialauth_subspace.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <sys/types.h>
+#include <ctime>
 
-// Default config path
-#ifndef FACIALAUTH_DEFAULT_CONFIG
-#define FACIALAUTH_DEFAULT_CONFIG "/etc/security/pam_facial.conf"
-#endif
+//
+// Resolved selectors (filled from the string options by fa_resolve_config)
+//
+enum FaTrainingMethod {
+    FA_METHOD_LBPH = 0,
+    FA_METHOD_EIGEN,
+    FA_METHOD_FISHER,
+    FA_METHOD_SFACE,
+    FA_METHOD_INVALID
+};
+
+enum FaDetectorProfile {
+    FA_DET_NONE = 0,
+    FA_DET_HAAR,
+    FA_DET_YUNET_FP32,
+    FA_DET_YUNET_INT8
+};
+
+enum FaRecognizerProfile {
+    FA_REC_SFACE_FP32 = 0,
+    FA_REC_SFACE_INT8
+};
 
 //
 // Main configuration structure
@@ -30,6 +69,19 @@ struct FacialAuthConfig
     int frames   = 20;
     int sleep_ms = 200;
 
+    // SFace verification: frames tried per attempt. Above 1, grabbing,
+    // detection and embedding run as a pipeline on three threads linked
+    // by queues of pipeline_depth frames (oldest dropped when full).
+    int verify_frames  = 1;
+    int pipeline_depth = 2;
+
+    // SFace forwards of attempts running at the same time in one process
+    // (threads, batch verification) are merged into one batched forward
+    // of up to sface_batch_max faces; a face waits at most
+    // sface_batch_window_ms for others. 1 (default) disables batching.
+    int sface_batch_max       = 1;
+    int sface_batch_window_ms = 2;
+
     bool fallback_device    = false;
     bool debug              = false;
     bool verbose            = false;
@@ -38,6 +90,56 @@ struct FacialAuthConfig
     bool ignore_failure     = false;
     bool save_failed_images = false;
 
+    // Resident engines (facial_authd) keep the camera streaming between attempts
+    bool keep_camera        = false;
+
+    // Parsed user models kept by long-lived processes
+    int model_cache_size    = 16;
+
+    // Budget for one verification attempt, camera open included (0 = none)
+    int auth_timeout_ms     = 5000;
+
+    // Per-stage timing trace: JSON line to trace_file, or syslog if empty
+    bool trace              = false;
+    std::string trace_file;
+
+    // Counters/histograms merged into <basedir>/metrics/facial_auth.prom
+    bool metrics            = true;
+
+    // Enrollment workers (0 = one per core)
+    int train_threads       = 0;
+
+    // CPU budget of an attempt: OpenCV worker threads (0 = OpenCV
+    // default, all cores; process-wide, see fa_set_inference_threads),
+    // CPU set of the attempt and pipeline threads ("0-3,6", empty = any)
+    // and nice increment of the pipeline threads. Training workers
+    // follow cpu_set and nice too.
+    int inference_threads   = 0;
+    std::string cpu_set;
+    int nice                = 0;
+
+    // Reuse detections/embeddings of unchanged images across training runs
+    bool embedding_cache    = true;
+
+    // Streaming enrollment: facial_capture embeds faces and writes the
+    // SFace gallery itself. capture_save: full | face | none
+    bool capture_embed      = false;
+    std::string capture_save = "full";
+    int capture_max_width   = 0;         // 0 = keep frame size
+
+    // Near-duplicate faces dropped during capture and training: SFace
+    // cosine similarity (0 = off), classic dHash Hamming distance (-1 = off).
+    // Off by default.
+    double dedup_similarity = 0.0;
+    int dedup_hash_distance = -1;
+
+    // Binary LBPH store written next to the model for fast logins:
+    // f32 | u16 (half the size, 16-bit fixed point) | no
+    std::string lbph_store  = "f32";
+
+    // Eigen/Fisher counterpart (<model>.proj): mean, basis, projections
+    bool subspace_store     = true;
+
     // Model profile selectors
     std::string detector_profile;
     std::string recognizer_profile;
@@ -50,6 +152,10 @@ struct FacialAuthConfig
     int eigen_components  = 80;
     int fisher_components = 80;
 
+    // Eigenfaces PCA: exact (cv::PCA) | randomized (low-rank sketch) |
+    // auto (randomized for large enrollments)
+    std::string eigen_solver = "auto";
+
     // SFace thresholds
     double sface_threshold      = 0.5;
     double sface_fp32_threshold = 0.5;
@@ -80,6 +186,24 @@ struct FacialAuthConfig
 
     // Output format
     std::string image_format = "jpg";
+
+    // ------------------------------------------------------
+    // Resolved snapshot: set by fa_resolve_config(), which
+    // fa_load_config() calls. Call it again after changing
+    // any of the string selectors above.
+    // ------------------------------------------------------
+    FaTrainingMethod    method     = FA_METHOD_LBPH;
+    FaDetectorProfile   detector   = FA_DET_NONE;
+    FaRecognizerProfile recognizer = FA_REC_SFACE_FP32;
+
+    std::string detector_path;          // model file of the selected detector
+    std::string sface_path;             // ONNX file of the selected SFace profile
+    double      sface_active_threshold = 0.5;
+
+    int dnn_backend_id = 0;             // cv::dnn::Backend
+    int dnn_target_id  = 0;             // cv::dnn::Target
+
+    FaCpuPolicy cpu_policy;             // cpu_set + nice
 };
 
 
@@ -101,11 +225,14 @@ struct DetectorWrapper
     cv::Ptr<cv::dnn::Net> yunet;
     cv::Size input_size = cv::Size(320,320);
 
-    bool debug = false;
     std::string model_path;
 
-    // Unified detector interface
-    bool detect(const cv::Mat &frame, cv::Rect &face);
+    // Unified detector interface. landmarks (YuNet only): eyes, nose tip,
+    // mouth corners in frame coordinates; left empty for Haar. failed is
+    // set when false means "could not run" rather than "no face".
+    bool detect(const cv::Mat &frame, cv::Rect &face,
+                std::vector<cv::Point2f> *landmarks = nullptr,
+                bool *failed = nullptr);
 };
 
 
@@ -131,13 +258,323 @@ bool compute_sface_embedding(
 );
 
 
+//
+// SFace embedding with an already loaded network
+//
+bool compute_sface_embedding(
+    cv::dnn::Net &net,
+    const cv::Mat &face,
+    cv::Mat &embedding,
+    std::string &log
+);
+
+
+//
+// Parsed user model: SFace gallery or classic recognizer.
+// Shared read-only between attempts; never modified after loading.
+//
+struct FaUserModel
+{
+    enum Kind { SFACE, CLASSIC };
+
+    Kind        kind = SFACE;
+    std::string path;
+    time_t      mtime = 0;
+    off_t       size  = 0;
+
+    std::vector<cv::Mat> gallery;                      // SFace embeddings
+    cv::Ptr<cv::face::FaceRecognizer> classic;         // LBPH / Eigen / Fisher
+    std::shared_ptr<const FaLbphModel> lbph;           // mmapped LBPH store, if fresh
+    std::shared_ptr<const FaSubspaceModel> subspace;   // mmapped Eigen/Fisher store, if fresh
+};
+
+//
+// Bounded LRU cache of parsed user models. With watch() an inotify
+// thread follows the models directory: a rewritten model is reloaded in
+// the background and swapped in, a deleted one is dropped. Readers only
+// take the mutex for the lookup and never wait for a reload.
+//
+class FaModelCache
+{
+public:
+    explicit FaModelCache(size_t capacity = 16);
+    ~FaModelCache();
+
+    FaModelCache(const FaModelCache &) = delete;
+    FaModelCache &operator=(const FaModelCache &) = delete;
+
+    bool watch(const std::string &models_dir);
+    void stop_watch();
+
+    std::shared_ptr<const FaUserModel> get(const std::string &path,
+                                           std::string &log);
+    void invalidate(const std::string &path);
+    void clear();
+
+private:
+    struct Entry {
+        std::shared_ptr<const FaUserModel> model;
+        std::list<std::string>::iterator   lru;
+    };
+    typedef std::unordered_map<std::string, Entry> Map;
+
+    void touch_locked(Map::iterator it);
+    void insert_locked(const std::string &path,
+                       std::shared_ptr<const FaUserModel> model);
+    void on_change(const std::string &path, bool removed);
+    void watch_loop();
+
+    size_t                 capacity_;
+    std::mutex             mutex_;
+    Map                    entries_;
+    std::list<std::string> lru_;        // front = most recently used
+    uint64_t               epoch_    = 0;
+    bool                   watching_ = false;
+
+    std::string            dir_;
+    int                    inotify_fd_ = -1;
+    int                    stop_fd_    = -1;
+    std::thread            watcher_;
+};
+
+const char *fa_attempt_status_name(FaAttemptStatus s);
+
+//
+// Cross-request SFace batching, shared by every engine of a process with
+// the same SFace model and DNN backend. Callers block in embed() while
+// one of them runs a batched forward for everybody waiting. A batch
+// starts when it is full, when its oldest face has waited the window, or
+// at once when every attempt in flight (see Session) is already waiting:
+// a lone attempt is never delayed.
+//
+class FaSfaceBatcher
+{
+public:
+    static std::shared_ptr<FaSfaceBatcher> shared(const FacialAuthConfig &cfg,
+                                                  std::string &log);
+
+    // face: aligned 112x112 BGR crop. Thread-safe.
+    bool embed(const cv::Mat &face, cv::Mat &embedding, std::string &log);
+
+    // Marks an attempt that may call embed() while it lasts.
+    class Session
+    {
+    public:
+        explicit Session(FaSfaceBatcher *b) : b_(b) { if (b_) b_->begin(); }
+        ~Session() { if (b_) b_->end(); }
+
+        Session(const Session &) = delete;
+        Session &operator=(const Session &) = delete;
+
+    private:
+        FaSfaceBatcher *b_;
+    };
+
+    size_t max_batch() const { return max_batch_; }
+
+private:
+    struct Slot;
+
+    FaSfaceBatcher(cv::dnn::Net net, size_t max_batch, int window_ms);
+
+    void begin();
+    void end();
+    void run_batch(std::unique_lock<std::mutex> &lk);
+
+    cv::dnn::Net              net_;
+    size_t                    max_batch_;
+    std::chrono::microseconds window_;
+
+    std::mutex                mutex_;
+    std::condition_variable   cv_;
+    std::deque<Slot *>        pending_;
+    size_t                    active_  = 0;
+    bool                      running_ = false;
+    uint64_t                  batches_ = 0;
+    uint64_t                  faces_   = 0;
+};
+
+//
+// Resident engine: detector, SFace net, user galleries and (optionally)
+// the camera stay loaded across fa_engine_test_user() calls.
+// Not thread-safe: callers serialize access to one engine.
+//
+struct FacialAuthEngine
+{
+    FacialAuthConfig cfg;
+
+    DetectorWrapper  det;
+    bool             det_ready = false;
+
+    cv::dnn::Net     sface_net;
+    std::string      sface_model;
+
+    cv::VideoCapture cap;
+
+    // Long-lived owners (facial_authd) set this before fa_engine_init()
+    // so model changes are tracked with inotify instead of stat().
+    bool resident = false;
+    std::shared_ptr<FaModelCache> models;
+
+    // Set when sface_batch_max > 1: SFace forwards go through the
+    // process-wide batcher and sface_net stays unloaded.
+    std::shared_ptr<FaSfaceBatcher> batcher;
+
+    // Grab and detect stages of the verify_frames pipeline, one thread
+    // each (fixed split, embedding stays on the caller), started once
+    // and reused by every attempt (cpu_set / nice applied).
+    std::unique_ptr<FaThreadPool> pool;
+};
+
+bool fa_engine_init(FacialAuthEngine &eng,
+                    const FacialAuthConfig &cfg,
+                    std::string &log);
+
+void fa_engine_release(FacialAuthEngine &eng);
+
+bool fa_engine_test_user(FacialAuthEngine &eng,
+                         const std::string &user,
+                         const std::string &model_path,
+                         double &best_conf,
+                         int &best_label,
+                         std::string &log,
+                         double threshold_override = -1.0,
+                         FacialAuthAttempt *attempt = nullptr);
+
+//
+// Asynchronous verification: fa_engine_test_user() / fa_test_user() on a
+// worker thread. event_fd() becomes readable when the attempt is decided,
+// for poll()-based event loops; the optional callback runs on the worker
+// right after. cancel() makes the attempt stop at the next frame or stage
+// boundary, and a cancelled attempt always closes the camera, even with
+// keep_camera. The engine must not be used by anyone else until done().
+// Destroying the handle cancels and waits for the worker.
+//
+struct FaAsyncResult
+{
+    bool            ok = false;
+    FaAttemptStatus status = FA_ATTEMPT_ERROR;
+    double          best_conf  = 0.0;
+    int             best_label = -1;
+    std::string     log;
+};
+
+class FaAsyncAttempt
+{
+public:
+    using Callback = std::function<void(const FaAsyncResult &)>;
+    using Work     = std::function<bool(FacialAuthAttempt &, FaAsyncResult &)>;
+
+    // Use fa_engine_test_user_async() / fa_test_user_async().
+    FaAsyncAttempt(Work work, Callback on_done, FacialAuthAttempt *attempt);
+    ~FaAsyncAttempt();
+
+    FaAsyncAttempt(const FaAsyncAttempt &) = delete;
+    FaAsyncAttempt &operator=(const FaAsyncAttempt &) = delete;
+
+    int  event_fd() const { return efd_; }
+    void cancel();
+    bool done() const;
+
+    // false when timeout_ms (< 0: no limit) passes first.
+    bool wait_for(int timeout_ms) const;
+
+    // Blocks until decided.
+    const FaAsyncResult &get() const;
+
+private:
+    FacialAuthAttempt               own_;
+    FacialAuthAttempt              *attempt_;
+    FaAsyncResult                   result_;
+    mutable std::mutex              mutex_;
+    mutable std::condition_variable cv_;
+    bool                            done_ = false;
+    int                             efd_  = -1;
+    std::thread                     worker_;
+};
+
+// attempt (optional, caller-owned) must outlive the handle.
+std::unique_ptr<FaAsyncAttempt> fa_engine_test_user_async(
+    FacialAuthEngine &eng,
+    const std::string &user,
+    const std::string &model_path,
+    double threshold_override = -1.0,
+    FaAsyncAttempt::Callback on_done = nullptr,
+    FacialAuthAttempt *attempt = nullptr);
+
+std::unique_ptr<FaAsyncAttempt> fa_test_user_async(
+    const std::string &user,
+    const FacialAuthConfig &cfg,
+    const std::string &model_path,
+    double threshold_override = -1.0,
+    FaAsyncAttempt::Callback on_done = nullptr,
+    FacialAuthAttempt *attempt = nullptr);
+
+//
+// Camera-less verification of frames supplied by the caller (a remote
+// client, a test fixture): each request names a user and carries decoded
+// frames and/or encoded JPEG/PNG buffers. Frames are tried in order and
+// the first accepted one decides. SFace accepts at or above the threshold
+// (threshold < 0: configured one); classic methods accept when the model
+// predicts a label within its own threshold.
+//
+struct FaVerifyRequest
+{
+    std::string user;
+    std::string model_path;                           // empty: fa_user_model_path()
+    std::vector<cv::Mat> frames;                      // BGR, BGRA or gray
+    std::vector<std::vector<unsigned char>> encoded;  // decoded after frames
+    double threshold = -1.0;
+};
+
+struct FaVerifyResult
+{
+    FaAttemptStatus status = FA_ATTEMPT_ERROR;
+    bool   accepted = false;
+    double score    = 0.0;      // SFace: best similarity, classic: best distance
+    int    label    = -1;
+    int    frames   = 0;        // frames examined
+    int    faces    = 0;        // frames with a face
+    std::string log;            // per-request log (batch calls)
+};
+
+bool fa_engine_verify(FacialAuthEngine &eng,
+                      const FaVerifyRequest &req,
+                      FaVerifyResult &res,
+                      std::string &log,
+                      FacialAuthAttempt *attempt = nullptr);
+
+// Many (user, frames) requests in one call: requests sharing a model are
+// verified back to back, so each model is parsed at most once. false only
+// when the engine cannot verify at all; see results[i] otherwise.
+bool fa_engine_verify_batch(FacialAuthEngine &eng,
+                            const std::vector<FaVerifyRequest> &reqs,
+                            std::vector<FaVerifyResult> &results,
+                            std::string &log);
+
+// One-shot: a camera-less engine for this batch only.
+bool fa_verify_batch(const FacialAuthConfig &cfg,
+                     const std::vector<FaVerifyRequest> &reqs,
+                     std::vector<FaVerifyResult> &results,
+                     std::string &log);
+
+
 //
 // Main library API
 //
+
+// Parses the file once per (path, inode, mtime) and hands out copies of
+// the resolved snapshot, resolved again when one of the model files it
+// names appears, disappears or changes; root also keeps a compiled cache
+// under FACIALAUTH_RUNDIR for the next process.
 bool fa_load_config(FacialAuthConfig &cfg,
                     std::string &log,
                     const std::string &path);
 
+bool fa_resolve_config(FacialAuthConfig &cfg, std::string &log);
+
+const char *fa_method_name(FaTrainingMethod m);
+
 std::string fa_user_image_dir(const FacialAuthConfig &cfg,
                               const std::string &user);
 
@@ -153,14 +590,77 @@ bool fa_train_user(const std::string &user,
                    const FacialAuthConfig &cfg,
                    std::string &log);
 
+//
+// Offline evaluation (facial_bench eval) of a labelled tree
+// <dataset>/<user>/*.jpg|png. The first enroll_per_user images of each
+// user, by name, build that user's model in memory; every other image is
+// a probe claimed against every model: a genuine pair for its own user,
+// an impostor pair for the others. Enrollment mirrors fa_train_user()
+// (Haar for classic methods), probes use the configured detector like a
+// login. Nothing is written except the embedding cache.
+//
+struct FaEvalOptions
+{
+    std::string dataset;
+    int enroll_per_user = 0;        // 0 = half of each user's images
+    int roc_points      = 41;
+};
+
+struct FaEvalPoint
+{
+    double threshold;
+    double far;                     // impostor pairs accepted
+    double frr;                     // genuine pairs rejected
+};
+
+struct FaEvalResult
+{
+    std::string method;
+    std::string detector;
+    std::string recognizer;         // SFace profile, empty for classic methods
+    bool        higher_is_better = true;   // SFace similarity, not a distance
+    double      threshold = 0.0;    // configured acceptance threshold
+    int         threads   = 1;
+
+    size_t users          = 0;
+    size_t enroll_images  = 0;
+    size_t enroll_faces   = 0;
+    size_t probe_images   = 0;
+    size_t probe_faces    = 0;
+    double enroll_seconds = 0.0;
+    double probe_seconds  = 0.0;
+    double match_seconds  = 0.0;
+
+    // Probes without a face score -inf (SFace) or +inf (classic): they
+    // count as rejected, as at login.
+    std::vector<double> genuine;
+    std::vector<double> impostor;
+
+    FaEvalPoint at_threshold{0.0, 0.0, 0.0};
+    FaEvalPoint eer{0.0, 0.0, 0.0};
+    std::vector<FaEvalPoint> roc;
+};
+
+bool fa_eval_dataset(const FacialAuthConfig &cfg,
+                     const FaEvalOptions &opt,
+                     FaEvalResult &res,
+                     std::string &log);
+
 bool fa_test_user(const std::string &user,
                   const FacialAuthConfig &cfg,
                   const std::string &model_path,
                   double &best_conf,
                   int &best_label,
                   std::string &log,
-                  double threshold_override = -1.0);
+                  double threshold_override = -1.0,
+                  FacialAuthAttempt *attempt = nullptr);
 
 bool fa_check_root(const std::string &tool_name);
 
+// Sets OpenCV's worker thread count (inference_threads); 0 keeps the
+// OpenCV default. The setting is process-wide, so facial_authd and the
+// CLIs call it once at startup, and the dlopen() entry used by the PAM
+// module calls it on the first in-process login.
+void fa_set_inference_threads(int threads);
+
 #endif // LIBFACIALAUTH_H
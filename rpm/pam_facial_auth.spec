@@ -35,10 +35,15 @@ mkdir -p %{buildroot}/etc/pam_facial_auth/models
 /usr/sbin/facial_capture
 /usr/sbin/facial_training
 /usr/sbin/facial_test
+/usr/sbin/facial_authd
+/usr/sbin/facial_bench
 /usr/share/man/man1/facial_capture.1.gz
 /usr/share/man/man1/facial_training.1.gz
 /usr/share/man/man1/facial_test.1.gz
+/usr/share/man/man1/facial_bench.1.gz
 /usr/share/man/man8/pam_facial_auth.8.gz
+/usr/share/man/man8/facial_authd.8.gz
+/usr/lib/systemd/system/facial_authd.service
 /etc/security/pam_facial.conf
 /etc/pam_facial_auth/
 
@@ -0,0 +1,704 @@
+#include "libfacialauth.h"
+#include "facialauth_ipc.h"
+#include "facialauth_log.h"
+#include "facialauth_metrics.h"
+
+#include <opencv2/core.hpp>
+
+#include <iostream>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <condition_variable>
+#include <deque>
+#include <system_error>
+#include <thread>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+
+#include <poll.h>
+#include <pwd.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Time a connected client gets to send its request (PAM sends it at once)
+static const int REQUEST_TIMEOUT_MS = 250;
+
+// Distinct config files kept warm at once
+static const size_t MAX_ENGINES = 4;
+
+// Connections served at once; further ones are closed right away and
+// the PAM client falls back to verifying in-process.
+static const int MAX_CLIENTS = 16;
+
+// Non-root peers: attempts in flight, and attempts per minute
+static const int PEER_MAX_INFLIGHT   = 1;
+static const int PEER_MAX_PER_MINUTE = 6;
+
+static volatile sig_atomic_t g_stop   = 0;
+static volatile sig_atomic_t g_reload = 0;
+
+static void on_signal(int sig)
+{
+    if (sig == SIGHUP)
+        g_reload = 1;
+    else
+        g_stop = 1;
+}
+
+static void print_help()
+{
+    std::cout <<
+    "Usage: facial_authd [options]\n\n"
+    "Options:\n"
+    "  -c, --config <file>    File di configurazione\n"
+    "                         (default: " FACIALAUTH_DEFAULT_CONFIG ")\n"
+    "  -s, --socket <path>    Socket di ascolto\n"
+    "                         (default: " FACIALAUTH_DEFAULT_SOCKET ")\n"
+    "      --debug            Abilita debug\n"
+    "  -H, --help             Mostra questo messaggio\n";
+}
+
+// ==========================================================
+// Warm engines, one per config file
+// ==========================================================
+
+//
+// Clients are served on their own threads. An engine (and its camera)
+// runs one attempt at a time: busy serializes them. A replaced engine is
+// retired under busy, once its last attempt has ended, so the new one
+// never opens the camera while the old one still holds it; clients that
+// queued on the old engine see retired and look the engine up again.
+//
+struct WarmEngine
+{
+    time_t           cfg_mtime = 0;     // (time_t)-1: rebuild on next use
+    FacialAuthEngine eng;
+    std::timed_mutex busy;
+    bool             retired = false;   // guarded by busy
+    std::chrono::steady_clock::time_point last_used;   // g_engines_mutex
+};
+
+static std::mutex g_engines_mutex;
+static std::map<std::string, std::shared_ptr<WarmEngine>> g_engines;
+
+// One (re)build per config file at a time. Loading the nets, and with
+// keep_camera opening the camera, happens under this lock only, so
+// clients of other configs are never held up by it.
+static std::map<std::string, std::shared_ptr<std::mutex>> g_builds;
+
+static time_t config_mtime(const std::string &path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+}
+
+// Fresh engine for cfg_path, else nullptr with *old set to the stale one.
+static std::shared_ptr<WarmEngine> lookup_engine(const std::string &cfg_path,
+                                                 time_t mtime,
+                                                 std::shared_ptr<WarmEngine> *old)
+{
+    auto it = g_engines.find(cfg_path);
+    if (it == g_engines.end())
+        return nullptr;
+    if (it->second->cfg_mtime == mtime) {
+        it->second->last_used = std::chrono::steady_clock::now();
+        return it->second;
+    }
+    if (old)
+        *old = it->second;
+    return nullptr;
+}
+
+// Waits for the engine's running attempt (attempts end within their own
+// budget), then frees its camera and nets.
+static void retire_engine(WarmEngine &w)
+{
+    std::lock_guard<std::timed_mutex> lk(w.busy);
+    if (w.retired)
+        return;
+    w.retired = true;
+    fa_engine_release(w.eng);
+}
+
+static std::shared_ptr<WarmEngine> get_engine(const std::string &cfg_path,
+                                              bool debug, std::string &log)
+{
+    time_t mtime = config_mtime(cfg_path);
+    std::shared_ptr<std::mutex> build;
+    {
+        std::lock_guard<std::mutex> lk(g_engines_mutex);
+        if (auto w = lookup_engine(cfg_path, mtime, nullptr))
+            return w;
+        std::shared_ptr<std::mutex> &b = g_builds[cfg_path];
+        if (!b)
+            b = std::make_shared<std::mutex>();
+        build = b;
+    }
+
+    std::lock_guard<std::mutex> bl(*build);
+
+    // Another client may have rebuilt it while we waited.
+    mtime = config_mtime(cfg_path);
+    std::shared_ptr<WarmEngine> old;
+    {
+        std::lock_guard<std::mutex> lk(g_engines_mutex);
+        if (auto w = lookup_engine(cfg_path, mtime, &old))
+            return w;
+    }
+    if (old)
+        retire_engine(*old);
+
+    FacialAuthConfig cfg;
+    std::string cfg_log;
+    bool ok = fa_load_config(cfg, cfg_log, cfg_path);
+    if (!ok)
+        log += cfg_log;
+    cfg.debug |= debug;
+
+    auto w = std::make_shared<WarmEngine>();
+    w->cfg_mtime = mtime;
+    w->eng.resident = true;
+    ok = ok && fa_engine_init(w->eng, cfg, log);
+
+    std::lock_guard<std::mutex> lk(g_engines_mutex);
+    if (!ok) {
+        g_engines.erase(cfg_path);
+        return nullptr;
+    }
+
+    // Full: make room by dropping the least recently used engine only.
+    // An attempt still running on it keeps it alive until it ends.
+    if (!g_engines.count(cfg_path) && g_engines.size() >= MAX_ENGINES) {
+        auto lru = g_engines.begin();
+        for (auto it = g_engines.begin(); it != g_engines.end(); ++it)
+            if (it->second->last_used < lru->second->last_used)
+                lru = it;
+        syslog(LOG_INFO, "dropping engine for %s", lru->first.c_str());
+        g_engines.erase(lru);
+    }
+
+    w->last_used = std::chrono::steady_clock::now();
+    g_engines[cfg_path] = w;
+
+    syslog(LOG_INFO, "engine ready for %s (method=%s)",
+           cfg_path.c_str(), fa_method_name(w->eng.cfg.method));
+    return w;
+}
+
+// Idle engines are freed now; busy ones are rebuilt on their next use,
+// after their attempt ends.
+static void drop_engines()
+{
+    std::lock_guard<std::mutex> lk(g_engines_mutex);
+    for (auto it = g_engines.begin(); it != g_engines.end(); ) {
+        WarmEngine &w = *it->second;
+        std::unique_lock<std::timed_mutex> busy(w.busy, std::try_to_lock);
+        if (busy.owns_lock()) {
+            w.retired = true;
+            fa_engine_release(w.eng);
+            it = g_engines.erase(it);
+        } else {
+            w.cfg_mtime = (time_t)-1;
+            ++it;
+        }
+    }
+}
+
+// ==========================================================
+// Per-peer limits (non-root clients)
+// ==========================================================
+
+struct PeerBudget
+{
+    int               inflight = 0;
+    std::deque<time_t> recent;          // attempt start times, last minute
+};
+
+static std::mutex                 g_peers_mutex;
+static std::map<uid_t, PeerBudget> g_peers;
+
+// false when uid already has an attempt running or used up its minute.
+static bool peer_admit(uid_t uid, std::string &why)
+{
+    if (uid == 0)
+        return true;
+
+    std::lock_guard<std::mutex> lk(g_peers_mutex);
+    PeerBudget &b = g_peers[uid];
+    time_t now = time(nullptr);
+    while (!b.recent.empty() && now - b.recent.front() >= 60)
+        b.recent.pop_front();
+
+    if (b.inflight >= PEER_MAX_INFLIGHT) {
+        why = "another attempt is running";
+        return false;
+    }
+    if ((int)b.recent.size() >= PEER_MAX_PER_MINUTE) {
+        why = "too many attempts, retry later";
+        return false;
+    }
+    ++b.inflight;
+    b.recent.push_back(now);
+    return true;
+}
+
+static void peer_release(uid_t uid)
+{
+    if (uid == 0)
+        return;
+
+    std::lock_guard<std::mutex> lk(g_peers_mutex);
+    auto it = g_peers.find(uid);
+    if (it == g_peers.end())
+        return;
+    --it->second.inflight;
+    if (it->second.inflight == 0 && it->second.recent.empty())
+        g_peers.erase(it);
+}
+
+// ==========================================================
+// Metrics, merged on a timer instead of after each login
+// ==========================================================
+
+static const int METRICS_FLUSH_S = 10;
+
+static std::mutex            g_metrics_mutex;
+static std::set<std::string> g_metrics_paths;
+
+static void note_metrics_path(const std::string &path)
+{
+    std::lock_guard<std::mutex> lk(g_metrics_mutex);
+    g_metrics_paths.insert(path);
+}
+
+// Samples are process-wide: the first file takes them, every file
+// merges its own spool.
+static void flush_metrics()
+{
+    std::set<std::string> paths;
+    {
+        std::lock_guard<std::mutex> lk(g_metrics_mutex);
+        paths = g_metrics_paths;
+    }
+    for (const auto &p : paths) {
+        std::string mlog;
+        if (!fa_metrics_flush(p, mlog))
+            syslog(LOG_DEBUG, "%s", mlog.c_str());
+    }
+}
+
+// ==========================================================
+// Request handling
+// ==========================================================
+
+static bool valid_user_name(const std::string &user)
+{
+    if (user.empty() || user == "." || user == "..")
+        return false;
+    return user.find('/') == std::string::npos;
+}
+
+// Non-root peers may only ask to verify themselves.
+static bool peer_may_verify(uid_t peer_uid, const std::string &user)
+{
+    if (peer_uid == 0)
+        return true;
+
+    struct passwd pw, *res = nullptr;
+    char buf[4096];
+    if (getpwnam_r(user.c_str(), &pw, buf, sizeof(buf), &res) != 0 || !res)
+        return false;
+    return res->pw_uid == peer_uid;
+}
+
+static void handle_client(int cfd, const std::string &default_cfg, bool debug)
+{
+    pid_t pid; uid_t uid; gid_t gid;
+    if (!fa_ipc_peer_cred(cfd, pid, uid, gid)) {
+        syslog(LOG_WARNING, "cannot read peer credentials, dropping client");
+        return;
+    }
+
+    FaIpcRequest req;
+    if (!fa_ipc_read_full(cfd, &req, sizeof(req), REQUEST_TIMEOUT_MS)) {
+        syslog(LOG_WARNING, "incomplete request from pid %d", (int)pid);
+        return;
+    }
+
+    FaIpcReply reply;
+    std::memset(&reply, 0, sizeof(reply));
+    reply.magic      = FA_IPC_MAGIC;
+    reply.version    = FA_IPC_VERSION;
+    reply.status     = FA_IPC_ERROR;
+    reply.best_label = -1;
+
+    if (req.magic != FA_IPC_MAGIC || req.version != FA_IPC_VERSION) {
+        fa_ipc_copy(reply.log, sizeof(reply.log), "protocol mismatch\n");
+        fa_ipc_write_full(cfd, &reply, sizeof(reply));
+        return;
+    }
+
+    req.user[FA_IPC_USER_MAX - 1]   = '\0';
+    req.config[FA_IPC_PATH_MAX - 1] = '\0';
+    std::string user = req.user;
+
+    if (!valid_user_name(user) || !peer_may_verify(uid, user)) {
+        syslog(LOG_WARNING, "uid %d (pid %d) denied verification of '%s'",
+               (int)uid, (int)pid, user.c_str());
+        reply.status = FA_IPC_DENIED;
+        fa_ipc_copy(reply.log, sizeof(reply.log), "request denied\n");
+        fa_ipc_write_full(cfd, &reply, sizeof(reply));
+        return;
+    }
+
+    std::string why;
+    if (!peer_admit(uid, why)) {
+        syslog(LOG_NOTICE, "uid %d (pid %d) rate limited: %s", (int)uid, (int)pid, why.c_str());
+        reply.status = FA_IPC_BUSY;
+        fa_ipc_copy(reply.log, sizeof(reply.log), "daemon busy: " + why + "\n");
+        fa_ipc_write_full(cfd, &reply, sizeof(reply));
+        return;
+    }
+    struct PeerTicket {
+        uid_t uid;
+        ~PeerTicket() { peer_release(uid); }
+    } ticket{ uid };
+
+    std::string cfg_path = default_cfg;
+    if (uid == 0 && req.config[0])
+        cfg_path = req.config;
+
+    std::string log;
+    FacialAuthAttempt attempt;
+    auto t_cfg = std::chrono::steady_clock::now();
+    std::shared_ptr<WarmEngine> warm;
+    FacialAuthEngine *eng = nullptr;
+
+    // The camera is shared: wait for the running attempt, within budget.
+    // The wait counts against auth_timeout_ms so that the client, which
+    // gives up after auth_timeout_ms plus a margin, still gets an answer.
+    // An engine retired while we waited is looked up again.
+    std::unique_lock<std::timed_mutex> busy;
+    std::chrono::steady_clock::time_point wait_until;
+    for (int tries = 0; tries < 3; ++tries) {
+        warm = get_engine(cfg_path, debug, log);
+        if (!warm)
+            break;
+
+        if (tries == 0) {
+            int wait_ms = warm->eng.cfg.auth_timeout_ms > 0 ? warm->eng.cfg.auth_timeout_ms : 5000;
+            wait_until = std::chrono::steady_clock::now() +
+                         std::chrono::milliseconds(wait_ms);
+            if (warm->eng.cfg.auth_timeout_ms > 0)
+                attempt.deadline = wait_until;
+        }
+
+        busy = std::unique_lock<std::timed_mutex>(warm->busy, std::defer_lock);
+        if (!busy.try_lock_until(wait_until)) {
+            reply.status = FA_IPC_BUSY;
+            log += "daemon busy: camera in use\n";
+            break;
+        }
+        if (!warm->retired) {
+            eng = &warm->eng;
+            break;
+        }
+        busy.unlock();
+    }
+    if (warm && !eng && reply.status != FA_IPC_BUSY) {
+        reply.status = FA_IPC_BUSY;
+        log += "daemon busy: engine reloading\n";
+    }
+    if (eng) {
+        if (eng->cfg.trace) {
+            attempt.trace.enabled = true;
+            fa_trace_add(&attempt.trace, "config_load", -1, t_cfg,
+                         std::chrono::steady_clock::now(), NAN);
+        }
+
+        std::string model_path = fa_user_model_path(eng->cfg, user);
+        double best_conf = 0.0;
+        int best_label = -1;
+
+        // A client that hangs up (password typed first, conversation
+        // aborted) cancels the attempt and frees the camera.
+        // Only root may pick the threshold; anyone else gets the
+        // configured one, like the config file itself.
+        double threshold = uid == 0 ? req.threshold : -1.0;
+
+        std::unique_ptr<FaAsyncAttempt> task =
+            fa_engine_test_user_async(*eng, user, model_path, threshold,
+                                      nullptr, &attempt);
+        struct pollfd pfd[2] = {
+            { task->event_fd(), POLLIN,    0 },
+            { cfd,              POLLRDHUP, 0 },
+        };
+        while (!task->done()) {
+            if (::poll(pfd, 2, task->event_fd() < 0 ? 50 : -1) < 0 && errno != EINTR)
+                break;
+            if (pfd[1].revents & (POLLRDHUP | POLLHUP | POLLERR)) {
+                syslog(LOG_INFO, "pid %d hung up, cancelling attempt for '%s'",
+                       (int)pid, user.c_str());
+                task->cancel();
+                pfd[1].fd = -1;
+            }
+        }
+
+        const FaAsyncResult &res = task->get();
+        bool ok    = res.ok;
+        best_conf  = res.best_conf;
+        best_label = res.best_label;
+        log       += res.log;
+
+        if (ok)
+            reply.status = FA_IPC_ACCEPT;
+        else if (attempt.status == FA_ATTEMPT_TIMEOUT)
+            reply.status = FA_IPC_TIMEOUT;
+        else
+            reply.status = FA_IPC_REJECT;
+        reply.best_conf  = best_conf;
+        reply.best_label = best_label;
+        if (eng->cfg.ignore_failure)
+            reply.flags |= FA_IPC_FLAG_IGNORE_FAILURE;
+    }
+
+    fa_ipc_copy(reply.log, sizeof(reply.log), log);
+    fa_ipc_write_full(cfd, &reply, sizeof(reply));
+
+    syslog(LOG_INFO, "user '%s' for uid %d (pid %d): %s",
+           user.c_str(), (int)uid, (int)pid,
+           reply.status == FA_IPC_ACCEPT  ? "accepted" :
+           reply.status == FA_IPC_REJECT  ? "rejected" :
+           reply.status == FA_IPC_TIMEOUT ? "timed out" :
+           reply.status == FA_IPC_BUSY    ? "busy" : "error");
+
+    if (eng && eng->cfg.metrics)
+        note_metrics_path(fa_metrics_path(eng->cfg.basedir));
+}
+
+// ==========================================================
+// Client threads
+// ==========================================================
+
+static std::mutex              g_clients_mutex;
+static std::condition_variable g_clients_cv;
+static int                     g_clients = 0;
+
+static bool client_begin()
+{
+    std::lock_guard<std::mutex> lk(g_clients_mutex);
+    if (g_clients >= MAX_CLIENTS)
+        return false;
+    ++g_clients;
+    return true;
+}
+
+static void client_end()
+{
+    {
+        std::lock_guard<std::mutex> lk(g_clients_mutex);
+        --g_clients;
+    }
+    g_clients_cv.notify_all();
+}
+
+// Running attempts end within their own budget.
+static void wait_clients()
+{
+    std::unique_lock<std::mutex> lk(g_clients_mutex);
+    g_clients_cv.wait(lk, [] { return g_clients == 0; });
+}
+
+// ==========================================================
+// Socket setup
+// ==========================================================
+
+static int open_listen_socket(const std::string &path)
+{
+    std::string dir = path.substr(0, path.find_last_of('/'));
+    if (!dir.empty() && ::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "[ERRORE] Impossibile creare " << dir << ": "
+                  << std::strerror(errno) << "\n";
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "[ERRORE] Percorso socket troppo lungo\n";
+        return -1;
+    }
+    fa_ipc_copy(addr.sun_path, sizeof(addr.sun_path), path);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "[ERRORE] socket(): " << std::strerror(errno) << "\n";
+        return -1;
+    }
+
+    ::unlink(path.c_str());
+    if (::bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        std::cerr << "[ERRORE] bind(" << path << "): " << std::strerror(errno) << "\n";
+        ::close(fd);
+        return -1;
+    }
+
+    // Any local process may connect; authorization uses SO_PEERCRED.
+    ::chmod(path.c_str(), 0666);
+
+    if (::listen(fd, 16) != 0) {
+        std::cerr << "[ERRORE] listen(): " << std::strerror(errno) << "\n";
+        ::close(fd);
+        ::unlink(path.c_str());
+        return -1;
+    }
+    return fd;
+}
+
+int facial_authd_main(int argc, char **argv)
+{
+    std::string config_path = FACIALAUTH_DEFAULT_CONFIG;
+    std::string socket_path = FACIALAUTH_DEFAULT_SOCKET;
+    bool debug = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        auto take_value = [&](const std::string &opt) -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Manca il valore per l'opzione " << opt << "\n";
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-c" || arg == "--config") {
+            config_path = take_value(arg);
+        } else if (arg == "-s" || arg == "--socket") {
+            socket_path = take_value(arg);
+        } else if (arg == "--debug") {
+            debug = true;
+        } else if (arg == "-H" || arg == "--help") {
+            print_help();
+            return 0;
+        } else {
+            std::cerr << "Opzione sconosciuta: " << arg << "\n";
+            print_help();
+            return 1;
+        }
+    }
+
+    if (!fa_check_root("facial_authd")) {
+        std::cerr << "[ERRORE] Questo strumento deve essere eseguito come root.\n";
+        return 1;
+    }
+
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT,  &sa, nullptr);
+    sigaction(SIGHUP,  &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    openlog("facial_authd", LOG_PID, LOG_AUTHPRIV);
+
+    // Process-wide settings, so taken once from the default configuration.
+    {
+        FacialAuthConfig cfg;
+        std::string cfg_log;
+        if (fa_load_config(cfg, cfg_log, config_path)) {
+            debug |= cfg.debug;
+            fa_set_inference_threads(cfg.inference_threads);
+        }
+    }
+    fa_log_set_level(debug ? FA_LOG_DEBUG : FA_LOG_INFO);
+
+    int lfd = open_listen_socket(socket_path);
+    if (lfd < 0)
+        return 1;
+
+    // Warm up the default configuration before the first login arrives.
+    std::string log;
+    if (!get_engine(config_path, debug, log))
+        syslog(LOG_WARNING, "default engine not ready: %s", log.c_str());
+
+    syslog(LOG_INFO, "listening on %s", socket_path.c_str());
+
+    time_t last_flush = time(nullptr);
+    while (!g_stop) {
+        if (time(nullptr) - last_flush >= METRICS_FLUSH_S) {
+            flush_metrics();
+            last_flush = time(nullptr);
+        }
+
+        if (g_reload) {
+            g_reload = 0;
+            drop_engines();
+            syslog(LOG_INFO, "reload requested, engines dropped");
+        }
+
+        struct pollfd pfd = { lfd, POLLIN, 0 };
+        int r = ::poll(&pfd, 1, 1000);
+        if (r <= 0)
+            continue;
+
+        int cfd = ::accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (cfd < 0)
+            continue;
+
+        if (!client_begin()) {
+            syslog(LOG_WARNING, "too many clients, dropping connection");
+            ::close(cfd);
+            continue;
+        }
+        try {
+            std::thread([cfd, config_path, debug]() {
+                try {
+                    handle_client(cfd, config_path, debug);
+                } catch (const std::exception &e) {
+                    syslog(LOG_ERR, "request failed: %s", e.what());
+                }
+                ::close(cfd);
+                client_end();
+            }).detach();
+        } catch (const std::system_error &e) {
+            syslog(LOG_ERR, "cannot start client thread: %s", e.what());
+            ::close(cfd);
+            client_end();
+        }
+    }
+
+    ::close(lfd);
+    ::unlink(socket_path.c_str());
+    wait_clients();
+    flush_metrics();
+    drop_engines();
+    closelog();
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    try {
+        return facial_authd_main(argc, argv);
+    }
+    catch (const cv::Exception &e) {
+        std::cerr << "[OpenCV ERROR] " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const std::exception &e) {
+        std::cerr << "[ERROR] " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,343 @@
+#include "libfacialauth.h"
+#include "facialauth_log.h"
+
+#include <opencv2/core.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static void print_bench_help()
+{
+    std::cout <<
+    "Usage: facial_bench eval -d <dir> [options]\n\n"
+    "Valuta offline accuratezza e velocita' su un dataset <dir>/<utente>/*.jpg\n"
+    "e stampa il risultato in JSON.\n\n"
+    "Options:\n"
+    "  -d, --dataset <dir>        Directory del dataset (una per utente)\n"
+    "  -c, --config <file>        File di configurazione\n"
+    "                             (default: " FACIALAUTH_DEFAULT_CONFIG ")\n"
+    "  -m, --method <list>        Metodi da valutare, separati da virgola\n"
+    "                             (lbph,eigen,fisher,sface; default: config)\n"
+    "      --detector <list>      Profili detector (default: config)\n"
+    "      --recognizer <list>    Profili SFace (default: config)\n"
+    "  -n, --enroll <num>         Immagini per utente usate per il modello\n"
+    "                             (default: meta')\n"
+    "      --roc-points <num>     Punti della curva ROC/DET (default: 41)\n"
+    "      --scores               Includi tutti i punteggi nel JSON\n"
+    "  -o, --output <file>        Scrivi il JSON su file invece che su stdout\n"
+    "      --debug                Abilita debug\n"
+    "  -H, --help                 Mostra questo messaggio\n";
+}
+
+// ==========================================================
+// JSON output
+// ==========================================================
+
+static void json_string(std::ostream &out, const std::string &s)
+{
+    out << '"';
+    for (unsigned char c : s) {
+        switch (c) {
+        case '"':  out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n";  break;
+        case '\t': out << "\\t";  break;
+        default:
+            if (c < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out << buf;
+            } else {
+                out << c;
+            }
+        }
+    }
+    out << '"';
+}
+
+// JSON has no infinities: rejected probes become null.
+static void json_number(std::ostream &out, double v)
+{
+    if (!std::isfinite(v)) {
+        out << "null";
+        return;
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6g", v);
+    out << buf;
+}
+
+static double rate(double n, double seconds)
+{
+    return seconds > 0.0 ? n / seconds : 0.0;
+}
+
+static void json_point(std::ostream &out, const FaEvalPoint &p)
+{
+    out << "{\"threshold\":";
+    json_number(out, p.threshold);
+    out << ",\"far\":";
+    json_number(out, p.far);
+    out << ",\"frr\":";
+    json_number(out, p.frr);
+    out << "}";
+}
+
+static void json_scores(std::ostream &out, const std::vector<double> &v)
+{
+    out << "[";
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (i) out << ",";
+        json_number(out, v[i]);
+    }
+    out << "]";
+}
+
+static void json_run(std::ostream &out, const FaEvalResult &r, bool with_scores)
+{
+    const double pairs = (double)(r.genuine.size() + r.impostor.size());
+
+    out << "    {\"method\":";
+    json_string(out, r.method);
+    out << ",\"detector\":";
+    json_string(out, r.detector);
+    out << ",\"recognizer\":";
+    json_string(out, r.recognizer);
+    out << ",\"score\":\"" << (r.higher_is_better ? "similarity" : "distance") << "\"";
+    out << ",\"threads\":" << r.threads;
+    out << ",\"users\":" << r.users;
+
+    out << ",\n     \"enroll\":{\"images\":" << r.enroll_images
+        << ",\"faces\":" << r.enroll_faces << ",\"seconds\":";
+    json_number(out, r.enroll_seconds);
+    out << ",\"images_per_s\":";
+    json_number(out, rate(r.enroll_images, r.enroll_seconds));
+    out << "}";
+
+    out << ",\n     \"probe\":{\"images\":" << r.probe_images
+        << ",\"faces\":" << r.probe_faces << ",\"seconds\":";
+    json_number(out, r.probe_seconds);
+    out << ",\"images_per_s\":";
+    json_number(out, rate(r.probe_images, r.probe_seconds));
+    out << "}";
+
+    out << ",\n     \"match\":{\"pairs\":" << (size_t)pairs
+        << ",\"genuine\":" << r.genuine.size()
+        << ",\"impostor\":" << r.impostor.size() << ",\"seconds\":";
+    json_number(out, r.match_seconds);
+    out << ",\"pairs_per_s\":";
+    json_number(out, rate(pairs, r.match_seconds));
+    out << "}";
+
+    out << ",\n     \"at_threshold\":";
+    json_point(out, r.at_threshold);
+    out << ",\n     \"eer\":";
+    json_point(out, r.eer);
+
+    out << ",\n     \"roc\":[";
+    for (size_t i = 0; i < r.roc.size(); ++i) {
+        out << (i ? ",\n       " : "\n       ");
+        json_point(out, r.roc[i]);
+    }
+    out << "]";
+
+    if (with_scores) {
+        out << ",\n     \"genuine_scores\":";
+        json_scores(out, r.genuine);
+        out << ",\n     \"impostor_scores\":";
+        json_scores(out, r.impostor);
+    }
+    out << "}";
+}
+
+// ==========================================================
+// eval
+// ==========================================================
+
+static std::vector<std::string> split_list(const std::string &s)
+{
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        if (!item.empty())
+            out.push_back(item);
+    return out;
+}
+
+static int bench_eval(int argc, char **argv)
+{
+    std::string config_path = FACIALAUTH_DEFAULT_CONFIG;
+    std::string output;
+    std::string methods, detectors, recognizers;
+    FaEvalOptions opt;
+    bool with_scores = false;
+    bool debug = false;
+
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        auto take_value = [&](const std::string &o) -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Manca il valore per l'opzione " << o << "\n";
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-d" || arg == "--dataset") {
+            opt.dataset = take_value(arg);
+        } else if (arg == "-c" || arg == "--config") {
+            config_path = take_value(arg);
+        } else if (arg == "-m" || arg == "--method") {
+            methods = take_value(arg);
+        } else if (arg == "--detector") {
+            detectors = take_value(arg);
+        } else if (arg == "--recognizer") {
+            recognizers = take_value(arg);
+        } else if (arg == "-n" || arg == "--enroll") {
+            opt.enroll_per_user = std::stoi(take_value(arg));
+        } else if (arg == "--roc-points") {
+            opt.roc_points = std::stoi(take_value(arg));
+        } else if (arg == "--scores") {
+            with_scores = true;
+        } else if (arg == "-o" || arg == "--output") {
+            output = take_value(arg);
+        } else if (arg == "--debug") {
+            debug = true;
+        } else if (arg == "-H" || arg == "--help") {
+            print_bench_help();
+            return 0;
+        } else {
+            std::cerr << "Opzione sconosciuta: " << arg << "\n";
+            print_bench_help();
+            return 1;
+        }
+    }
+
+    if (opt.dataset.empty()) {
+        std::cerr << "[ERRORE] Devi specificare --dataset <dir>.\n";
+        return 1;
+    }
+
+    FacialAuthConfig base;
+    std::string log;
+    if (!fa_load_config(base, log, config_path)) {
+        std::cerr << log;
+        // continuiamo con i defaults
+    }
+    debug |= base.debug;
+    base.debug = debug;
+
+    fa_log_set_sink(fa_log_sink_stderr, nullptr);
+    fa_log_set_level(debug ? FA_LOG_DEBUG : FA_LOG_WARN);
+
+    // Enrollment and matching run on their own workers, as in training.
+    fa_set_inference_threads(base.train_threads == 1 ? base.inference_threads : 1);
+
+    std::vector<std::string> mlist = split_list(methods);
+    std::vector<std::string> dlist = split_list(detectors);
+    std::vector<std::string> rlist = split_list(recognizers);
+    if (mlist.empty()) mlist.push_back(base.training_method);
+    if (dlist.empty()) dlist.push_back(base.detector_profile);
+    if (rlist.empty()) rlist.push_back(base.recognizer_profile);
+
+    std::vector<FaEvalResult> runs;
+    bool failed = false;
+
+    for (const auto &m : mlist) {
+        // Classic methods always detect with Haar and ignore the SFace
+        // profile: one run is enough.
+        bool is_sface = (m == "sface");
+        size_t ndet = is_sface ? dlist.size() : 1;
+        size_t nrec = is_sface ? rlist.size() : 1;
+        for (size_t di = 0; di < ndet; ++di) {
+            const std::string &d = dlist[di];
+            for (size_t r = 0; r < nrec; ++r) {
+                FacialAuthConfig cfg = base;
+                cfg.training_method    = m;
+                cfg.detector_profile   = d;
+                cfg.recognizer_profile = rlist[r];
+
+                std::string rlog;
+                FaEvalResult res;
+                if (!fa_resolve_config(cfg, rlog) ||
+                    !fa_eval_dataset(cfg, opt, res, rlog)) {
+                    std::cerr << "[ERRORE] " << m << "/" << d
+                              << (is_sface ? "/" + rlist[r] : std::string())
+                              << ":\n" << rlog;
+                    failed = true;
+                    continue;
+                }
+                runs.push_back(std::move(res));
+            }
+        }
+    }
+
+    std::ofstream file;
+    if (!output.empty()) {
+        file.open(output);
+        if (!file) {
+            std::cerr << "[ERRORE] Impossibile scrivere " << output << "\n";
+            return 1;
+        }
+    }
+    std::ostream &out = output.empty() ? std::cout : file;
+
+    char when[32];
+    time_t now = time(nullptr);
+    struct tm tmv;
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tmv));
+
+    out << "{\"dataset\":";
+    json_string(out, opt.dataset);
+    out << ",\"time\":\"" << when << "\"";
+    out << ",\"opencv\":\"" << CV_VERSION << "\"";
+    out << ",\"enroll_per_user\":" << opt.enroll_per_user;
+    out << ",\n  \"runs\":[";
+    for (size_t i = 0; i < runs.size(); ++i) {
+        out << (i ? ",\n" : "\n");
+        json_run(out, runs[i], with_scores);
+    }
+    out << "]}\n";
+
+    return (failed || runs.empty()) ? 1 : 0;
+}
+
+int facial_bench_main(int argc, char **argv)
+{
+    std::string cmd = argc > 1 ? argv[1] : "";
+
+    if (cmd == "eval")
+        return bench_eval(argc, argv);
+
+    if (cmd == "-H" || cmd == "--help") {
+        print_bench_help();
+        return 0;
+    }
+
+    std::cerr << (cmd.empty() ? "Manca il comando" : "Comando sconosciuto: " + cmd) << "\n";
+    print_bench_help();
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    try {
+        return facial_bench_main(argc, argv);
+    }
+    catch (const cv::Exception &e) {
+        std::cerr << "[OpenCV ERROR] " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const std::exception &e) {
+        std::cerr << "[ERROR] " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -1,4 +1,5 @@
 #include "libfacialauth.h"
+#include "facialauth_log.h"
 
 #include <opencv2/core.hpp>
 
@@ -35,6 +36,9 @@ static void print_help()
     "      --list-devices         Mostra webcam reali (V4L2)\n"
     "      --list-resolutions     Mostra risoluzioni webcam\n"
     "      --format <fmt>         Formato: jpg|png|bmp\n"
+    "      --stream               Calcola gli embedding SFace durante la\n"
+    "                             cattura e aggiorna direttamente il modello\n"
+    "      --save <mode>          Immagini da salvare: full|face|none\n"
     "  -v, --verbose              Output informativo\n"
     "      --debug                Output dettagliato\n"
     "      --nogui                Disabilita GUI\n"
@@ -135,6 +139,8 @@ static void debug_dump(const FacialAuthConfig &cfg)
     << " sleep_ms=" << cfg.sleep_ms << "\n"
     << " detector=" << cfg.detector_profile << "\n"
     << " format=" << cfg.image_format << "\n"
+    << " capture_embed=" << (cfg.capture_embed?"yes":"no") << "\n"
+    << " capture_save=" << cfg.capture_save << "\n"
     << " debug=" << (cfg.debug?"yes":"no") << "\n"
     << " verbose=" << (cfg.verbose?"yes":"no") << "\n";
 }
@@ -149,6 +155,8 @@ int facial_capture_main(int argc, char **argv)
 
     std::string detector_override;
     std::string format_override;
+    std::string save_override;
+    bool stream=false;
 
     bool force=false, flush_only=false;
     bool verbose=false, debug=false, nogui=false;
@@ -176,6 +184,8 @@ int facial_capture_main(int argc, char **argv)
         else if (a=="--list-devices") list_dev=true;
         else if (a=="--list-resolutions") list_res=true;
         else if (a=="--format") format_override=take(a);
+        else if (a=="--stream") stream=true;
+        else if (a=="--save") save_override=take(a);
         else if (a=="-v"||a=="--verbose") verbose=true;
         else if (a=="--debug") debug=true;
         else if (a=="--nogui") nogui=true;
@@ -196,6 +206,10 @@ int facial_capture_main(int argc, char **argv)
     cfg.debug |= debug;
     cfg.verbose |= verbose;
 
+    fa_log_set_sink(fa_log_sink_stderr, nullptr);
+    fa_log_set_level(cfg.debug ? FA_LOG_DEBUG : cfg.verbose ? FA_LOG_INFO : FA_LOG_WARN);
+    fa_set_inference_threads(cfg.inference_threads);
+
     if (cfg.debug)
         debug_dump(cfg);
 
@@ -208,6 +222,12 @@ int facial_capture_main(int argc, char **argv)
 
     if (force) cfg.force_overwrite=true;
     if (nogui) cfg.nogui=true;
+    if (stream) cfg.capture_embed=true;
+    if (!save_override.empty()) cfg.capture_save=save_override;
+
+    if (cfg.capture_save!="full" && cfg.capture_save!="face" && cfg.capture_save!="none") {
+        std::cerr<<"[ERRORE] Valore non valido per --save (full|face|none)\n"; return 1;
+    }
 
     std::string fmt = cfg.image_format;
     std::transform(fmt.begin(), fmt.end(), fmt.begin(), ::tolower);
@@ -256,6 +276,8 @@ int facial_capture_main(int argc, char **argv)
             std::cerr<<"Detector sconosciuto\n"; return 1;
         }
         cfg.detector_profile=detector_override;
+        std::string resolve_log;
+        fa_resolve_config(cfg, resolve_log);
     }
 
     std::string tool = "facial_capture";
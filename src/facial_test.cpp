@@ -1,9 +1,13 @@
 #include "libfacialauth.h"
+#include "facialauth_log.h"
 
 #include <opencv2/core.hpp>
 
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <vector>
 #include <algorithm>
 
 static void print_test_help()
@@ -15,6 +19,8 @@ static void print_test_help()
     "  -c, --config <file>    File di configurazione\n"
     "                         (default: /etc/pam_facial_auth/pam_facial.conf)\n"
     "      --threshold <val>  Soglia di confronto (override opzionale)\n"
+    "  -i, --image <file>     Verifica l'immagine invece della webcam\n"
+    "                         (ripetibile: vince la prima accettata)\n"
     "  -v, --verbose          Output dettagliato\n"
     "      --debug            Abilita debug\n"
     "  -H, --help             Mostra questo messaggio\n";
@@ -25,6 +31,7 @@ int facial_test_cli_main(int argc, char **argv)
     std::string user;
     std::string config_path = FACIALAUTH_DEFAULT_CONFIG;
     double threshold_override = -1.0;
+    std::vector<std::string> images;
     bool verbose = false;
     bool debug = false;
 
@@ -45,6 +52,8 @@ int facial_test_cli_main(int argc, char **argv)
             config_path = take_value(arg);
         } else if (arg == "--threshold") {
             threshold_override = std::stod(take_value(arg));
+        } else if (arg == "-i" || arg == "--image") {
+            images.push_back(take_value(arg));
         } else if (arg == "-v" || arg == "--verbose") {
             verbose = true;
         } else if (arg == "--debug") {
@@ -71,14 +80,48 @@ int facial_test_cli_main(int argc, char **argv)
         // continuiamo con i defaults
     }
 
+    // debug=yes in the config counts as --debug; the library leaves the
+    // process-wide log level alone.
+    if (cfg.debug)
+        debug = true;
     if (verbose || debug)
         cfg.debug = true;
 
+    fa_log_set_sink(fa_log_sink_stderr, nullptr);
+    fa_log_set_level(debug ? FA_LOG_DEBUG : verbose ? FA_LOG_INFO : FA_LOG_WARN);
+    fa_set_inference_threads(cfg.inference_threads);
+
    if (!fa_check_root("facial_test")) {
         std::cerr << "[ERRORE] Questo strumento deve essere eseguito come root.\n";
         return 1;
     }
 
+    if (!images.empty()) {
+        FaVerifyRequest req;
+        req.user      = user;
+        req.threshold = threshold_override;
+        for (const auto &path : images) {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) {
+                std::cerr << "[ERRORE] Impossibile leggere " << path << "\n";
+                return 1;
+            }
+            req.encoded.emplace_back(std::istreambuf_iterator<char>(in),
+                                     std::istreambuf_iterator<char>());
+        }
+
+        std::vector<FaVerifyResult> res;
+        if (!fa_verify_batch(cfg, { req }, res, log)) {
+            std::cerr << log;
+            return 1;
+        }
+        std::cout << res[0].log;
+        std::cout << "[RISULTATO] " << fa_attempt_status_name(res[0].status)
+                  << " score=" << res[0].score << " label=" << res[0].label
+                  << " frames=" << res[0].frames << " faces=" << res[0].faces << "\n";
+        return res[0].accepted ? 0 : 1;
+    }
+
     std::string model_path = fa_user_model_path(cfg, user);
     double best_conf = 0.0;
     int best_label   = -1;
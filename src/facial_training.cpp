@@ -1,4 +1,5 @@
 #include "libfacialauth.h"
+#include "facialauth_log.h"
 
 #include <opencv2/core.hpp>
 
@@ -15,6 +16,7 @@ static void print_training_help()
     "  -c, --config <file>    File di configurazione\n"
     "                         (default: /etc/pam_facial_auth/pam_facial.conf)\n"
     "      --threshold <val>  Soglia opzionale per il training (override)\n"
+    "  -f, --force            Ricostruisce il modello da zero\n"
     "  -v, --verbose          Output dettagliato\n"
     "      --debug            Abilita debug\n"
     "  -H, --help             Mostra questo messaggio\n";
@@ -26,6 +28,7 @@ int facial_training_cli_main(int argc, char **argv)
     std::string config_path = FACIALAUTH_DEFAULT_CONFIG;
     bool verbose = false;
     bool debug = false;
+    bool force = false;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -42,6 +45,8 @@ int facial_training_cli_main(int argc, char **argv)
             user = take_value(arg);
         } else if (arg == "-c" || arg == "--config") {
             config_path = take_value(arg);
+        } else if (arg == "-f" || arg == "--force") {
+            force = true;
         } else if (arg == "-v" || arg == "--verbose") {
             verbose = true;
         } else if (arg == "--debug") {
@@ -68,8 +73,21 @@ int facial_training_cli_main(int argc, char **argv)
         // usiamo comunque i default
     }
 
+    // debug=yes in the config counts as --debug; the library leaves the
+    // process-wide log level alone.
+    if (cfg.debug)
+        debug = true;
     if (verbose || debug)
         cfg.debug = true;
+    if (force)
+        cfg.force_overwrite = true;
+
+    fa_log_set_sink(fa_log_sink_stderr, nullptr);
+    fa_log_set_level(debug ? FA_LOG_DEBUG : verbose ? FA_LOG_INFO : FA_LOG_WARN);
+
+    // One image per training worker: OpenCV's own pool would oversubscribe
+    // the cores the workers already use.
+    fa_set_inference_threads(cfg.train_threads == 1 ? cfg.inference_threads : 1);
 
     if (!fa_check_root("facial_training")) {
         std::cerr << "[ERRORE] Questo strumento deve essere eseguito come root.\n";
@@ -0,0 +1,191 @@
+#include "../include/facialauth_config.h"
+#include "../include/facialauth_ipc.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ==========================================================
+// Helpers
+// ==========================================================
+
+uint64_t fa_fnv1a64(const void *data, size_t len, uint64_t h)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+bool fa_parse_bool(const std::string &v)
+{
+    return strcasecmp(v.c_str(), "yes") == 0 ||
+           strcasecmp(v.c_str(), "true") == 0 || v == "1";
+}
+
+bool fa_config_stamp(const std::string &path, FaConfigStamp &st)
+{
+    struct stat sb;
+    if (::stat(path.c_str(), &sb) != 0)
+        return false;
+
+    st.dev  = (uint64_t)sb.st_dev;
+    st.ino  = (uint64_t)sb.st_ino;
+    st.sec  = (int64_t)sb.st_mtim.tv_sec;
+    st.nsec = (int64_t)sb.st_mtim.tv_nsec;
+    st.size = (int64_t)sb.st_size;
+    return true;
+}
+
+// ==========================================================
+// Binary cache of compiled entries (written by root only)
+// ==========================================================
+
+static const char     CFG_CACHE_MAGIC[8] = { 'F','A','C','F','G','B','I','N' };
+static const uint32_t CFG_CACHE_VERSION  = 3;
+
+std::string fa_config_cache_path(const std::string &cfg_path)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/config-%016llx.cache",
+             (unsigned long long)fa_fnv1a64(cfg_path.data(), cfg_path.size()));
+    return std::string(FACIALAUTH_RUNDIR) + name;
+}
+
+template <typename T>
+static void put_raw(std::string &out, const T &v)
+{
+    out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void put_str(std::string &out, const std::string &s)
+{
+    put_raw(out, (uint32_t)s.size());
+    out += s;
+}
+
+template <typename T>
+static bool get_raw(const std::string &in, size_t &off, T &v)
+{
+    if (off + sizeof(v) > in.size()) return false;
+    std::memcpy(&v, in.data() + off, sizeof(v));
+    off += sizeof(v);
+    return true;
+}
+
+static bool get_str(const std::string &in, size_t &off, std::string &s)
+{
+    uint32_t len = 0;
+    if (!get_raw(in, off, len) || off + len > in.size()) return false;
+    s.assign(in.data() + off, len);
+    off += len;
+    return true;
+}
+
+void fa_write_config_cache(
+    const std::string &cfg_path,
+    const FaConfigStamp &stamp,
+    uint64_t schema,
+    const std::vector<FaConfigEntry> &entries,
+    const std::string &log
+)
+{
+    if (::geteuid() != 0)
+        return;
+
+    std::string out(CFG_CACHE_MAGIC, sizeof(CFG_CACHE_MAGIC));
+    put_raw(out, CFG_CACHE_VERSION);
+    put_raw(out, schema);
+    put_raw(out, stamp);
+    put_str(out, log);
+    put_raw(out, (uint32_t)entries.size());
+    for (const auto &e : entries) {
+        put_raw(out, e.id);
+        put_str(out, e.key);
+        put_str(out, e.subkey);
+        put_str(out, e.value);
+    }
+
+    ::mkdir(FACIALAUTH_RUNDIR, 0755);
+
+    std::string path = fa_config_cache_path(cfg_path);
+    std::string tmp  = path + ".tmp." + std::to_string(::getpid());
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f.is_open())
+            return;
+        f.write(out.data(), (std::streamsize)out.size());
+        if (!f.good()) {
+            f.close();
+            ::unlink(tmp.c_str());
+            return;
+        }
+    }
+    ::chmod(tmp.c_str(), 0644);
+    if (::rename(tmp.c_str(), path.c_str()) != 0)
+        ::unlink(tmp.c_str());
+}
+
+bool fa_read_config_cache(
+    const std::string &cfg_path,
+    const FaConfigStamp &stamp,
+    uint64_t &schema,
+    std::vector<FaConfigEntry> &entries,
+    std::string &log
+)
+{
+    std::string path = fa_config_cache_path(cfg_path);
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    // Only trust a cache that nobody but root could have written.
+    struct stat sb;
+    if (::fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_uid != 0 ||
+        (sb.st_mode & (S_IWGRP | S_IWOTH)) || sb.st_size > (1 << 20))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    std::string in((size_t)sb.st_size, '\0');
+    ssize_t n = ::read(fd, &in[0], in.size());
+    ::close(fd);
+    if (n != (ssize_t)in.size())
+        return false;
+
+    size_t off = sizeof(CFG_CACHE_MAGIC);
+    if (in.size() < off || std::memcmp(in.data(), CFG_CACHE_MAGIC, off) != 0)
+        return false;
+
+    uint32_t version = 0, count = 0;
+    FaConfigStamp cached;
+    std::string cached_log;
+    if (!get_raw(in, off, version) || version != CFG_CACHE_VERSION ||
+        !get_raw(in, off, schema) ||
+        !get_raw(in, off, cached) || !(cached == stamp) ||
+        !get_str(in, off, cached_log) ||
+        !get_raw(in, off, count))
+        return false;
+
+    std::vector<FaConfigEntry> out;
+    for (uint32_t i = 0; i < count; ++i) {
+        FaConfigEntry e;
+        if (!get_raw(in, off, e.id) || !get_str(in, off, e.key) ||
+            !get_str(in, off, e.subkey) || !get_str(in, off, e.value))
+            return false;
+        out.push_back(std::move(e));
+    }
+
+    entries.swap(out);
+    log = cached_log;
+    return true;
+}
@@ -0,0 +1,167 @@
+#include "../include/facialauth_ipc.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ==========================================================
+// Helpers
+// ==========================================================
+
+void fa_ipc_copy(char *dst, size_t cap, const std::string &src)
+{
+    if (cap == 0) return;
+    size_t n = std::min(src.size(), cap - 1);
+    std::memcpy(dst, src.data(), n);
+    dst[n] = '\0';
+}
+
+bool fa_ipc_read_full(int fd, void *buf, size_t len, int timeout_ms, int cancel_fd)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+    char *p = static_cast<char *>(buf);
+
+    while (len > 0) {
+        int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0)
+            return false;
+
+        struct pollfd pfd[2] = {
+            { fd,        POLLIN, 0 },
+            { cancel_fd, POLLIN, 0 },   // ignored by poll() when < 0
+        };
+        int r = ::poll(pfd, 2, left);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (r == 0 || pfd[1].revents) {
+            errno = (r == 0) ? ETIMEDOUT : ECANCELED;
+            return false;
+        }
+
+        ssize_t n = ::recv(fd, p, len, 0);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return false;
+        }
+        if (n == 0)
+            return false;
+
+        p   += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+bool fa_ipc_write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = static_cast<const char *>(buf);
+    while (len > 0) {
+        ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p   += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+bool fa_ipc_peer_cred(int fd, pid_t &pid, uid_t &uid, gid_t &gid)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+        len != sizeof(cred))
+        return false;
+
+    pid = cred.pid;
+    uid = cred.uid;
+    gid = cred.gid;
+    return true;
+}
+
+// ==========================================================
+// Client
+// ==========================================================
+
+FaIpcClientResult fa_ipc_authenticate(
+    const std::string &socket_path,
+    const FaIpcRequest &req,
+    FaIpcReply &reply,
+    int timeout_ms,
+    std::string &err,
+    int cancel_fd
+)
+{
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        err = "socket path too long: " + socket_path;
+        return FA_IPC_CLIENT_NO_DAEMON;
+    }
+    fa_ipc_copy(addr.sun_path, sizeof(addr.sun_path), socket_path);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        err = std::string("socket(): ") + std::strerror(errno);
+        return FA_IPC_CLIENT_FAILED;
+    }
+
+    if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int e = errno;
+        ::close(fd);
+        err = "connect(" + socket_path + "): " + std::strerror(e);
+        return (e == ENOENT || e == ECONNREFUSED || e == ENOTDIR)
+               ? FA_IPC_CLIENT_NO_DAEMON
+               : FA_IPC_CLIENT_FAILED;
+    }
+
+    // Only trust a daemon running as root.
+    pid_t pid; uid_t uid; gid_t gid;
+    if (!fa_ipc_peer_cred(fd, pid, uid, gid) || uid != 0) {
+        ::close(fd);
+        err = "daemon socket is not owned by a root process";
+        return FA_IPC_CLIENT_FAILED;
+    }
+
+    if (!fa_ipc_write_full(fd, &req, sizeof(req))) {
+        int e = errno;
+        ::close(fd);
+        err = std::string("send(): ") + std::strerror(e);
+        return FA_IPC_CLIENT_FAILED;
+    }
+
+    std::memset(&reply, 0, sizeof(reply));
+    bool ok = fa_ipc_read_full(fd, &reply, sizeof(reply), timeout_ms, cancel_fd);
+    int e = errno;
+    ::close(fd);
+
+    if (!ok && e == ECANCELED) {
+        err = "cancelled while waiting for daemon";
+        return FA_IPC_CLIENT_CANCELLED;
+    }
+    if (!ok) {
+        err = "no reply from daemon within " + std::to_string(timeout_ms) + " ms";
+        return FA_IPC_CLIENT_FAILED;
+    }
+
+    if (reply.magic != FA_IPC_MAGIC || reply.version != FA_IPC_VERSION) {
+        err = "protocol mismatch with daemon";
+        return FA_IPC_CLIENT_FAILED;
+    }
+
+    reply.log[FA_IPC_LOG_MAX - 1] = '\0';
+    return FA_IPC_CLIENT_OK;
+}
@@ -0,0 +1,642 @@
+#include "../include/facialauth_lbph.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ==========================================================
+// On-disk layout
+// ==========================================================
+
+static const char     LBPH_MAGIC[8]  = { 'F','A','L','B','P','H','\0','\1' };
+static const uint32_t LBPH_VERSION   = 1;
+static const size_t   LBPH_ALIGN     = 64;
+
+//
+// Header, then int32 labels[rows], then rows (64-byte aligned), each
+// bins() elements of float or uint16 depending on dtype. Host endianness:
+// the store is rebuilt by facial_training, never shipped between hosts.
+//
+struct LbphFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    int32_t  radius;
+    int32_t  neighbors;
+    int32_t  grid_x;
+    int32_t  grid_y;
+    uint64_t bins;
+    uint64_t rows;
+    int64_t  source_size;
+    int64_t  source_mtime_ns;
+    double   threshold;
+    uint64_t labels_offset;
+    uint64_t rows_offset;
+};
+
+static size_t dtype_size(uint32_t dtype)
+{
+    return dtype == FA_LBPH_U16 ? sizeof(uint16_t) : sizeof(float);
+}
+
+static uint64_t align_up(uint64_t v)
+{
+    return (v + LBPH_ALIGN - 1) & ~(uint64_t)(LBPH_ALIGN - 1);
+}
+
+std::string fa_lbph_path(const std::string &model_path)
+{
+    return model_path + ".lbph";
+}
+
+// ==========================================================
+// Chi-square kernels and dispatch
+// ==========================================================
+
+//
+// HISTCMP_CHISQR_ALT: 2 * sum((a-b)^2 / (a+b)) over bins with a+b > 0
+// (LBPH bins are multiples of 1/cell_area, so "> DBL_EPSILON" and "> 0"
+// select the same terms). Rows are scanned `block` bins at a time, with
+// float sums per block folded into a double; once the partial distance
+// reaches `bound` (the best row so far) the row cannot win and the scan
+// stops early, returning the partial value.
+//
+
+static inline double chisq_term(double a, double b)
+{
+    double s = a + b;
+    if (!(s > 0.0))
+        return 0.0;
+    double d = a - b;
+    return d * d / s;
+}
+
+static double chisq_f32_scalar(const float *a, const float *b, size_t n,
+                               size_t block, double bound)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += block) {
+        size_t e = std::min(n, i + block);
+        float part = 0.0f;
+        for (size_t k = i; k < e; ++k)
+            part += (float)chisq_term(a[k], b[k]);
+        total += part;
+        if (2.0 * total >= bound)
+            break;
+    }
+    return 2.0 * total;
+}
+
+static const float U16_SCALE = 1.0f / 65535.0f;
+
+static double chisq_u16_scalar(const float *a, const uint16_t *b, size_t n,
+                               size_t block, double bound)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += block) {
+        size_t e = std::min(n, i + block);
+        float part = 0.0f;
+        for (size_t k = i; k < e; ++k)
+            part += (float)chisq_term(a[k], b[k] * U16_SCALE);
+        total += part;
+        if (2.0 * total >= bound)
+            break;
+    }
+    return 2.0 * total;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static inline __m256 chisq8_avx2(__m256 a, __m256 b)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 s    = _mm256_add_ps(a, b);
+    __m256 d    = _mm256_sub_ps(a, b);
+    __m256 live = _mm256_cmp_ps(s, zero, _CMP_GT_OQ);
+    __m256 den  = _mm256_blendv_ps(_mm256_set1_ps(1.0f), s, live);
+    return _mm256_and_ps(live, _mm256_div_ps(_mm256_mul_ps(d, d), den));
+}
+
+__attribute__((target("avx2")))
+static inline float hsum_avx2(__m256 v)
+{
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2")))
+static double chisq_f32_avx2(const float *a, const float *b, size_t n,
+                             size_t block, double bound)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += block) {
+        size_t e = std::min(n, i + block);
+        __m256 acc = _mm256_setzero_ps();
+        size_t k = i;
+        for (; k + 8 <= e; k += 8)
+            acc = _mm256_add_ps(acc, chisq8_avx2(_mm256_loadu_ps(a + k),
+                                                 _mm256_loadu_ps(b + k)));
+        float part = hsum_avx2(acc);
+        for (; k < e; ++k)
+            part += (float)chisq_term(a[k], b[k]);
+        total += part;
+        if (2.0 * total >= bound)
+            break;
+    }
+    return 2.0 * total;
+}
+
+__attribute__((target("avx2")))
+static double chisq_u16_avx2(const float *a, const uint16_t *b, size_t n,
+                             size_t block, double bound)
+{
+    const __m256 scale = _mm256_set1_ps(U16_SCALE);
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += block) {
+        size_t e = std::min(n, i + block);
+        __m256 acc = _mm256_setzero_ps();
+        size_t k = i;
+        for (; k + 8 <= e; k += 8) {
+            __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + k));
+            __m256 bv = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(q)), scale);
+            acc = _mm256_add_ps(acc, chisq8_avx2(_mm256_loadu_ps(a + k), bv));
+        }
+        float part = hsum_avx2(acc);
+        for (; k < e; ++k)
+            part += (float)chisq_term(a[k], b[k] * U16_SCALE);
+        total += part;
+        if (2.0 * total >= bound)
+            break;
+    }
+    return 2.0 * total;
+}
+#elif defined(__ARM_NEON)
+static inline float32x4_t chisq4_neon(float32x4_t a, float32x4_t b)
+{
+    float32x4_t s    = vaddq_f32(a, b);
+    float32x4_t d    = vsubq_f32(a, b);
+    uint32x4_t  live = vcgtq_f32(s, vdupq_n_f32(0.0f));
+    float32x4_t den  = vbslq_f32(live, s, vdupq_n_f32(1.0f));
+    float32x4_t q    = vdivq_f32(vmulq_f32(d, d), den);
+    return vreinterpretq_f32_u32(vandq_u32(live, vreinterpretq_u32_f32(q)));
+}
+
+static double chisq_f32_neon(const float *a, const float *b, size_t n,
+                             size_t block, double bound)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += block) {
+        size_t e = std::min(n, i + block);
+        float32x4_t acc = vdupq_n_f32(0.0f);
+        size_t k = i;
+        for (; k + 4 <= e; k += 4)
+            acc = vaddq_f32(acc, chisq4_neon(vld1q_f32(a + k), vld1q_f32(b + k)));
+        float part = vaddvq_f32(acc);
+        for (; k < e; ++k)
+            part += (float)chisq_term(a[k], b[k]);
+        total += part;
+        if (2.0 * total >= bound)
+            break;
+    }
+    return 2.0 * total;
+}
+
+static double chisq_u16_neon(const float *a, const uint16_t *b, size_t n,
+                             size_t block, double bound)
+{
+    const float32x4_t scale = vdupq_n_f32(U16_SCALE);
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += block) {
+        size_t e = std::min(n, i + block);
+        float32x4_t acc = vdupq_n_f32(0.0f);
+        size_t k = i;
+        for (; k + 4 <= e; k += 4) {
+            float32x4_t bv = vmulq_f32(vcvtq_f32_u32(vmovl_u16(vld1_u16(b + k))), scale);
+            acc = vaddq_f32(acc, chisq4_neon(vld1q_f32(a + k), bv));
+        }
+        float part = vaddvq_f32(acc);
+        for (; k < e; ++k)
+            part += (float)chisq_term(a[k], b[k] * U16_SCALE);
+        total += part;
+        if (2.0 * total >= bound)
+            break;
+    }
+    return 2.0 * total;
+}
+#endif
+
+
+// ==========================================================
+// Features (same arithmetic as opencv_contrib lbph_faces.cpp)
+// ==========================================================
+
+//
+// One neighbour's contribution to a row of extended LBP codes:
+// bit n is set where the bilinear sample t at (fx|cx, fy|cy) is >= the
+// centre (within FLT_EPSILON). t is summed in the same order as
+// opencv_contrib, and without FMA, so every variant yields the same codes.
+//
+struct ElbpTap
+{
+    int   fx, fy, cx, cy;
+    float w1, w2, w3, w4;
+    int   bit;
+};
+
+static void elbp_row_scalar(const uint8_t *r0, const uint8_t *rf, const uint8_t *rc,
+                            const ElbpTap &tp, int j0, int j1, int radius, int *out)
+{
+    for (int j = j0; j < j1; ++j) {
+        float t = tp.w1 * rf[j + tp.fx] + tp.w2 * rf[j + tp.cx] +
+                  tp.w3 * rc[j + tp.fx] + tp.w4 * rc[j + tp.cx];
+        float c = r0[j];
+        bool bit = (t > c) ||
+                   (std::abs(t - c) < std::numeric_limits<float>::epsilon());
+        out[j - radius] |= (int)bit << tp.bit;
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static inline __m256 load8_avx2(const uint8_t *p)
+{
+    __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+}
+
+__attribute__((target("avx2")))
+static void elbp_row_avx2(const uint8_t *r0, const uint8_t *rf, const uint8_t *rc,
+                          const ElbpTap &tp, int j0, int j1, int radius, int *out)
+{
+    const __m256 w1 = _mm256_set1_ps(tp.w1), w2 = _mm256_set1_ps(tp.w2);
+    const __m256 w3 = _mm256_set1_ps(tp.w3), w4 = _mm256_set1_ps(tp.w4);
+    const __m256 eps  = _mm256_set1_ps(std::numeric_limits<float>::epsilon());
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256i bit = _mm256_set1_epi32(1 << tp.bit);
+
+    int j = j0;
+    for (; j + 8 <= j1; j += 8) {
+        __m256 t = _mm256_mul_ps(w1, load8_avx2(rf + j + tp.fx));
+        t = _mm256_add_ps(t, _mm256_mul_ps(w2, load8_avx2(rf + j + tp.cx)));
+        t = _mm256_add_ps(t, _mm256_mul_ps(w3, load8_avx2(rc + j + tp.fx)));
+        t = _mm256_add_ps(t, _mm256_mul_ps(w4, load8_avx2(rc + j + tp.cx)));
+        __m256 c = load8_avx2(r0 + j);
+
+        __m256 gt   = _mm256_cmp_ps(t, c, _CMP_GT_OQ);
+        __m256 diff = _mm256_andnot_ps(sign, _mm256_sub_ps(t, c));
+        __m256 near = _mm256_cmp_ps(diff, eps, _CMP_LT_OQ);
+        __m256i m   = _mm256_castps_si256(_mm256_or_ps(gt, near));
+
+        int *o = out + (j - radius);
+        __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(o));
+        acc = _mm256_or_si256(acc, _mm256_and_si256(m, bit));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(o), acc);
+    }
+    elbp_row_scalar(r0, rf, rc, tp, j, j1, radius, out);
+}
+#elif defined(__ARM_NEON)
+static void elbp_row_neon(const uint8_t *r0, const uint8_t *rf, const uint8_t *rc,
+                          const ElbpTap &tp, int j0, int j1, int radius, int *out)
+{
+    const float32x4_t w1 = vdupq_n_f32(tp.w1), w2 = vdupq_n_f32(tp.w2);
+    const float32x4_t w3 = vdupq_n_f32(tp.w3), w4 = vdupq_n_f32(tp.w4);
+    const float32x4_t eps = vdupq_n_f32(std::numeric_limits<float>::epsilon());
+    const uint32x4_t bit = vdupq_n_u32(1u << tp.bit);
+
+    auto load4 = [](const uint8_t *p) {
+        uint32_t w;
+        std::memcpy(&w, p, sizeof(w));
+        uint16x4_t h = vget_low_u16(vmovl_u8(vcreate_u8(w)));
+        return vcvtq_f32_u32(vmovl_u16(h));
+    };
+
+    int j = j0;
+    for (; j + 4 <= j1; j += 4) {
+        float32x4_t t = vmulq_f32(w1, load4(rf + j + tp.fx));
+        t = vaddq_f32(t, vmulq_f32(w2, load4(rf + j + tp.cx)));
+        t = vaddq_f32(t, vmulq_f32(w3, load4(rc + j + tp.fx)));
+        t = vaddq_f32(t, vmulq_f32(w4, load4(rc + j + tp.cx)));
+        float32x4_t c = load4(r0 + j);
+
+        uint32x4_t m = vorrq_u32(vcgtq_f32(t, c),
+                                 vcltq_f32(vabdq_f32(t, c), eps));
+
+        int *o = out + (j - radius);
+        uint32x4_t acc = vreinterpretq_u32_s32(vld1q_s32(o));
+        acc = vorrq_u32(acc, vandq_u32(m, bit));
+        vst1q_s32(o, vreinterpretq_s32_u32(acc));
+    }
+    elbp_row_scalar(r0, rf, rc, tp, j, j1, radius, out);
+}
+#endif
+
+struct LbphKernels
+{
+    void   (*elbp_row)(const uint8_t *, const uint8_t *, const uint8_t *,
+                       const ElbpTap &, int, int, int, int *);
+    double (*chisq_f32)(const float *, const float *, size_t, size_t, double);
+    double (*chisq_u16)(const float *, const uint16_t *, size_t, size_t, double);
+    const char *name;
+};
+
+// Picked once per process from what the CPU supports.
+static const LbphKernels &kernels()
+{
+    static const LbphKernels k = [] {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2"))
+            return LbphKernels{ elbp_row_avx2, chisq_f32_avx2, chisq_u16_avx2, "avx2" };
+#elif defined(__ARM_NEON)
+        return LbphKernels{ elbp_row_neon, chisq_f32_neon, chisq_u16_neon, "neon" };
+#endif
+        return LbphKernels{ elbp_row_scalar, chisq_f32_scalar, chisq_u16_scalar, "scalar" };
+    }();
+    return k;
+}
+
+const char *fa_lbph_kernel_name()
+{
+    return kernels().name;
+}
+
+// Extended LBP code of every pixel at least `radius` away from the border.
+static void elbp(const uint8_t *img, int width, int height, size_t stride,
+                 int radius, int neighbors, std::vector<int> &dst)
+{
+    const int dw = width - 2 * radius;
+    const int dh = height - 2 * radius;
+    dst.assign((size_t)std::max(dw, 0) * std::max(dh, 0), 0);
+    if (dw <= 0 || dh <= 0)
+        return;
+
+    const LbphKernels &k = kernels();
+
+    for (int n = 0; n < neighbors; ++n) {
+        float x = static_cast<float>(radius * std::cos(2.0 * M_PI * n / static_cast<float>(neighbors)));
+        float y = static_cast<float>(-radius * std::sin(2.0 * M_PI * n / static_cast<float>(neighbors)));
+
+        ElbpTap tp;
+        tp.fx = static_cast<int>(std::floor(x));
+        tp.fy = static_cast<int>(std::floor(y));
+        tp.cx = static_cast<int>(std::ceil(x));
+        tp.cy = static_cast<int>(std::ceil(y));
+
+        float ty = y - tp.fy;
+        float tx = x - tp.fx;
+
+        tp.w1 = (1 - tx) * (1 - ty);
+        tp.w2 =      tx  * (1 - ty);
+        tp.w3 = (1 - tx) *      ty;
+        tp.w4 =      tx  *      ty;
+        tp.bit = n;
+
+        for (int i = radius; i < height - radius; ++i) {
+            k.elbp_row(img + (size_t)i * stride,
+                       img + (size_t)(i + tp.fy) * stride,
+                       img + (size_t)(i + tp.cy) * stride,
+                       tp, radius, width - radius, radius,
+                       &dst[(size_t)(i - radius) * dw]);
+        }
+    }
+}
+
+void fa_lbph_histogram(const uint8_t *img, int width, int height, size_t stride,
+                       const FaLbphParams &p, float *out)
+{
+    const size_t patterns = (size_t)1 << p.neighbors;
+    std::memset(out, 0, p.bins() * sizeof(float));
+
+    std::vector<int> codes;
+    elbp(img, width, height, stride, p.radius, p.neighbors, codes);
+
+    const int lw = width - 2 * p.radius;
+    const int lh = height - 2 * p.radius;
+    if (codes.empty() || p.grid_x <= 0 || p.grid_y <= 0)
+        return;
+
+    const int cw = lw / p.grid_x;
+    const int ch = lh / p.grid_y;
+    if (cw <= 0 || ch <= 0)
+        return;
+    const float inv = 1.0f / (float)(cw * ch);
+
+    for (int gy = 0; gy < p.grid_y; ++gy) {
+        for (int gx = 0; gx < p.grid_x; ++gx) {
+            float *h = out + ((size_t)gy * p.grid_x + gx) * patterns;
+            for (int y = gy * ch; y < (gy + 1) * ch; ++y) {
+                const int *row = &codes[(size_t)y * lw + (size_t)gx * cw];
+                for (int x = 0; x < cw; ++x)
+                    h[row[x]] += 1.0f;
+            }
+            for (size_t b = 0; b < patterns; ++b)
+                h[b] *= inv;
+        }
+    }
+}
+
+// ==========================================================
+// Writer
+// ==========================================================
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = static_cast<const char *>(buf);
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p   += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+bool fa_lbph_write(const std::string &path,
+                   const FaLbphParams &params,
+                   double threshold,
+                   const float *hist,
+                   const int32_t *labels,
+                   size_t rows,
+                   FaLbphDtype dtype,
+                   int64_t source_size,
+                   int64_t source_mtime_ns,
+                   std::string &log)
+{
+    const size_t bins = params.bins();
+
+    LbphFileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, LBPH_MAGIC, sizeof(h.magic));
+    h.version         = LBPH_VERSION;
+    h.dtype           = dtype;
+    h.radius          = params.radius;
+    h.neighbors       = params.neighbors;
+    h.grid_x          = params.grid_x;
+    h.grid_y          = params.grid_y;
+    h.bins            = bins;
+    h.rows            = rows;
+    h.source_size     = source_size;
+    h.source_mtime_ns = source_mtime_ns;
+    h.threshold       = threshold;
+    h.labels_offset   = sizeof(h);
+    h.rows_offset     = align_up(h.labels_offset + rows * sizeof(int32_t));
+
+    std::vector<char> out(h.rows_offset + rows * bins * dtype_size(dtype), 0);
+    std::memcpy(out.data(), &h, sizeof(h));
+    if (rows)
+        std::memcpy(out.data() + h.labels_offset, labels, rows * sizeof(int32_t));
+
+    char *dst = out.data() + h.rows_offset;
+    if (dtype == FA_LBPH_U16) {
+        uint16_t *q = reinterpret_cast<uint16_t *>(dst);
+        for (size_t i = 0; i < rows * bins; ++i) {
+            float v = std::min(std::max(hist[i], 0.0f), 1.0f);
+            q[i] = (uint16_t)std::lround(v * 65535.0f);
+        }
+    } else if (rows) {
+        std::memcpy(dst, hist, rows * bins * sizeof(float));
+    }
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log += "Cannot create " + path + ": " + std::strerror(errno) + "\n";
+        return false;
+    }
+    bool ok = write_all(fd, out.data(), out.size());
+    ok = (::close(fd) == 0) && ok;
+    if (!ok) {
+        log += "Cannot write " + path + "\n";
+        ::unlink(path.c_str());
+    }
+    return ok;
+}
+
+// ==========================================================
+// Reader
+// ==========================================================
+
+FaLbphModel::~FaLbphModel()
+{
+    if (map_)
+        ::munmap(map_, map_len_);
+}
+
+bool FaLbphModel::open(const std::string &path,
+                       int64_t source_size,
+                       int64_t source_mtime_ns,
+                       std::string &log)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LbphFileHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t len = (size_t)st.st_size;
+    void *m = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        log += "mmap(" + path + "): " + std::strerror(errno) + "\n";
+        return false;
+    }
+
+    LbphFileHeader h;
+    std::memcpy(&h, m, sizeof(h));
+
+    FaLbphParams p;
+    p.radius    = h.radius;
+    p.neighbors = h.neighbors;
+    p.grid_x    = h.grid_x;
+    p.grid_y    = h.grid_y;
+
+    bool valid =
+        std::memcmp(h.magic, LBPH_MAGIC, sizeof(h.magic)) == 0 &&
+        h.version == LBPH_VERSION &&
+        (h.dtype == FA_LBPH_F32 || h.dtype == FA_LBPH_U16) &&
+        p.radius > 0 && p.neighbors > 0 && p.neighbors <= 16 &&
+        p.grid_x > 0 && p.grid_y > 0 && h.bins == p.bins() &&
+        h.labels_offset >= sizeof(h) && h.rows_offset % LBPH_ALIGN == 0 &&
+        h.rows_offset <= len && h.labels_offset <= h.rows_offset &&
+        h.rows <= (h.rows_offset - h.labels_offset) / sizeof(int32_t) &&
+        h.rows <= (len - h.rows_offset) / (h.bins * dtype_size(h.dtype));
+
+    // The XML model changed since the store was written.
+    bool fresh = h.source_size == source_size && h.source_mtime_ns == source_mtime_ns;
+
+    if (!valid || !fresh) {
+        if (!valid)
+            log += "Ignoring corrupt LBPH store: " + path + "\n";
+        ::munmap(m, len);
+        return false;
+    }
+
+    if (map_)
+        ::munmap(map_, map_len_);
+    map_       = m;
+    map_len_   = len;
+    params_    = p;
+    dtype_     = (FaLbphDtype)h.dtype;
+    threshold_ = h.threshold;
+    rows_      = (size_t)h.rows;
+    labels_    = reinterpret_cast<const int32_t *>(static_cast<const char *>(m) + h.labels_offset);
+    data_      = static_cast<const char *>(m) + h.rows_offset;
+    return true;
+}
+
+void FaLbphModel::predict(const uint8_t *img, int width, int height, size_t stride,
+                          int &label, double &dist) const
+{
+    label = -1;
+    dist  = std::numeric_limits<double>::max();
+
+    const size_t bins = params_.bins();
+    std::vector<float> query(bins);
+    fa_lbph_histogram(img, width, height, stride, params_, query.data());
+
+    // One grid cell per block: a row stops as soon as it exceeds the best.
+    const LbphKernels &k = kernels();
+    const size_t block = (size_t)1 << params_.neighbors;
+
+    size_t best = rows_;
+    for (size_t r = 0; r < rows_; ++r) {
+        double d;
+        if (dtype_ == FA_LBPH_U16)
+            d = k.chisq_u16(query.data(), static_cast<const uint16_t *>(data_) + r * bins,
+                            bins, block, dist);
+        else
+            d = k.chisq_f32(query.data(), static_cast<const float *>(data_) + r * bins,
+                            bins, block, dist);
+        if (d < dist) {
+            dist = d;
+            best = r;
+        }
+    }
+
+    if (best < rows_ && dist < threshold_)
+        label = labels_[best];
+}
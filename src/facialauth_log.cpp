@@ -0,0 +1,49 @@
+#include "../include/facialauth_log.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+#include <syslog.h>
+
+std::atomic<int> g_fa_log_level{FA_LOG_INFO};
+
+static FaLogSink g_sink     = fa_log_sink_syslog;
+static void     *g_sink_ctx = nullptr;
+
+// Long enough for a path plus context; longer messages are truncated.
+static const size_t LOG_LINE_MAX = 512;
+
+void fa_log_set_sink(FaLogSink sink, void *ctx)
+{
+    g_sink     = sink ? sink : fa_log_sink_syslog;
+    g_sink_ctx = ctx;
+}
+
+void fa_log_set_level(FaLogLevel level)
+{
+    g_fa_log_level.store((int)level, std::memory_order_relaxed);
+}
+
+void fa_log_sink_syslog(FaLogLevel level, const char *msg, void *)
+{
+    static const int prio[] = { LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG };
+    syslog(LOG_AUTHPRIV | prio[level], "facial_auth: %s", msg);
+}
+
+void fa_log_sink_stderr(FaLogLevel level, const char *msg, void *)
+{
+    static const char *tag[] = { "[ERROR] ", "[WARN] ", "[INFO] ", "[DEBUG] " };
+    std::fprintf(stderr, "%s%s\n", tag[level], msg);
+}
+
+void fa_log_write(FaLogLevel level, const char *fmt, ...)
+{
+    char buf[LOG_LINE_MAX];
+
+    va_list ap;
+    va_start(ap, fmt);
+    std::vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    g_sink(level, buf, g_sink_ctx);
+}
@@ -0,0 +1,327 @@
+#include "../include/facialauth_metrics.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ==========================================================
+// Storage
+// ==========================================================
+
+// Upper bounds in microseconds; the last bucket is +Inf.
+static const int64_t BUCKET_US[] = {
+    5000, 10000, 25000, 50000, 100000, 250000,
+    500000, 1000000, 2500000, 5000000, 10000000
+};
+static const int NUM_BUCKETS = sizeof(BUCKET_US) / sizeof(BUCKET_US[0]) + 1;
+
+static const char *RESULT_NAMES[FA_RESULT_COUNT] = {
+    "accept", "reject", "no_face", "timeout", "camera_error", "error", "cancelled"
+};
+
+static const char *STAGE_NAMES[FA_METRIC_STAGE_COUNT] = {
+    "camera_open", "detect", "embed", "total"
+};
+
+struct Histogram
+{
+    std::atomic<uint64_t> buckets[NUM_BUCKETS];   // non-cumulative
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_us;
+};
+
+struct Metrics
+{
+    std::atomic<uint64_t> results[FA_RESULT_COUNT];
+    Histogram             stages[FA_METRIC_STAGE_COUNT];
+};
+
+// Plain snapshot, used for "already flushed" bookkeeping
+struct MetricsSnapshot
+{
+    uint64_t results[FA_RESULT_COUNT] = {};
+    uint64_t buckets[FA_METRIC_STAGE_COUNT][NUM_BUCKETS] = {};
+    uint64_t count[FA_METRIC_STAGE_COUNT]  = {};
+    uint64_t sum_us[FA_METRIC_STAGE_COUNT] = {};
+};
+
+static Metrics         g_metrics;       // zero-initialized (static storage)
+static MetricsSnapshot g_flushed;
+static std::mutex      g_flush_mutex;
+
+// ==========================================================
+// Recording
+// ==========================================================
+
+void fa_metrics_result(FaMetricResult r)
+{
+    if (r < 0 || r >= FA_RESULT_COUNT)
+        return;
+    g_metrics.results[r].fetch_add(1, std::memory_order_relaxed);
+}
+
+void fa_metrics_observe(FaMetricStage stage, int64_t dur_us)
+{
+    if (stage < 0 || stage >= FA_METRIC_STAGE_COUNT)
+        return;
+    if (dur_us < 0)
+        dur_us = 0;
+
+    int b = 0;
+    while (b < NUM_BUCKETS - 1 && dur_us > BUCKET_US[b])
+        ++b;
+
+    Histogram &h = g_metrics.stages[stage];
+    h.buckets[b].fetch_add(1, std::memory_order_relaxed);
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.sum_us.fetch_add((uint64_t)dur_us, std::memory_order_relaxed);
+}
+
+// ==========================================================
+// Textfile output
+// ==========================================================
+
+std::string fa_metrics_path(const std::string &basedir)
+{
+    std::string base = basedir.empty() ? "/var/lib/pam_facial_auth" : basedir;
+    if (base.back() != '/')
+        base += '/';
+    return base + "metrics/facial_auth.prom";
+}
+
+static void take_snapshot(MetricsSnapshot &s)
+{
+    for (int r = 0; r < FA_RESULT_COUNT; ++r)
+        s.results[r] = g_metrics.results[r].load(std::memory_order_relaxed);
+
+    for (int st = 0; st < FA_METRIC_STAGE_COUNT; ++st) {
+        const Histogram &h = g_metrics.stages[st];
+        for (int b = 0; b < NUM_BUCKETS; ++b)
+            s.buckets[st][b] = h.buckets[b].load(std::memory_order_relaxed);
+        s.count[st]  = h.count.load(std::memory_order_relaxed);
+        s.sum_us[st] = h.sum_us.load(std::memory_order_relaxed);
+    }
+}
+
+static std::string le_label(int b)
+{
+    if (b == NUM_BUCKETS - 1)
+        return "+Inf";
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%g", BUCKET_US[b] / 1e6);
+    return buf;
+}
+
+// Series -> value from an existing file; comments and junk are skipped.
+static void read_series(const std::string &path, std::map<std::string, double> &out)
+{
+    std::ifstream f(path);
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t sp = line.rfind(' ');
+        if (sp == std::string::npos)
+            continue;
+        char *end = nullptr;
+        double v = std::strtod(line.c_str() + sp + 1, &end);
+        if (end == line.c_str() + sp + 1)
+            continue;
+        out[line.substr(0, sp)] = v;
+    }
+}
+
+static void put_series(std::ostringstream &os,
+                       std::map<std::string, double> &old,
+                       const std::string &series,
+                       double delta)
+{
+    double v = old[series] + delta;
+    os << series << ' ' << v << '\n';
+}
+
+static std::string render(std::map<std::string, double> &old,
+                          const MetricsSnapshot &cur)
+{
+    std::ostringstream os;
+    os.precision(17);
+
+    os << "# HELP facial_auth_attempts_total Face verification attempts by result.\n"
+          "# TYPE facial_auth_attempts_total counter\n";
+    for (int r = 0; r < FA_RESULT_COUNT; ++r)
+        put_series(os, old,
+                   std::string("facial_auth_attempts_total{result=\"") + RESULT_NAMES[r] + "\"}",
+                   (double)(cur.results[r] - g_flushed.results[r]));
+
+    os << "# HELP facial_auth_stage_seconds Latency of verification stages.\n"
+          "# TYPE facial_auth_stage_seconds histogram\n";
+    for (int st = 0; st < FA_METRIC_STAGE_COUNT; ++st) {
+        std::string stage = std::string("stage=\"") + STAGE_NAMES[st] + "\"";
+        uint64_t cum = 0;
+        for (int b = 0; b < NUM_BUCKETS; ++b) {
+            cum += cur.buckets[st][b] - g_flushed.buckets[st][b];
+            put_series(os, old,
+                       "facial_auth_stage_seconds_bucket{" + stage +
+                       ",le=\"" + le_label(b) + "\"}", (double)cum);
+        }
+        put_series(os, old, "facial_auth_stage_seconds_sum{" + stage + "}",
+                   (cur.sum_us[st] - g_flushed.sum_us[st]) / 1e6);
+        put_series(os, old, "facial_auth_stage_seconds_count{" + stage + "}",
+                   (double)(cur.count[st] - g_flushed.count[st]));
+    }
+    return os.str();
+}
+
+// <dir of path>/spool: per-attempt deltas of processes without a daemon.
+static std::string spool_dir(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    return dir + "/spool";
+}
+
+static void list_spool(const std::string &dir, std::vector<std::string> &files)
+{
+    DIR *d = ::opendir(dir.c_str());
+    if (!d)
+        return;
+    while (struct dirent *e = ::readdir(d)) {
+        if (std::strncmp(e->d_name, "delta.", 6) == 0)
+            files.push_back(dir + "/" + e->d_name);
+    }
+    ::closedir(d);
+}
+
+bool fa_metrics_spool(const std::string &path, std::string &log)
+{
+    std::lock_guard<std::mutex> lk(g_flush_mutex);
+
+    MetricsSnapshot cur;
+    take_snapshot(cur);
+    if (std::memcmp(&cur, &g_flushed, sizeof(cur)) == 0)
+        return true;
+
+    std::string dir = spool_dir(path);
+    ::mkdir(dir.substr(0, dir.size() - 6).c_str(), 0755);
+    ::mkdir(dir.c_str(), 0700);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    std::string name = std::to_string(::getpid()) + "." +
+                       std::to_string((long long)ts.tv_sec) +
+                       std::to_string((long long)ts.tv_nsec);
+    std::string file = dir + "/delta." + name;
+
+    // Written under a name list_spool() skips and renamed into place, so
+    // a concurrent flush never merges (and then unlinks) a partial delta.
+    std::string tmp = dir + "/tmp." + name;
+
+    std::map<std::string, double> none;
+    std::string text = render(none, cur);
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log += "metrics: cannot create " + tmp + ": " + std::strerror(errno) + "\n";
+        return false;
+    }
+    bool ok = ::write(fd, text.data(), text.size()) == (ssize_t)text.size();
+    ok = (::close(fd) == 0) && ok;
+    if (ok)
+        ok = ::rename(tmp.c_str(), file.c_str()) == 0;
+    if (!ok) {
+        ::unlink(tmp.c_str());
+        log += "metrics: cannot write " + file + "\n";
+        return false;
+    }
+    g_flushed = cur;
+    return true;
+}
+
+size_t fa_metrics_spooled(const std::string &path)
+{
+    std::vector<std::string> files;
+    list_spool(spool_dir(path), files);
+    return files.size();
+}
+
+bool fa_metrics_flush(const std::string &path, std::string &log)
+{
+    std::lock_guard<std::mutex> lk(g_flush_mutex);
+
+    MetricsSnapshot cur;
+    take_snapshot(cur);
+
+    std::vector<std::string> spooled;
+    list_spool(spool_dir(path), spooled);
+    if (spooled.empty() && std::memcmp(&cur, &g_flushed, sizeof(cur)) == 0)
+        return true;   // nothing new
+
+    std::string dir = path.substr(0, path.find_last_of('/'));
+    if (!dir.empty())
+        ::mkdir(dir.c_str(), 0755);
+
+    // Serializes the read-merge-rename cycle between processes. The lock
+    // file is root-only, so other users cannot hold it; whoever finds it
+    // taken leaves the merge to the holder and keeps its samples.
+    std::string lock_path = path + ".lock";
+    int lfd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (lfd < 0) {
+        log += "metrics: cannot open " + lock_path + ": " + std::strerror(errno) + "\n";
+        return false;
+    }
+    (void)::fchmod(lfd, 0600);     // files from older versions were 0644
+    if (::flock(lfd, LOCK_EX | LOCK_NB) != 0) {
+        ::close(lfd);
+        log += "metrics: " + lock_path + " busy, flush deferred\n";
+        return false;
+    }
+
+    std::map<std::string, double> old;
+    read_series(path, old);
+    for (const auto &f : spooled) {
+        std::map<std::string, double> delta;
+        read_series(f, delta);
+        for (const auto &kv : delta)
+            old[kv.first] += kv.second;
+    }
+    std::string text = render(old, cur);
+
+    std::string tmp = path + ".tmp." + std::to_string(::getpid());
+    bool ok = false;
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        ok = ::write(fd, text.data(), text.size()) == (ssize_t)text.size();
+        ok = (::close(fd) == 0) && ok;
+        if (ok)
+            ok = ::rename(tmp.c_str(), path.c_str()) == 0;
+        if (!ok)
+            ::unlink(tmp.c_str());
+    }
+    if (ok)
+        for (const auto &f : spooled)
+            ::unlink(f.c_str());
+
+    ::flock(lfd, LOCK_UN);
+    ::close(lfd);
+
+    if (!ok) {
+        log += "metrics: cannot write " + path + "\n";
+        return false;
+    }
+    g_flushed = cur;
+    return true;
+}
@@ -0,0 +1,169 @@
+#include "../include/facialauth_pool.h"
+#include "../include/facialauth_log.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// ==========================================================
+// CPU policy
+// ==========================================================
+
+static pid_t current_tid()
+{
+    return (pid_t)::syscall(SYS_gettid);
+}
+
+bool fa_parse_cpu_set(const std::string &spec, std::vector<int> &cpus,
+                      std::string &log)
+{
+    cpus.clear();
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty())
+            continue;
+
+        char *p = nullptr;
+        long lo = std::strtol(item.c_str(), &p, 10);
+        long hi = lo;
+        if (*p == '-')
+            hi = std::strtol(p + 1, &p, 10);
+        if (*p != '\0' || lo < 0 || hi < lo || hi >= CPU_SETSIZE) {
+            log += "Invalid cpu_set entry: '" + item + "'\n";
+            cpus.clear();
+            return false;
+        }
+        for (long c = lo; c <= hi; ++c)
+            cpus.push_back((int)c);
+    }
+    return true;
+}
+
+bool fa_apply_cpu_policy(const FaCpuPolicy &p, std::string &log)
+{
+    bool ok = true;
+
+    if (!p.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : p.cpus)
+            CPU_SET(c, &set);
+        if (::sched_setaffinity(0, sizeof(set), &set) != 0) {
+            log += std::string("sched_setaffinity: ") + std::strerror(errno) + "\n";
+            ok = false;
+        }
+    }
+
+    if (p.nice != 0) {
+        pid_t tid = current_tid();
+        errno = 0;
+        int cur = ::getpriority(PRIO_PROCESS, (id_t)tid);
+        if (errno != 0) {
+            log += std::string("getpriority: ") + std::strerror(errno) + "\n";
+            ok = false;
+        } else if (::setpriority(PRIO_PROCESS, (id_t)tid, cur + p.nice) != 0) {
+            log += std::string("setpriority: ") + std::strerror(errno) + "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+FaCpuScope::FaCpuScope(const FaCpuPolicy &p)
+{
+    if (p.cpus.empty())
+        return;
+
+    cpu_set_t set;
+    if (::sched_getaffinity(0, sizeof(set), &set) != 0) {
+        FA_WARN("CPU set not applied: sched_getaffinity: %s", std::strerror(errno));
+        return;
+    }
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(&set);
+    mask_.assign(b, b + sizeof(set));
+    have_mask_ = true;
+
+    FaCpuPolicy affinity;
+    affinity.cpus = p.cpus;
+    std::string log;
+    if (!fa_apply_cpu_policy(affinity, log))
+        FA_WARN("CPU set not applied: %s", log.c_str());
+    active_ = true;
+}
+
+FaCpuScope::~FaCpuScope()
+{
+    if (!active_)
+        return;
+
+    if (have_mask_) {
+        cpu_set_t set;
+        std::memcpy(&set, mask_.data(), sizeof(set));
+        if (::sched_setaffinity(0, sizeof(set), &set) != 0)
+            FA_DBG("Cannot restore CPU set: %s", std::strerror(errno));
+    }
+}
+
+// ==========================================================
+// Thread pool
+// ==========================================================
+
+FaThreadPool::FaThreadPool(size_t threads, const FaCpuPolicy &policy)
+    : policy_(policy)
+{
+    for (size_t i = 0; i < threads; ++i)
+        workers_.emplace_back(&FaThreadPool::run, this);
+}
+
+FaThreadPool::~FaThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : workers_)
+        t.join();
+}
+
+std::future<void> FaThreadPool::submit(std::function<void()> fn)
+{
+    std::packaged_task<void()> task(std::move(fn));
+    std::future<void> f = task.get_future();
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+    return f;
+}
+
+void FaThreadPool::run()
+{
+    std::string log;
+    if (!policy_.empty() && !fa_apply_cpu_policy(policy_, log))
+        FA_WARN("Pool worker CPU policy not applied: %s", log.c_str());
+
+    for (;;) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lk(mutex_);
+            cv_.wait(lk, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty())
+                return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
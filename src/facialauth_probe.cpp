@@ -0,0 +1,119 @@
+#include "../include/facialauth_probe.h"
+#include "../include/facialauth_config.h"
+
+#include <fstream>
+#include <cctype>
+#include <cstdlib>
+
+#include <sys/stat.h>
+
+// ==========================================================
+// Helpers
+// ==========================================================
+
+static std::string trim(const std::string &s)
+{
+    size_t b = 0;
+    while (b < s.size() && std::isspace((unsigned char)s[b])) ++b;
+    size_t e = s.size();
+    while (e > b && std::isspace((unsigned char)s[e - 1])) --e;
+    return s.substr(b, e - b);
+}
+
+static bool is_char_device(const std::string &path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && S_ISCHR(st.st_mode);
+}
+
+// ==========================================================
+// Probes
+// ==========================================================
+
+static void set_probe_key(FaProbeConfig &cfg, const std::string &key, const std::string &val)
+{
+    if (key == "basedir")
+        cfg.basedir = val;
+    else if (key == "device")
+        cfg.device = val;
+    else if (key == "fallback_device")
+        cfg.fallback_device = fa_parse_bool(val);
+    else if (key == "auth_timeout_ms")
+        cfg.auth_timeout_ms = std::atoi(val.c_str());
+}
+
+bool fa_probe_config(
+    const std::string &path,
+    FaProbeConfig &cfg,
+    std::string &log
+)
+{
+    cfg = FaProbeConfig();
+
+    // Root's compiled cache, when it was written for this very file. Its
+    // values were validated by the loader already.
+    FaConfigStamp stamp;
+    std::vector<FaConfigEntry> entries;
+    uint64_t schema = 0;
+    std::string cache_log;
+    if (fa_config_stamp(path, stamp) &&
+        fa_read_config_cache(path, stamp, schema, entries, cache_log))
+    {
+        for (const auto &e : entries)
+            set_probe_key(cfg, e.key, e.value);
+        return true;
+    }
+
+    std::ifstream f(path);
+    if (!f.is_open()) {
+        log += "Cannot open config file: " + path + "\n";
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(f, line)) {
+        std::string s = trim(line);
+        if (s.empty() || s[0] == '#')
+            continue;
+
+        auto pos = s.find('=');
+        if (pos == std::string::npos)
+            continue;
+
+        set_probe_key(cfg, trim(s.substr(0, pos)), trim(s.substr(pos + 1)));
+    }
+    return true;
+}
+
+std::string fa_model_path(const std::string &basedir, const std::string &user)
+{
+    std::string base = basedir.empty() ? "/var/lib/pam_facial_auth" : basedir;
+    if (base.back() != '/')
+        base += '/';
+    return base + "models/" + user + ".xml";
+}
+
+bool fa_probe_model(const FaProbeConfig &cfg, const std::string &user)
+{
+    struct stat st;
+    std::string path = fa_model_path(cfg.basedir, user);
+    return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+}
+
+bool fa_probe_camera(const FaProbeConfig &cfg)
+{
+    if (!cfg.device.empty()) {
+        // Not a device node (index, URL, pipeline): can't tell cheaply.
+        if (cfg.device[0] != '/' || is_char_device(cfg.device))
+            return true;
+    }
+
+    // Same candidates open_camera() tries.
+    if (cfg.fallback_device) {
+        for (int i = 0; i < 3; ++i) {
+            if (is_char_device("/dev/video" + std::to_string(i)))
+                return true;
+        }
+    }
+    return false;
+}
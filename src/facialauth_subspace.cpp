@@ -0,0 +1,408 @@
+#include "../include/facialauth_subspace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ==========================================================
+// On-disk layout
+// ==========================================================
+
+static const char     PROJ_MAGIC[8] = { 'F','A','P','R','O','J','\0','\1' };
+static const uint32_t PROJ_VERSION  = 1;
+static const size_t   PROJ_ALIGN    = 64;
+
+// Vectors are zero-padded to a multiple of this many floats, so the
+// kernels below never need a scalar tail.
+static const size_t   PROJ_LANES    = 16;
+
+//
+// Header, then int32 labels[rows], then (each 64-byte aligned) the mean,
+// the basis transposed to `components` rows of dim_stride floats, and the
+// projections as `rows` rows of comp_stride floats. Host endianness, as
+// for the LBPH store.
+//
+struct ProjFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t dim;
+    uint64_t dim_stride;
+    uint64_t components;
+    uint64_t comp_stride;
+    uint64_t rows;
+    int64_t  source_size;
+    int64_t  source_mtime_ns;
+    double   threshold;
+    uint64_t labels_offset;
+    uint64_t mean_offset;
+    uint64_t basis_offset;
+    uint64_t proj_offset;
+};
+
+static uint64_t align_up(uint64_t v, uint64_t a)
+{
+    return (v + a - 1) & ~(a - 1);
+}
+
+std::string fa_subspace_path(const std::string &model_path)
+{
+    return model_path + ".proj";
+}
+
+// ==========================================================
+// Kernels and dispatch
+// ==========================================================
+
+//
+// n is always a multiple of PROJ_LANES. Float lanes are folded into a
+// double every DOT_BLOCK elements so a 10k-pixel dot product keeps the
+// precision of OpenCV's double-precision projection to within ~1e-6.
+// l2sq stops once the partial sum reaches `bound` (the best row so far).
+//
+
+static const size_t DOT_BLOCK = 1024;
+
+static double dot_scalar(const float *a, const float *b, size_t n)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += DOT_BLOCK) {
+        size_t e = std::min(n, i + DOT_BLOCK);
+        float part = 0.0f;
+        for (size_t k = i; k < e; ++k)
+            part += a[k] * b[k];
+        total += part;
+    }
+    return total;
+}
+
+static double l2sq_scalar(const float *a, const float *b, size_t n, double bound)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += PROJ_LANES) {
+        float part = 0.0f;
+        for (size_t k = i; k < i + PROJ_LANES; ++k) {
+            float d = a[k] - b[k];
+            part += d * d;
+        }
+        total += part;
+        if (total >= bound)
+            break;
+    }
+    return total;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static inline float hsum_avx2(__m256 v)
+{
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2")))
+static double dot_avx2(const float *a, const float *b, size_t n)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += DOT_BLOCK) {
+        size_t e = std::min(n, i + DOT_BLOCK);
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        for (size_t k = i; k < e; k += 16) {
+            acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + k),
+                                                     _mm256_loadu_ps(b + k)));
+            acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + k + 8),
+                                                     _mm256_loadu_ps(b + k + 8)));
+        }
+        total += hsum_avx2(_mm256_add_ps(acc0, acc1));
+    }
+    return total;
+}
+
+__attribute__((target("avx2")))
+static double l2sq_avx2(const float *a, const float *b, size_t n, double bound)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += PROJ_LANES) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),     _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        total += hsum_avx2(_mm256_add_ps(_mm256_mul_ps(d0, d0), _mm256_mul_ps(d1, d1)));
+        if (total >= bound)
+            break;
+    }
+    return total;
+}
+#elif defined(__ARM_NEON)
+static double dot_neon(const float *a, const float *b, size_t n)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += DOT_BLOCK) {
+        size_t e = std::min(n, i + DOT_BLOCK);
+        float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+        for (size_t k = i; k < e; k += 8) {
+            acc0 = vmlaq_f32(acc0, vld1q_f32(a + k),     vld1q_f32(b + k));
+            acc1 = vmlaq_f32(acc1, vld1q_f32(a + k + 4), vld1q_f32(b + k + 4));
+        }
+        total += vaddvq_f32(vaddq_f32(acc0, acc1));
+    }
+    return total;
+}
+
+static double l2sq_neon(const float *a, const float *b, size_t n, double bound)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < n; i += PROJ_LANES) {
+        float32x4_t acc = vdupq_n_f32(0.0f);
+        for (size_t k = i; k < i + PROJ_LANES; k += 4) {
+            float32x4_t d = vsubq_f32(vld1q_f32(a + k), vld1q_f32(b + k));
+            acc = vmlaq_f32(acc, d, d);
+        }
+        total += vaddvq_f32(acc);
+        if (total >= bound)
+            break;
+    }
+    return total;
+}
+#endif
+
+struct SubspaceKernels
+{
+    double (*dot)(const float *, const float *, size_t);
+    double (*l2sq)(const float *, const float *, size_t, double);
+};
+
+static const SubspaceKernels &kernels()
+{
+    static const SubspaceKernels k = [] {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2"))
+            return SubspaceKernels{ dot_avx2, l2sq_avx2 };
+#elif defined(__ARM_NEON)
+        return SubspaceKernels{ dot_neon, l2sq_neon };
+#endif
+        return SubspaceKernels{ dot_scalar, l2sq_scalar };
+    }();
+    return k;
+}
+
+// ==========================================================
+// Writer
+// ==========================================================
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = static_cast<const char *>(buf);
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p   += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+bool fa_subspace_write(const std::string &path,
+                       size_t dim,
+                       size_t components,
+                       const float *mean,
+                       const float *basis,
+                       const float *proj,
+                       const int32_t *labels,
+                       size_t rows,
+                       double threshold,
+                       int64_t source_size,
+                       int64_t source_mtime_ns,
+                       std::string &log)
+{
+    ProjFileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, PROJ_MAGIC, sizeof(h.magic));
+    h.version         = PROJ_VERSION;
+    h.dim             = dim;
+    h.dim_stride      = align_up(dim, PROJ_LANES);
+    h.components      = components;
+    h.comp_stride     = align_up(components, PROJ_LANES);
+    h.rows            = rows;
+    h.source_size     = source_size;
+    h.source_mtime_ns = source_mtime_ns;
+    h.threshold       = threshold;
+    h.labels_offset   = sizeof(h);
+    h.mean_offset     = align_up(h.labels_offset + rows * sizeof(int32_t), PROJ_ALIGN);
+    h.basis_offset    = align_up(h.mean_offset + h.dim_stride * sizeof(float), PROJ_ALIGN);
+    h.proj_offset     = align_up(h.basis_offset + components * h.dim_stride * sizeof(float),
+                                 PROJ_ALIGN);
+
+    std::vector<char> out(h.proj_offset + rows * h.comp_stride * sizeof(float), 0);
+    std::memcpy(out.data(), &h, sizeof(h));
+    if (rows)
+        std::memcpy(out.data() + h.labels_offset, labels, rows * sizeof(int32_t));
+    std::memcpy(out.data() + h.mean_offset, mean, dim * sizeof(float));
+
+    // Transposed, so each output component is one contiguous dot product.
+    float *bt = reinterpret_cast<float *>(out.data() + h.basis_offset);
+    for (size_t i = 0; i < dim; ++i)
+        for (size_t j = 0; j < components; ++j)
+            bt[j * h.dim_stride + i] = basis[i * components + j];
+
+    float *pr = reinterpret_cast<float *>(out.data() + h.proj_offset);
+    for (size_t r = 0; r < rows; ++r)
+        std::memcpy(pr + r * h.comp_stride, proj + r * components, components * sizeof(float));
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log += "Cannot create " + path + ": " + std::strerror(errno) + "\n";
+        return false;
+    }
+    bool ok = write_all(fd, out.data(), out.size());
+    ok = (::close(fd) == 0) && ok;
+    if (!ok) {
+        log += "Cannot write " + path + "\n";
+        ::unlink(path.c_str());
+    }
+    return ok;
+}
+
+// ==========================================================
+// Reader
+// ==========================================================
+
+FaSubspaceModel::~FaSubspaceModel()
+{
+    if (map_)
+        ::munmap(map_, map_len_);
+}
+
+bool FaSubspaceModel::open(const std::string &path,
+                           int64_t source_size,
+                           int64_t source_mtime_ns,
+                           std::string &log)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ProjFileHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t len = (size_t)st.st_size;
+    void *m = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        log += "mmap(" + path + "): " + std::strerror(errno) + "\n";
+        return false;
+    }
+
+    ProjFileHeader h;
+    std::memcpy(&h, m, sizeof(h));
+
+    const uint64_t max_elems = len / sizeof(float);
+    bool valid =
+        std::memcmp(h.magic, PROJ_MAGIC, sizeof(h.magic)) == 0 &&
+        h.version == PROJ_VERSION &&
+        h.dim > 0 && h.components > 0 &&
+        h.dim_stride == align_up(h.dim, PROJ_LANES) &&
+        h.comp_stride == align_up(h.components, PROJ_LANES) &&
+        h.dim_stride <= max_elems && h.comp_stride <= max_elems &&
+        h.components <= max_elems / h.dim_stride &&
+        h.labels_offset >= sizeof(h) && h.labels_offset <= h.mean_offset &&
+        h.mean_offset % PROJ_ALIGN == 0 && h.basis_offset % PROJ_ALIGN == 0 &&
+        h.proj_offset % PROJ_ALIGN == 0 &&
+        h.rows <= (h.mean_offset - h.labels_offset) / sizeof(int32_t) &&
+        h.mean_offset + h.dim_stride * sizeof(float) <= h.basis_offset &&
+        h.basis_offset + h.components * h.dim_stride * sizeof(float) <= h.proj_offset &&
+        h.proj_offset <= len &&
+        h.rows <= (len - h.proj_offset) / (h.comp_stride * sizeof(float));
+
+    // The XML model changed since the store was written.
+    bool fresh = h.source_size == source_size && h.source_mtime_ns == source_mtime_ns;
+
+    if (!valid || !fresh) {
+        if (!valid)
+            log += "Ignoring corrupt projection store: " + path + "\n";
+        ::munmap(m, len);
+        return false;
+    }
+
+    const char *base = static_cast<const char *>(m);
+
+    if (map_)
+        ::munmap(map_, map_len_);
+    map_         = m;
+    map_len_     = len;
+    dim_         = (size_t)h.dim;
+    dim_stride_  = (size_t)h.dim_stride;
+    components_  = (size_t)h.components;
+    comp_stride_ = (size_t)h.comp_stride;
+    rows_        = (size_t)h.rows;
+    threshold_   = h.threshold;
+    labels_      = reinterpret_cast<const int32_t *>(base + h.labels_offset);
+    mean_        = reinterpret_cast<const float *>(base + h.mean_offset);
+    basis_       = reinterpret_cast<const float *>(base + h.basis_offset);
+    proj_        = reinterpret_cast<const float *>(base + h.proj_offset);
+    return true;
+}
+
+bool FaSubspaceModel::predict(const uint8_t *img, int width, int height, size_t stride,
+                              int &label, double &dist) const
+{
+    label = -1;
+    dist  = std::numeric_limits<double>::max();
+
+    if (width <= 0 || height <= 0 || (size_t)width * (size_t)height != dim_)
+        return false;
+
+    // Padding stays zero on both sides, so it adds nothing to the sums.
+    std::vector<float> x(dim_stride_, 0.0f);
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *row = img + (size_t)y * stride;
+        float *dst = &x[(size_t)y * width];
+        const float *mu = mean_ + (size_t)y * width;
+        for (int i = 0; i < width; ++i)
+            dst[i] = (float)row[i] - mu[i];
+    }
+
+    const SubspaceKernels &k = kernels();
+
+    std::vector<float> q(comp_stride_, 0.0f);
+    for (size_t j = 0; j < components_; ++j)
+        q[j] = (float)k.dot(basis_ + j * dim_stride_, x.data(), dim_stride_);
+
+    double best_sq = std::numeric_limits<double>::max();
+    size_t best = rows_;
+    for (size_t r = 0; r < rows_; ++r) {
+        double d = k.l2sq(q.data(), proj_ + r * comp_stride_, comp_stride_, best_sq);
+        if (d < best_sq) {
+            best_sq = d;
+            best = r;
+        }
+    }
+
+    if (best < rows_) {
+        dist = std::sqrt(best_sq);
+        if (dist < threshold_)
+            label = labels_[best];
+    }
+    return true;
+}
@@ -0,0 +1,182 @@
+#include "../include/facialauth_trace.h"
+
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+
+#include <fcntl.h>
+#include <syslog.h>
+#include <unistd.h>
+
+// ==========================================================
+// Recording
+// ==========================================================
+
+static int64_t since_us(const FaTrace &t, std::chrono::steady_clock::time_point p)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(p - t.t0).count();
+}
+
+static void trace_start(FaTrace &t, std::chrono::steady_clock::time_point now)
+{
+    if (t.t0 == std::chrono::steady_clock::time_point()) {
+        t.t0 = now;
+        t.events.reserve(32);
+    }
+}
+
+FaTraceSpan::FaTraceSpan(FaTrace *trace, const char *stage, int frame,
+                         FaMetricStage metric)
+    : trace_((trace && trace->enabled) ? trace : nullptr),
+      stage_(stage), frame_(frame), metric_(metric), score_(NAN)
+{
+    if (!trace_ && metric_ == FA_METRIC_NONE)
+        return;
+    start_ = std::chrono::steady_clock::now();
+    if (trace_)
+        trace_start(*trace_, start_);
+}
+
+FaTraceSpan::~FaTraceSpan()
+{
+    if (!trace_ && metric_ == FA_METRIC_NONE)
+        return;
+
+    auto end = std::chrono::steady_clock::now();
+    if (metric_ != FA_METRIC_NONE)
+        fa_metrics_observe(metric_, std::chrono::duration_cast<
+                           std::chrono::microseconds>(end - start_).count());
+    if (trace_)
+        fa_trace_add(trace_, stage_, frame_, start_, end, score_);
+}
+
+void fa_trace_add(
+    FaTrace *trace,
+    const char *stage,
+    int frame,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end,
+    double score
+)
+{
+    if (!trace || !trace->enabled)
+        return;
+
+    trace_start(*trace, start);
+
+    FaTraceEvent ev;
+    ev.stage    = stage;
+    ev.frame    = frame;
+    ev.start_us = since_us(*trace, start);
+    ev.dur_us   = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    ev.score    = score;
+    trace->events.push_back(ev);
+}
+
+void fa_trace_mark(FaTrace *trace, const char *stage, double score)
+{
+    auto now = std::chrono::steady_clock::now();
+    fa_trace_add(trace, stage, -1, now, now, score);
+}
+
+// ==========================================================
+// Output
+// ==========================================================
+
+static void json_string(std::string &out, const std::string &s)
+{
+    out += '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
+
+static void json_number(std::string &out, double v)
+{
+    if (std::isnan(v) || std::isinf(v)) {
+        out += "null";
+        return;
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6g", v);
+    out += buf;
+}
+
+std::string fa_trace_json(
+    const FaTrace &trace,
+    const std::string &user,
+    const char *method,
+    const char *status,
+    double score
+)
+{
+    int64_t total = 0;
+    for (const auto &e : trace.events)
+        if (e.start_us + e.dur_us > total)
+            total = e.start_us + e.dur_us;
+
+    std::string out;
+    out.reserve(128 + trace.events.size() * 80);
+
+    out += "{\"ts\":" + std::to_string((long long)::time(nullptr));
+    out += ",\"user\":";
+    json_string(out, user);
+    out += ",\"method\":";
+    json_string(out, method ? method : "");
+    out += ",\"status\":";
+    json_string(out, status ? status : "");
+    out += ",\"frames\":" + std::to_string(trace.frames);
+    out += ",\"score\":";
+    json_number(out, score);
+    out += ",\"total_us\":" + std::to_string((long long)total);
+    out += ",\"stages\":[";
+
+    for (size_t i = 0; i < trace.events.size(); ++i) {
+        const FaTraceEvent &e = trace.events[i];
+        if (i) out += ',';
+        out += "{\"stage\":";
+        json_string(out, e.stage);
+        if (e.frame >= 0)
+            out += ",\"frame\":" + std::to_string(e.frame);
+        out += ",\"start_us\":" + std::to_string((long long)e.start_us);
+        out += ",\"dur_us\":" + std::to_string((long long)e.dur_us);
+        if (!std::isnan(e.score)) {
+            out += ",\"score\":";
+            json_number(out, e.score);
+        }
+        out += '}';
+    }
+    out += "]}";
+    return out;
+}
+
+void fa_trace_emit(const std::string &json, const std::string &file)
+{
+    if (file.empty()) {
+        syslog(LOG_AUTHPRIV | LOG_INFO, "facial_auth trace: %s", json.c_str());
+        return;
+    }
+
+    int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        syslog(LOG_AUTHPRIV | LOG_WARNING, "facial_auth trace: cannot open %s",
+               file.c_str());
+        return;
+    }
+
+    // One write() per record keeps concurrent appenders from interleaving.
+    std::string line = json + "\n";
+    ssize_t r = ::write(fd, line.data(), line.size());
+    (void)r;
+    ::close(fd);
+}
@@ -1,4 +1,15 @@
 #include "../include/libfacialauth.h"
+#include "../include/facialauth_config.h"
+#include "../include/facialauth_ipc.h"
+#include "../include/facialauth_lbph.h"
+#include "../include/facialauth_log.h"
+#include "../include/facialauth_pool.h"
+#include "../include/facialauth_probe.h"
+#include "../include/facialauth_queue.h"
+#include "../include/facialauth_metrics.h"
+#include "../include/facialauth_subspace.h"
+#include "../include/facialauth_trace.h"
+#include "../include/facialauth_usdt.h"
 
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
@@ -10,6 +21,15 @@
 #include <opencv2/core/cuda.hpp>
 #endif
 
+// CAP_PROP_OPEN_TIMEOUT_MSEC / CAP_PROP_READ_TIMEOUT_MSEC appeared in 4.5.2.
+#if CV_VERSION_MAJOR > 4 || \
+    (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || \
+                               (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2)))
+#define FA_CAP_TIMEOUTS 1
+#else
+#define FA_CAP_TIMEOUTS 0
+#endif
+
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -21,6 +41,23 @@
 #include <cstdlib>
 #include <cerrno>
 #include <cstring>
+#include <stdexcept>
+#include <climits>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <limits>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <strings.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -31,7 +68,6 @@ namespace fs = std::filesystem;
 
 using std::string;
 using std::cerr;
-using std::cout;
 using std::endl;
 
 // ==========================================================
@@ -60,6 +96,27 @@ static void ensure_dirs(const string &path)
     }
 }
 
+// Temporary sibling of a model file, renamed over it once complete so
+// readers and the model cache never see a half-written file. The
+// extension is kept because cv::FileStorage picks the format from it.
+static std::string staging_path(const std::string &file)
+{
+    fs::path p(file);
+    fs::path tmp = p.parent_path() /
+        ("." + p.stem().string() + "." + std::to_string(::getpid()) +
+         p.extension().string());
+    return tmp.string();
+}
+
+static bool commit_staged(const std::string &tmp, const std::string &file)
+{
+    if (::rename(tmp.c_str(), file.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
 static void sleep_ms_int(int ms)
 {
     if (ms <= 0) return;
@@ -79,6 +136,16 @@ bool fa_check_root(const std::string &tool_name)
     return true;
 }
 
+// ==========================================================
+// fa_set_inference_threads (public API)
+// ==========================================================
+
+void fa_set_inference_threads(int threads)
+{
+    if (threads > 0)
+        cv::setNumThreads(threads);
+}
+
 // Optional: internal helper for const char*
 static bool fa_check_root_cstr(const char *tool_name)
 {
@@ -104,31 +171,325 @@ static inline bool starts_with(const string &s, const string &prefix)
     return std::equal(prefix.begin(), prefix.end(), s.begin());
 }
 
+static inline bool iequals(const string &s, const char *lit)
+{
+    return strcasecmp(s.c_str(), lit) == 0;
+}
+
+static inline bool icontains(const string &s, const char *lit)
+{
+    return strcasestr(s.c_str(), lit) != nullptr;
+}
+
 // ==========================================================
-// Config loader
+// DNN backend/target helpers
 // ==========================================================
 
-bool fa_load_config(
-    FacialAuthConfig &cfg,
-    std::string &logbuf,
-    const std::string &path
-)
+static int parse_dnn_backend(const std::string &b)
 {
-    cfg = FacialAuthConfig();
-    logbuf.clear();
+    if (iequals(b, "cpu"))        return cv::dnn::DNN_BACKEND_OPENCV;
+    if (iequals(b, "cuda"))       return cv::dnn::DNN_BACKEND_CUDA;
+    if (iequals(b, "cuda_fp16"))  return cv::dnn::DNN_BACKEND_CUDA;
+    if (iequals(b, "opencl"))     return cv::dnn::DNN_BACKEND_OPENCV;
+    return cv::dnn::DNN_BACKEND_DEFAULT;
+}
 
-    std::string cfg_path = path.empty() ? FACIALAUTH_DEFAULT_CONFIG : path;
+static int parse_dnn_target(const std::string &t)
+{
+    if (iequals(t, "cpu"))        return cv::dnn::DNN_TARGET_CPU;
+    if (iequals(t, "cuda"))       return cv::dnn::DNN_TARGET_CUDA;
+    if (iequals(t, "cuda_fp16"))  return cv::dnn::DNN_TARGET_CUDA_FP16;
+    if (iequals(t, "opencl"))     return cv::dnn::DNN_TARGET_OPENCL;
+    return cv::dnn::DNN_TARGET_CPU;
+}
 
-    std::ifstream f(cfg_path);
-    if (!f.is_open()) {
-        logbuf += "Cannot open config file: " + cfg_path + "\n";
+// ==========================================================
+// Config keys
+// ==========================================================
+
+typedef void (*ConfigSetter)(FacialAuthConfig &cfg, const std::string &val);
+
+struct ConfigKey
+{
+    const char  *name;
+    ConfigSetter set;
+};
+
+#define FA_CFG_STRING(k, f) { k, [](FacialAuthConfig &c, const std::string &v) { c.f = v; } }
+#define FA_CFG_BOOL(k, f)   { k, [](FacialAuthConfig &c, const std::string &v) { c.f = fa_parse_bool(v); } }
+#define FA_CFG_INT(k, f)    { k, [](FacialAuthConfig &c, const std::string &v) { c.f = std::stoi(v); } }
+#define FA_CFG_DOUBLE(k, f) { k, [](FacialAuthConfig &c, const std::string &v) { c.f = std::stod(v); } }
+
+static void set_detector_model(FacialAuthConfig &cfg, const std::string &subkey, const std::string &val)
+{
+    cfg.detector_models[subkey] = val;
+
+    if (subkey == "haar" || subkey == "haar_model") {
+        cfg.haar_cascade_path = val;
+        cfg.detector_models["haar"] = val;
+    } else if (subkey == "yunet_fp32" || subkey == "yunet_model_fp32") {
+        cfg.yunet_model = val;
+        cfg.detector_models["yunet_fp32"] = val;
+    } else if (subkey == "yunet_int8" || subkey == "yunet_model_int8") {
+        cfg.yunet_model_int8 = val;
+        cfg.detector_models["yunet_int8"] = val;
+    }
+}
+
+static void set_recognizer_model(FacialAuthConfig &cfg, const std::string &subkey, const std::string &val)
+{
+    cfg.recognizer_models[subkey] = val;
+
+    if (subkey == "sface_fp32" || subkey == "sface_model_fp32") {
+        cfg.sface_model = val;
+        cfg.recognizer_models["sface_fp32"] = val;
+    } else if (subkey == "sface_int8" || subkey == "sface_model_int8") {
+        cfg.sface_model_int8 = val;
+        cfg.recognizer_models["sface_int8"] = val;
+    }
+}
+
+static const ConfigKey CONFIG_KEYS[] = {
+    FA_CFG_STRING("basedir",            basedir),
+    FA_CFG_STRING("device",             device),
+    FA_CFG_BOOL  ("fallback_device",    fallback_device),
+    FA_CFG_INT   ("width",              width),
+    FA_CFG_INT   ("height",             height),
+    FA_CFG_INT   ("frames",             frames),
+    FA_CFG_INT   ("sleep_ms",           sleep_ms),
+    FA_CFG_INT   ("verify_frames",      verify_frames),
+    FA_CFG_INT   ("pipeline_depth",     pipeline_depth),
+    FA_CFG_INT   ("sface_batch_max",    sface_batch_max),
+    FA_CFG_INT   ("sface_batch_window_ms", sface_batch_window_ms),
+    FA_CFG_BOOL  ("debug",              debug),
+    FA_CFG_BOOL  ("verbose",            verbose),
+    FA_CFG_BOOL  ("nogui",              nogui),
+    FA_CFG_STRING("training_method",    training_method),
+    FA_CFG_BOOL  ("force_overwrite",    force_overwrite),
+    FA_CFG_BOOL  ("ignore_failure",     ignore_failure),
+    FA_CFG_BOOL  ("save_failed_images", save_failed_images),
+    FA_CFG_BOOL  ("keep_camera",        keep_camera),
+    FA_CFG_INT   ("model_cache_size",   model_cache_size),
+    FA_CFG_INT   ("auth_timeout_ms",    auth_timeout_ms),
+    FA_CFG_BOOL  ("trace",              trace),
+    FA_CFG_BOOL  ("metrics",            metrics),
+    FA_CFG_INT   ("train_threads",      train_threads),
+    FA_CFG_INT   ("inference_threads",  inference_threads),
+    FA_CFG_STRING("cpu_set",            cpu_set),
+    FA_CFG_INT   ("nice",               nice),
+    FA_CFG_BOOL  ("embedding_cache",    embedding_cache),
+    FA_CFG_BOOL  ("capture_embed",      capture_embed),
+    FA_CFG_STRING("capture_save",       capture_save),
+    FA_CFG_INT   ("capture_max_width",  capture_max_width),
+    FA_CFG_DOUBLE("dedup_similarity",   dedup_similarity),
+    FA_CFG_INT   ("dedup_hash_distance", dedup_hash_distance),
+    FA_CFG_STRING("lbph_store",         lbph_store),
+    FA_CFG_BOOL  ("subspace_store",     subspace_store),
+    FA_CFG_STRING("trace_file",         trace_file),
+    FA_CFG_STRING("image_format",       image_format),
+
+    FA_CFG_STRING("detector_profile",   detector_profile),
+    FA_CFG_STRING("recognizer_profile", recognizer_profile),
+
+    FA_CFG_DOUBLE("lbph_threshold",     lbph_threshold),
+    FA_CFG_DOUBLE("eigen_threshold",    eigen_threshold),
+    FA_CFG_DOUBLE("fisher_threshold",   fisher_threshold),
+    FA_CFG_INT   ("eigen_components",   eigen_components),
+    FA_CFG_INT   ("fisher_components",  fisher_components),
+    FA_CFG_STRING("eigen_solver",       eigen_solver),
+
+    { "sface_threshold", [](FacialAuthConfig &c, const std::string &v) {
+        c.sface_threshold      = std::stod(v);
+        c.sface_fp32_threshold = c.sface_threshold;
+        c.sface_int8_threshold = c.sface_threshold;
+    } },
+    FA_CFG_DOUBLE("sface_fp32_threshold", sface_fp32_threshold),
+    FA_CFG_DOUBLE("sface_int8_threshold", sface_int8_threshold),
+
+    FA_CFG_STRING("dnn_backend",        dnn_backend),
+    FA_CFG_STRING("dnn_target",         dnn_target),
+
+    FA_CFG_STRING("model_path",         model_path),
+    FA_CFG_STRING("haar_cascade_path",  haar_cascade_path),
+
+    { "yunet_model",      [](FacialAuthConfig &c, const std::string &v) { set_detector_model(c, "yunet_fp32", v); } },
+    { "yunet_model_int8", [](FacialAuthConfig &c, const std::string &v) { set_detector_model(c, "yunet_int8", v); } },
+    { "haar_model",       [](FacialAuthConfig &c, const std::string &v) { set_detector_model(c, "haar", v); } },
+    { "sface_model",      [](FacialAuthConfig &c, const std::string &v) { set_recognizer_model(c, "sface_fp32", v); } },
+    { "sface_model_int8", [](FacialAuthConfig &c, const std::string &v) { set_recognizer_model(c, "sface_int8", v); } },
+};
+
+#undef FA_CFG_STRING
+#undef FA_CFG_BOOL
+#undef FA_CFG_INT
+#undef FA_CFG_DOUBLE
+
+static const uint16_t NUM_CONFIG_KEYS    = sizeof(CONFIG_KEYS) / sizeof(CONFIG_KEYS[0]);
+static const uint16_t CFG_KEY_DETECT     = 0xfff0;   // detect_<subkey>
+static const uint16_t CFG_KEY_RECOGNIZE  = 0xfff1;   // recognize_<subkey>
+
+static int find_config_key(const std::string &key)
+{
+    static const std::unordered_map<std::string, int> index = [] {
+        std::unordered_map<std::string, int> m;
+        for (int i = 0; i < NUM_CONFIG_KEYS; ++i)
+            m.emplace(CONFIG_KEYS[i].name, i);
+        return m;
+    }();
+
+    auto it = index.find(key);
+    return it == index.end() ? -1 : it->second;
+}
+
+// Cached entries store table indices: tie them to the table layout.
+static uint64_t config_schema_hash()
+{
+    static const uint64_t h = [] {
+        uint64_t x = fa_fnv1a64(nullptr, 0);
+        for (int i = 0; i < NUM_CONFIG_KEYS; ++i)
+            x = fa_fnv1a64(CONFIG_KEYS[i].name, std::strlen(CONFIG_KEYS[i].name) + 1, x);
+        return x;
+    }();
+    return h;
+}
+
+static bool apply_config_entry(FacialAuthConfig &cfg, const FaConfigEntry &e)
+{
+    if (e.id == CFG_KEY_DETECT)
+        set_detector_model(cfg, e.subkey, e.value);
+    else if (e.id == CFG_KEY_RECOGNIZE)
+        set_recognizer_model(cfg, e.subkey, e.value);
+    else if (e.id < NUM_CONFIG_KEYS)
+        CONFIG_KEYS[e.id].set(cfg, e.value);
+    else
         return false;
+    return true;
+}
+
+// ==========================================================
+// Config snapshot resolution
+// ==========================================================
+
+const char *fa_method_name(FaTrainingMethod m)
+{
+    switch (m) {
+    case FA_METHOD_LBPH:   return "lbph";
+    case FA_METHOD_EIGEN:  return "eigen";
+    case FA_METHOD_FISHER: return "fisher";
+    case FA_METHOD_SFACE:  return "sface";
+    default:               return "invalid";
+    }
+}
+
+static void check_model_file(const std::string &path, std::string &log)
+{
+    if (!path.empty() && !file_exists(path))
+        log += "Model file not found: " + path + "\n";
+}
+
+bool fa_resolve_config(FacialAuthConfig &cfg, std::string &log)
+{
+    bool ok = true;
+
+    // Training method ("auto" follows the recognizer profile)
+    const std::string &m = cfg.training_method;
+    if (iequals(m, "auto"))
+        cfg.method = (strncasecmp(cfg.recognizer_profile.c_str(), "sface", 5) == 0)
+                     ? FA_METHOD_SFACE : FA_METHOD_LBPH;
+    else if (iequals(m, "lbph"))
+        cfg.method = FA_METHOD_LBPH;
+    else if (iequals(m, "eigen") || iequals(m, "eigenfaces"))
+        cfg.method = FA_METHOD_EIGEN;
+    else if (iequals(m, "fisher") || iequals(m, "fisherfaces"))
+        cfg.method = FA_METHOD_FISHER;
+    else if (iequals(m, "sface"))
+        cfg.method = FA_METHOD_SFACE;
+    else {
+        cfg.method = FA_METHOD_INVALID;
+        log += "Unsupported training method: " + m + "\n";
+        ok = false;
+    }
+
+    // Recognizer (SFace precision, model, threshold)
+    bool int8 = icontains(cfg.recognizer_profile, "int8");
+    cfg.recognizer = int8 ? FA_REC_SFACE_INT8 : FA_REC_SFACE_FP32;
+
+    auto rit = cfg.recognizer_models.find(int8 ? "sface_int8" : "sface_fp32");
+    if (rit != cfg.recognizer_models.end())
+        cfg.sface_path = rit->second;
+    else
+        cfg.sface_path = int8 ? cfg.sface_model_int8 : cfg.sface_model;
+
+    cfg.sface_active_threshold = int8 ? cfg.sface_int8_threshold
+                                      : cfg.sface_fp32_threshold;
+
+    // DNN backend / target
+    cfg.dnn_backend_id = parse_dnn_backend(cfg.dnn_backend);
+    cfg.dnn_target_id  = parse_dnn_target(cfg.dnn_target);
+
+    // CPU budget (a bad cpu_set is reported and ignored)
+    fa_parse_cpu_set(cfg.cpu_set, cfg.cpu_policy.cpus, log);
+    cfg.cpu_policy.nice = std::max(0, std::min(cfg.nice, 19));
+
+    // Every configured model must exist on disk
+    check_model_file(cfg.haar_cascade_path, log);
+    check_model_file(cfg.yunet_model,       log);
+    check_model_file(cfg.yunet_model_int8,  log);
+    check_model_file(cfg.sface_model,       log);
+    check_model_file(cfg.sface_model_int8,  log);
+
+    // Detector
+    const std::string &dp = cfg.detector_profile;
+    cfg.detector = FA_DET_NONE;
+    cfg.detector_path.clear();
+
+    if (dp.empty() || iequals(dp, "auto")) {
+        // Prefer YuNet FP32, then YuNet INT8, then Haar.
+        if (!cfg.yunet_model.empty() && file_exists(cfg.yunet_model)) {
+            cfg.detector = FA_DET_YUNET_FP32;
+            cfg.detector_path = cfg.yunet_model;
+        } else if (!cfg.yunet_model_int8.empty() && file_exists(cfg.yunet_model_int8)) {
+            cfg.detector = FA_DET_YUNET_INT8;
+            cfg.detector_path = cfg.yunet_model_int8;
+        } else if (!cfg.haar_cascade_path.empty() && file_exists(cfg.haar_cascade_path)) {
+            cfg.detector = FA_DET_HAAR;
+            cfg.detector_path = cfg.haar_cascade_path;
+        } else {
+            log += "No suitable detector found in auto mode.\n";
+        }
+    } else if (iequals(dp, "haar")) {
+        cfg.detector = FA_DET_HAAR;
+        cfg.detector_path = cfg.haar_cascade_path;
+    } else if (iequals(dp, "yunet") || iequals(dp, "yunet_fp32")) {
+        cfg.detector = FA_DET_YUNET_FP32;
+        cfg.detector_path = cfg.yunet_model;
+    } else if (iequals(dp, "yunet_int8")) {
+        cfg.detector = FA_DET_YUNET_INT8;
+        cfg.detector_path = cfg.yunet_model_int8;
+    } else {
+        log += "Unknown detector_profile: " + dp + "\n";
     }
 
+    if (cfg.basedir.empty())
+        cfg.basedir = "/var/lib/pam_facial_auth";
+
+    return ok;
+}
+
+// ==========================================================
+// Config loader
+// ==========================================================
+
+static bool compile_config(
+    std::istream &in,
+    std::vector<FaConfigEntry> &entries,
+    std::string &logbuf
+)
+{
     std::string line;
     int lineno = 0;
 
-    while (std::getline(f, line)) {
+    while (std::getline(in, line)) {
         ++lineno;
         std::string s = trim(line);
 
@@ -141,147 +502,172 @@ bool fa_load_config(
             continue;
         }
 
-        std::string key = trim(s.substr(0, pos));
-        std::string val = trim(s.substr(pos + 1));
+        FaConfigEntry e;
+        e.key   = trim(s.substr(0, pos));
+        e.value = trim(s.substr(pos + 1));
+        const std::string &key = e.key;
 
         if (key.empty()) {
             logbuf += "Ignoring empty key at line " + std::to_string(lineno) + "\n";
             continue;
         }
 
-        auto to_bool = [&](const std::string &v, bool &dest) {
-            std::string low = v;
-            std::transform(low.begin(), low.end(), low.begin(),
-                           [](unsigned char c){ return std::tolower(c); });
-            dest = (low == "yes" || low == "true" || low == "1");
-        };
+        int idx = find_config_key(key);
+        if (idx >= 0) {
+            e.id = (uint16_t)idx;
+        } else if (starts_with(key, "detect_")) {
+            e.id = CFG_KEY_DETECT;
+            e.subkey = key.substr(7);
+        } else if (starts_with(key, "recognize_")) {
+            e.id = CFG_KEY_RECOGNIZE;
+            e.subkey = key.substr(10);
+        } else {
+            logbuf += "Unknown key at line " + std::to_string(lineno) +
+            ": '" + key + "'\n";
+            continue;
+        }
 
+        // Validate numeric values now so the compiled form never throws.
         try {
-            if (key == "basedir") {
-                cfg.basedir = val;
-            } else if (key == "device") {
-                cfg.device = val;
-            } else if (key == "fallback_device") {
-                to_bool(val, cfg.fallback_device);
-            } else if (key == "width") {
-                cfg.width = std::stoi(val);
-            } else if (key == "height") {
-                cfg.height = std::stoi(val);
-            } else if (key == "frames") {
-                cfg.frames = std::stoi(val);
-            } else if (key == "sleep_ms") {
-                cfg.sleep_ms = std::stoi(val);
-            } else if (key == "debug") {
-                to_bool(val, cfg.debug);
-            } else if (key == "verbose") {
-                to_bool(val, cfg.verbose);
-            } else if (key == "nogui") {
-                to_bool(val, cfg.nogui);
-            } else if (key == "training_method") {
-                cfg.training_method = val;
-            } else if (key == "force_overwrite") {
-                to_bool(val, cfg.force_overwrite);
-            } else if (key == "ignore_failure") {
-                to_bool(val, cfg.ignore_failure);
-            } else if (key == "save_failed_images") {
-                to_bool(val, cfg.save_failed_images);
-            } else if (key == "image_format") {
-                cfg.image_format = val;
-
-            } else if (key == "detector_profile") {
-                cfg.detector_profile = val;
-            } else if (key == "recognizer_profile") {
-                cfg.recognizer_profile = val;
-
-            } else if (key == "lbph_threshold") {
-                cfg.lbph_threshold = std::stod(val);
-            } else if (key == "eigen_threshold") {
-                cfg.eigen_threshold = std::stod(val);
-            } else if (key == "fisher_threshold") {
-                cfg.fisher_threshold = std::stod(val);
-
-            } else if (key == "eigen_components") {
-                cfg.eigen_components = std::stoi(val);
-            } else if (key == "fisher_components") {
-                cfg.fisher_components = std::stoi(val);
-
-            } else if (key == "sface_threshold") {
-                cfg.sface_threshold      = std::stod(val);
-                cfg.sface_fp32_threshold = cfg.sface_threshold;
-                cfg.sface_int8_threshold = cfg.sface_threshold;
-            } else if (key == "sface_fp32_threshold") {
-                cfg.sface_fp32_threshold = std::stod(val);
-            } else if (key == "sface_int8_threshold") {
-                cfg.sface_int8_threshold = std::stod(val);
-
-            } else if (key == "dnn_backend") {
-                cfg.dnn_backend = val;
-            } else if (key == "dnn_target") {
-                cfg.dnn_target = val;
-
-            } else if (key == "model_path") {
-                cfg.model_path = val;
-            } else if (key == "haar_cascade_path") {
-                cfg.haar_cascade_path = val;
-
-            } else if (starts_with(key, "detect_")) {
-                std::string subkey = key.substr(7);
-                cfg.detector_models[subkey] = val;
-
-                if (subkey == "haar" || subkey == "haar_model") {
-                    cfg.haar_cascade_path = val;
-                    cfg.detector_models["haar"] = val;
-                } else if (subkey == "yunet_fp32" || subkey == "yunet_model_fp32") {
-                    cfg.yunet_model = val;
-                    cfg.detector_models["yunet_fp32"] = val;
-                } else if (subkey == "yunet_int8" || subkey == "yunet_model_int8") {
-                    cfg.yunet_model_int8 = val;
-                    cfg.detector_models["yunet_int8"] = val;
-                }
+            FacialAuthConfig probe;
+            apply_config_entry(probe, e);
+        }
+        catch (const std::exception &ex) {
+            logbuf += "Error parsing line " + std::to_string(lineno) +
+            " ('" + key + "'): " + ex.what() + "\n";
+            continue;
+        }
+
+        entries.push_back(std::move(e));
+    }
 
-            } else if (starts_with(key, "recognize_")) {
-                std::string subkey = key.substr(10);
-                cfg.recognizer_models[subkey] = val;
+    return true;
+}
 
-                if (subkey == "sface_fp32" || subkey == "sface_model_fp32") {
-                    cfg.sface_model = val;
-                    cfg.recognizer_models["sface_fp32"] = val;
-                } else if (subkey == "sface_int8" || subkey == "sface_model_int8") {
-                    cfg.sface_model_int8 = val;
-                    cfg.recognizer_models["sface_int8"] = val;
-                }
+// ----------------------------------------------------------
+// Binary cache of compiled entries (see facialauth_config.h)
+// ----------------------------------------------------------
 
-            } else if (key == "yunet_model") {
-                cfg.yunet_model = val;
-                cfg.detector_models["yunet_fp32"] = val;
-            } else if (key == "yunet_model_int8") {
-                cfg.yunet_model_int8 = val;
-                cfg.detector_models["yunet_int8"] = val;
-            } else if (key == "haar_model") {
-                cfg.haar_cascade_path = val;
-                cfg.detector_models["haar"] = val;
-            } else if (key == "sface_model") {
-                cfg.sface_model = val;
-                cfg.recognizer_models["sface_fp32"] = val;
-            } else if (key == "sface_model_int8") {
-                cfg.sface_model_int8 = val;
-                cfg.recognizer_models["sface_int8"] = val;
-            } else {
-                logbuf += "Unknown key at line " + std::to_string(lineno) +
-                ": '" + key + "'\n";
-            }
+static void write_config_cache(
+    const std::string &cfg_path,
+    const FaConfigStamp &stamp,
+    const std::vector<FaConfigEntry> &entries,
+    const std::string &logbuf
+)
+{
+    fa_write_config_cache(cfg_path, stamp, config_schema_hash(), entries, logbuf);
+}
+
+// Entries hold key table indices: only a cache of this table is usable.
+static bool read_config_cache(
+    const std::string &cfg_path,
+    const FaConfigStamp &stamp,
+    std::vector<FaConfigEntry> &entries,
+    std::string &logbuf
+)
+{
+    uint64_t schema = 0;
+    std::vector<FaConfigEntry> cached;
+    std::string log;
+    if (!fa_read_config_cache(cfg_path, stamp, schema, cached, log) ||
+        schema != config_schema_hash())
+        return false;
+
+    entries.swap(cached);
+    logbuf = log;
+    return true;
+}
+
+// ----------------------------------------------------------
+// In-process snapshot, reused while the file and its models are unchanged
+// ----------------------------------------------------------
+
+struct ConfigSnapshot
+{
+    std::string              path;
+    FaConfigStamp              stamp;
+    std::vector<FaConfigStamp> models;    // see model_stamps()
+    FacialAuthConfig         cfg;
+    std::string              log;
+};
+
+static std::mutex     g_cfg_mutex;
+static ConfigSnapshot g_cfg_snapshot;
+
+// fa_resolve_config() looks at these files (auto detector, "Model file
+// not found"), so its result is only reused while they are unchanged.
+// A missing file has an all-zero stamp.
+static std::vector<FaConfigStamp> model_stamps(const FacialAuthConfig &cfg)
+{
+    std::vector<FaConfigStamp> out;
+    for (const std::string *p : { &cfg.haar_cascade_path, &cfg.yunet_model,
+                                  &cfg.yunet_model_int8, &cfg.sface_model,
+                                  &cfg.sface_model_int8 }) {
+        FaConfigStamp st;
+        if (p->empty() || !fa_config_stamp(*p, st))
+            st = FaConfigStamp();
+        out.push_back(st);
+    }
+    return out;
+}
+
+bool fa_load_config(
+    FacialAuthConfig &cfg,
+    std::string &logbuf,
+    const std::string &path
+)
+{
+    cfg = FacialAuthConfig();
+    logbuf.clear();
+
+    std::string cfg_path = path.empty() ? FACIALAUTH_DEFAULT_CONFIG : path;
+
+    FaConfigStamp stamp;
+    if (!fa_config_stamp(cfg_path, stamp)) {
+        logbuf += "Cannot open config file: " + cfg_path + "\n";
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(g_cfg_mutex);
+        if (g_cfg_snapshot.path == cfg_path && g_cfg_snapshot.stamp == stamp &&
+            model_stamps(g_cfg_snapshot.cfg) == g_cfg_snapshot.models) {
+            cfg    = g_cfg_snapshot.cfg;
+            logbuf = g_cfg_snapshot.log;
+            return true;
         }
-        catch (const std::exception &e) {
-            logbuf += "Error parsing line " + std::to_string(lineno) +
-            " ('" + key + "'): " + e.what() + "\n";
+    }
+
+    std::vector<FaConfigEntry> entries;
+    if (!read_config_cache(cfg_path, stamp, entries, logbuf)) {
+        std::ifstream f(cfg_path);
+        if (!f.is_open()) {
+            logbuf += "Cannot open config file: " + cfg_path + "\n";
+            return false;
         }
+
+        entries.clear();
+        logbuf.clear();
+        compile_config(f, entries, logbuf);
+        write_config_cache(cfg_path, stamp, entries, logbuf);
     }
 
-    f.close();
+    for (const auto &e : entries)
+        apply_config_entry(cfg, e);
 
-    if (cfg.basedir.empty())
-        cfg.basedir = "/var/lib/pam_facial_auth";
+    // Stamped before resolving: a model appearing meanwhile is seen next time.
+    std::vector<FaConfigStamp> models = model_stamps(cfg);
+
+    // Resolution problems (missing models, bad method) are reported in the
+    // log and by the stage that needs them; the file itself loaded fine.
+    fa_resolve_config(cfg, logbuf);
 
+    std::lock_guard<std::mutex> lk(g_cfg_mutex);
+    g_cfg_snapshot.path   = cfg_path;
+    g_cfg_snapshot.stamp  = stamp;
+    g_cfg_snapshot.models = models;
+    g_cfg_snapshot.cfg    = cfg;
+    g_cfg_snapshot.log    = logbuf;
     return true;
 }
 
@@ -304,26 +690,104 @@ std::string fa_user_model_path(
     const std::string &user
 )
 {
-    fs::path base(cfg.basedir.empty() ? "/var/lib/pam_facial_auth" : cfg.basedir);
-    fs::path p = base / "models" / (user + ".xml");
-    return p.string();
+    return fa_model_path(cfg.basedir, user);
+}
+
+// ==========================================================
+// Attempt budget / cancellation
+// ==========================================================
+
+// Below this much budget, optional work (stale-frame flush, fallback
+// cameras) is skipped.
+static const long LOW_BUDGET_MS = 250;
+
+const char *fa_attempt_status_name(FaAttemptStatus s)
+{
+    switch (s) {
+    case FA_ATTEMPT_NONE:         return "none";
+    case FA_ATTEMPT_ACCEPT:       return "accept";
+    case FA_ATTEMPT_REJECT:       return "reject";
+    case FA_ATTEMPT_NO_FACE:      return "no_face";
+    case FA_ATTEMPT_TIMEOUT:      return "timeout";
+    case FA_ATTEMPT_CAMERA_ERROR: return "camera_error";
+    case FA_ATTEMPT_ERROR:        return "error";
+    case FA_ATTEMPT_CANCELLED:    return "cancelled";
+    }
+    return "unknown";
+}
+
+static void attempt_start(FacialAuthAttempt &a, const FacialAuthConfig &cfg)
+{
+    a.trace.enabled = cfg.trace;
+
+    if (a.started == std::chrono::steady_clock::time_point())
+        a.started = std::chrono::steady_clock::now();
+
+    if (a.deadline == std::chrono::steady_clock::time_point() &&
+        cfg.auth_timeout_ms > 0)
+        a.deadline = std::chrono::steady_clock::now() +
+                     std::chrono::milliseconds(cfg.auth_timeout_ms);
+}
+
+// Milliseconds left, LONG_MAX without a deadline.
+static long attempt_remaining_ms(const FacialAuthAttempt *a)
+{
+    if (!a || a->deadline == std::chrono::steady_clock::time_point())
+        return LONG_MAX;
+    long ms = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        a->deadline - std::chrono::steady_clock::now()).count();
+    return ms > 0 ? ms : 0;
+}
+
+// True (with status set) when the attempt must not go past this stage.
+static bool attempt_stop(
+    FacialAuthAttempt *a,
+    std::string &log,
+    const char *stage
+)
+{
+    if (!a)
+        return false;
+
+    if (a->cancel.load(std::memory_order_relaxed)) {
+        a->status = FA_ATTEMPT_CANCELLED;
+        log += std::string("fa_test_user: cancelled ") + stage + ".\n";
+        return true;
+    }
+    if (attempt_remaining_ms(a) == 0) {
+        a->status = FA_ATTEMPT_TIMEOUT;
+        log += std::string("fa_test_user: time budget exhausted ") + stage + ".\n";
+        return true;
+    }
+    return false;
 }
 
 // ==========================================================
 // Camera helpers
 // ==========================================================
 
+// What a single open/read may block for: the rest of the attempt, clamped
+// for the int-typed capture properties. 0 means no deadline.
+static int camera_timeout_ms(const FacialAuthAttempt *attempt)
+{
+    long left = attempt_remaining_ms(attempt);
+    if (left == LONG_MAX)
+        return 0;
+    return (int)std::max(1L, std::min(left, (long)INT_MAX));
+}
+
 static bool open_camera(
     cv::VideoCapture &cap,
     const FacialAuthConfig &cfg,
-    std::string &log
+    std::string &log,
+    FacialAuthAttempt *attempt = nullptr
 )
 {
     std::vector<std::string> devs;
     if (!cfg.device.empty())
         devs.push_back(cfg.device);
 
-    if (cfg.fallback_device) {
+    if (cfg.fallback_device && attempt_remaining_ms(attempt) >= LOW_BUDGET_MS) {
         for (int i = 0; i < 3; ++i) {
             std::string d = "/dev/video" + std::to_string(i);
             if (std::find(devs.begin(), devs.end(), d) == devs.end())
@@ -332,17 +796,24 @@ static bool open_camera(
     }
 
     for (const auto &d : devs) {
+        if (attempt_stop(attempt, log, "while opening camera"))
+            return false;
+#if FA_CAP_TIMEOUTS
+        // A wedged V4L2 device otherwise blocks open() and the first read
+        // past auth_timeout_ms; backends without support ignore these.
+        std::vector<int> params;
+        if (int ms = camera_timeout_ms(attempt))
+            params = { cv::CAP_PROP_OPEN_TIMEOUT_MSEC, ms,
+                       cv::CAP_PROP_READ_TIMEOUT_MSEC, ms };
+        cap.open(d, cv::CAP_ANY, params);
+#else
         cap.open(d);
+#endif
         if (cap.isOpened()) {
-            if (cfg.debug) {
-                log += "Opened camera: " + d + "\n";
-            }
+            FA_DBG("Opened camera: %s", d.c_str());
             return true;
-        } else {
-            if (cfg.debug) {
-                log += "Failed to open camera: " + d + "\n";
-            }
         }
+        FA_DBG("Failed to open camera: %s", d.c_str());
     }
     return false;
 }
@@ -351,16 +822,98 @@ static bool capture_frame(
     cv::VideoCapture &cap,
     cv::Mat &frame,
     const FacialAuthConfig &cfg,
-    std::string &log
+    std::string &log,
+    FacialAuthAttempt *attempt = nullptr
 )
 {
     cap.set(cv::CAP_PROP_FRAME_WIDTH,  cfg.width);
     cap.set(cv::CAP_PROP_FRAME_HEIGHT, cfg.height);
+#if FA_CAP_TIMEOUTS
+    if (int ms = camera_timeout_ms(attempt))
+        cap.set(cv::CAP_PROP_READ_TIMEOUT_MSEC, ms);
+#endif
 
+    int64_t t0 = fa_usdt_now_us();
+    (void)t0;
     if (!cap.read(frame) || frame.empty()) {
         log += "Failed to read frame from camera\n";
         return false;
     }
+    FA_PROBE3(frame_arrival, frame.cols, frame.rows, fa_usdt_now_us() - t0);
+    return true;
+}
+
+// ==========================================================
+// SFace enrollment manifest
+// ==========================================================
+
+//
+// One processed enrollment image, stored alongside the gallery so a
+// later training run only embeds what changed. row indexes the gallery,
+// or is -1 when the image gave no face (so it is not retried each run).
+//
+struct FaManifestEntry
+{
+    std::string file;     // name inside the image directory
+    std::string stamp;    // "<size>:<mtime sec>.<nsec>"
+    std::string hash;     // FNV-1a of the content, hex
+    int         row = -1;
+};
+
+static bool file_stamp(const std::string &path, std::string &stamp)
+{
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+        return false;
+    stamp = std::to_string((long long)st.st_size) + ":" +
+            std::to_string((long long)st.st_mtim.tv_sec) + "." +
+            std::to_string((long long)st.st_mtim.tv_nsec);
+    return true;
+}
+
+static bool file_content_hash(const std::string &path, std::string &hash)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    uint64_t h = fa_fnv1a64(nullptr, 0);
+    char buf[65536];
+    while (in.read(buf, sizeof(buf)) || in.gcount() > 0)
+        h = fa_fnv1a64(buf, (size_t)in.gcount(), h);
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+    hash = hex;
+    return true;
+}
+
+static void write_manifest(cv::FileStorage &fs,
+                           const std::vector<FaManifestEntry> &manifest)
+{
+    fs << "manifest" << "[";
+    for (const auto &m : manifest) {
+        fs << "{" << "file" << m.file << "stamp" << m.stamp
+           << "hash" << m.hash << "row" << m.row << "}";
+    }
+    fs << "]";
+}
+
+static bool read_manifest(const cv::FileNode &mn,
+                          std::vector<FaManifestEntry> &manifest)
+{
+    manifest.clear();
+    if (mn.empty() || mn.type() != cv::FileNode::SEQ)
+        return false;
+
+    for (auto it = mn.begin(); it != mn.end(); ++it) {
+        FaManifestEntry m;
+        (*it)["file"]  >> m.file;
+        (*it)["stamp"] >> m.stamp;
+        (*it)["hash"]  >> m.hash;
+        (*it)["row"]   >> m.row;
+        manifest.push_back(m);
+    }
     return true;
 }
 
@@ -372,16 +925,18 @@ static bool fa_save_sface_model(
     const FacialAuthConfig &cfg,
     const std::string &profile,
     const std::string &file,
-    const std::vector<cv::Mat> &embeds
+    const std::vector<cv::Mat> &embeds,
+    const std::vector<FaManifestEntry> *manifest = nullptr
 )
 {
+    std::string tmp = staging_path(file);
     try {
         ensure_dirs(fs::path(file).parent_path().string());
-        cv::FileStorage fs(file, cv::FileStorage::WRITE);
+        cv::FileStorage fs(tmp, cv::FileStorage::WRITE);
         if (!fs.isOpened()) return false;
 
         fs << "type" << "sface";
-        fs << "version" << 1;
+        fs << "version" << (manifest ? 2 : 1);
 
         fs << "recognizer_profile" << profile;
         fs << "detector_profile"   << cfg.detector_profile;
@@ -397,9 +952,13 @@ static bool fa_save_sface_model(
         for (const auto &e : embeds)
             fs << e;
         fs << "]";
+
+        if (manifest)
+            write_manifest(fs, *manifest);
         fs.release();
-        return true;
+        return commit_staged(tmp, file);
     } catch (...) {
+        ::unlink(tmp.c_str());
         return false;
     }
 }
@@ -439,34 +998,76 @@ static bool fa_load_sface_model(
     }
 }
 
-// ==========================================================
-// DNN backend/target helpers
-// ==========================================================
-
-static int parse_dnn_backend(const std::string &b)
+// Manifest of a version 2 gallery, plus the profiles it was built with.
+static bool fa_load_sface_manifest(
+    const std::string &file,
+    std::string &recognizer_profile,
+    std::string &detector_profile,
+    std::vector<FaManifestEntry> &manifest
+)
 {
-    std::string low = b;
-    std::transform(low.begin(), low.end(), low.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
+    try {
+        cv::FileStorage fs(file, cv::FileStorage::READ);
+        if (!fs.isOpened()) return false;
 
-    if (low == "cpu")        return cv::dnn::DNN_BACKEND_OPENCV;
-    if (low == "cuda")       return cv::dnn::DNN_BACKEND_CUDA;
-    if (low == "cuda_fp16")  return cv::dnn::DNN_BACKEND_CUDA;
-    if (low == "opencl")     return cv::dnn::DNN_BACKEND_OPENCV;
-    return cv::dnn::DNN_BACKEND_DEFAULT;
-}
+        std::string type;
+        fs["type"] >> type;
+        if (type != "sface" || !read_manifest(fs["manifest"], manifest))
+            return false;
 
-static int parse_dnn_target(const std::string &t)
-{
-    std::string low = t;
-    std::transform(low.begin(), low.end(), low.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
+        fs["recognizer_profile"] >> recognizer_profile;
+        fs["detector_profile"]   >> detector_profile;
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
 
-    if (low == "cpu")        return cv::dnn::DNN_TARGET_CPU;
-    if (low == "cuda")       return cv::dnn::DNN_TARGET_CUDA;
-    if (low == "cuda_fp16")  return cv::dnn::DNN_TARGET_CUDA_FP16;
-    if (low == "opencl")     return cv::dnn::DNN_TARGET_OPENCL;
-    return cv::dnn::DNN_TARGET_CPU;
+// ==========================================================
+// Classic model load helper
+// ==========================================================
+
+// The recognizer type is taken from the top-level node name written by
+// cv::Algorithm::save() (opencv_lbphfaces, opencv_eigenfaces, ...).
+static cv::Ptr<cv::face::FaceRecognizer> load_classic_model(
+    const std::string &file,
+    std::string &log
+)
+{
+    try {
+        cv::FileStorage fs(file, cv::FileStorage::READ);
+        if (!fs.isOpened()) {
+            log += "Cannot open classic model: " + file + "\n";
+            return cv::Ptr<cv::face::FaceRecognizer>();
+        }
+
+        cv::FileNode node = fs.getFirstTopLevelNode();
+        std::string name = node.name();
+
+        cv::Ptr<cv::face::FaceRecognizer> rec;
+        if (icontains(name, "lbph"))
+            rec = cv::face::LBPHFaceRecognizer::create();
+        else if (icontains(name, "eigen"))
+            rec = cv::face::EigenFaceRecognizer::create();
+        else if (icontains(name, "fisher"))
+            rec = cv::face::FisherFaceRecognizer::create();
+        else {
+            log += "Unknown classic model type '" + name + "' in " + file + "\n";
+            return cv::Ptr<cv::face::FaceRecognizer>();
+        }
+
+        rec->read(node);
+        if (rec->empty()) {
+            log += "Classic model is empty: " + file + "\n";
+            return cv::Ptr<cv::face::FaceRecognizer>();
+        }
+        return rec;
+    } catch (const cv::Exception &e) {
+        log += "Failed to load classic model: ";
+        log += e.what();
+        log += "\n";
+        return cv::Ptr<cv::face::FaceRecognizer>();
+    }
 }
 
 // ==========================================================
@@ -480,18 +1081,19 @@ bool resolve_sface_model(
     std::string &out_resolved_profile
 )
 {
-    // Decide which logical SFace profile to use (fp32 / int8) and which ONNX path.
-    std::string p = profile.empty() ? cfg.recognizer_profile : profile;
-    if (p.empty()) {
-        // Default to fp32 if nothing is specified.
-        p = "sface_fp32";
+    // Same profile as the snapshot: already resolved at load time.
+    if (profile.empty() || profile == cfg.recognizer_profile) {
+        out_model_file = cfg.sface_path;
+        out_resolved_profile = (cfg.recognizer == FA_REC_SFACE_INT8)
+                               ? "sface_int8" : "sface_fp32";
+        if (out_model_file.empty()) {
+            out_resolved_profile.clear();
+            return false;
+        }
+        return true;
     }
 
-    std::string low = p;
-    std::transform(low.begin(), low.end(), low.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
-
-    bool use_int8 = (low.find("int8") != std::string::npos);
+    bool use_int8 = icontains(profile, "int8");
 
     std::string key = use_int8 ? "sface_int8" : "sface_fp32";
     std::string path;
@@ -521,19 +1123,16 @@ bool resolve_sface_model(
 // SFace embedding computation
 // ==========================================================
 
-bool compute_sface_embedding(
+static bool load_sface_net(
     const FacialAuthConfig &cfg,
-    const cv::Mat &face,
-    const std::string &profile,
-    cv::Mat &embedding,
+    const std::string &model_path,
+    cv::dnn::Net &net,
     std::string &log
 )
 {
-    std::string model_path;
-    std::string used_profile;
-
-    if (!resolve_sface_model(cfg, profile, model_path, used_profile)) {
-        log += "SFace model not configured for profile '" + profile + "'.\n";
+    if (model_path.empty()) {
+        log += "SFace model not configured for profile '" +
+        cfg.recognizer_profile + "'.\n";
         return false;
     }
 
@@ -543,18 +1142,38 @@ bool compute_sface_embedding(
     }
 
     try {
-        cv::dnn::Net net = cv::dnn::readNetFromONNX(model_path);
+        net = cv::dnn::readNetFromONNX(model_path);
         if (net.empty()) {
             log += "Failed to load SFace ONNX model: " + model_path + "\n";
             return false;
         }
 
-        int backend = parse_dnn_backend(cfg.dnn_backend);
-        int target  = parse_dnn_target(cfg.dnn_target);
+        net.setPreferableBackend(cfg.dnn_backend_id);
+        net.setPreferableTarget(cfg.dnn_target_id);
+
+        FA_DBG("Loaded SFace model '%s'.", model_path.c_str());
+        return true;
+    }
+    catch (const std::exception &ex) {
+        log += "Exception loading SFace model: ";
+        log += ex.what();
+        log += "\n";
+        return false;
+    }
+}
 
-        net.setPreferableBackend(backend);
-        net.setPreferableTarget(target);
+bool compute_sface_embedding(
+    cv::dnn::Net &net,
+    const cv::Mat &face,
+    cv::Mat &embedding,
+    std::string &log
+)
+{
+    int64_t t0 = fa_usdt_now_us();
+    FA_PROBE2(sface_entry, face.cols, face.rows);
+    (void)t0;
 
+    try {
         cv::Mat blob = cv::dnn::blobFromImage(
             face,
             1.0 / 255.0,
@@ -568,6 +1187,7 @@ bool compute_sface_embedding(
         cv::Mat out = net.forward();
 
         if (out.empty()) {
+            FA_PROBE2(sface_exit, 0, fa_usdt_now_us() - t0);
             log += "SFace forward() produced empty output.\n";
             return false;
         }
@@ -580,15 +1200,11 @@ bool compute_sface_embedding(
             e /= norm;
 
         embedding = e;
-
-        if (cfg.debug) {
-            log += "Computed SFace embedding using model '" +
-            model_path + "' profile='" + used_profile + "'.\n";
-        }
-
+        FA_PROBE2(sface_exit, 1, fa_usdt_now_us() - t0);
         return true;
     }
     catch (const std::exception &ex) {
+        FA_PROBE2(sface_exit, 0, fa_usdt_now_us() - t0);
         log += "Exception in compute_sface_embedding: ";
         log += ex.what();
         log += "\n";
@@ -596,22 +1212,87 @@ bool compute_sface_embedding(
     }
 }
 
+bool compute_sface_embedding(
+    const FacialAuthConfig &cfg,
+    const cv::Mat &face,
+    const std::string &profile,
+    cv::Mat &embedding,
+    std::string &log
+)
+{
+    cv::dnn::Net net;
+    std::string model_path;
+    std::string used_profile;
+
+    if (!resolve_sface_model(cfg, profile, model_path, used_profile)) {
+        log += "SFace model not configured for profile '" + profile + "'.\n";
+        return false;
+    }
+
+    if (!load_sface_net(cfg, model_path, net, log))
+        return false;
+
+    return compute_sface_embedding(net, face, embedding, log);
+}
+
 // ==========================================================
 // DetectorWrapper::detect (HAAR / YuNet)
 // ==========================================================
 
-bool DetectorWrapper::detect(const cv::Mat &frame, cv::Rect &face)
+// Acceptance thresholds; part of the embedding cache key, since changing
+// them changes which images have a face.
+static const double HAAR_SCALE        = 1.1;
+static const int    HAAR_NEIGHBORS    = 3;
+static const int    HAAR_MIN_FACE     = 30;
+static const float  YUNET_MIN_SCORE   = 0.55f;
+static const int    YUNET_MIN_FACE_DIV = 8;    // min face = side / 8
+
+static std::string detector_thresholds_key()
 {
-    face = cv::Rect();
+    char buf[96];
+    std::snprintf(buf, sizeof(buf), "haar:%g/%d/%d yunet:%g/%d",
+                  HAAR_SCALE, HAAR_NEIGHBORS, HAAR_MIN_FACE,
+                  (double)YUNET_MIN_SCORE, YUNET_MIN_FACE_DIV);
+    return buf;
+}
+
+// Fires detect_exit on every return path of DetectorWrapper::detect().
+struct DetectExitProbe
+{
+    const cv::Rect &face;
+    int             type;
+    int64_t         t0;
+
+    ~DetectExitProbe() {
+        FA_PROBE4(detect_exit, face.width, face.height, type,
+                  fa_usdt_now_us() - t0);
+    }
+};
 
-    if (frame.empty())
+bool DetectorWrapper::detect(const cv::Mat &frame, cv::Rect &face,
+                             std::vector<cv::Point2f> *landmarks,
+                             bool *failed)
+{
+    face = cv::Rect();
+    if (landmarks)
+        landmarks->clear();
+    if (failed)
+        *failed = false;
+
+    if (frame.empty()) {
+        if (failed)
+            *failed = true;
         return false;
+    }
 
     int W = frame.cols;
     int H = frame.rows;
 
-    if (debug)
-        std::cout << "[DEBUG] DetectorWrapper::detect(): frame=" << W << "x" << H << "\n";
+    FA_PROBE2(detect_entry, W, H);
+    DetectExitProbe exit_probe{ face, (int)type, fa_usdt_now_us() };
+    (void)exit_probe;
+
+    FA_DBG("DetectorWrapper::detect(): frame=%dx%d", W, H);
 
     // ----------------- HAAR -----------------
     if (type == DET_HAAR)
@@ -623,25 +1304,21 @@ bool DetectorWrapper::detect(const cv::Mat &frame, cv::Rect &face)
         haar.detectMultiScale(
             gray,
             faces,
-            1.1,
-            3,
+            HAAR_SCALE,
+            HAAR_NEIGHBORS,
             0,
-            cv::Size(30, 30)
+            cv::Size(HAAR_MIN_FACE, HAAR_MIN_FACE)
         );
 
         if (faces.empty()) {
-            if (debug)
-                std::cout << "[DEBUG] HAAR: no face detected.\n";
+            FA_DBG("HAAR: no face detected.");
             return false;
         }
 
         face = faces[0];
 
-        if (debug) {
-            std::cout << "[DEBUG] HAAR: face detected at "
-            << face.x << "," << face.y << " "
-            << face.width << "x" << face.height << "\n";
-        }
+        FA_DBG("HAAR: face detected at %d,%d %dx%d",
+               face.x, face.y, face.width, face.height);
 
         return true;
     }
@@ -659,9 +1336,7 @@ bool DetectorWrapper::detect(const cv::Mat &frame, cv::Rect &face)
         cv::Rect crop(cx, 0, crop_w, crop_h);
         cv::Mat roi = frame(crop).clone();
 
-        if (debug)
-            std::cout << "[DEBUG] YuNet: crop4:3=" << roi.cols << "x" << roi.rows
-            << " @" << cx << ",0\n";
+        FA_DBG("YuNet: crop4:3=%dx%d @%d,0", roi.cols, roi.rows, cx);
 
         // Resize input to fixed square 640x640
         cv::Mat resized;
@@ -669,39 +1344,36 @@ bool DetectorWrapper::detect(const cv::Mat &frame, cv::Rect &face)
         const int net_h = 640;
         cv::resize(roi, resized, cv::Size(net_w, net_h));
 
-        if (debug)
-            std::cout << "[DEBUG] YuNet: input square=" << net_w << "x" << net_h << "\n";
+        FA_DBG("YuNet: input square=%dx%d", net_w, net_h);
 
         try {
             yunet->setInput(cv::dnn::blobFromImage(resized));
             cv::Mat out = yunet->forward();
 
             if (out.empty()) {
-                if (debug)
-                    std::cout << "[DEBUG] YuNet: empty output.\n";
+                FA_DBG("YuNet: empty output.");
                 return false;
             }
 
             const int num = out.size[2];
 
             if (num <= 0) {
-                if (debug)
-                    std::cout << "[DEBUG] YuNet: no faces detected.\n";
+                FA_DBG("YuNet: no faces detected.");
                 return false;
             }
 
-            if (debug)
-                std::cout << "[DEBUG] YuNet: " << num << " faces found.\n";
+            FA_DBG("YuNet: %d faces found.", num);
 
             float best_score = 0.0f;
             cv::Rect best_rect;
+            const float *best_data = nullptr;
 
             for (int i = 0; i < num; i++) {
                 float *data = (float *)out.ptr(0, 0, i);
 
                 float score = data[14];  // confidence score
 
-                if (score < 0.55f)
+                if (score < YUNET_MIN_SCORE)
                     continue;
 
                 float x = data[0] * net_w;
@@ -712,22 +1384,21 @@ bool DetectorWrapper::detect(const cv::Mat &frame, cv::Rect &face)
                 cv::Rect r((int)x, (int)y, (int)w, (int)h);
 
                 // Filter tiny boxes (noise)
-                int minFace = std::min(net_w, net_h) / 8;
+                int minFace = std::min(net_w, net_h) / YUNET_MIN_FACE_DIV;
                 if (r.width < minFace || r.height < minFace) {
-                    if (debug)
-                        std::cout << "[DEBUG] YuNet: face discarded as too small.\n";
+                    FA_DBG("YuNet: face discarded as too small.");
                     continue;
                 }
 
                 if (score > best_score) {
                     best_score = score;
                     best_rect  = r;
+                    best_data  = data;
                 }
             }
 
-            if (best_score < 0.55f) {
-                if (debug)
-                    std::cout << "[DEBUG] YuNet: no valid face above threshold.\n";
+            if (best_score < YUNET_MIN_SCORE) {
+                FA_DBG("YuNet: no valid face above threshold.");
                 return false;
             }
 
@@ -747,222 +1418,99 @@ bool DetectorWrapper::detect(const cv::Mat &frame, cv::Rect &face)
                 mapped.x + mapped.width  > W ||
                 mapped.y + mapped.height > H)
             {
-                if (debug)
-                    std::cout << "[DEBUG] YuNet: mapped bounding box out of frame, discarded.\n";
+                FA_DBG("YuNet: mapped bounding box out of frame, discarded.");
                 return false;
             }
 
-            int minFaceOriginal = std::min(W, H) / 8;
+            int minFaceOriginal = std::min(W, H) / YUNET_MIN_FACE_DIV;
             if (mapped.width < minFaceOriginal || mapped.height < minFaceOriginal) {
-                if (debug)
-                    std::cout << "[DEBUG] YuNet: face too small in original frame, discarded.\n";
+                FA_DBG("YuNet: face too small in original frame, discarded.");
                 return false;
             }
 
-            if (debug) {
-                std::cout << "[DEBUG] YuNet: valid face "
-                << mapped.x << "," << mapped.y << " "
-                << mapped.width << "x" << mapped.height
-                << " (score=" << best_score << ")\n";
+            FA_DBG("YuNet: valid face %d,%d %dx%d (score=%.3f)",
+                   mapped.x, mapped.y, mapped.width, mapped.height, best_score);
+
+            if (landmarks) {
+                for (int k = 0; k < 5; ++k) {
+                    landmarks->emplace_back(
+                        crop.x + best_data[4 + 2 * k] * net_w * sx,
+                        crop.y + best_data[5 + 2 * k] * net_h * sy);
+                }
             }
 
             face = mapped;
             return true;
         }
         catch (const cv::Exception &e) {
-            if (debug)
-                std::cout << "[DEBUG] YuNet: OpenCV exception: " << e.what() << "\n";
+            FA_WARN("YuNet: OpenCV exception: %s", e.what());
+            if (failed)
+                *failed = true;
             return false;
         }
     }
 
-    if (debug)
-        std::cout << "[DEBUG] DetectorWrapper: no detector initialized.\n";
+    FA_DBG("DetectorWrapper: no detector initialized.");
 
+    if (failed)
+        *failed = true;
     return false;
 }
 
 // ==========================================================
-// init_detector: choose and initialize detector backend
+// init_detector: initialize the detector selected in the snapshot
 // ==========================================================
 
-static bool init_detector(const FacialAuthConfig &cfg,
+static bool load_detector(const FacialAuthConfig &cfg,
+                          FaDetectorProfile kind,
+                          const std::string &path,
                           DetectorWrapper &det,
                           std::string &log)
 {
     det = DetectorWrapper();
-    det.debug = cfg.debug;
-
-    std::string profile = cfg.detector_profile;
-    if (profile.empty())
-        profile = "auto";
-
-    std::string low = profile;
-    std::transform(low.begin(), low.end(), low.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
-
-    if (low == "auto") {
-        // Prefer YuNet FP32, then YuNet INT8, then Haar.
-        if (cfg.detector_models.count("yunet_fp32") &&
-            file_exists(cfg.detector_models.at("yunet_fp32")))
-        {
-            std::string path = cfg.detector_models.at("yunet_fp32");
-            try {
-                det.yunet = cv::makePtr<cv::dnn::Net>(cv::dnn::readNetFromONNX(path));
-                det.type = DetectorWrapper::DET_YUNET;
-                det.model_path = path;
-
-                int backend = parse_dnn_backend(cfg.dnn_backend);
-                int target  = parse_dnn_target(cfg.dnn_target);
-                det.yunet->setPreferableBackend(backend);
-                det.yunet->setPreferableTarget(target);
-
-                if (cfg.debug) {
-                    log += "Using YuNet FP32 detector: " + path + "\n";
-                }
-                return true;
-            } catch (const std::exception &e) {
-                log += std::string("Failed to init YuNet FP32: ") + e.what() + "\n";
-            }
-        }
-
-        if (cfg.detector_models.count("yunet_int8") &&
-            file_exists(cfg.detector_models.at("yunet_int8")))
-        {
-            std::string path = cfg.detector_models.at("yunet_int8");
-            try {
-                det.yunet = cv::makePtr<cv::dnn::Net>(cv::dnn::readNetFromONNX(path));
-                det.type = DetectorWrapper::DET_YUNET;
-                det.model_path = path;
-
-                int backend = parse_dnn_backend(cfg.dnn_backend);
-                int target  = parse_dnn_target(cfg.dnn_target);
-                det.yunet->setPreferableBackend(backend);
-                det.yunet->setPreferableTarget(target);
 
-                if (cfg.debug) {
-                    log += "Using YuNet INT8 detector: " + path + "\n";
-                }
-                return true;
-            } catch (const std::exception &e) {
-                log += std::string("Failed to init YuNet INT8: ") + e.what() + "\n";
-            }
-        }
+    if (kind == FA_DET_NONE) {
+        log += "No usable detector for detector_profile '" +
+        cfg.detector_profile + "'.\n";
+        return false;
+    }
 
-        if (cfg.detector_models.count("haar") &&
-            file_exists(cfg.detector_models.at("haar")))
-        {
-            std::string path = cfg.detector_models.at("haar");
-            if (det.haar.load(path)) {
-                det.type = DetectorWrapper::DET_HAAR;
-                det.model_path = path;
-                if (cfg.debug) {
-                    log += "Using Haar detector: " + path + "\n";
-                }
-                return true;
-            } else {
-                log += "Failed to load Haar cascade: " + path + "\n";
-            }
-        }
+    const char *name = (kind == FA_DET_HAAR)        ? "Haar" :
+                       (kind == FA_DET_YUNET_INT8)  ? "YuNet INT8" : "YuNet FP32";
 
-        log += "No suitable detector found in auto mode.\n";
+    if (path.empty() || !file_exists(path)) {
+        log += std::string(name) + " detector file not found: " + path + "\n";
         return false;
     }
 
-    if (low == "haar") {
-        std::string path;
-        auto it = cfg.detector_models.find("haar");
-        if (it != cfg.detector_models.end())
-            path = it->second;
-        else
-            path = cfg.haar_cascade_path;
-
-        if (path.empty()) {
-            log += "Haar detector requested but model path is empty.\n";
-            return false;
-        }
-        if (!file_exists(path)) {
-            log += "Haar detector file not found: " + path + "\n";
-            return false;
-        }
+    if (kind == FA_DET_HAAR) {
         if (!det.haar.load(path)) {
             log += "Failed to load Haar cascade: " + path + "\n";
             return false;
         }
         det.type = DetectorWrapper::DET_HAAR;
-        det.model_path = path;
-        if (cfg.debug) {
-            log += "Using Haar detector: " + path + "\n";
-        }
-        return true;
-    }
-
-    if (low == "yunet" || low == "yunet_fp32") {
-        std::string path;
-        auto it = cfg.detector_models.find("yunet_fp32");
-        if (it != cfg.detector_models.end())
-            path = it->second;
-        else
-            path = cfg.yunet_model;
-
-        if (path.empty() || !file_exists(path)) {
-            log += "YuNet FP32 file not found.\n";
-            return false;
-        }
+    } else {
         try {
             det.yunet = cv::makePtr<cv::dnn::Net>(cv::dnn::readNetFromONNX(path));
             det.type = DetectorWrapper::DET_YUNET;
-            det.model_path = path;
-
-            int backend = parse_dnn_backend(cfg.dnn_backend);
-            int target  = parse_dnn_target(cfg.dnn_target);
-            det.yunet->setPreferableBackend(backend);
-            det.yunet->setPreferableTarget(target);
-
-            if (cfg.debug) {
-                log += "Using YuNet FP32 detector: " + path + "\n";
-            }
-            return true;
+            det.yunet->setPreferableBackend(cfg.dnn_backend_id);
+            det.yunet->setPreferableTarget(cfg.dnn_target_id);
         } catch (const std::exception &e) {
-            log += std::string("Failed to init YuNet FP32: ") + e.what() + "\n";
+            log += std::string("Failed to init ") + name + ": " + e.what() + "\n";
             return false;
         }
     }
 
-    if (low == "yunet_int8") {
-        std::string path;
-        auto it = cfg.detector_models.find("yunet_int8");
-        if (it != cfg.detector_models.end())
-            path = it->second;
-        else
-            path = cfg.yunet_model_int8;
-
-        if (path.empty() || !file_exists(path)) {
-            log += "YuNet INT8 file not found.\n";
-            return false;
-        }
-        try {
-            det.yunet = cv::makePtr<cv::dnn::Net>(cv::dnn::readNetFromONNX(path));
-            det.type = DetectorWrapper::DET_YUNET;
-            det.model_path = path;
-
-            int backend = parse_dnn_backend(cfg.dnn_backend);
-            int target  = parse_dnn_target(cfg.dnn_target);
-            det.yunet->setPreferableBackend(backend);
-            det.yunet->setPreferableTarget(target);
-
-            if (cfg.debug) {
-                log += "Using YuNet INT8 detector: " + path + "\n";
-            }
-            return true;
-        } catch (const std::exception &e) {
-            log += std::string("Failed to init YuNet INT8: ") + e.what() + "\n";
-            return false;
-        }
-    }
+    det.model_path = path;
+    FA_DBG("Using %s detector: %s", name, path.c_str());
+    return true;
+}
 
-    log += "Unknown detector_profile: " + profile + "\n";
-    return false;
+static bool init_detector(const FacialAuthConfig &cfg,
+                          DetectorWrapper &det,
+                          std::string &log)
+{
+    return load_detector(cfg, cfg.detector, cfg.detector_path, det, log);
 }
 
 // ==========================================================
@@ -970,485 +1518,3439 @@ static bool init_detector(const FacialAuthConfig &cfg,
 // ==========================================================
 
 static cv::Ptr<cv::face::FaceRecognizer> create_classic_recognizer(
-    const std::string &method,
+    FaTrainingMethod method,
     const FacialAuthConfig &cfg,
     std::string &err
 )
 {
-    std::string low = method;
-    std::transform(low.begin(), low.end(), low.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
-
     try {
-        if (low == "lbph") {
+        switch (method) {
+        case FA_METHOD_LBPH:
             // radius, neighbors, grid_x, grid_y, threshold
             return cv::face::LBPHFaceRecognizer::create(
                 1, 8, 8, 8, cfg.lbph_threshold
             );
-        } else if (low == "eigen" || low == "eigenfaces") {
+        case FA_METHOD_EIGEN:
             return cv::face::EigenFaceRecognizer::create(
                 cfg.eigen_components, cfg.eigen_threshold
             );
-        } else if (low == "fisher" || low == "fisherfaces") {
+        case FA_METHOD_FISHER:
             return cv::face::FisherFaceRecognizer::create(
                 cfg.fisher_components, cfg.fisher_threshold
             );
+        default:
+            break;
         }
     } catch (const std::exception &e) {
         err = e.what();
         return cv::Ptr<cv::face::FaceRecognizer>();
     }
 
-    err = "Unsupported method '" + method + "'";
+    err = std::string("Unsupported method '") + fa_method_name(method) + "'";
     return cv::Ptr<cv::face::FaceRecognizer>();
 }
 
 // ==========================================================
-// Training helpers (classic LBPH/Eigen/Fisher)
+// Enrollment embedding cache (content addressed)
 // ==========================================================
 
-static bool train_classic(
-    const std::string &user,
-    const FacialAuthConfig &cfg,
-    const std::string &method,
-    const std::string &imgdir,
-    const std::string &model_path,
-    bool force_overwrite,
-    std::string &log
-)
+//
+// What detection and SFace produced for one image. The key covers the
+// image content, the detector profile and the exact detector/recognizer
+// model files, so an entry never goes stale: changing any of them simply
+// selects another key. Images without a face are cached too.
+//
+struct FaEmbeddingRecord
 {
-    if (!is_dir(imgdir)) {
-        log += "Image directory does not exist: " + imgdir + "\n";
-        return false;
-    }
+    bool                     face = false;
+    cv::Rect                 box;
+    std::vector<cv::Point2f> landmarks;
+    cv::Mat                  embedding;   // 1xN CV_32F
+};
 
-    std::vector<cv::String> files;
-    cv::glob(imgdir + "/*.jpg", files, false);
-    cv::glob(imgdir + "/*.png", files, false);
+static const char     EMB_CACHE_MAGIC[8] = { 'F','A','E','M','B','E','D','C' };
+static const uint32_t EMB_CACHE_VERSION  = 1;
 
-    if (files.empty()) {
-        log += "No images found in: " + imgdir + "\n";
-        return false;
-    }
+template <typename T>
+static void put_raw(std::string &out, const T &v)
+{
+    out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
 
-    std::vector<cv::Mat> faces;
-    std::vector<int> labels;
+template <typename T>
+static bool get_raw(const std::string &in, size_t &off, T &v)
+{
+    if (off + sizeof(v) > in.size()) return false;
+    std::memcpy(&v, in.data() + off, sizeof(v));
+    off += sizeof(v);
+    return true;
+}
 
-    // Use unified detector (YuNet or Haar)
-    DetectorWrapper det;
-    FacialAuthConfig tmp = cfg;
-    tmp.detector_profile = "haar"; // HAAR is best for classic training
-    if (!init_detector(tmp, det, log)) {
-        log += "Failed to initialize Haar detector for classic training.\n";
-        return false;
-    }
+static bool get_str(const std::string &in, size_t &off, std::string &s, uint32_t len)
+{
+    if (off + len > in.size()) return false;
+    s.assign(in.data() + off, len);
+    off += len;
+    return true;
+}
 
-    for (const auto &fn : files) {
-        cv::Mat img = cv::imread(fn);
-        if (img.empty()) {
-            log += "Cannot read image: " + fn + "\n";
-            continue;
-        }
+// Content hash of a model file, computed once per file version.
+static std::string model_file_hash(const std::string &path)
+{
+    static std::mutex mtx;
+    static std::map<std::string, std::pair<std::string, std::string>> memo;
+
+    std::string stamp, hash;
+    if (!file_stamp(path, stamp))
+        return std::string();
+
+    std::lock_guard<std::mutex> lk(mtx);
+    auto it = memo.find(path);
+    if (it != memo.end() && it->second.first == stamp)
+        return it->second.second;
+
+    if (!file_content_hash(path, hash))
+        return std::string();
+    memo[path] = std::make_pair(stamp, hash);
+    return hash;
+}
 
-        cv::Rect face_rect;
-        if (!det.detect(img, face_rect)) {
-            log += "No face detected in image: " + fn + "\n";
-            continue;
-        }
+static fs::path embedding_cache_dir(const FacialAuthConfig &cfg)
+{
+    fs::path base(cfg.basedir.empty() ? "/var/lib/pam_facial_auth" : cfg.basedir);
+    return base / "cache" / "embeddings";
+}
 
-        cv::Mat face = img(face_rect).clone();
-        cv::Mat gray;
-        cv::cvtColor(face, gray, cv::COLOR_BGR2GRAY);
-        cv::resize(gray, gray, cv::Size(92,112));
+static std::string embedding_cache_path(
+    const FacialAuthConfig &cfg,
+    const std::string &context,
+    const std::string &image_hash
+)
+{
+    std::string k = image_hash + '\0' + context;
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx",
+                  (unsigned long long)fa_fnv1a64(k.data(), k.size()));
 
-        faces.push_back(gray);
-        labels.push_back(0);
-    }
+    return (embedding_cache_dir(cfg) / std::string(name, 2) /
+            (std::string(name) + ".bin")).string();
+}
+
+// Everything but the image: empty when a model file cannot be read or
+// the cache directory cannot be created. Embeddings are biometric data,
+// hence the 0700 directory.
+static std::string embedding_cache_context(const FacialAuthConfig &cfg)
+{
+    std::string det = model_file_hash(cfg.detector_path);
+    std::string rec = model_file_hash(cfg.sface_path);
+    if (det.empty() || rec.empty())
+        return std::string();
+
+    std::string dir = embedding_cache_dir(cfg).string();
+    ensure_dirs(dir);
+    if (::chmod(dir.c_str(), 0700) != 0)
+        return std::string();
+
+    return cfg.detector_profile + '\0' + det + '\0' + rec + '\0' +
+           detector_thresholds_key();
+}
 
-    if (faces.empty()) {
-        log += "No valid faces found for classic training.\n";
+static bool read_embedding_record(const std::string &path,
+                                  const std::string &image_hash,
+                                  FaEmbeddingRecord &rec)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
         return false;
-    }
+    std::string in((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
 
-    // Create the OpenCV recognizer directly
-    cv::Ptr<cv::face::FaceRecognizer> rec;
+    size_t off = sizeof(EMB_CACHE_MAGIC);
+    if (in.size() < off || std::memcmp(in.data(), EMB_CACHE_MAGIC, off) != 0)
+        return false;
 
-    std::string m = method;
-    std::transform(m.begin(), m.end(), m.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
+    uint32_t version = 0, len = 0, nlm = 0;
+    uint8_t face = 0;
+    std::string stored_hash;
+    int32_t box[4];
+    if (!get_raw(in, off, version) || version != EMB_CACHE_VERSION ||
+        !get_raw(in, off, len) || !get_str(in, off, stored_hash, len) ||
+        stored_hash != image_hash ||
+        !get_raw(in, off, face) || !get_raw(in, off, box) ||
+        !get_raw(in, off, nlm) || nlm > 16)
+        return false;
 
-    if (m == "lbph") {
-        rec = cv::face::LBPHFaceRecognizer::create();
-        rec->setThreshold(cfg.lbph_threshold);
+    rec = FaEmbeddingRecord();
+    rec.face = face != 0;
+    rec.box  = cv::Rect(box[0], box[1], box[2], box[3]);
+    for (uint32_t i = 0; i < nlm; ++i) {
+        float xy[2];
+        if (!get_raw(in, off, xy))
+            return false;
+        rec.landmarks.emplace_back(xy[0], xy[1]);
     }
-    else if (m == "eigen") {
-        rec = cv::face::EigenFaceRecognizer::create(cfg.eigen_components, cfg.eigen_threshold);
+
+    int32_t cols = 0;
+    if (!get_raw(in, off, cols) || cols < 0 || cols > 4096 ||
+        off + (size_t)cols * sizeof(float) != in.size())
+        return false;
+    if (cols > 0) {
+        rec.embedding.create(1, cols, CV_32F);
+        std::memcpy(rec.embedding.ptr<float>(), in.data() + off,
+                    (size_t)cols * sizeof(float));
     }
-    else if (m == "fisher") {
-        rec = cv::face::FisherFaceRecognizer::create(cfg.fisher_components, cfg.fisher_threshold);
+    return rec.face == (cols > 0);
+}
+
+static void write_embedding_record(const std::string &path,
+                                   const std::string &image_hash,
+                                   const FaEmbeddingRecord &rec)
+{
+    cv::Mat emb;
+    if (rec.face)
+        rec.embedding.reshape(1, 1).convertTo(emb, CV_32F);
+
+    std::string out(EMB_CACHE_MAGIC, sizeof(EMB_CACHE_MAGIC));
+    put_raw(out, EMB_CACHE_VERSION);
+    put_raw(out, (uint32_t)image_hash.size());
+    out += image_hash;
+    put_raw(out, (uint8_t)(rec.face ? 1 : 0));
+    int32_t box[4] = { rec.box.x, rec.box.y, rec.box.width, rec.box.height };
+    put_raw(out, box);
+    put_raw(out, (uint32_t)rec.landmarks.size());
+    for (const auto &p : rec.landmarks) {
+        float xy[2] = { p.x, p.y };
+        put_raw(out, xy);
     }
-    else {
-        log += "Unsupported training method: " + method + "\n";
-        return false;
+    put_raw(out, (int32_t)emb.cols);
+    if (!emb.empty())
+        out.append(reinterpret_cast<const char *>(emb.ptr<float>()),
+                   (size_t)emb.cols * sizeof(float));
+
+    ensure_dirs(fs::path(path).parent_path().string());
+    static std::atomic<unsigned> seq{0};
+    std::string tmp = path + ".tmp." + std::to_string(::getpid()) + "." +
+                      std::to_string(seq++);
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f.is_open())
+            return;
+        f.write(out.data(), (std::streamsize)out.size());
+        if (!f.good()) {
+            f.close();
+            ::unlink(tmp.c_str());
+            return;
+        }
     }
+    if (::rename(tmp.c_str(), path.c_str()) != 0)
+        ::unlink(tmp.c_str());
+}
 
-    rec->train(faces, labels);
+// ==========================================================
+// Near-duplicate rejection (capture and training)
+// ==========================================================
 
-    if (file_exists(model_path) && !force_overwrite) {
-        log += "Model file already exists (use --force to overwrite): " + model_path + "\n";
-        return false;
-    }
+static double cosine_similarity(const cv::Mat &a, const cv::Mat &b)
+{
+    double dot = a.dot(b);
+    double na  = cv::norm(a);
+    double nb  = cv::norm(b);
+    if (na <= 0.0 || nb <= 0.0) return 0.0;
+    return dot / (na * nb);
+}
 
-    rec->save(model_path);
-    log += "Classic model saved to: " + model_path + "\n";
-    return true;
+// 64-bit difference hash of a face crop: the cheap similarity test for
+// the classic path, which has no embedding.
+static uint64_t face_dhash(const cv::Mat &face)
+{
+    cv::Mat gray, small;
+    if (face.channels() == 3)
+        cv::cvtColor(face, gray, cv::COLOR_BGR2GRAY);
+    else
+        gray = face;
+    cv::resize(gray, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+
+    uint64_t h = 0;
+    for (int y = 0; y < 8; ++y) {
+        const unsigned char *row = small.ptr<unsigned char>(y);
+        for (int x = 0; x < 8; ++x)
+            h = (h << 1) | (row[x] > row[x + 1] ? 1u : 0u);
+    }
+    return h;
 }
-if (cfg.verbose) {
-                std::cout << "[VERBOSE] Invalid bounding box → image discarded\n";
-            }
-            continue;
-        }
 
-        if (cfg.debug) {
-            std::cout << "[DEBUG] Face detected: x=" << face.x
-            << " y=" << face.y
-            << " w=" << face.width
-            << " h=" << face.height << "\n";
-        }
+//
+// Remembers what was kept so far and refuses samples too close to any of
+// it: consecutive frames of a still user add rows, not information.
+// Pairwise, O(n^2) in the samples kept: fine for one user's few hundred
+// images, which is why it stays opt-in.
+//
+struct NearDupFilter
+{
+    double max_similarity;   // SFace cosine; <= 0 disables
+    int    max_distance;     // dHash Hamming bits; < 0 disables
+    std::vector<cv::Mat>  embeds;
+    std::vector<uint64_t> hashes;
+    int dropped = 0;
 
-        int idx = start_index + saved;
-        std::string outfile = imgdir + "/" + std::to_string(idx) + "." + img_format;
+    explicit NearDupFilter(const FacialAuthConfig &cfg)
+        : max_similarity(cfg.dedup_similarity),
+          max_distance(cfg.dedup_hash_distance) {}
 
-        if (!cv::imwrite(outfile, frame)) {
-            log += "[ERROR] Cannot save image: " + outfile + "\n";
-        } else {
-            ++saved;
-            if (cfg.verbose) {
-                std::cout << "[VERBOSE] Saved: " << outfile << "\n";
+    bool accept_embedding(const cv::Mat &e)
+    {
+        if (max_similarity > 0.0) {
+            for (const auto &k : embeds) {
+                if (cosine_similarity(e, k) >= max_similarity) {
+                    ++dropped;
+                    return false;
+                }
             }
         }
-
-        if (cfg.sleep_ms > 0) {
-            sleep_ms_int(cfg.sleep_ms);
-        }
+        embeds.push_back(e);
+        return true;
     }
 
-    if (saved == 0) {
-        log += "[WARN] No images saved: no face detected in captured frames.\n";
-        return false;
+    bool accept_hash(uint64_t h)
+    {
+        if (max_distance >= 0) {
+            for (uint64_t k : hashes) {
+                if (__builtin_popcountll(h ^ k) <= max_distance) {
+                    ++dropped;
+                    return false;
+                }
+            }
+        }
+        hashes.push_back(h);
+        return true;
     }
 
-    log += "[INFO] Capture completed. Images saved: " +
-    std::to_string(saved) + "\n";
-    return true;
-}
+    void report(std::string &log) const
+    {
+        if (dropped > 0)
+            log += "Near-duplicates dropped: " + std::to_string(dropped) + "\n";
+    }
+};
 
 // ==========================================================
-// Public API: train user
+// Parallel enrollment (decode, detect, crop, embed)
 // ==========================================================
 
-bool fa_train_user(
-    const std::string &user,
-    const FacialAuthConfig &cfg,
-    std::string &log
+// One enrollment image after processing; kept in input order.
+struct EnrollSample
+{
+    bool        ok = false;
+    cv::Mat     data;       // SFace embedding or 92x112 gray face
+    std::string log;
+};
+
+// *.jpg and *.png in imgdir, sorted so the gallery order is stable.
+static std::vector<cv::String> list_enroll_images(const std::string &imgdir)
+{
+    std::vector<cv::String> files, png;
+    cv::glob(imgdir + "/*.jpg", files, false);
+    cv::glob(imgdir + "/*.png", png, false);   // glob() clears its output
+    files.insert(files.end(), png.begin(), png.end());
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static int enroll_workers(const FacialAuthConfig &cfg, size_t jobs)
+{
+    int n = cfg.train_threads;
+    if (n <= 0)
+        n = (int)std::thread::hardware_concurrency();
+    if (n <= 0)
+        n = 1;
+    if ((size_t)n > jobs)
+        n = (int)jobs;
+    return std::max(n, 1);
+}
+
+// Returns false when the outcome says nothing about the image itself
+// (unreadable file, detector error, embedding failure) and must not be
+// cached in rec.
+static bool enroll_one(
+    const std::string &fn,
+    DetectorWrapper &det,
+    cv::dnn::Net *sface_net,
+    EnrollSample &out,
+    FaEmbeddingRecord *rec = nullptr
 )
 {
-    std::string imgdir     = fa_user_image_dir(cfg, user);
-    std::string model_path = fa_user_model_path(cfg, user);
+    cv::Mat img = cv::imread(fn);
+    if (img.empty()) {
+        out.log = "Cannot read image: " + fn + "\n";
+        return false;
+    }
 
-    if (!is_dir(imgdir)) {
-        log += "fa_train_user: image directory does not exist: " + imgdir + "\n";
+    // Only a detector that ran and found nothing is a cacheable answer.
+    cv::Rect face_rect;
+    std::vector<cv::Point2f> landmarks;
+    bool found = false, failed = false;
+    try {
+        found = det.detect(img, face_rect, rec ? &landmarks : nullptr, &failed);
+    } catch (const std::exception &e) {
+        out.log = "Face detection failed for: " + fn + ": " + e.what() + "\n";
+        return false;
+    }
+    if (!found) {
+        if (failed) {
+            out.log = "Face detection failed for: " + fn + "\n";
+            return false;
+        }
+        out.log = "No face detected in: " + fn + "\n";
+        if (rec)
+            *rec = FaEmbeddingRecord();
+        return true;
+    }
+
+    cv::Mat face = img(face_rect);
+
+    if (!sface_net) {
+        cv::Mat gray;
+        cv::cvtColor(face, gray, cv::COLOR_BGR2GRAY);
+        cv::resize(gray, out.data, cv::Size(92, 112));
+        out.ok = true;
+        return true;
+    }
+
+    cv::Mat resized;
+    cv::resize(face, resized, cv::Size(112, 112));
+
+    std::string log_emb;
+    if (!compute_sface_embedding(*sface_net, resized, out.data, log_emb)) {
+        out.log = "Failed to compute embedding for: " + fn + "\n" + log_emb;
         return false;
     }
+    out.ok = true;
 
-    std::string method = cfg.training_method;
-    std::string rp = cfg.recognizer_profile;
+    if (rec) {
+        rec->face      = true;
+        rec->box       = face_rect;
+        rec->landmarks = std::move(landmarks);
+        rec->embedding = out.data;
+    }
+    return true;
+}
 
-    std::string method_low = method;
-    std::transform(method_low.begin(), method_low.end(), method_low.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
+//
+// enroll_one() behind the embedding cache. An empty context disables it.
+// Read and detector failures are not cached; images on which the
+// detector ran and found no face are.
+//
+static void enroll_one_cached(
+    const FacialAuthConfig &cfg,
+    const std::string &context,
+    const std::string &fn,
+    DetectorWrapper &det,
+    cv::dnn::Net *sface_net,
+    EnrollSample &out
+)
+{
+    std::string hash;
+    if (context.empty() || !file_content_hash(fn, hash)) {
+        enroll_one(fn, det, sface_net, out);
+        return;
+    }
 
-    // Automatic choice based on recognizer_profile
-    if (method_low == "auto") {
-        std::string rp_low = rp;
-        std::transform(rp_low.begin(), rp_low.end(), rp_low.begin(),
-                       [](unsigned char c){ return std::tolower(c); });
-        if (rp_low.rfind("sface", 0) == 0) {
-            method = "sface";
+    std::string path = embedding_cache_path(cfg, context, hash);
+    FaEmbeddingRecord rec;
+    if (read_embedding_record(path, hash, rec)) {
+        if (rec.face) {
+            out.data = rec.embedding;
+            out.ok   = true;
         } else {
-            method = "lbph";
+            out.log = "No face detected in: " + fn + " (cached)\n";
         }
+        return;
     }
 
-    std::string mlow = method;
-    std::transform(mlow.begin(), mlow.end(), mlow.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
+    if (enroll_one(fn, det, sface_net, out, &rec))
+        write_embedding_record(path, hash, rec);
+}
+
+//
+// Processes files on a pool of workers, each with its own detector and
+// (for SFace) its own net: cv::dnn::Net is not safe to share. results[i]
+// always belongs to files[i], whatever the thread count.
+//
+static bool enroll_images(
+    const FacialAuthConfig &cfg,
+    const std::vector<cv::String> &files,
+    FaDetectorProfile det_kind,
+    const std::string &det_path,
+    bool sface,
+    std::vector<EnrollSample> &results,
+    std::string &log
+)
+{
+    results.assign(files.size(), EnrollSample());
+    if (files.empty())
+        return true;
+
+    const int workers = enroll_workers(cfg, files.size());
+
+    // Detector and SFace files are hashed once, before the workers start.
+    std::string context;
+    if (sface && cfg.embedding_cache)
+        context = embedding_cache_context(cfg);
 
-    if (mlow == "sface") {
+    std::atomic<size_t> next{0};
+    std::atomic<bool>   failed{false};
+    std::mutex          log_mutex;
+
+    auto run = [&]() {
         DetectorWrapper det;
-        if (!init_detector(cfg, det, log)) {
-            log += "fa_train_user: cannot initialize detector.\n";
-            return false;
+        cv::dnn::Net net;
+        std::string wlog;
+
+        bool ready = load_detector(cfg, det_kind, det_path, det, wlog) &&
+                     (!sface || load_sface_net(cfg, cfg.sface_path, net, wlog));
+        if (!ready) {
+            if (!failed.exchange(true)) {
+                std::lock_guard<std::mutex> lk(log_mutex);
+                log += wlog;
+            }
+            return;
         }
 
-        std::vector<cv::String> files;
-        cv::glob(imgdir + "/*.jpg", files, false);
-        cv::glob(imgdir + "/*.png", files, false);
-
-        if (files.empty()) {
-            log += "No images found for SFace training in: " + imgdir + "\n";
-            return false;
+        for (size_t i = next++; i < files.size() && !failed; i = next++) {
+            if (sface)
+                enroll_one_cached(cfg, context, files[i], det, &net, results[i]);
+            else
+                enroll_one(files[i], det, nullptr, results[i]);
         }
+    };
+
+    // Our workers take the whole policy, the caller only the CPU set.
+    std::vector<std::thread> pool;
+    for (int t = 1; t < workers; ++t) {
+        pool.emplace_back([&]() {
+            std::string plog;
+            if (!cfg.cpu_policy.empty() && !fa_apply_cpu_policy(cfg.cpu_policy, plog))
+                FA_WARN("Training worker CPU policy not applied: %s", plog.c_str());
+            run();
+        });
+    }
+    {
+        FaCpuScope cpu(cfg.cpu_policy);
+        run();
+    }
+    for (auto &th : pool)
+        th.join();
 
-        std::vector<cv::Mat> embeddings;
-        for (const auto &fn : files) {
-            cv::Mat img = cv::imread(fn);
-            if (img.empty()) {
-                log += "Cannot read image: " + fn + "\n";
-                continue;
-            }
+    FA_DBG("Enrollment: %zu images on %d workers", files.size(), workers);
 
-            cv::Rect face_rect;
-            if (!det.detect(img, face_rect)) {
-                log += "No face detected in: " + fn + "\n";
-                continue;
-            }
+    for (const auto &r : results)
+        log += r.log;
+    return !failed;
+}
 
-            cv::Mat face = img(face_rect).clone();
-            cv::Mat resized;
-            cv::resize(face, resized, cv::Size(112, 112));
+//
+// Matches the image directory against the manifest of the current model:
+// an image is reused when its name and size/mtime stamp are unchanged, or
+// when its content hash is known (touched or renamed files). Everything
+// else lands in todo. Entries pointing past the model's rows are ignored.
+//
+struct ManifestDiff
+{
+    std::vector<FaManifestEntry> manifest;   // one per file, row unset
+    std::vector<long>            reuse;      // old manifest index or -1
+    std::vector<cv::String>      todo;
+    std::vector<size_t>          todo_slot;  // file index of todo[k]
+    size_t                       dropped = 0;
+};
+
+static void diff_manifest(
+    const std::vector<cv::String> &files,
+    const std::vector<FaManifestEntry> &old_manifest,
+    size_t rows,
+    ManifestDiff &d,
+    std::string &log
+)
+{
+    std::unordered_map<std::string, size_t> by_file, by_hash;
+    for (size_t i = 0; i < old_manifest.size(); ++i) {
+        const FaManifestEntry &m = old_manifest[i];
+        if (m.row >= (int)rows || m.file.empty())
+            continue;
+        by_file.emplace(m.file, i);
+        by_hash.emplace(m.hash, i);
+    }
 
-            cv::Mat emb;
-            std::string log_emb;
-            if (!compute_sface_embedding(cfg, resized, rp, emb, log_emb)) {
-                log += "Failed to compute embedding for: " + fn + "\n";
-                log += log_emb;
-                continue;
-            }
+    d.manifest.assign(files.size(), FaManifestEntry());
+    d.reuse.assign(files.size(), -1);
+    d.todo.clear();
+    d.todo_slot.clear();
 
-            embeddings.push_back(emb);
-        }
+    for (size_t i = 0; i < files.size(); ++i) {
+        FaManifestEntry &m = d.manifest[i];
+        m.file = fs::path(files[i]).filename().string();
+        file_stamp(files[i], m.stamp);
 
-        if (embeddings.empty()) {
-            log += "No embeddings computed for SFace training.\n";
-            return false;
+        auto it = by_file.find(m.file);
+        if (it != by_file.end() && old_manifest[it->second].stamp == m.stamp) {
+            m.hash     = old_manifest[it->second].hash;
+            d.reuse[i] = (long)it->second;
+            continue;
         }
 
-        if (file_exists(model_path) && !cfg.force_overwrite) {
-            log += "Model file already exists (use --force to overwrite): " + model_path + "\n";
-            return false;
+        // Left with an empty hash: dropped from the manifest, retried next run
+        if (!file_content_hash(files[i], m.hash)) {
+            log += "Cannot read image: " + std::string(files[i]) + "\n";
+            continue;
         }
 
-        if (!fa_save_sface_model(cfg, rp, model_path, embeddings)) {
-            log += "Failed to save SFace model: " + model_path + "\n";
-            return false;
+        auto ht = by_hash.find(m.hash);
+        if (ht != by_hash.end()) {
+            d.reuse[i] = (long)ht->second;
+            continue;
         }
 
-        log += "SFace model saved to: " + model_path + "\n";
-        return true;
-    } else {
-        return train_classic(
-            user,
-            cfg,
-            method,
-            imgdir,
-            model_path,
-            cfg.force_overwrite,
-            log
-        );
+        d.todo.push_back(files[i]);
+        d.todo_slot.push_back(i);
     }
+
+    // Rows captured without an image file are not the directory's business.
+    std::vector<bool> kept(old_manifest.size(), false);
+    for (size_t i = 0; i < old_manifest.size(); ++i)
+        kept[i] = old_manifest[i].file.empty();
+    for (long r : d.reuse)
+        if (r >= 0)
+            kept[r] = true;
+    d.dropped = std::count(kept.begin(), kept.end(), false);
+}
+
+static void prune_manifest(std::vector<FaManifestEntry> &manifest)
+{
+    manifest.erase(std::remove_if(manifest.begin(), manifest.end(),
+                                  [](const FaManifestEntry &m) { return m.hash.empty(); }),
+                   manifest.end());
 }
 
 // ==========================================================
-// Public API: test user
+// Training helpers (classic LBPH/Eigen/Fisher)
 // ==========================================================
 
-static double cosine_similarity(const cv::Mat &a, const cv::Mat &b)
+static bool stat_stamp(const std::string &path, int64_t &size, int64_t &mtime_ns)
 {
-    double dot = a.dot(b);
-    double na  = cv::norm(a);
-    double nb  = cv::norm(b);
-    if (na <= 0.0 || nb <= 0.0) return 0.0;
-    return dot / (na * nb);
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+        return false;
+    size     = (int64_t)st.st_size;
+    mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return true;
 }
 
-bool fa_test_user(
-    const std::string &user,
+//
+// Binary copy of an LBPH model for logins (see facialauth_lbph.h), tied
+// to the staged XML file: rename() keeps size and mtime, so the store is
+// valid exactly once the XML it mirrors is in place.
+//
+static void save_lbph_store(
     const FacialAuthConfig &cfg,
-    const std::string &modelPath,
-    double &best_conf,
-    int &best_label,
-    std::string &log,
-    double threshold_override
+    cv::face::LBPHFaceRecognizer &lbph,
+    const std::string &staged_xml,
+    const std::string &model_path,
+    std::string &log
 )
 {
-    best_conf = 0.0;
-    best_label = -1;
+    std::string store = fa_lbph_path(model_path);
+    int64_t size = 0, mtime_ns = 0;
+    if (cfg.lbph_store == "no" || !stat_stamp(staged_xml, size, mtime_ns)) {
+        ::unlink(store.c_str());
+        return;
+    }
 
-    if (!file_exists(modelPath)) {
-        log += "Model file not found: " + modelPath + "\n";
-        return false;
+    FaLbphParams p;
+    p.radius    = lbph.getRadius();
+    p.neighbors = lbph.getNeighbors();
+    p.grid_x    = lbph.getGridX();
+    p.grid_y    = lbph.getGridY();
+
+    std::vector<cv::Mat> hists = lbph.getHistograms();
+    cv::Mat labels_mat = lbph.getLabels();
+    const size_t bins = p.bins();
+
+    std::vector<float>   rows(hists.size() * bins);
+    std::vector<int32_t> labels(hists.size(), 0);
+    for (size_t i = 0; i < hists.size(); ++i) {
+        cv::Mat h = hists[i].reshape(1, 1);
+        if (h.type() != CV_32F || (size_t)h.total() != bins) {
+            log += "Unexpected LBPH histogram layout, binary store not written.\n";
+            ::unlink(store.c_str());
+            return;
+        }
+        std::memcpy(&rows[i * bins], h.ptr<float>(), bins * sizeof(float));
+        if ((int)i < labels_mat.rows)
+            labels[i] = labels_mat.at<int>((int)i, 0);
+    }
+
+    FaLbphDtype dtype = (cfg.lbph_store == "u16") ? FA_LBPH_U16 : FA_LBPH_F32;
+    std::string tmp = staging_path(store);
+    if (!fa_lbph_write(tmp, p, lbph.getThreshold(), rows.data(), labels.data(),
+                       hists.size(), dtype, size, mtime_ns, log) ||
+        !commit_staged(tmp, store))
+    {
+        ::unlink(store.c_str());
     }
+}
 
-    std::string method = cfg.training_method;
-    std::string rp     = cfg.recognizer_profile;
+// Eigen/Fisher model contents, in BasicFaceRecognizer's layout.
+struct SubspaceModel
+{
+    double threshold = 0.0;
+    int num_components = 0;
+    cv::Mat mean;                       // 1 x dim, CV_64F
+    cv::Mat eigenvalues;                // components x 1, CV_64F
+    cv::Mat eigenvectors;               // dim x components, CV_64F
+    std::vector<cv::Mat> projections;   // 1 x components each, CV_64F
+    cv::Mat labels;                     // rows x 1, CV_32S
+};
+
+static void subspace_from_recognizer(const cv::face::BasicFaceRecognizer &rec,
+                                     SubspaceModel &m)
+{
+    m.threshold      = rec.getThreshold();
+    m.num_components = rec.getNumComponents();
+    m.mean           = rec.getMean();
+    m.eigenvalues    = rec.getEigenValues();
+    m.eigenvectors   = rec.getEigenVectors();
+    m.projections    = rec.getProjections();
+    m.labels         = rec.getLabels();
+}
 
-    std::string method_low = method;
-    std::transform(method_low.begin(), method_low.end(), method_low.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
+// Same keys as BasicFaceRecognizer::write(), so read() loads the result.
+static void write_subspace_fields(cv::FileStorage &fs, const SubspaceModel &m)
+{
+    fs << "threshold" << m.threshold;
+    fs << "num_components" << m.num_components;
+    fs << "mean" << m.mean;
+    fs << "eigenvalues" << m.eigenvalues;
+    fs << "eigenvectors" << m.eigenvectors;
+    fs << "projections" << "[";
+    for (const auto &p : m.projections)
+        fs << p;
+    fs << "]";
+    fs << "labels" << m.labels;
+    fs << "labelsInfo" << "[" << "]";
+}
 
-    if (method_low == "auto") {
-        std::string rp_low = rp;
-        std::transform(rp_low.begin(), rp_low.end(), rp_low.begin(),
-                       [](unsigned char c){ return std::tolower(c); });
-        if (rp_low.rfind("sface", 0) == 0) {
-            method = "sface";
-        } else {
-            method = "lbph";
+// Binary copy of an Eigen/Fisher model (see facialauth_subspace.h),
+// tied to the staged XML file like the LBPH store.
+static void save_subspace_store(
+    const FacialAuthConfig &cfg,
+    const SubspaceModel &m,
+    const std::string &staged_xml,
+    const std::string &model_path,
+    std::string &log
+)
+{
+    std::string store = fa_subspace_path(model_path);
+    int64_t size = 0, mtime_ns = 0;
+    if (!cfg.subspace_store || !stat_stamp(staged_xml, size, mtime_ns)) {
+        ::unlink(store.c_str());
+        return;
+    }
+
+    const size_t dim   = m.mean.total();
+    const size_t comps = (size_t)m.eigenvectors.cols;
+    if (dim == 0 || comps == 0 || (size_t)m.eigenvectors.rows != dim) {
+        log += "Unexpected Eigen/Fisher model layout, binary store not written.\n";
+        ::unlink(store.c_str());
+        return;
+    }
+
+    cv::Mat mean, basis;
+    m.mean.reshape(1, 1).convertTo(mean, CV_32F);
+    m.eigenvectors.convertTo(basis, CV_32F);
+
+    const size_t rows = m.projections.size();
+    std::vector<float>   proj(rows * comps);
+    std::vector<int32_t> labels(rows, 0);
+    for (size_t i = 0; i < rows; ++i) {
+        cv::Mat p;
+        m.projections[i].reshape(1, 1).convertTo(p, CV_32F);
+        if ((size_t)p.total() != comps) {
+            log += "Unexpected Eigen/Fisher projection size, binary store not written.\n";
+            ::unlink(store.c_str());
+            return;
         }
+        std::memcpy(&proj[i * comps], p.ptr<float>(), comps * sizeof(float));
+        if (i < m.labels.total())
+            labels[i] = m.labels.at<int>((int)i);
     }
 
-    std::string mlow = method;
-    std::transform(mlow.begin(), mlow.end(), mlow.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
+    std::string tmp = staging_path(store);
+    if (!fa_subspace_write(tmp, dim, comps, mean.ptr<float>(), basis.ptr<float>(),
+                           proj.data(), labels.data(), rows, m.threshold,
+                           size, mtime_ns, log) ||
+        !commit_staged(tmp, store))
+    {
+        ::unlink(store.c_str());
+    }
+}
 
-    cv::VideoCapture cap;
-    if (!open_camera(cap, cfg, log)) {
-        log += "fa_test_user: cannot open camera.\n";
+//
+// Eigenfaces with the randomized PCA of Halko, Martinsson and Tropp: a
+// rank (k + 10) sketch of the centred data, refined by two power
+// iterations. cv::PCA keeps a double copy of every image plus an n x n
+// covariance; this works on one float copy and dim x (k + 10) sketches,
+// and yields the same top-k subspace to within the sketch's accuracy.
+//
+static const int RPCA_OVERSAMPLE   = 10;
+static const int RPCA_POWER_ITERS  = 2;
+static const size_t RPCA_AUTO_MIN  = 256;
+
+static bool use_randomized_pca(const FacialAuthConfig &cfg, size_t samples)
+{
+    if (cfg.eigen_components <= 0 || iequals(cfg.eigen_solver, "exact"))
         return false;
+    if (iequals(cfg.eigen_solver, "randomized"))
+        return true;
+    return samples >= RPCA_AUTO_MIN &&
+           samples > 2 * (size_t)(cfg.eigen_components + RPCA_OVERSAMPLE);
+}
+
+// Columns of m replaced by an orthonormal basis of their span.
+static void orthonormalize(cv::Mat &m)
+{
+    cv::Mat w, u, vt;
+    cv::SVD::compute(m, w, u, vt, cv::SVD::MODIFY_A);
+    m = u;
+}
+
+static bool train_eigen_randomized(
+    const FacialAuthConfig &cfg,
+    const std::vector<cv::Mat> &faces,
+    const std::vector<int> &labels,
+    SubspaceModel &out,
+    std::string &log
+)
+{
+    const int n = (int)faces.size();
+    const int d = (int)faces[0].total();
+
+    cv::Mat X(n, d, CV_32F);
+    for (int i = 0; i < n; ++i) {
+        if ((int)faces[i].total() != d) {
+            log += "Eigenfaces training needs images of the same size.\n";
+            return false;
+        }
+        cv::Mat row = X.row(i);
+        faces[i].reshape(1, 1).convertTo(row, CV_32F);
     }
 
-    DetectorWrapper det;
-    if (!init_detector(cfg, det, log)) {
-        log += "fa_test_user: cannot initialize detector.\n";
+    cv::Mat mean;
+    cv::reduce(X, mean, 0, cv::REDUCE_AVG, CV_32F);
+    for (int i = 0; i < n; ++i) {
+        cv::Mat row = X.row(i);
+        row -= mean;
+    }
+
+    const int l = std::min(cfg.eigen_components + RPCA_OVERSAMPLE, std::min(n, d));
+
+    // Fixed seed: the same images always give the same model.
+    cv::Mat omega(d, l, CV_32F);
+    cv::RNG rng(0x46414345u);
+    rng.fill(omega, cv::RNG::NORMAL, cv::Scalar(0), cv::Scalar(1));
+
+    cv::Mat Y = X * omega;                              // n x l
+    for (int it = 0; it < RPCA_POWER_ITERS; ++it) {
+        orthonormalize(Y);
+        cv::Mat Z;
+        cv::gemm(X, Y, 1.0, cv::Mat(), 0.0, Z, cv::GEMM_1_T);   // d x l
+        orthonormalize(Z);
+        Y = X * Z;
+    }
+    orthonormalize(Y);                                  // Q, n x l
+
+    cv::Mat B;
+    cv::gemm(Y, X, 1.0, cv::Mat(), 0.0, B, cv::GEMM_1_T);       // l x d
+    cv::Mat G;
+    cv::gemm(B, B, 1.0, cv::Mat(), 0.0, G, cv::GEMM_2_T);       // l x l
+
+    cv::Mat evals, evecs;
+    if (!cv::eigen(G, evals, evecs)) {
+        log += "Randomized PCA failed to converge.\n";
         return false;
     }
 
-    if (mlow == "sface") {
-        std::vector<cv::Mat> gallery;
-        if (!fa_load_sface_model(modelPath, gallery)) {
-            log += "Failed to load SFace model: " + modelPath + "\n";
-            return false;
-        }
+    int k = std::min(cfg.eigen_components, l);
+    while (k > 0 && !(evals.at<float>(k - 1) > 0.0f))
+        --k;
+    if (k == 0) {
+        log += "Eigenfaces training images carry no variance.\n";
+        return false;
+    }
 
-        if (gallery.empty()) {
-            log += "SFace model has empty gallery.\n";
-            return false;
-        }
+    // Right singular vectors of B: B^T u_j / sigma_j.
+    cv::Mat V;
+    cv::gemm(B, evecs.rowRange(0, k), 1.0, cv::Mat(), 0.0, V,
+             cv::GEMM_1_T | cv::GEMM_2_T);                      // d x k
+    out.eigenvalues.create(k, 1, CV_64F);
+    for (int j = 0; j < k; ++j) {
+        double s2 = evals.at<float>(j);
+        cv::Mat col = V.col(j);
+        col *= 1.0 / std::sqrt(s2);
+        out.eigenvalues.at<double>(j) = s2 / n;         // as cv::PCA (COVAR_SCALE)
+    }
 
-        cv::Mat frame;
-        if (!capture_frame(cap, frame, cfg, log)) {
-            log += "fa_test_user: cannot capture frame.\n";
-            return false;
-        }
+    cv::Mat P = X * V;                                  // n x k
+
+    out.threshold      = cfg.eigen_threshold;
+    out.num_components = k;
+    mean.convertTo(out.mean, CV_64F);
+    V.convertTo(out.eigenvectors, CV_64F);
+    out.projections.clear();
+    for (int i = 0; i < n; ++i) {
+        cv::Mat p;
+        P.row(i).convertTo(p, CV_64F);
+        out.projections.push_back(p);
+    }
+    out.labels = cv::Mat(labels, true);
+    return true;
+}
 
-        cv::Rect face_rect;
-        if (!det.detect(frame, face_rect)) {
-            log += "No face detected in test frame.\n";
+// Like cv::Algorithm::save(), plus the enrollment manifest after the
+// model. sub, if given, replaces the (untrained) rec's own fields.
+static bool save_classic_model(
+    const FacialAuthConfig &cfg,
+    const cv::Ptr<cv::face::FaceRecognizer> &rec,
+    const std::string &model_path,
+    const std::vector<FaManifestEntry> &manifest,
+    std::string &log,
+    const SubspaceModel *sub = nullptr
+)
+{
+    ensure_dirs(fs::path(model_path).parent_path().string());
+    std::string tmp = staging_path(model_path);
+    try {
+        cv::FileStorage fs(tmp, cv::FileStorage::WRITE);
+        if (!fs.isOpened())
             return false;
-        }
+        fs << rec->getDefaultName() << "{";
+        if (sub)
+            write_subspace_fields(fs, *sub);
+        else
+            rec->write(fs);
+        fs << "}";
+        write_manifest(fs, manifest);
+        fs.release();
+    } catch (...) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
 
-        cv::Mat face = frame(face_rect).clone();
-        cv::Mat resized;
-        cv::resize(face, resized, cv::Size(112, 112));
+    auto *lbph = dynamic_cast<cv::face::LBPHFaceRecognizer *>(rec.get());
+    if (lbph)
+        save_lbph_store(cfg, *lbph, tmp, model_path, log);
+    else
+        ::unlink(fa_lbph_path(model_path).c_str());
+
+    SubspaceModel trained;
+    auto *basic = dynamic_cast<cv::face::BasicFaceRecognizer *>(rec.get());
+    if (!sub && basic) {
+        subspace_from_recognizer(*basic, trained);
+        sub = &trained;
+    }
+    if (sub)
+        save_subspace_store(cfg, *sub, tmp, model_path, log);
+    else
+        ::unlink(fa_subspace_path(model_path).c_str());
 
-        cv::Mat emb;
-        std::string log_emb;
-        if (!compute_sface_embedding(cfg, resized, rp, emb, log_emb)) {
-            log += "Failed to compute test embedding.\n";
-            log += log_emb;
-            return false;
-        }
+    return commit_staged(tmp, model_path);
+}
+
+//
+// LBPH keeps one histogram per image, so new images are folded into the
+// existing model with update(). Eigen/Fisher projections depend on the
+// whole set, as does dropping an image, so those retrain from scratch.
+// Either way nothing is rewritten when the directory did not change.
+//
+static bool train_classic(
+    const FacialAuthConfig &cfg,
+    FaTrainingMethod method,
+    const std::string &imgdir,
+    const std::string &model_path,
+    bool force_overwrite,
+    std::string &log
+)
+{
+    if (!is_dir(imgdir)) {
+        log += "Image directory does not exist: " + imgdir + "\n";
+        return false;
+    }
 
-        double best_sim = -1.0;
-        int best_idx = -1;
+    std::vector<cv::String> files = list_enroll_images(imgdir);
 
-        for (size_t i = 0; i < gallery.size(); ++i) {
-            double sim = cosine_similarity(emb, gallery[i]);
-            if (sim > best_sim) {
-                best_sim = sim;
-                best_idx = (int)i;
-            }
-        }
+    if (files.empty()) {
+        log += "No images found in: " + imgdir + "\n";
+        return false;
+    }
 
-        best_conf  = best_sim;
-        best_label = (best_idx >= 0) ? 0 : -1;
+    std::string err;
+    cv::Ptr<cv::face::FaceRecognizer> rec = create_classic_recognizer(method, cfg, err);
+    if (!rec) {
+        log += "Unsupported training method: " + err + "\n";
+        return false;
+    }
 
-        double thr;
-        if (threshold_override >= 0.0) {
-            thr = threshold_override;
-        } else {
-            std::string rp_low = rp;
-            std::transform(rp_low.begin(), rp_low.end(), rp_low.begin(),
-                           [](unsigned char c){ return std::tolower(c); });
-            if (rp_low.find("int8") != std::string::npos) {
-                thr = cfg.sface_int8_threshold;
-            } else {
-                thr = cfg.sface_fp32_threshold;
-            }
-        }
+    std::vector<FaManifestEntry> old_manifest;
+    cv::Ptr<cv::face::FaceRecognizer> old_rec;
+    size_t old_rows = 0;
 
-        if (best_sim >= thr) {
-            log += "SFace similarity " + std::to_string(best_sim) +
-            " >= threshold " + std::to_string(thr) + " (accepted)\n";
-            return true;
-        } else {
-            log += "SFace similarity " + std::to_string(best_sim) +
-            " < threshold " + std::to_string(thr) + " (rejected)\n";
-            return false;
-        }
-    } else {
-        // Classic LBPH/Eigen/Fisher branch
-        cv::Ptr<cv::face::FaceRecognizer> rec;
+    if (file_exists(model_path) && !force_overwrite) {
+        bool usable = false;
         try {
-            // Let OpenCV decide which concrete recognizer to instantiate
-            rec = cv::Algorithm::load<cv::face::FaceRecognizer>(modelPath);
-        } catch (const cv::Exception &e) {
-            log += "Failed to load classic model: ";
-            log += e.what();
-            log += "\n";
-            return false;
+            cv::FileStorage fs(model_path, cv::FileStorage::READ);
+            usable = fs.isOpened() &&
+                     fs.getFirstTopLevelNode().name() == rec->getDefaultName() &&
+                     read_manifest(fs["manifest"], old_manifest);
+        } catch (...) {
         }
-
-        if (!rec) {
-            log += "Failed to load classic model: Algorithm::load returned null.\n";
+        if (!usable) {
+            log += "Model file already exists (use --force to overwrite): " + model_path + "\n";
             return false;
         }
 
-        cv::Mat frame;
-        if (!capture_frame(cap, frame, cfg, log)) {
-            log += "fa_test_user: cannot capture frame.\n";
-            return false;
+        if (method == FA_METHOD_LBPH) {
+            old_rec = load_classic_model(model_path, log);
+            auto *lbph = dynamic_cast<cv::face::LBPHFaceRecognizer *>(old_rec.get());
+            if (lbph)
+                old_rows = lbph->getHistograms().size();
+        } else {
+            for (const auto &m : old_manifest)
+                old_rows = std::max(old_rows, (size_t)(m.row + 1));
         }
+    }
 
-        cv::Rect face_rect;
-        if (!det.detect(frame, face_rect)) {
-            log += "No face detected in test frame.\n";
-            return false;
-        }
+    ManifestDiff d;
+    diff_manifest(files, old_manifest, old_rows, d, log);
 
-        cv::Mat face = frame(face_rect).clone();
-        cv::Mat gray;
+    if (!old_manifest.empty() && d.todo.empty() && d.dropped == 0) {
+        log += "Classic model is up to date: " + model_path + "\n";
+        return true;
+    }
+
+    const bool update = old_rec && method == FA_METHOD_LBPH && d.dropped == 0;
+    if (!update) {
+        // Full retrain: every readable image goes through the detector.
+        d.todo.clear();
+        d.todo_slot.clear();
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (d.manifest[i].hash.empty() &&
+                !file_content_hash(files[i], d.manifest[i].hash))
+                continue;
+            d.reuse[i] = -1;
+            d.todo.push_back(files[i]);
+            d.todo_slot.push_back(i);
+        }
+    }
+
+    // HAAR is best for classic training
+    std::vector<EnrollSample> samples;
+    if (!enroll_images(cfg, d.todo, FA_DET_HAAR, cfg.haar_cascade_path,
+                       false, samples, log)) {
+        log += "Failed to initialize Haar detector for classic training.\n";
+        return false;
+    }
+
+    for (size_t i = 0; i < files.size(); ++i)
+        if (d.reuse[i] >= 0)
+            d.manifest[i].row = old_manifest[d.reuse[i]].row;
+
+    // In update mode the existing histograms carry no hash: new faces are
+    // only compared with each other.
+    NearDupFilter dedup(cfg);
+    size_t rows = update ? old_rows : 0;
+    std::vector<cv::Mat> faces;
+    std::vector<int> labels;
+    for (size_t k = 0; k < samples.size(); ++k) {
+        if (!samples[k].ok || !dedup.accept_hash(face_dhash(samples[k].data)))
+            continue;
+        d.manifest[d.todo_slot[k]].row = (int)(rows + faces.size());
+        faces.push_back(samples[k].data);
+        labels.push_back(0);
+    }
+    prune_manifest(d.manifest);
+    dedup.report(log);
+
+    SubspaceModel sub;
+    bool randomized = false;
+    if (update) {
+        if (!faces.empty())
+            old_rec->update(faces, labels);
+        rec = old_rec;
+    } else {
+        if (faces.empty()) {
+            log += "No valid faces found for classic training.\n";
+            return false;
+        }
+        randomized = method == FA_METHOD_EIGEN && use_randomized_pca(cfg, faces.size());
+        if (randomized) {
+            if (!train_eigen_randomized(cfg, faces, labels, sub, log))
+                return false;
+            log += "Eigenfaces trained with randomized PCA (" +
+                   std::to_string(sub.num_components) + " components)\n";
+        } else {
+            rec->train(faces, labels);
+        }
+    }
+
+    if (!save_classic_model(cfg, rec, model_path, d.manifest, log,
+                            randomized ? &sub : nullptr)) {
+        log += "Cannot write classic model: " + model_path + "\n";
+        return false;
+    }
+
+    if (update) {
+        log += "Classic model updated: " + std::to_string(faces.size()) +
+               " new histogram(s)\n";
+    }
+    log += "Classic model saved to: " + model_path + "\n";
+    return true;
+}
+
+// ==========================================================
+// Public API: capture images
+// ==========================================================
+
+static int next_image_index(const std::string &imgdir)
+{
+    int next = 0;
+    if (!is_dir(imgdir))
+        return next;
+
+    for (const auto &e : fs::directory_iterator(imgdir)) {
+        if (!e.is_regular_file())
+            continue;
+        try {
+            int idx = std::stoi(e.path().stem().string());
+            if (idx >= next)
+                next = idx + 1;
+        } catch (...) {
+        }
+    }
+    return next;
+}
+
+// What fa_capture_images() keeps of each accepted frame on disk.
+static bool save_capture_image(
+    const FacialAuthConfig &cfg,
+    const cv::Mat &frame,
+    const cv::Rect &face,
+    const std::string &outfile
+)
+{
+    cv::Mat out = frame;
+
+    if (cfg.capture_save == "face") {
+        // Keep some context so the detector finds the face again on training.
+        int mx = face.width / 4, my = face.height / 4;
+        cv::Rect r(face.x - mx, face.y - my, face.width + 2 * mx, face.height + 2 * my);
+        out = frame(r & cv::Rect(0, 0, frame.cols, frame.rows));
+    } else if (cfg.capture_max_width > 0 && frame.cols > cfg.capture_max_width) {
+        double f = (double)cfg.capture_max_width / frame.cols;
+        cv::resize(frame, out, cv::Size(), f, f, cv::INTER_AREA);
+    }
+
+    return cv::imwrite(outfile, out);
+}
+
+//
+// Streaming enrollment: existing gallery and manifest of model_path, so new
+// rows can be appended. Empty when the model is absent or being replaced.
+//
+static bool load_gallery_for_append(
+    const FacialAuthConfig &cfg,
+    const std::string &model_path,
+    std::vector<cv::Mat> &embeds,
+    std::vector<FaManifestEntry> &manifest,
+    std::string &log
+)
+{
+    embeds.clear();
+    manifest.clear();
+    if (cfg.force_overwrite || !file_exists(model_path))
+        return true;
+
+    std::string rec_profile, det_profile;
+    if (!fa_load_sface_manifest(model_path, rec_profile, det_profile, manifest)) {
+        log += "[ERROR] Model file already exists (use --force to overwrite): " +
+               model_path + "\n";
+        return false;
+    }
+    if (rec_profile != cfg.recognizer_profile || det_profile != cfg.detector_profile) {
+        log += "[ERROR] Model was built with recognizer '" + rec_profile +
+               "' and detector '" + det_profile + "' (use --force to rebuild)\n";
+        return false;
+    }
+    fa_load_sface_model(model_path, embeds);
+    return true;
+}
+
+bool fa_capture_images(
+    const std::string &user,
+    const FacialAuthConfig &cfg,
+    const std::string &format,
+    std::string &log
+)
+{
+    std::string imgdir = fa_user_image_dir(cfg, user);
+    std::string img_format = format.empty() ? cfg.image_format : format;
+    const bool save = cfg.capture_save != "none";
+    const bool stream = cfg.capture_embed;
+
+    if (stream && cfg.method != FA_METHOD_SFACE) {
+        log += "[ERROR] capture_embed requires training_method=sface.\n";
+        return false;
+    }
+    if (!stream && !save) {
+        log += "[ERROR] capture_save=none only makes sense with capture_embed.\n";
+        return false;
+    }
+
+    std::string model_path = fa_user_model_path(cfg, user);
+    std::vector<cv::Mat> gallery;
+    std::vector<FaManifestEntry> manifest;
+    cv::dnn::Net net;
+    if (stream) {
+        if (!load_gallery_for_append(cfg, model_path, gallery, manifest, log))
+            return false;
+        if (!load_sface_net(cfg, cfg.sface_path, net, log)) {
+            log += "[ERROR] Cannot load SFace model.\n";
+            return false;
+        }
+    }
+    const size_t old_rows = gallery.size();
+
+    // New frames must also differ from what the gallery already holds.
+    NearDupFilter dedup(cfg);
+    dedup.embeds = gallery;
+
+    if (cfg.force_overwrite && is_dir(imgdir)) {
+        for (const auto &e : fs::directory_iterator(imgdir)) {
+            if (e.is_regular_file())
+                fs::remove(e.path());
+        }
+    }
+    if (save)
+        ensure_dirs(imgdir);
+
+    int start_index = next_image_index(imgdir);
+
+    cv::VideoCapture cap;
+    if (!open_camera(cap, cfg, log)) {
+        log += "[ERROR] Cannot open camera.\n";
+        return false;
+    }
+
+    DetectorWrapper det;
+    if (!init_detector(cfg, det, log)) {
+        log += "[ERROR] Cannot initialize detector.\n";
+        return false;
+    }
+
+    // Give up after a bounded number of frames without a usable face.
+    const int max_frames = std::max(cfg.frames, 1) * 10;
+    int saved = 0;
+
+    for (int n = 0; n < max_frames && saved < cfg.frames; ++n) {
+        cv::Mat frame;
+        if (!capture_frame(cap, frame, cfg, log))
+            break;
+
+        cv::Rect face;
+        if (!det.detect(frame, face)) {
+            FA_INFO("No face detected");
+            continue;
+        }
+
+        if (face.width <= 0 || face.height <= 0 ||
+            face.x < 0 || face.y < 0 ||
+            face.x + face.width  > frame.cols ||
+            face.y + face.height > frame.rows)
+        {
+            FA_INFO("Invalid bounding box, image discarded");
+            continue;
+        }
+
+        FA_DBG("Face detected: x=%d y=%d w=%d h=%d",
+               face.x, face.y, face.width, face.height);
+
+        // Same crop/resize as enrollment from files
+        FaManifestEntry entry;
+        if (stream) {
+            cv::Mat resized, emb;
+            cv::resize(frame(face), resized, cv::Size(112, 112));
+            if (!compute_sface_embedding(net, resized, emb, log))
+                continue;
+            if (!dedup.accept_embedding(emb)) {
+                FA_INFO("Near-duplicate face, frame discarded");
+                continue;
+            }
+            entry.row = (int)gallery.size();
+            gallery.push_back(emb);
+        } else if (!dedup.accept_hash(face_dhash(frame(face)))) {
+            FA_INFO("Near-duplicate face, frame discarded");
+            continue;
+        }
+
+        if (save) {
+            int idx = start_index + saved;
+            std::string outfile = imgdir + "/" + std::to_string(idx) + "." + img_format;
+
+            if (!save_capture_image(cfg, frame, face, outfile)) {
+                log += "[ERROR] Cannot save image: " + outfile + "\n";
+                if (!stream)
+                    continue;
+            } else {
+                FA_INFO("Saved: %s", outfile.c_str());
+                entry.file = fs::path(outfile).filename().string();
+                file_stamp(outfile, entry.stamp);
+                file_content_hash(outfile, entry.hash);
+            }
+        }
+
+        ++saved;
+        if (stream)
+            manifest.push_back(entry);
+
+        if (cfg.sleep_ms > 0) {
+            sleep_ms_int(cfg.sleep_ms);
+        }
+    }
+
+    if (dedup.dropped > 0) {
+        log += "[INFO] ";
+        dedup.report(log);
+    }
+
+    if (saved == 0) {
+        log += "[WARN] No images saved: no face detected in captured frames.\n";
+        return false;
+    }
+
+    if (stream) {
+        if (!fa_save_sface_model(cfg, cfg.recognizer_profile, model_path,
+                                 gallery, &manifest)) {
+            log += "[ERROR] Failed to save SFace model: " + model_path + "\n";
+            return false;
+        }
+        log += "[INFO] Gallery updated: " + std::to_string(gallery.size() - old_rows) +
+               " new rows, " + std::to_string(gallery.size()) + " total (" +
+               model_path + ")\n";
+    }
+
+    log += "[INFO] Capture completed. Images saved: " +
+    std::to_string(save ? saved : 0) + "\n";
+    return true;
+}
+
+// ==========================================================
+// Training helpers (SFace gallery)
+// ==========================================================
+
+//
+// Builds or updates the SFace gallery. With an existing version 2 model
+// and no force_overwrite, only images whose size/mtime and content hash
+// are unknown get embedded; rows of deleted images are dropped. Rows are
+// always laid out in sorted file order, so the result matches a full
+// rebuild of the same directory.
+//
+static bool train_sface(
+    const FacialAuthConfig &cfg,
+    const std::string &imgdir,
+    const std::string &model_path,
+    std::string &log
+)
+{
+    std::vector<cv::String> files = list_enroll_images(imgdir);
+
+    if (files.empty()) {
+        log += "No images found for SFace training in: " + imgdir + "\n";
+        return false;
+    }
+
+    std::vector<FaManifestEntry> old_manifest;
+    std::vector<cv::Mat> old_embeds;
+    bool incremental = false;
+
+    if (file_exists(model_path) && !cfg.force_overwrite) {
+        std::string rec_profile, det_profile;
+        if (!fa_load_sface_manifest(model_path, rec_profile, det_profile, old_manifest)) {
+            log += "Model file already exists (use --force to overwrite): " + model_path + "\n";
+            return false;
+        }
+        if (rec_profile != cfg.recognizer_profile || det_profile != cfg.detector_profile) {
+            log += "Model was built with recognizer '" + rec_profile + "' and detector '" +
+                   det_profile + "' (use --force to rebuild): " + model_path + "\n";
+            return false;
+        }
+        // An empty gallery is fine here: every row may have been skipped.
+        fa_load_sface_model(model_path, old_embeds);
+        incremental = true;
+    }
+
+    ManifestDiff d;
+    diff_manifest(files, old_manifest, old_embeds.size(), d, log);
+
+    if (incremental && d.todo.empty() && d.dropped == 0) {
+        log += "SFace model is up to date: " + model_path + "\n";
+        return true;
+    }
+
+    std::vector<EnrollSample> samples;
+    if (!d.todo.empty() &&
+        !enroll_images(cfg, d.todo, cfg.detector, cfg.detector_path,
+                       true, samples, log)) {
+        log += "fa_train_user: cannot initialize detector or SFace model.\n";
+        return false;
+    }
+
+    std::vector<const cv::Mat *> row_of(files.size(), nullptr);
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (d.reuse[i] >= 0) {
+            int r = old_manifest[d.reuse[i]].row;
+            if (r >= 0)
+                row_of[i] = &old_embeds[r];
+        }
+    }
+    for (size_t k = 0; k < d.todo.size(); ++k)
+        if (samples[k].ok)
+            row_of[d.todo_slot[k]] = &samples[k].data;
+
+    // Near-duplicates keep their manifest entry (row -1) so they are not
+    // embedded again on the next run.
+    NearDupFilter dedup(cfg);
+    std::vector<cv::Mat> embeddings;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (d.manifest[i].hash.empty())
+            continue;   // unreadable, retried next run
+        bool keep = row_of[i] && dedup.accept_embedding(*row_of[i]);
+        d.manifest[i].row = keep ? (int)embeddings.size() : -1;
+        if (keep)
+            embeddings.push_back(*row_of[i]);
+    }
+    prune_manifest(d.manifest);
+
+    // Rows streamed by facial_capture without saving the frame
+    for (const auto &m : old_manifest) {
+        if (!m.file.empty() || m.row < 0 || m.row >= (int)old_embeds.size())
+            continue;
+        if (!dedup.accept_embedding(old_embeds[m.row]))
+            continue;
+        FaManifestEntry e = m;
+        e.row = (int)embeddings.size();
+        embeddings.push_back(old_embeds[m.row]);
+        d.manifest.push_back(e);
+    }
+    dedup.report(log);
+
+    if (embeddings.empty()) {
+        log += "No embeddings computed for SFace training.\n";
+        return false;
+    }
+
+    if (!fa_save_sface_model(cfg, cfg.recognizer_profile, model_path,
+                             embeddings, &d.manifest)) {
+        log += "Failed to save SFace model: " + model_path + "\n";
+        return false;
+    }
+
+    if (incremental) {
+        log += "SFace model updated: " + std::to_string(d.todo.size()) +
+               " new image(s), " + std::to_string(d.dropped) +
+               " removed, " + std::to_string(embeddings.size()) + " rows\n";
+    }
+    log += "SFace model saved to: " + model_path + "\n";
+    return true;
+}
+
+// ==========================================================
+// Public API: train user
+// ==========================================================
+
+bool fa_train_user(
+    const std::string &user,
+    const FacialAuthConfig &cfg,
+    std::string &log
+)
+{
+    std::string imgdir     = fa_user_image_dir(cfg, user);
+    std::string model_path = fa_user_model_path(cfg, user);
+
+    if (!is_dir(imgdir)) {
+        log += "fa_train_user: image directory does not exist: " + imgdir + "\n";
+        return false;
+    }
+
+    if (cfg.method == FA_METHOD_INVALID) {
+        log += "Unsupported training method: " + cfg.training_method + "\n";
+        return false;
+    }
+
+    if (cfg.method == FA_METHOD_SFACE) {
+        return train_sface(cfg, imgdir, model_path, log);
+    } else {
+        return train_classic(
+            cfg,
+            cfg.method,
+            imgdir,
+            model_path,
+            cfg.force_overwrite,
+            log
+        );
+    }
+}
+
+// ==========================================================
+// Public API: offline evaluation
+// ==========================================================
+
+static double seconds_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static bool eval_accepts(const FaEvalResult &r, double score, double thr)
+{
+    return r.higher_is_better ? score >= thr : score < thr;
+}
+
+static FaEvalPoint eval_point(const FaEvalResult &r, double thr)
+{
+    size_t fa = 0, fr = 0;
+    for (double s : r.impostor)
+        fa += eval_accepts(r, s, thr);
+    for (double s : r.genuine)
+        fr += !eval_accepts(r, s, thr);
+
+    FaEvalPoint p;
+    p.threshold = thr;
+    p.far = r.impostor.empty() ? 0.0 : (double)fa / r.impostor.size();
+    p.frr = r.genuine.empty()  ? 0.0 : (double)fr / r.genuine.size();
+    return p;
+}
+
+// ROC/DET points evenly spaced over the finite scores, and the EER from
+// a sweep over every distinct score.
+static void eval_curves(FaEvalResult &r, int roc_points)
+{
+    std::vector<double> all;
+    for (double s : r.genuine)
+        if (std::isfinite(s)) all.push_back(s);
+    for (double s : r.impostor)
+        if (std::isfinite(s)) all.push_back(s);
+
+    r.at_threshold = eval_point(r, r.threshold);
+    r.roc.clear();
+    if (all.empty())
+        return;
+
+    std::sort(all.begin(), all.end());
+    all.erase(std::unique(all.begin(), all.end()), all.end());
+
+    const double lo = all.front(), hi = all.back();
+    const int n = std::max(roc_points, 2);
+    for (int i = 0; i < n; ++i)
+        r.roc.push_back(eval_point(r, lo + (hi - lo) * i / (n - 1)));
+
+    // Both rates are monotonic in the threshold: bisect for the crossing.
+    size_t a = 0, b = all.size() - 1;
+    auto gap = [&](size_t i) {
+        FaEvalPoint p = eval_point(r, all[i]);
+        return r.higher_is_better ? p.frr - p.far : p.far - p.frr;
+    };
+    while (b - a > 1) {
+        size_t m = (a + b) / 2;
+        (gap(m) < 0.0 ? a : b) = m;
+    }
+    FaEvalPoint pa = eval_point(r, all[a]), pb = eval_point(r, all[b]);
+    r.eer = (std::abs(pa.far - pa.frr) <= std::abs(pb.far - pb.frr)) ? pa : pb;
+    double rate = (r.eer.far + r.eer.frr) / 2.0;
+    r.eer.far = r.eer.frr = rate;
+}
+
+bool fa_eval_dataset(
+    const FacialAuthConfig &cfg,
+    const FaEvalOptions &opt,
+    FaEvalResult &res,
+    std::string &log
+)
+{
+    res = FaEvalResult();
+
+    if (cfg.method == FA_METHOD_INVALID) {
+        log += "Unsupported training method: " + cfg.training_method + "\n";
+        return false;
+    }
+    if (!is_dir(opt.dataset)) {
+        log += "Dataset directory does not exist: " + opt.dataset + "\n";
+        return false;
+    }
+
+    const bool sface = cfg.method == FA_METHOD_SFACE;
+
+    res.method           = fa_method_name(cfg.method);
+    res.detector         = cfg.detector_profile;
+    res.recognizer       = sface ? cfg.recognizer_profile : std::string();
+    res.higher_is_better = sface;
+    res.threshold        = sface                          ? cfg.sface_active_threshold :
+                           cfg.method == FA_METHOD_EIGEN  ? cfg.eigen_threshold :
+                           cfg.method == FA_METHOD_FISHER ? cfg.fisher_threshold :
+                                                            cfg.lbph_threshold;
+
+    // Users and their enrollment/probe split
+    std::vector<std::string> users;
+    std::error_code ec;
+    for (const auto &e : fs::directory_iterator(opt.dataset, ec))
+        if (e.is_directory(ec))
+            users.push_back(e.path().filename().string());
+    std::sort(users.begin(), users.end());
+
+    std::vector<cv::String> enroll_files, probe_files;
+    std::vector<int> enroll_user, probe_user;
+    for (size_t u = 0; u < users.size(); ++u) {
+        std::vector<cv::String> files = list_enroll_images(opt.dataset + "/" + users[u]);
+        if (files.empty())
+            continue;
+        size_t k = opt.enroll_per_user > 0 ? std::min(files.size(), (size_t)opt.enroll_per_user)
+                                           : (files.size() + 1) / 2;
+        for (size_t i = 0; i < files.size(); ++i) {
+            auto &dst   = (i < k) ? enroll_files : probe_files;
+            auto &owner = (i < k) ? enroll_user  : probe_user;
+            dst.push_back(files[i]);
+            owner.push_back((int)u);
+        }
+    }
+
+    res.users         = users.size();
+    res.enroll_images = enroll_files.size();
+    res.probe_images  = probe_files.size();
+    if (probe_files.empty()) {
+        log += "No probe images in: " + opt.dataset + "\n";
+        return false;
+    }
+
+    // Feature extraction, as fa_train_user() would do it. Classic models
+    // are trained on Haar crops, so their probes are cropped the same way:
+    // two detectors would measure the crop mismatch, not the recognizer.
+    std::vector<EnrollSample> enrolled, probes;
+    std::string elog;
+
+    const FaDetectorProfile det_kind = sface ? cfg.detector : FA_DET_HAAR;
+    const std::string      &det_path = sface ? cfg.detector_path : cfg.haar_cascade_path;
+    if (!sface)
+        res.detector = "haar";
+
+    auto t0 = std::chrono::steady_clock::now();
+    bool ok = enroll_images(cfg, enroll_files, det_kind, det_path,
+                            sface, enrolled, elog);
+    res.enroll_seconds = seconds_since(t0);
+    if (!ok) {
+        log += elog;
+        return false;
+    }
+
+    t0 = std::chrono::steady_clock::now();
+    ok = enroll_images(cfg, probe_files, det_kind, det_path,
+                       sface, probes, elog);
+    res.probe_seconds = seconds_since(t0);
+    if (!ok) {
+        log += elog;
+        return false;
+    }
+    FA_DBG("%s", elog.c_str());
+
+    // In-memory models, one per user with enrolled faces
+    std::vector<std::vector<cv::Mat>> galleries(users.size());
+    std::vector<std::vector<cv::Mat>> faces(users.size());
+    for (size_t i = 0; i < enrolled.size(); ++i) {
+        if (!enrolled[i].ok)
+            continue;
+        ++res.enroll_faces;
+        (sface ? galleries : faces)[enroll_user[i]].push_back(enrolled[i].data);
+    }
+
+    // No threshold while scoring: predict() must report every distance.
+    FacialAuthConfig open_cfg = cfg;
+    open_cfg.lbph_threshold   = DBL_MAX;
+    open_cfg.eigen_threshold  = DBL_MAX;
+    open_cfg.fisher_threshold = DBL_MAX;
+
+    std::vector<cv::Ptr<cv::face::FaceRecognizer>> recs(users.size());
+    if (!sface) {
+        for (size_t u = 0; u < users.size(); ++u) {
+            if (faces[u].empty())
+                continue;
+            std::string err;
+            recs[u] = create_classic_recognizer(cfg.method, open_cfg, err);
+            try {
+                if (recs[u])
+                    recs[u]->train(faces[u], std::vector<int>(faces[u].size(), 0));
+            } catch (const std::exception &e) {
+                err = e.what();
+                recs[u].reset();
+            }
+            if (!recs[u]) {
+                log += "Cannot train " + res.method + " model for " + users[u] + ": " + err + "\n";
+                return false;
+            }
+        }
+    }
+
+    std::vector<int> targets;
+    for (size_t u = 0; u < users.size(); ++u)
+        if (sface ? !galleries[u].empty() : (bool)recs[u])
+            targets.push_back((int)u);
+
+    // Every probe against every model, on the enrollment worker count
+    const double reject = sface ? -std::numeric_limits<double>::infinity()
+                                :  std::numeric_limits<double>::infinity();
+    std::vector<double> scores(probes.size() * targets.size(), reject);
+
+    for (const auto &p : probes)
+        res.probe_faces += p.ok;
+
+    res.threads = enroll_workers(cfg, probes.size());
+    std::atomic<size_t> next{0};
+    auto run = [&]() {
+        for (size_t i = next++; i < probes.size(); i = next++) {
+            if (!probes[i].ok)
+                continue;
+            for (size_t t = 0; t < targets.size(); ++t) {
+                double &out = scores[i * targets.size() + t];
+                if (sface) {
+                    for (const auto &g : galleries[targets[t]])
+                        out = std::max(out, cosine_similarity(probes[i].data, g));
+                } else {
+                    int label = -1;
+                    recs[targets[t]]->predict(probes[i].data, label, out);
+                }
+            }
+        }
+    };
+
+    t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 1; t < res.threads; ++t)
+        pool.emplace_back(run);
+    run();
+    for (auto &th : pool)
+        th.join();
+    res.match_seconds = seconds_since(t0);
+
+    for (size_t i = 0; i < probes.size(); ++i)
+        for (size_t t = 0; t < targets.size(); ++t)
+            (probe_user[i] == targets[t] ? res.genuine : res.impostor)
+                .push_back(scores[i * targets.size() + t]);
+
+    eval_curves(res, opt.roc_points);
+    return true;
+}
+
+// ==========================================================
+// Public API: test user
+// ==========================================================
+
+// ==========================================================
+// User model cache (bounded LRU, inotify invalidation)
+// ==========================================================
+
+static std::shared_ptr<const FaUserModel> load_user_model(
+    const std::string &path,
+    std::string &log
+)
+{
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        log += "Model file not found: " + path + "\n";
+        return nullptr;
+    }
+
+    auto m = std::make_shared<FaUserModel>();
+    m->path  = path;
+    m->mtime = st.st_mtime;
+    m->size  = st.st_size;
+
+    // LBPH with a fresh binary store: no XML parsing at all.
+    auto store = std::make_shared<FaLbphModel>();
+    int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    if (store->open(fa_lbph_path(path), (int64_t)st.st_size, mtime_ns, log)) {
+        FA_DBG("LBPH store %s: %zu rows, %s kernels",
+               fa_lbph_path(path).c_str(), store->rows(), fa_lbph_kernel_name());
+        m->kind = FaUserModel::CLASSIC;
+        m->lbph = store;
+        return m;
+    }
+
+    // Eigen/Fisher likewise.
+    auto proj = std::make_shared<FaSubspaceModel>();
+    if (proj->open(fa_subspace_path(path), (int64_t)st.st_size, mtime_ns, log)) {
+        FA_DBG("Projection store %s: %zu rows, %zu components",
+               fa_subspace_path(path).c_str(), proj->rows(), proj->components());
+        m->kind = FaUserModel::CLASSIC;
+        m->subspace = proj;
+        return m;
+    }
+
+    std::string type;
+    try {
+        cv::FileStorage fs(path, cv::FileStorage::READ);
+        if (fs.isOpened())
+            fs["type"] >> type;
+    } catch (...) {
+    }
+
+    if (type == "sface") {
+        m->kind = FaUserModel::SFACE;
+        if (!fa_load_sface_model(path, m->gallery)) {
+            log += "Failed to load SFace model: " + path + "\n";
+            return nullptr;
+        }
+    } else {
+        m->kind = FaUserModel::CLASSIC;
+        m->classic = load_classic_model(path, log);
+        if (!m->classic)
+            return nullptr;
+    }
+    return m;
+}
+
+FaModelCache::FaModelCache(size_t capacity)
+    : capacity_(capacity ? capacity : 1)
+{
+}
+
+FaModelCache::~FaModelCache()
+{
+    stop_watch();
+}
+
+void FaModelCache::touch_locked(Map::iterator it)
+{
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+}
+
+void FaModelCache::insert_locked(const std::string &path,
+                                 std::shared_ptr<const FaUserModel> model)
+{
+    auto it = entries_.find(path);
+    if (it != entries_.end()) {
+        it->second.model = std::move(model);
+        touch_locked(it);
+        return;
+    }
+
+    while (entries_.size() >= capacity_ && !lru_.empty()) {
+        entries_.erase(lru_.back());
+        lru_.pop_back();
+    }
+
+    lru_.push_front(path);
+    Entry e;
+    e.model = std::move(model);
+    e.lru   = lru_.begin();
+    entries_.emplace(path, std::move(e));
+}
+
+std::shared_ptr<const FaUserModel> FaModelCache::get(const std::string &path,
+                                                     std::string &log)
+{
+    uint64_t epoch;
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        auto it = entries_.find(path);
+        if (it != entries_.end()) {
+            bool fresh = watching_;
+            if (!fresh) {
+                // No inotify: revalidate with stat().
+                struct stat st;
+                fresh = ::stat(path.c_str(), &st) == 0 &&
+                        st.st_mtime == it->second.model->mtime &&
+                        st.st_size  == it->second.model->size;
+            }
+            if (fresh) {
+                touch_locked(it);
+                return it->second.model;
+            }
+        }
+        epoch = epoch_;
+    }
+
+    // Miss: parse outside the lock so other readers are never held up.
+    std::shared_ptr<const FaUserModel> m = load_user_model(path, log);
+
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (!m) {
+        auto it = entries_.find(path);
+        if (it != entries_.end()) {
+            lru_.erase(it->second.lru);
+            entries_.erase(it);
+        }
+        return nullptr;
+    }
+
+    // A change notification raced with the load: serve it, don't cache it.
+    if (epoch == epoch_)
+        insert_locked(path, m);
+    return m;
+}
+
+void FaModelCache::invalidate(const std::string &path)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    ++epoch_;
+    auto it = entries_.find(path);
+    if (it != entries_.end()) {
+        lru_.erase(it->second.lru);
+        entries_.erase(it);
+    }
+}
+
+void FaModelCache::clear()
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    ++epoch_;
+    entries_.clear();
+    lru_.clear();
+}
+
+bool FaModelCache::watch(const std::string &dir)
+{
+    stop_watch();
+    ensure_dirs(dir);
+
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0)
+        return false;
+
+    if (inotify_add_watch(inotify_fd_, dir.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                          IN_DELETE | IN_DELETE_SELF) < 0)
+    {
+        ::close(inotify_fd_);
+        inotify_fd_ = -1;
+        return false;
+    }
+
+    stop_fd_ = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd_ < 0) {
+        ::close(inotify_fd_);
+        inotify_fd_ = -1;
+        return false;
+    }
+
+    dir_ = dir;
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        // Entries loaded before the watch existed may already be stale.
+        ++epoch_;
+        entries_.clear();
+        lru_.clear();
+        watching_ = true;
+    }
+    watcher_ = std::thread(&FaModelCache::watch_loop, this);
+    return true;
+}
+
+void FaModelCache::stop_watch()
+{
+    if (watcher_.joinable()) {
+        uint64_t one = 1;
+        ssize_t r = ::write(stop_fd_, &one, sizeof(one));
+        (void)r;
+        watcher_.join();
+    }
+    if (inotify_fd_ >= 0) ::close(inotify_fd_);
+    if (stop_fd_ >= 0)    ::close(stop_fd_);
+    inotify_fd_ = stop_fd_ = -1;
+
+    std::lock_guard<std::mutex> lk(mutex_);
+    watching_ = false;
+}
+
+void FaModelCache::on_change(const std::string &path, bool removed)
+{
+    bool cached;
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        ++epoch_;
+        cached = entries_.count(path) != 0;
+        if (removed && cached) {
+            auto it = entries_.find(path);
+            lru_.erase(it->second.lru);
+            entries_.erase(it);
+        }
+    }
+    if (removed || !cached)
+        return;
+
+    // Rebuild off the lock; readers keep the previous model until the swap.
+    std::string log;
+    std::shared_ptr<const FaUserModel> m = load_user_model(path, log);
+
+    std::lock_guard<std::mutex> lk(mutex_);
+    auto it = entries_.find(path);
+    if (it == entries_.end())
+        return;
+    if (m) {
+        it->second.model = std::move(m);
+    } else {
+        lru_.erase(it->second.lru);
+        entries_.erase(it);
+    }
+}
+
+void FaModelCache::watch_loop()
+{
+    alignas(struct inotify_event) char buf[4096];
+
+    for (;;) {
+        struct pollfd pfd[2] = {
+            { inotify_fd_, POLLIN, 0 },
+            { stop_fd_,    POLLIN, 0 },
+        };
+        if (::poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfd[1].revents)
+            break;
+
+        ssize_t n = ::read(inotify_fd_, buf, sizeof(buf));
+        if (n <= 0)
+            continue;
+
+        for (char *p = buf; p < buf + n; ) {
+            auto *ev = reinterpret_cast<struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+                // Directory gone: fall back to stat() revalidation.
+                std::lock_guard<std::mutex> lk(mutex_);
+                watching_ = false;
+                continue;
+            }
+            if (ev->mask & IN_Q_OVERFLOW) {
+                clear();
+                continue;
+            }
+            if (ev->len == 0 || ev->name[0] == '.')
+                continue;
+
+            std::string path = dir_ + "/" + ev->name;
+            on_change(path, (ev->mask & (IN_DELETE | IN_MOVED_FROM)) != 0);
+        }
+    }
+}
+
+// ==========================================================
+// SFace cross-request batching
+// ==========================================================
+
+struct FaSfaceBatcher::Slot
+{
+    const cv::Mat *face;
+    cv::Mat       *embedding;
+    std::chrono::steady_clock::time_point arrival;
+    std::string    log;
+    bool           ok   = false;
+    bool           done = false;
+};
+
+// One forward for every face; false when the output is not one row per face.
+static bool sface_forward_batch(
+    cv::dnn::Net &net,
+    const std::vector<cv::Mat> &faces,
+    std::vector<cv::Mat> &embeddings,
+    std::string &log
+)
+{
+    const int n = (int)faces.size();
+    cv::Mat blob = cv::dnn::blobFromImages(faces, 1.0 / 255.0, cv::Size(112, 112),
+                                           cv::Scalar(0, 0, 0), true, false);
+    net.setInput(blob);
+    cv::Mat out = net.forward();
+    if (out.empty() || out.dims < 2 || out.size[0] != n) {
+        log += "SFace forward() did not return one embedding per face.\n";
+        return false;
+    }
+
+    cv::Mat rows = out.reshape(1, n);
+    embeddings.resize(n);
+    for (int i = 0; i < n; ++i) {
+        cv::Mat e;
+        rows.row(i).convertTo(e, CV_32F);
+        double norm = cv::norm(e);
+        if (norm > 0.0)
+            e /= norm;
+        embeddings[i] = e;
+    }
+    return true;
+}
+
+std::shared_ptr<FaSfaceBatcher> FaSfaceBatcher::shared(
+    const FacialAuthConfig &cfg,
+    std::string &log
+)
+{
+    static std::mutex registry_mutex;
+    static std::map<std::string, std::weak_ptr<FaSfaceBatcher>> registry;
+
+    // A rewritten model file gets a new batcher.
+    int64_t size = 0, mtime_ns = 0;
+    stat_stamp(cfg.sface_path, size, mtime_ns);
+    std::string key = cfg.sface_path + '|' + std::to_string(mtime_ns) + '|' +
+                      std::to_string(cfg.dnn_backend_id) + '|' +
+                      std::to_string(cfg.dnn_target_id) + '|' +
+                      std::to_string(cfg.sface_batch_max) + '|' +
+                      std::to_string(cfg.sface_batch_window_ms);
+
+    std::lock_guard<std::mutex> lk(registry_mutex);
+    auto it = registry.find(key);
+    if (it != registry.end())
+        if (auto b = it->second.lock())
+            return b;
+
+    cv::dnn::Net net;
+    if (!load_sface_net(cfg, cfg.sface_path, net, log))
+        return nullptr;
+
+    std::shared_ptr<FaSfaceBatcher> b(
+        new FaSfaceBatcher(net, (size_t)std::max(cfg.sface_batch_max, 1),
+                           std::max(cfg.sface_batch_window_ms, 0)));
+    registry[key] = b;
+    return b;
+}
+
+FaSfaceBatcher::FaSfaceBatcher(cv::dnn::Net net, size_t max_batch, int window_ms)
+    : net_(net), max_batch_(max_batch), window_(std::chrono::milliseconds(window_ms))
+{
+}
+
+void FaSfaceBatcher::begin()
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    ++active_;
+}
+
+void FaSfaceBatcher::end()
+{
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        --active_;
+    }
+    // The waiters may now be everybody left.
+    cv_.notify_all();
+}
+
+// Called with lk held and no batch running; returns with lk held.
+void FaSfaceBatcher::run_batch(std::unique_lock<std::mutex> &lk)
+{
+    const size_t n = std::min(pending_.size(), max_batch_);
+    std::vector<Slot *> batch(pending_.begin(), pending_.begin() + n);
+    pending_.erase(pending_.begin(), pending_.begin() + n);
+    running_ = true;
+    lk.unlock();
+
+    int64_t t0 = fa_usdt_now_us();
+    bool batched = false;
+    std::string err;
+    if (n > 1) {
+        std::vector<cv::Mat> faces, embeddings;
+        for (Slot *sl : batch)
+            faces.push_back(*sl->face);
+        try {
+            batched = sface_forward_batch(net_, faces, embeddings, err);
+        } catch (const std::exception &e) {
+            err += e.what();
+        }
+        if (batched) {
+            for (size_t i = 0; i < n; ++i) {
+                *batch[i]->embedding = embeddings[i];
+                batch[i]->ok = true;
+            }
+        } else {
+            FA_WARN("SFace batched forward of %zu faces failed, "
+                    "embedding them one by one: %s", n, err.c_str());
+        }
+    }
+    if (!batched)
+        for (Slot *sl : batch)
+            sl->ok = compute_sface_embedding(net_, *sl->face, *sl->embedding, sl->log);
+
+    FA_DBG("SFace batch of %zu face(s) in %lld us", n,
+           (long long)(fa_usdt_now_us() - t0));
+
+    lk.lock();
+    for (Slot *sl : batch)
+        sl->done = true;
+    running_ = false;
+    ++batches_;
+    faces_ += n;
+    cv_.notify_all();
+}
+
+bool FaSfaceBatcher::embed(const cv::Mat &face, cv::Mat &embedding, std::string &log)
+{
+    Slot slot;
+    slot.face      = &face;
+    slot.embedding = &embedding;
+    slot.arrival   = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lk(mutex_);
+    pending_.push_back(&slot);
+    cv_.notify_all();
+
+    // Whoever sees a due batch and no forward running becomes the leader.
+    while (!slot.done) {
+        if (running_ || pending_.empty()) {
+            cv_.wait(lk);
+            continue;
+        }
+        auto due = pending_.front()->arrival + window_;
+        if (pending_.size() >= max_batch_ ||
+            pending_.size() >= std::max<size_t>(active_, 1) ||
+            std::chrono::steady_clock::now() >= due)
+            run_batch(lk);
+        else
+            cv_.wait_until(lk, due);
+    }
+
+    log += slot.log;
+    return slot.ok;
+}
+
+// ==========================================================
+// Resident engine (warm detector, SFace net, galleries, camera)
+// ==========================================================
+
+static bool engine_open_camera(
+    FacialAuthEngine &eng,
+    std::string &log,
+    FacialAuthAttempt *attempt = nullptr
+)
+{
+    if (eng.cap.isOpened()) {
+        // Drop the frame buffered while idle so the attempt sees a fresh one.
+        if (attempt_remaining_ms(attempt) >= LOW_BUDGET_MS)
+            eng.cap.grab();
+        return true;
+    }
+
+    if (!open_camera(eng.cap, eng.cfg, log, attempt))
+        return false;
+
+    if (eng.cfg.keep_camera)
+        eng.cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
+    return true;
+}
+
+void fa_engine_release(FacialAuthEngine &eng)
+{
+    eng.cap.release();
+    eng.det = DetectorWrapper();
+    eng.det_ready = false;
+    eng.sface_net = cv::dnn::Net();
+    eng.sface_model.clear();
+    eng.batcher.reset();
+    if (eng.models)
+        eng.models->clear();
+}
+
+// Fixed per-stage split of the verify_frames pipeline: one grab and one
+// detect thread; the embedding stage runs on the attempt's own thread.
+static const size_t PIPELINE_POOL_THREADS = 2;
+
+bool fa_engine_init(
+    FacialAuthEngine &eng,
+    const FacialAuthConfig &cfg,
+    std::string &log
+)
+{
+    fa_engine_release(eng);
+    eng.cfg = cfg;
+
+    eng.pool.reset();
+    if (cfg.method == FA_METHOD_SFACE && cfg.verify_frames > 1)
+        eng.pool.reset(new FaThreadPool(PIPELINE_POOL_THREADS, cfg.cpu_policy));
+
+    eng.models.reset(new FaModelCache(cfg.model_cache_size));
+    if (eng.resident) {
+        fs::path dir = fs::path(cfg.basedir) / "models";
+        if (!eng.models->watch(dir.string()))
+            log += "fa_engine_init: inotify unavailable, models revalidated by stat().\n";
+    }
+
+    if (!init_detector(cfg, eng.det, log)) {
+        log += "fa_engine_init: cannot initialize detector.\n";
+        return false;
+    }
+    eng.det_ready = true;
+
+    if (cfg.method == FA_METHOD_SFACE) {
+        eng.sface_model = cfg.sface_path;
+        if (cfg.sface_batch_max > 1) {
+            eng.batcher = FaSfaceBatcher::shared(cfg, log);
+            if (!eng.batcher) {
+                log += "fa_engine_init: cannot load SFace model.\n";
+                return false;
+            }
+        } else if (!load_sface_net(cfg, eng.sface_model, eng.sface_net, log)) {
+            log += "fa_engine_init: cannot load SFace model.\n";
+            return false;
+        }
+    }
+
+    if (cfg.keep_camera && !engine_open_camera(eng, log, nullptr))
+        log += "fa_engine_init: camera not available, will retry on demand.\n";
+
+    return true;
+}
+
+// Through the shared batcher when the engine has one.
+static bool engine_embed(
+    FacialAuthEngine &eng,
+    const cv::Mat &face,
+    cv::Mat &emb,
+    std::string &log
+)
+{
+    if (eng.batcher)
+        return eng.batcher->embed(face, emb, log);
+    return compute_sface_embedding(eng.sface_net, face, emb, log);
+}
+
+// Best cosine similarity of emb against the gallery.
+static double match_gallery(
+    const cv::Mat &emb,
+    const std::vector<cv::Mat> &gallery,
+    FaTrace *tr,
+    int frame
+)
+{
+    double best_sim = -1.0;
+    int64_t t_match = fa_usdt_now_us();
+    (void)t_match;
+    {
+        FaTraceSpan sp(tr, "match", frame);
+        for (const auto &g : gallery)
+            best_sim = std::max(best_sim, cosine_similarity(emb, g));
+        sp.set_score(best_sim);
+    }
+    FA_PROBE3(gallery_match, (int)gallery.size(), (int64_t)(best_sim * 1e6),
+              fa_usdt_now_us() - t_match);
+    return best_sim;
+}
+
+// Detect, align, embed and match one frame; sim is the best similarity.
+static bool sface_score_frame(
+    FacialAuthEngine &eng,
+    const cv::Mat &frame,
+    const std::vector<cv::Mat> &gallery,
+    int index,
+    double &sim,
+    std::string &log,
+    FacialAuthAttempt *attempt
+)
+{
+    FaTrace *tr = &attempt->trace;
+
+    cv::Rect face_rect;
+    bool found;
+    {
+        FaTraceSpan sp(tr, "detect", index, FA_METRIC_DETECT);
+        found = eng.det.detect(frame, face_rect);
+    }
+    if (!found) {
+        attempt->status = FA_ATTEMPT_NO_FACE;
+        log += "No face detected in test frame.\n";
+        return false;
+    }
+    if (attempt_stop(attempt, log, "after detection"))
+        return false;
+
+    cv::Mat resized;
+    {
+        FaTraceSpan sp(tr, "align", index);
+        cv::Mat face = frame(face_rect).clone();
+        cv::resize(face, resized, cv::Size(112, 112));
+    }
+
+    cv::Mat emb;
+    std::string log_emb;
+    bool embedded;
+    {
+        FaTraceSpan sp(tr, "embed", index, FA_METRIC_EMBED);
+        embedded = engine_embed(eng, resized, emb, log_emb);
+    }
+    if (!embedded) {
+        attempt->status = FA_ATTEMPT_ERROR;
+        log += "Failed to compute test embedding.\n";
+        log += log_emb;
+        return false;
+    }
+    if (attempt_stop(attempt, log, "after embedding"))
+        return false;
+
+    sim = match_gallery(emb, gallery, tr, index);
+    return true;
+}
+
+static bool sface_single_frame(
+    FacialAuthEngine &eng,
+    const std::vector<cv::Mat> &gallery,
+    double &best_sim,
+    std::string &log,
+    FacialAuthAttempt *attempt
+)
+{
+    const FacialAuthConfig &cfg = eng.cfg;
+    FaTrace *tr = &attempt->trace;
+
+    cv::Mat frame;
+    bool got;
+    {
+        FaTraceSpan sp(tr, "first_frame", 0);
+        got = capture_frame(eng.cap, frame, cfg, log, attempt);
+    }
+    if (!got) {
+        attempt->status = FA_ATTEMPT_CAMERA_ERROR;
+        log += "fa_test_user: cannot capture frame.\n";
+        return false;
+    }
+    tr->frames = 1;
+    if (attempt_stop(attempt, log, "after capture"))
+        return false;
+
+    return sface_score_frame(eng, frame, gallery, 0, best_sim, log, attempt);
+}
+
+// Pipelined verification: a frame travels grab -> detect -> embed.
+struct PipeFrame
+{
+    int     index = -1;
+    cv::Mat image;
+};
+
+//
+// Per-stage busy time and item count, and the stage's own trace events:
+// FaTrace is not thread-safe, so each thread records into a private copy
+// that is merged once the pipeline has stopped.
+//
+struct PipeStage
+{
+    const char *name;
+    FaTrace     trace;
+    int         items   = 0;
+    int64_t     busy_us = 0;
+
+    PipeStage(const char *n, const FaTrace &parent) : name(n)
+    {
+        trace.enabled = parent.enabled;
+        trace.t0      = parent.t0;
+    }
+};
+
+static int64_t elapsed_us(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - t0).count();
+}
+
+//
+// Up to verify_frames frames, each stage on its own thread: while the
+// embedder works on frame n the detector handles n+1 and the camera
+// grabs n+2, so throughput follows the slowest stage instead of the sum.
+// Full queues drop their oldest frame: the camera never waits for
+// inference, and inference always gets the freshest frame. The first
+// frame at or above thr ends the attempt, as do cancel and the deadline,
+// both checked between frames in every stage.
+//
+static bool sface_pipeline(
+    FacialAuthEngine &eng,
+    const std::vector<cv::Mat> &gallery,
+    double thr,
+    double &best_sim,
+    std::string &log,
+    FacialAuthAttempt *attempt
+)
+{
+    const FacialAuthConfig &cfg = eng.cfg;
+    FaTrace *tr = &attempt->trace;
+
+    // Every stage timestamps against the same origin.
+    if (tr->enabled && tr->t0 == std::chrono::steady_clock::time_point())
+        tr->t0 = std::chrono::steady_clock::now();
+
+    const size_t depth = (size_t)std::max(cfg.pipeline_depth, 1);
+    FaBoundedQueue<PipeFrame> frames(depth), faces(depth);
+
+    std::atomic<bool> stop{false};
+    std::atomic<bool> camera_error{false};
+    std::string grab_log;
+
+    PipeStage grab("grab", *tr), detect("detect", *tr), embed("embed", *tr);
+
+    auto should_stop = [&]() {
+        return stop.load(std::memory_order_relaxed) ||
+               attempt->cancel.load(std::memory_order_relaxed) ||
+               attempt_remaining_ms(attempt) == 0;
+    };
+
+    // Engine pool threads when there is one, otherwise plain threads.
+    auto start = [&](std::function<void()> fn) {
+        if (eng.pool)
+            return eng.pool->submit(std::move(fn));
+        return std::async(std::launch::async, std::move(fn));
+    };
+
+    std::future<void> grabber = start([&]() {
+        for (int i = 0; i < cfg.verify_frames && !should_stop(); ++i) {
+            PipeFrame f;
+            f.index = i;
+            auto t0 = std::chrono::steady_clock::now();
+            bool got;
+            {
+                FaTraceSpan sp(&grab.trace, "grab", i);
+                got = capture_frame(eng.cap, f.image, cfg, grab_log, attempt);
+            }
+            grab.busy_us += elapsed_us(t0);
+            if (!got) {
+                camera_error = true;
+                break;
+            }
+            ++grab.items;
+            frames.push_drop_oldest(std::move(f));
+        }
+        frames.close();
+    });
+
+    std::future<void> detector = start([&]() {
+        PipeFrame f;
+        while (frames.pop_wait(f, &stop)) {
+            if (should_stop())
+                break;
+            auto t0 = std::chrono::steady_clock::now();
+            cv::Rect face_rect;
+            bool found;
+            {
+                FaTraceSpan sp(&detect.trace, "detect", f.index, FA_METRIC_DETECT);
+                found = eng.det.detect(f.image, face_rect);
+            }
+            if (found) {
+                FaTraceSpan sp(&detect.trace, "align", f.index);
+                cv::Mat aligned;
+                cv::resize(f.image(face_rect), aligned, cv::Size(112, 112));
+                f.image = aligned;
+            }
+            detect.busy_us += elapsed_us(t0);
+            ++detect.items;
+            if (found)
+                faces.push_drop_oldest(std::move(f));
+        }
+        faces.close();
+    });
+
+    bool any_face = false;
+    bool embed_error = false;
+    std::string log_emb;
+    PipeFrame f;
+    while (faces.pop_wait(f, &stop)) {
+        if (should_stop())
+            break;
+        auto t0 = std::chrono::steady_clock::now();
+        cv::Mat emb;
+        bool embedded;
+        {
+            FaTraceSpan sp(&embed.trace, "embed", f.index, FA_METRIC_EMBED);
+            embedded = engine_embed(eng, f.image, emb, log_emb);
+        }
+        if (!embedded) {
+            embed_error = true;
+            stop = true;
+            break;
+        }
+        double sim = match_gallery(emb, gallery, &embed.trace, f.index);
+        embed.busy_us += elapsed_us(t0);
+        ++embed.items;
+
+        any_face = true;
+        best_sim = std::max(best_sim, sim);
+        if (best_sim >= thr)
+            stop = true;
+    }
+    stop = true;
+    // Both stages reference this frame: wait for both before rethrowing.
+    grabber.wait();
+    detector.wait();
+    grabber.get();
+    detector.get();
+
+    // Merge the per-stage traces and report occupancy and latency.
+    for (PipeStage *st : { &grab, &detect, &embed })
+        tr->events.insert(tr->events.end(), st->trace.events.begin(), st->trace.events.end());
+    std::stable_sort(tr->events.begin(), tr->events.end(),
+                     [](const FaTraceEvent &a, const FaTraceEvent &b) {
+                         return a.start_us < b.start_us;
+                     });
+    tr->frames = grab.items;
+    fa_trace_mark(tr, "frames_queue_depth", frames.mean_depth());
+    fa_trace_mark(tr, "faces_queue_depth",  faces.mean_depth());
+
+    FA_DBG("Pipeline: %d frames grabbed, %d detected, %d embedded; "
+           "busy ms grab=%.1f detect=%.1f embed=%.1f; "
+           "dropped frames=%llu faces=%llu; mean depth frames=%.2f faces=%.2f",
+           grab.items, detect.items, embed.items,
+           grab.busy_us / 1000.0, detect.busy_us / 1000.0, embed.busy_us / 1000.0,
+           (unsigned long long)frames.dropped(), (unsigned long long)faces.dropped(),
+           frames.mean_depth(), faces.mean_depth());
+
+    if (embed_error) {
+        attempt->status = FA_ATTEMPT_ERROR;
+        log += "Failed to compute test embedding.\n";
+        log += log_emb;
+        return false;
+    }
+    if (any_face && best_sim >= thr)
+        return true;
+    if (attempt_stop(attempt, log, "in pipeline"))
+        return false;
+    if (camera_error && grab.items == 0) {
+        attempt->status = FA_ATTEMPT_CAMERA_ERROR;
+        log += grab_log;
+        log += "fa_test_user: cannot capture frame.\n";
+        return false;
+    }
+    if (!any_face) {
+        attempt->status = FA_ATTEMPT_NO_FACE;
+        log += "No face detected in " + std::to_string(grab.items) + " test frame(s).\n";
+        return false;
+    }
+    return true;
+}
+
+static bool engine_test_sface(
+    FacialAuthEngine &eng,
+    const std::string &modelPath,
+    double &best_conf,
+    int &best_label,
+    std::string &log,
+    double threshold_override,
+    FacialAuthAttempt *attempt
+)
+{
+    const FacialAuthConfig &cfg = eng.cfg;
+
+    attempt->status = FA_ATTEMPT_ERROR;
+
+    std::shared_ptr<const FaUserModel> model = eng.models->get(modelPath, log);
+    if (!model)
+        return false;
+
+    if (model->kind != FaUserModel::SFACE) {
+        log += "Model is not an SFace gallery: " + modelPath + "\n";
+        return false;
+    }
+
+    const std::vector<cv::Mat> *gallery = &model->gallery;
+    if (gallery->empty()) {
+        log += "SFace model has empty gallery.\n";
+        return false;
+    }
+
+    double thr = (threshold_override >= 0.0) ? threshold_override
+                                             : cfg.sface_active_threshold;
+
+    if (attempt_stop(attempt, log, "before capture"))
+        return false;
+
+    double best_sim = -1.0;
+    bool scored = (cfg.verify_frames > 1)
+        ? sface_pipeline(eng, *gallery, thr, best_sim, log, attempt)
+        : sface_single_frame(eng, *gallery, best_sim, log, attempt);
+    if (!scored)
+        return false;
+
+    best_conf  = best_sim;
+    best_label = 0;
+
+    if (best_sim >= thr) {
+        attempt->status = FA_ATTEMPT_ACCEPT;
+        log += "SFace similarity " + std::to_string(best_sim) +
+        " >= threshold " + std::to_string(thr) + " (accepted)\n";
+        return true;
+    }
+
+    attempt->status = FA_ATTEMPT_REJECT;
+    log += "SFace similarity " + std::to_string(best_sim) +
+    " < threshold " + std::to_string(thr) + " (rejected)\n";
+    return false;
+}
+
+// Detect, align and predict one frame; label is -1 above the model threshold.
+static bool classic_score_frame(
+    FacialAuthEngine &eng,
+    const FaUserModel &model,
+    const cv::Mat &frame,
+    int index,
+    int &label,
+    double &conf,
+    std::string &log,
+    FacialAuthAttempt *attempt
+)
+{
+    FaTrace *tr = &attempt->trace;
+
+    cv::Rect face_rect;
+    bool found;
+    {
+        FaTraceSpan sp(tr, "detect", index, FA_METRIC_DETECT);
+        found = eng.det.detect(frame, face_rect);
+    }
+    if (!found) {
+        attempt->status = FA_ATTEMPT_NO_FACE;
+        log += "No face detected in test frame.\n";
+        return false;
+    }
+    if (attempt_stop(attempt, log, "after detection"))
+        return false;
+
+    cv::Mat gray;
+    {
+        FaTraceSpan sp(tr, "align", index);
+        cv::Mat face = frame(face_rect).clone();
         cv::cvtColor(face, gray, cv::COLOR_BGR2GRAY);
         cv::resize(gray, gray, cv::Size(92, 112));
+    }
+
+    label = -1;
+    conf = 0.0;
+    try {
+        FaTraceSpan sp(tr, "match", index);
+        if (model.lbph) {
+            model.lbph->predict(gray.ptr<unsigned char>(), gray.cols, gray.rows,
+                                gray.step, label, conf);
+        } else if (model.subspace) {
+            if (!model.subspace->predict(gray.ptr<unsigned char>(), gray.cols, gray.rows,
+                                         gray.step, label, conf))
+                throw std::runtime_error("probe size does not match the model");
+        } else {
+            model.classic->predict(gray, label, conf);
+        }
+        sp.set_score(conf);
+    } catch (const std::exception &e) {
+        attempt->status = FA_ATTEMPT_ERROR;
+        log += "Classic predict failed: ";
+        log += e.what();
+        log += "\n";
+        return false;
+    }
+    return true;
+}
+
+static bool engine_test_classic(
+    FacialAuthEngine &eng,
+    const std::string &modelPath,
+    double &best_conf,
+    int &best_label,
+    std::string &log,
+    FacialAuthAttempt *attempt
+)
+{
+    const FacialAuthConfig &cfg = eng.cfg;
+
+    attempt->status = FA_ATTEMPT_ERROR;
+
+    std::shared_ptr<const FaUserModel> model = eng.models->get(modelPath, log);
+    if (!model)
+        return false;
+
+    if (model->kind != FaUserModel::CLASSIC ||
+        (!model->classic && !model->lbph && !model->subspace)) {
+        log += "Model is not a classic recognizer: " + modelPath + "\n";
+        return false;
+    }
+
+    if (attempt_stop(attempt, log, "before capture"))
+        return false;
+
+    FaTrace *tr = &attempt->trace;
+
+    cv::Mat frame;
+    bool got;
+    {
+        FaTraceSpan sp(tr, "first_frame", 0);
+        got = capture_frame(eng.cap, frame, cfg, log, attempt);
+    }
+    if (!got) {
+        attempt->status = FA_ATTEMPT_CAMERA_ERROR;
+        log += "fa_test_user: cannot capture frame.\n";
+        return false;
+    }
+    tr->frames = 1;
+    if (attempt_stop(attempt, log, "after capture"))
+        return false;
+
+    int label = -1;
+    double conf = 0.0;
+    if (!classic_score_frame(eng, *model, frame, 0, label, conf, log, attempt))
+        return false;
+
+    best_label = label;
+    best_conf  = conf;
+
+    // The recognizer answers -1 when the face is beyond its threshold.
+    if (label < 0) {
+        attempt->status = FA_ATTEMPT_REJECT;
+        log += "Classic recognizer: face not recognized, confidence " +
+               std::to_string(conf) + " (rejected)\n";
+        return false;
+    }
+    attempt->status = FA_ATTEMPT_ACCEPT;
+
+    FA_INFO("Classic recognizer predicted label=%d with confidence=%f", label, conf);
+    return true;
+}
+
+static FaMetricResult metric_result(FaAttemptStatus s)
+{
+    switch (s) {
+    case FA_ATTEMPT_ACCEPT:       return FA_RESULT_ACCEPT;
+    case FA_ATTEMPT_REJECT:       return FA_RESULT_REJECT;
+    case FA_ATTEMPT_NO_FACE:      return FA_RESULT_NO_FACE;
+    case FA_ATTEMPT_TIMEOUT:      return FA_RESULT_TIMEOUT;
+    case FA_ATTEMPT_CAMERA_ERROR: return FA_RESULT_CAMERA_ERROR;
+    case FA_ATTEMPT_CANCELLED:    return FA_RESULT_CANCELLED;
+    default:                      return FA_RESULT_ERROR;
+    }
+}
+
+// Called exactly once per attempt, when it is decided.
+static void finish_attempt(
+    const FacialAuthConfig &cfg,
+    const std::string &user,
+    FacialAuthAttempt &attempt,
+    double score
+)
+{
+    fa_metrics_result(metric_result(attempt.status));
+    fa_metrics_observe(FA_METRIC_TOTAL,
+                       std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - attempt.started).count());
+
+    if (!attempt.trace.enabled)
+        return;
+
+    fa_trace_mark(&attempt.trace, "decision", score);
+    fa_trace_emit(fa_trace_json(attempt.trace, user, fa_method_name(cfg.method),
+                                fa_attempt_status_name(attempt.status), score),
+                  cfg.trace_file);
+}
+
+static bool engine_test_user(
+    FacialAuthEngine &eng,
+    const std::string &modelPath,
+    double &best_conf,
+    int &best_label,
+    std::string &log,
+    double threshold_override,
+    FacialAuthAttempt *attempt
+)
+{
+    attempt->status = FA_ATTEMPT_ERROR;
+
+    best_conf = 0.0;
+    best_label = -1;
+
+    if (!file_exists(modelPath)) {
+        log += "Model file not found: " + modelPath + "\n";
+        return false;
+    }
+
+    if (!eng.det_ready) {
+        log += "fa_engine_test_user: engine not initialized.\n";
+        return false;
+    }
+
+    if (eng.cfg.method == FA_METHOD_INVALID) {
+        log += "Unsupported training method: " + eng.cfg.training_method + "\n";
+        return false;
+    }
+
+    if (attempt_stop(attempt, log, "before camera open"))
+        return false;
+
+    bool opened;
+    {
+        FaTraceSpan sp(&attempt->trace, "camera_open", -1, FA_METRIC_CAMERA_OPEN);
+        opened = engine_open_camera(eng, log, attempt);
+    }
+    if (!opened) {
+        if (attempt->status != FA_ATTEMPT_TIMEOUT &&
+            attempt->status != FA_ATTEMPT_CANCELLED)
+            attempt->status = FA_ATTEMPT_CAMERA_ERROR;
+        log += "fa_test_user: cannot open camera.\n";
+        return false;
+    }
+
+    bool ok = false;
+    if (attempt_stop(attempt, log, "after camera open"))
+        ok = false;
+    else if (eng.cfg.method == FA_METHOD_SFACE)
+        ok = engine_test_sface(eng, modelPath, best_conf, best_label,
+                               log, threshold_override, attempt);
+    else
+        ok = engine_test_classic(eng, modelPath, best_conf, best_label,
+                                 log, attempt);
+
+    // An abandoned attempt frees the camera (and its LED) at once.
+    if (!eng.cfg.keep_camera || attempt->status == FA_ATTEMPT_CANCELLED)
+        eng.cap.release();
+
+    return ok;
+}
+
+bool fa_engine_test_user(
+    FacialAuthEngine &eng,
+    const std::string &user,
+    const std::string &modelPath,
+    double &best_conf,
+    int &best_label,
+    std::string &log,
+    double threshold_override,
+    FacialAuthAttempt *attempt
+)
+{
+    FacialAuthAttempt local;
+    if (!attempt)
+        attempt = &local;
+    attempt_start(*attempt, eng.cfg);
+
+    bool ok;
+    {
+        FaCpuScope cpu(eng.cfg.cpu_policy);
+        FaSfaceBatcher::Session batch(eng.batcher.get());
+        ok = engine_test_user(eng, modelPath, best_conf, best_label,
+                              log, threshold_override, attempt);
+    }
+
+    finish_attempt(eng.cfg, user, *attempt, best_conf);
+    return ok;
+}
 
-        int label = -1;
-        double conf = 0.0;
+bool fa_test_user(
+    const std::string &user,
+    const FacialAuthConfig &cfg,
+    const std::string &modelPath,
+    double &best_conf,
+    int &best_label,
+    std::string &log,
+    double threshold_override,
+    FacialAuthAttempt *attempt
+)
+{
+    best_conf = 0.0;
+    best_label = -1;
+
+    if (!file_exists(modelPath)) {
+        log += "Model file not found: " + modelPath + "\n";
+        return false;
+    }
+
+    // The budget covers the cold start below as well.
+    FacialAuthAttempt local;
+    if (!attempt)
+        attempt = &local;
+    attempt_start(*attempt, cfg);
+
+    // One-shot engine: everything is loaded cold and dropped on return.
+    FacialAuthEngine eng;
+    bool ready;
+    {
+        FaTraceSpan sp(&attempt->trace, "engine_init");
+        ready = fa_engine_init(eng, cfg, log);
+    }
+    if (!ready) {
+        attempt->status = FA_ATTEMPT_ERROR;
+        finish_attempt(cfg, user, *attempt, best_conf);
+        return false;
+    }
+    if (attempt_stop(attempt, log, "after model loading")) {
+        finish_attempt(cfg, user, *attempt, best_conf);
+        return false;
+    }
+
+    return fa_engine_test_user(eng, user, modelPath, best_conf, best_label,
+                               log, threshold_override, attempt);
+}
+
+// ==========================================================
+// Public API: asynchronous verification
+// ==========================================================
+
+FaAsyncAttempt::FaAsyncAttempt(Work work, Callback on_done, FacialAuthAttempt *attempt)
+    : attempt_(attempt ? attempt : &own_)
+{
+    efd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (efd_ < 0)
+        FA_WARN("eventfd: %s", std::strerror(errno));
+
+    worker_ = std::thread([this, work = std::move(work), on_done = std::move(on_done)]() {
+        FaAsyncResult r;
         try {
-            rec->predict(gray, label, conf);
+            r.ok = work(*attempt_, r);
+            r.status = attempt_->status;
         } catch (const std::exception &e) {
-            log += "Classic predict failed: ";
-            log += e.what();
-            log += "\n";
-            return false;
+            r.ok = false;
+            r.status = FA_ATTEMPT_ERROR;
+            r.log += std::string("Verification failed: ") + e.what() + "\n";
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            result_ = std::move(r);
+            done_ = true;
         }
+        cv_.notify_all();
+        if (efd_ >= 0) {
+            uint64_t one = 1;
+            (void)!::write(efd_, &one, sizeof(one));
+        }
+        if (on_done)
+            on_done(result_);
+    });
+}
+
+FaAsyncAttempt::~FaAsyncAttempt()
+{
+    cancel();
+    if (worker_.joinable())
+        worker_.join();
+    if (efd_ >= 0)
+        ::close(efd_);
+}
+
+void FaAsyncAttempt::cancel()
+{
+    attempt_->cancel.store(true, std::memory_order_relaxed);
+}
 
-        best_label = label;
-        best_conf  = conf;
+bool FaAsyncAttempt::done() const
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    return done_;
+}
 
-        log += "Classic recognizer predicted label=" +
-        std::to_string(label) + " with confidence=" +
-        std::to_string(conf) + "\n";
+bool FaAsyncAttempt::wait_for(int timeout_ms) const
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    if (timeout_ms < 0) {
+        cv_.wait(lk, [this] { return done_; });
         return true;
     }
+    return cv_.wait_for(lk, std::chrono::milliseconds(timeout_ms),
+                        [this] { return done_; });
+}
+
+const FaAsyncResult &FaAsyncAttempt::get() const
+{
+    wait_for(-1);
+    return result_;
+}
+
+std::unique_ptr<FaAsyncAttempt> fa_engine_test_user_async(
+    FacialAuthEngine &eng,
+    const std::string &user,
+    const std::string &model_path,
+    double threshold_override,
+    FaAsyncAttempt::Callback on_done,
+    FacialAuthAttempt *attempt
+)
+{
+    auto work = [&eng, user, model_path, threshold_override](FacialAuthAttempt &a,
+                                                              FaAsyncResult &r) {
+        return fa_engine_test_user(eng, user, model_path, r.best_conf, r.best_label,
+                                   r.log, threshold_override, &a);
+    };
+    return std::make_unique<FaAsyncAttempt>(work, std::move(on_done), attempt);
+}
+
+std::unique_ptr<FaAsyncAttempt> fa_test_user_async(
+    const std::string &user,
+    const FacialAuthConfig &cfg,
+    const std::string &model_path,
+    double threshold_override,
+    FaAsyncAttempt::Callback on_done,
+    FacialAuthAttempt *attempt
+)
+{
+    auto work = [user, cfg, model_path, threshold_override](FacialAuthAttempt &a,
+                                                            FaAsyncResult &r) {
+        return fa_test_user(user, cfg, model_path, r.best_conf, r.best_label,
+                            r.log, threshold_override, &a);
+    };
+    return std::make_unique<FaAsyncAttempt>(work, std::move(on_done), attempt);
+}
+
+// ==========================================================
+// Public API: camera-less verification
+// ==========================================================
+
+// Detector and recognizers expect 8-bit BGR.
+static bool frame_to_bgr(const cv::Mat &in, cv::Mat &out)
+{
+    if (in.empty() || in.depth() != CV_8U)
+        return false;
+    switch (in.channels()) {
+    case 3:  out = in;                                   return true;
+    case 1:  cv::cvtColor(in, out, cv::COLOR_GRAY2BGR);  return true;
+    case 4:  cv::cvtColor(in, out, cv::COLOR_BGRA2BGR);  return true;
+    default: return false;
+    }
+}
+
+static void collect_frames(
+    const FaVerifyRequest &req,
+    std::vector<cv::Mat> &frames,
+    std::string &log,
+    FaTrace *tr
+)
+{
+    frames.reserve(req.frames.size() + req.encoded.size());
+
+    for (size_t i = 0; i < req.frames.size(); ++i) {
+        cv::Mat bgr;
+        if (frame_to_bgr(req.frames[i], bgr))
+            frames.push_back(bgr);
+        else
+            log += "Frame " + std::to_string(i) + ": unsupported format, skipped.\n";
+    }
+
+    for (size_t i = 0; i < req.encoded.size(); ++i) {
+        cv::Mat img;
+        {
+            FaTraceSpan sp(tr, "decode", (int)i);
+            if (!req.encoded[i].empty())
+                img = cv::imdecode(req.encoded[i], cv::IMREAD_COLOR);
+        }
+        if (img.empty())
+            log += "Encoded frame " + std::to_string(i) + ": cannot decode, skipped.\n";
+        else
+            frames.push_back(img);
+    }
+}
+
+static bool engine_verify_frames(
+    FacialAuthEngine &eng,
+    const std::string &modelPath,
+    const std::vector<cv::Mat> &frames,
+    double threshold_override,
+    FaVerifyResult &res,
+    std::string &log,
+    FacialAuthAttempt *attempt
+)
+{
+    const FacialAuthConfig &cfg = eng.cfg;
+    const bool sface = cfg.method == FA_METHOD_SFACE;
+
+    attempt->status = FA_ATTEMPT_ERROR;
+
+    if (!eng.det_ready) {
+        log += "fa_engine_verify: engine not initialized.\n";
+        return false;
+    }
+    if (cfg.method == FA_METHOD_INVALID) {
+        log += "Unsupported training method: " + cfg.training_method + "\n";
+        return false;
+    }
+    if (frames.empty()) {
+        log += "fa_engine_verify: no usable frames.\n";
+        return false;
+    }
+
+    std::shared_ptr<const FaUserModel> model = eng.models->get(modelPath, log);
+    if (!model)
+        return false;
+
+    if (sface && (model->kind != FaUserModel::SFACE || model->gallery.empty())) {
+        log += "Model is not an SFace gallery: " + modelPath + "\n";
+        return false;
+    }
+    if (!sface && (model->kind != FaUserModel::CLASSIC ||
+                   (!model->classic && !model->lbph && !model->subspace))) {
+        log += "Model is not a classic recognizer: " + modelPath + "\n";
+        return false;
+    }
+
+    const double thr = (threshold_override >= 0.0) ? threshold_override
+                                                   : cfg.sface_active_threshold;
+    double best = sface ? -1.0 : DBL_MAX;
+    int best_label = -1;
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (attempt_stop(attempt, log, "between frames"))
+            return false;
+
+        ++res.frames;
+        attempt->trace.frames = res.frames;
+
+        bool scored;
+        if (sface) {
+            double sim = -1.0;
+            scored = sface_score_frame(eng, frames[i], model->gallery, (int)i,
+                                       sim, log, attempt);
+            if (scored && sim > best) {
+                best = sim;
+                best_label = 0;
+            }
+        } else {
+            int label = -1;
+            double conf = 0.0;
+            scored = classic_score_frame(eng, *model, frames[i], (int)i,
+                                         label, conf, log, attempt);
+            if (scored && (conf < best || (label >= 0 && best_label < 0))) {
+                best = conf;
+                best_label = label;
+            }
+        }
+
+        if (!scored) {
+            if (attempt->status == FA_ATTEMPT_NO_FACE)
+                continue;
+            return false;
+        }
+        ++res.faces;
+        if (sface ? best >= thr : best_label >= 0)
+            break;
+    }
+
+    if (res.faces == 0) {
+        attempt->status = FA_ATTEMPT_NO_FACE;
+        return false;
+    }
+
+    res.score    = best;
+    res.label    = best_label;
+    res.accepted = sface ? best >= thr : best_label >= 0;
+    attempt->status = res.accepted ? FA_ATTEMPT_ACCEPT : FA_ATTEMPT_REJECT;
+
+    FA_INFO("Verified %d frame(s), %d with a face: score %f (%s)",
+            res.frames, res.faces, best, res.accepted ? "accepted" : "rejected");
+    return res.accepted;
+}
+
+static bool engine_verify(
+    FacialAuthEngine &eng,
+    const FaVerifyRequest &req,
+    const std::string &model_path,
+    FaVerifyResult &res,
+    std::string &log,
+    FacialAuthAttempt *attempt
+)
+{
+    res = FaVerifyResult();
+
+    FacialAuthAttempt local;
+    if (!attempt)
+        attempt = &local;
+    attempt_start(*attempt, eng.cfg);
+
+    bool ok;
+    {
+        FaCpuScope cpu(eng.cfg.cpu_policy);
+        FaSfaceBatcher::Session batch(eng.batcher.get());
+        std::vector<cv::Mat> frames;
+        collect_frames(req, frames, log, &attempt->trace);
+        ok = engine_verify_frames(eng, model_path, frames, req.threshold,
+                                  res, log, attempt);
+    }
+
+    res.status = attempt->status;
+    finish_attempt(eng.cfg, req.user, *attempt, res.score);
+    return ok;
+}
+
+bool fa_engine_verify(
+    FacialAuthEngine &eng,
+    const FaVerifyRequest &req,
+    FaVerifyResult &res,
+    std::string &log,
+    FacialAuthAttempt *attempt
+)
+{
+    return engine_verify(eng, req,
+                         req.model_path.empty() ? fa_user_model_path(eng.cfg, req.user)
+                                                : req.model_path,
+                         res, log, attempt);
+}
+
+bool fa_engine_verify_batch(
+    FacialAuthEngine &eng,
+    const std::vector<FaVerifyRequest> &reqs,
+    std::vector<FaVerifyResult> &results,
+    std::string &log
+)
+{
+    results.assign(reqs.size(), FaVerifyResult());
+
+    if (!eng.det_ready) {
+        log += "fa_engine_verify_batch: engine not initialized.\n";
+        return false;
+    }
+
+    // Group by model so a small model cache does not reload it per request.
+    std::vector<std::string> paths(reqs.size());
+    std::vector<size_t> order(reqs.size());
+    for (size_t i = 0; i < reqs.size(); ++i) {
+        paths[i] = reqs[i].model_path.empty()
+                   ? fa_user_model_path(eng.cfg, reqs[i].user)
+                   : reqs[i].model_path;
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return paths[a] < paths[b]; });
+
+    // With a batcher, requests run on parallel workers so that their SFace
+    // forwards meet in one batch. Extra workers are views of the engine
+    // with their own detector; models and batcher are shared.
+    const size_t workers = eng.batcher
+        ? std::max<size_t>(1, std::min(reqs.size(), eng.batcher->max_batch()))
+        : 1;
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> accepted{0};
+
+    auto run = [&](FacialAuthEngine &w) {
+        for (size_t k = next++; k < order.size(); k = next++) {
+            size_t i = order[k];
+            std::string rlog;
+            if (engine_verify(w, reqs[i], paths[i], results[i], rlog, nullptr))
+                ++accepted;
+            results[i].log = std::move(rlog);
+        }
+    };
+
+    std::vector<std::unique_ptr<FacialAuthEngine>> views(workers);
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < workers; ++t) {
+        pool.emplace_back([&, t]() {
+            FacialAuthEngine &w = *(views[t] = std::make_unique<FacialAuthEngine>());
+            w.cfg     = eng.cfg;
+            w.models  = eng.models;
+            w.batcher = eng.batcher;
+            std::string dlog;
+            w.det_ready = init_detector(w.cfg, w.det, dlog);
+            if (w.det_ready)
+                run(w);
+            else
+                FA_WARN("Batch worker without detector: %s", dlog.c_str());
+        });
+    }
+    run(eng);
+    for (auto &th : pool)
+        th.join();
+
+    FA_DBG("Batch verification: %zu requests on %zu workers, %zu accepted",
+           reqs.size(), workers, accepted.load());
+    return true;
+}
+
+bool fa_verify_batch(
+    const FacialAuthConfig &cfg,
+    const std::vector<FaVerifyRequest> &reqs,
+    std::vector<FaVerifyResult> &results,
+    std::string &log
+)
+{
+    FacialAuthConfig ecfg = cfg;
+    ecfg.keep_camera = false;
+
+    FacialAuthEngine eng;
+    if (!fa_engine_init(eng, ecfg, log)) {
+        results.assign(reqs.size(), FaVerifyResult());
+        return false;
+    }
+    return fa_engine_verify_batch(eng, reqs, results, log);
+}
+
+// ==========================================================
+// dlopen() entry for the PAM front end
+// ==========================================================
+
+// Spooled metric deltas after which an in-process login merges them.
+static const size_t METRICS_SPOOL_MERGE = 64;
+
+// The dlopen()ed engine is the only user of its OpenCV in the host
+// process, so the first login there sets inference_threads once.
+static std::once_flag g_backend_threads_once;
+
+extern "C" bool fa_backend_test_user(
+    const FaBackendRequest *req,
+    FaBackendResult *res
+)
+{
+    if (!req || !res)
+        return false;
+
+    res->accepted       = 0;
+    res->ignore_failure = 0;
+    res->log[0]         = '\0';
+
+    if (req->abi != FA_BACKEND_ABI || !req->user) {
+        fa_ipc_copy(res->log, sizeof(res->log), "backend ABI mismatch\n");
+        return false;
+    }
+
+    std::string log;
+    FacialAuthConfig cfg;
+    auto t_cfg = std::chrono::steady_clock::now();
+    if (!fa_load_config(cfg, log, req->config_path ? req->config_path : "")) {
+        fa_ipc_copy(res->log, sizeof(res->log), "failed to load config: " + log);
+        return false;
+    }
+    if (req->attempt && cfg.trace) {
+        req->attempt->trace.enabled = true;
+        fa_trace_add(&req->attempt->trace, "config_load", -1, t_cfg,
+                     std::chrono::steady_clock::now(), NAN);
+    }
+
+    std::call_once(g_backend_threads_once, [&cfg] {
+        fa_set_inference_threads(cfg.inference_threads);
+    });
+
+    if (req->ignore_failure)
+        cfg.ignore_failure = true;
+    res->ignore_failure = cfg.ignore_failure ? 1 : 0;
+
+    std::string user = req->user;
+    std::string model_path = fa_user_model_path(cfg, user);
+    double best_conf = 0.0;
+    int best_label = -1;
+
+    try {
+        res->accepted = fa_test_user(user, cfg, model_path, best_conf,
+                                     best_label, log, -1.0, req->attempt) ? 1 : 0;
+    } catch (const std::exception &e) {
+        log += std::string("fa_test_user failed: ") + e.what() + "\n";
+        if (req->attempt)
+            req->attempt->status = FA_ATTEMPT_ERROR;
+    }
+
+    // After the decision the login only pays for one small delta file;
+    // facial_authd merges the spool. Without a daemon, one login in
+    // METRICS_SPOOL_MERGE merges it, and only if nobody holds the lock.
+    if (cfg.metrics) {
+        std::string mpath = fa_metrics_path(cfg.basedir), mlog;
+        if (fa_metrics_spool(mpath, mlog) &&
+            fa_metrics_spooled(mpath) >= METRICS_SPOOL_MERGE)
+            fa_metrics_flush(mpath, mlog);
+        FA_DBG("%s", mlog.c_str());
+    }
+
+    fa_ipc_copy(res->log, sizeof(res->log), log);
+    return true;
 }
@@ -1,4 +1,7 @@
-#include "../include/libfacialauth.h"
+#include "../include/facialauth_backend.h"
+#include "../include/facialauth_ipc.h"
+#include "../include/facialauth_probe.h"
+#include "../include/facialauth_usdt.h"
 
 extern "C" {
     #include <security/pam_modules.h>
@@ -8,8 +11,78 @@ extern "C" {
 }
 
 #include <string>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
-static const char *DEFAULT_CONFIG_PATH = "/etc/security/pam_facial.conf";
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <libintl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+static const char *DEFAULT_CONFIG_PATH = FACIALAUTH_DEFAULT_CONFIG;
+
+struct PamOptions
+{
+    std::string cfg_path          = DEFAULT_CONFIG_PATH;
+    std::string socket_path       = FACIALAUTH_DEFAULT_SOCKET;
+    int         daemon_timeout_ms = 0;     // 0: auth_timeout_ms + margin
+    std::string prompt;                    // concurrent; empty: pam_unix's
+    bool        use_daemon        = true;
+    bool        ignore_failure    = false;
+    bool        concurrent        = false;
+    bool        allow_remote      = false;
+};
+
+static void parse_options(int argc, const char **argv, PamOptions &o)
+{
+    for (int i = 0; i < argc; ++i) {
+        std::string opt = argv[i] ? argv[i] : "";
+        if (opt.rfind("config=", 0) == 0) {
+            o.cfg_path = opt.substr(7);
+        } else if (opt.rfind("socket=", 0) == 0) {
+            o.socket_path = opt.substr(7);
+        } else if (opt.rfind("daemon_timeout=", 0) == 0) {
+            o.daemon_timeout_ms = std::max(0, std::atoi(opt.c_str() + 15));
+        } else if (opt.rfind("prompt=", 0) == 0) {
+            o.prompt = opt.substr(7);
+        } else if (opt == "nodaemon") {
+            o.use_daemon = false;
+        } else if (opt == "ignore_failure") {
+            o.ignore_failure = true;
+        } else if (opt == "concurrent") {
+            o.concurrent = true;
+        } else if (opt == "allow_remote") {
+            o.allow_remote = true;
+        }
+    }
+}
+
+static int status_from_daemon(const FaIpcReply &reply,
+                              bool ignore_failure,
+                              std::string &log)
+{
+    log += reply.log;
+
+    if (reply.status == FA_IPC_ACCEPT)
+        return PAM_SUCCESS;
+
+    // Out of budget: let the stack fall through to passwords.
+    if (reply.status == FA_IPC_DENIED || reply.status == FA_IPC_TIMEOUT ||
+        reply.status == FA_IPC_BUSY)
+        return PAM_AUTHINFO_UNAVAIL;
+
+    if (ignore_failure || (reply.flags & FA_IPC_FLAG_IGNORE_FAILURE))
+        return PAM_IGNORE;
+    return PAM_AUTH_ERR;
+}
 
 static int get_pam_user(pam_handle_t *pamh, std::string &user)
 {
@@ -21,6 +94,356 @@ static int get_pam_user(pam_handle_t *pamh, std::string &user)
     return PAM_SUCCESS;
 }
 
+// ==========================================================
+// Applicability (no OpenCV loaded yet)
+// ==========================================================
+
+static bool is_remote_session(pam_handle_t *pamh)
+{
+    const void *item = nullptr;
+    if (pam_get_item(pamh, PAM_RHOST, &item) != PAM_SUCCESS || !item)
+        return false;
+
+    const char *rhost = static_cast<const char *>(item);
+    return *rhost &&
+           std::strcmp(rhost, "localhost") != 0 &&
+           std::strcmp(rhost, "127.0.0.1") != 0 &&
+           std::strcmp(rhost, "::1") != 0;
+}
+
+//
+// Returns PAM_SUCCESS if a face attempt makes sense, otherwise the status
+// to return right away (with the reason in log).
+//
+static int check_applicable(pam_handle_t *pamh,
+                            PamOptions &o,
+                            const std::string &user,
+                            std::string &log)
+{
+    if (!o.allow_remote && is_remote_session(pamh)) {
+        log += "remote session, no camera to use\n";
+        return PAM_IGNORE;
+    }
+
+    FaProbeConfig pc;
+    if (!fa_probe_config(o.cfg_path, pc, log))
+        return PAM_AUTH_ERR;
+
+    // Wait for the daemon as long as the attempt itself may take.
+    if (o.daemon_timeout_ms <= 0)
+        o.daemon_timeout_ms = pc.auth_timeout_ms > 0
+            ? pc.auth_timeout_ms + FA_IPC_TIMEOUT_MARGIN_MS
+            : FA_IPC_DEFAULT_TIMEOUT_MS;
+
+    if (!fa_probe_model(pc, user)) {
+        log += "no face model for user " + user + "\n";
+        return PAM_IGNORE;
+    }
+
+    if (!fa_probe_camera(pc)) {
+        log += "no camera device available\n";
+        return PAM_IGNORE;
+    }
+    return PAM_SUCCESS;
+}
+
+// ==========================================================
+// Engine (libfacialauth.so), loaded on first in-process attempt
+// ==========================================================
+
+static fa_backend_test_user_fn load_backend(std::string &log)
+{
+    static std::mutex mtx;
+    static fa_backend_test_user_fn fn = nullptr;
+
+    std::lock_guard<std::mutex> lk(mtx);
+    if (fn)
+        return fn;
+
+    // Never dlclose()d: OpenCV does not survive being unloaded.
+    void *h = dlopen(FACIALAUTH_BACKEND_PATH, RTLD_NOW | RTLD_LOCAL);
+    if (!h && std::strchr(FACIALAUTH_BACKEND_PATH, '/'))
+        h = dlopen("libfacialauth.so", RTLD_NOW | RTLD_LOCAL);
+    if (!h) {
+        const char *e = dlerror();
+        log += std::string("cannot load engine: ") + (e ? e : "unknown error") + "\n";
+        return nullptr;
+    }
+
+    fn = reinterpret_cast<fa_backend_test_user_fn>(dlsym(h, FA_BACKEND_SYMBOL));
+    if (!fn)
+        log += "engine has no " FA_BACKEND_SYMBOL " entry point\n";
+    return fn;
+}
+
+// ==========================================================
+// Face verification (daemon or in-process)
+// ==========================================================
+
+//
+// Runs the whole face check and returns a PAM status. Does not touch the
+// PAM handle, so it may run in a worker thread; everything worth logging
+// is appended to log.
+//
+static int face_check(const PamOptions &o,
+                      const std::string &user,
+                      std::string &log,
+                      FacialAuthAttempt *attempt,
+                      int cancel_fd)
+{
+    // Thin client: let facial_authd do the work with its warm state.
+    if (o.use_daemon) {
+        FaIpcRequest req;
+        std::memset(&req, 0, sizeof(req));
+        req.magic     = FA_IPC_MAGIC;
+        req.version   = FA_IPC_VERSION;
+        req.threshold = -1.0;
+        fa_ipc_copy(req.user,   sizeof(req.user),   user);
+        fa_ipc_copy(req.config, sizeof(req.config), o.cfg_path);
+
+        FaIpcReply reply;
+        std::string err;
+        switch (fa_ipc_authenticate(o.socket_path, req, reply,
+                                    o.daemon_timeout_ms, err, cancel_fd)) {
+        case FA_IPC_CLIENT_OK:
+            return status_from_daemon(reply, o.ignore_failure, log);
+        case FA_IPC_CLIENT_CANCELLED:
+            log += "daemon: " + err + "\n";
+            return PAM_IGNORE;
+        case FA_IPC_CLIENT_FAILED:
+            log += "daemon: " + err + "\n";
+            return PAM_AUTHINFO_UNAVAIL;
+        case FA_IPC_CLIENT_NO_DAEMON:
+            break;  // fall back to in-process verification
+        }
+    }
+
+    fa_backend_test_user_fn test_user = load_backend(log);
+    if (!test_user)
+        return PAM_AUTHINFO_UNAVAIL;
+
+    FacialAuthAttempt local;
+    if (!attempt)
+        attempt = &local;
+
+    FaBackendRequest breq;
+    breq.abi            = FA_BACKEND_ABI;
+    breq.user           = user.c_str();
+    breq.config_path    = o.cfg_path.c_str();
+    breq.ignore_failure = o.ignore_failure ? 1 : 0;
+    breq.attempt        = attempt;
+
+    FaBackendResult res;
+    bool served = test_user(&breq, &res);
+    log += res.log;
+
+    if (!served)
+        return PAM_AUTH_ERR;
+    if (res.accepted)
+        return PAM_SUCCESS;
+    if (attempt->status == FA_ATTEMPT_TIMEOUT)
+        return PAM_AUTHINFO_UNAVAIL;
+    if (res.ignore_failure || attempt->status == FA_ATTEMPT_CANCELLED)
+        return PAM_IGNORE;
+    return PAM_AUTH_ERR;
+}
+
+// ==========================================================
+// Concurrent mode: face check races the password prompt
+// ==========================================================
+
+struct RaceState
+{
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    bool face_done = false;
+    int  face_ret  = PAM_AUTH_ERR;
+    bool pass_done = false;
+    bool pass_ok   = false;
+};
+
+enum TtyRead { TTY_LINE, TTY_CANCELLED, TTY_ERROR };
+
+//
+// The prompt pam_unix shows through pam_get_authtok(): Linux-PAM's
+// "Password: ", translated with its own catalogue.
+//
+static std::string default_password_prompt()
+{
+    return dgettext("Linux-PAM", "Password: ");
+}
+
+//
+// Shows prompt and reads one line with echo off from tty, giving up as
+// soon as cancel_fd becomes readable. The host's conversation function is
+// never involved, so nothing has to be interrupted inside gdm/sshd/polkit
+// code.
+//
+static TtyRead read_tty_password(int tty, int cancel_fd, const std::string &prompt,
+                                 std::string &out)
+{
+    struct termios saved, quiet;
+    if (tcgetattr(tty, &saved) != 0)
+        return TTY_ERROR;
+    quiet = saved;
+    quiet.c_lflag &= ~(tcflag_t)(ECHO | ECHONL);
+    quiet.c_lflag |= ICANON;
+    if (tcsetattr(tty, TCSAFLUSH, &quiet) != 0)
+        return TTY_ERROR;
+
+    (void)!::write(tty, prompt.data(), prompt.size());
+
+    TtyRead r = TTY_ERROR;
+    out.clear();
+    for (;;) {
+        struct pollfd pfd[2] = {
+            { tty,       POLLIN, 0 },
+            { cancel_fd, POLLIN, 0 },
+        };
+        if (::poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfd[1].revents & POLLIN) {
+            r = TTY_CANCELLED;
+            break;
+        }
+        if (pfd[0].revents & (POLLHUP | POLLERR))
+            break;
+        if (!(pfd[0].revents & POLLIN))
+            continue;
+
+        // Canonical mode: poll() reports input once a line is complete.
+        char buf[256];
+        ssize_t n = ::read(tty, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        out.append(buf, (size_t)n);
+        explicit_bzero(buf, sizeof(buf));
+        size_t nl = out.find('\n');
+        if (nl != std::string::npos) {
+            std::fill(out.begin() + nl, out.end(), '\0');
+            out.resize(nl);
+            r = TTY_LINE;
+            break;
+        }
+    }
+
+    tcsetattr(tty, TCSAFLUSH, &saved);
+    (void)!::write(tty, "\n", 1);
+    return r;
+}
+
+//
+// Returns the PAM status of whichever side decides first:
+//   face accepted         -> prompt withdrawn, PAM_SUCCESS
+//   password entered      -> face cancelled, PAM_AUTHTOK set, PAM_IGNORE
+//                            so the next module (pam_unix use_first_pass)
+//                            checks it without prompting again
+// The prompt is read straight from the controlling terminal. Without one
+// (graphical greeters, screen lockers, ssh keyboard-interactive) the face
+// check simply runs first and the next module prompts as usual.
+//
+static int face_or_password(pam_handle_t *pamh,
+                            const PamOptions &o,
+                            const std::string &user,
+                            std::string &log)
+{
+    int tty = ::open("/dev/tty", O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (tty < 0 || !isatty(tty)) {
+        if (tty >= 0)
+            ::close(tty);
+        log += "concurrent: no controlling terminal, face check only\n";
+        return face_check(o, user, log, nullptr, -1);
+    }
+
+    // One eventfd per side: face_cancel stops the face check, prompt_cancel
+    // withdraws the prompt.
+    int face_cancel   = eventfd(0, EFD_CLOEXEC);
+    int prompt_cancel = eventfd(0, EFD_CLOEXEC);
+    if (face_cancel < 0 || prompt_cancel < 0) {
+        if (face_cancel >= 0)   ::close(face_cancel);
+        if (prompt_cancel >= 0) ::close(prompt_cancel);
+        ::close(tty);
+        return face_check(o, user, log, nullptr, -1);
+    }
+
+    RaceState st;
+    FacialAuthAttempt attempt;
+    std::string password;
+
+    std::thread face([&] {
+        std::string flog;
+        int r;
+        try {
+            r = face_check(o, user, flog, &attempt, face_cancel);
+        } catch (const std::exception &e) {
+            flog += std::string("face check failed: ") + e.what() + "\n";
+            r = PAM_AUTHINFO_UNAVAIL;
+        }
+        {
+            std::lock_guard<std::mutex> lk(st.mutex);
+            st.face_done = true;
+            st.face_ret  = r;
+            log += flog;
+        }
+        st.cv.notify_all();
+    });
+
+    std::thread prompt([&] {
+        TtyRead r = read_tty_password(tty, prompt_cancel,
+                                      o.prompt.empty() ? default_password_prompt() : o.prompt,
+                                      password);
+        {
+            std::lock_guard<std::mutex> lk(st.mutex);
+            st.pass_done = true;
+            st.pass_ok   = (r == TTY_LINE);
+        }
+        st.cv.notify_all();
+    });
+
+    bool face_won;
+    {
+        std::unique_lock<std::mutex> lk(st.mutex);
+        st.cv.wait(lk, [&] {
+            return st.pass_done || (st.face_done && st.face_ret == PAM_SUCCESS);
+        });
+        face_won = st.face_done && st.face_ret == PAM_SUCCESS;
+    }
+
+    uint64_t one = 1;
+    if (face_won) {
+        (void)!::write(prompt_cancel, &one, sizeof(one));
+    } else {
+        attempt.cancel = true;
+        (void)!::write(face_cancel, &one, sizeof(one));
+    }
+    prompt.join();
+    face.join();
+
+    ::close(face_cancel);
+    ::close(prompt_cancel);
+    ::close(tty);
+
+    int ret;
+    if (st.face_done && st.face_ret == PAM_SUCCESS) {
+        ret = PAM_SUCCESS;
+    } else if (!st.pass_ok) {
+        log += "password prompt failed, face check did not succeed\n";
+        ret = PAM_AUTHINFO_UNAVAIL;
+    } else {
+        log += "password entered before face verification completed\n";
+        ret = pam_set_item(pamh, PAM_AUTHTOK, password.c_str()) == PAM_SUCCESS
+              ? PAM_IGNORE : PAM_AUTH_ERR;
+    }
+    explicit_bzero(&password[0], password.size());
+    return ret;
+}
+
 extern "C" {
 
     PAM_EXTERN int pam_sm_authenticate(
@@ -32,17 +455,11 @@ extern "C" {
     {
         (void)flags;
 
-        std::string cfg_path = DEFAULT_CONFIG_PATH;
-        bool ignore_failure_override = false;
+        int64_t t0 = fa_usdt_now_us();
+        (void)t0;
 
-        for (int i = 0; i < argc; ++i) {
-            std::string opt = argv[i] ? argv[i] : "";
-            if (opt.rfind("config=", 0) == 0) {
-                cfg_path = opt.substr(7);
-            } else if (opt == "ignore_failure") {
-                ignore_failure_override = true;
-            }
-        }
+        PamOptions opts;
+        parse_options(argc, argv, opts);
 
         std::string user;
         int pret = get_pam_user(pamh, user);
@@ -51,32 +468,20 @@ extern "C" {
             return pret;
         }
 
-        FacialAuthConfig cfg;
         std::string log;
-        if (!fa_load_config(cfg, log, cfg_path)) {
-            pam_syslog(pamh, LOG_ERR, "pam_facial_auth: failed to load config: %s", log.c_str());
-            // Se la config non c'è, meglio fallire "pulito" o ignorare?
-            return PAM_AUTH_ERR;
-        }
-
-        if (ignore_failure_override)
-            cfg.ignore_failure = true;
+        int ret = check_applicable(pamh, opts, user, log);
+        if (ret == PAM_SUCCESS)
+            ret = opts.concurrent
+                  ? face_or_password(pamh, opts, user, log)
+                  : face_check(opts, user, log, nullptr, -1);
 
-        std::string model_path = fa_user_model_path(cfg, user);
-        double best_conf = 0.0;
-        int best_label = -1;
-        bool ok = fa_test_user(user, cfg, model_path, best_conf, best_label, log, -1.0);
+        if (!log.empty())
+            pam_syslog(pamh, ret == PAM_SUCCESS || ret == PAM_IGNORE ||
+                             ret == PAM_AUTH_ERR ? LOG_INFO : LOG_ERR,
+                       "pam_facial_auth: %s", log.c_str());
 
-        pam_syslog(pamh, LOG_INFO, "pam_facial_auth: %s", log.c_str());
-
-        if (ok) {
-            return PAM_SUCCESS;
-        } else {
-            if (cfg.ignore_failure) {
-                return PAM_IGNORE;
-            }
-            return PAM_AUTH_ERR;
-        }
+        FA_PROBE3(pam_decision, ret, (int)opts.concurrent, fa_usdt_now_us() - t0);
+        return ret;
     }
 
     PAM_EXTERN int pam_sm_setcred(
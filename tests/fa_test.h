@@ -0,0 +1,77 @@
+#ifndef FA_TEST_H
+#define FA_TEST_H
+
+//
+// Minimal checks for the unit tests run by ctest: every failed check is
+// printed with its location and counted, and main() returns
+// FA_TEST_RESULT() so that any failure fails the test.
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+#include <unistd.h>
+
+static int fa_test_failures = 0;
+
+#define FA_CHECK(cond)                                                       \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                         __FILE__, __LINE__, #cond);                         \
+            ++fa_test_failures;                                              \
+        }                                                                    \
+    } while (0)
+
+#define FA_CHECK_EQ(a, b)                                                    \
+    do {                                                                     \
+        auto fa_a_ = (a);                                                    \
+        auto fa_b_ = (b);                                                    \
+        if (!(fa_a_ == fa_b_)) {                                             \
+            std::fprintf(stderr, "%s:%d: check failed: %s == %s (%s vs %s)\n", \
+                         __FILE__, __LINE__, #a, #b,                         \
+                         std::to_string(fa_a_).c_str(),                      \
+                         std::to_string(fa_b_).c_str());                     \
+            ++fa_test_failures;                                              \
+        }                                                                    \
+    } while (0)
+
+// |a - b| within rel * max(|a|, |b|, 1)
+#define FA_CHECK_NEAR(a, b, rel)                                             \
+    do {                                                                     \
+        double fa_a_ = (double)(a);                                          \
+        double fa_b_ = (double)(b);                                          \
+        double fa_s_ = std::fmax(1.0, std::fmax(std::fabs(fa_a_), std::fabs(fa_b_))); \
+        if (!(std::fabs(fa_a_ - fa_b_) <= (rel) * fa_s_)) {                  \
+            std::fprintf(stderr, "%s:%d: check failed: %s ~ %s (%.9g vs %.9g)\n", \
+                         __FILE__, __LINE__, #a, #b, fa_a_, fa_b_);          \
+            ++fa_test_failures;                                              \
+        }                                                                    \
+    } while (0)
+
+#define FA_TEST_RESULT()                                                     \
+    (fa_test_failures == 0 ? 0 : (std::fprintf(stderr, "%d check(s) failed\n", \
+                                               fa_test_failures), 1))
+
+// Fresh directory under $TMPDIR (or /tmp), removed by the caller's
+// fa_test_rmdir(); empty string on failure.
+static inline std::string fa_test_tmpdir()
+{
+    const char *base = std::getenv("TMPDIR");
+    std::string tmpl = std::string(base && *base ? base : "/tmp") + "/fa_test.XXXXXX";
+    if (!::mkdtemp(&tmpl[0]))
+        return std::string();
+    return tmpl;
+}
+
+static inline void fa_test_rmdir(const std::string &dir)
+{
+    std::error_code ec;
+    if (!dir.empty())
+        std::filesystem::remove_all(dir, ec);
+}
+
+#endif // FA_TEST_H
@@ -0,0 +1,88 @@
+#ifndef FA_TEST_FACES_H
+#define FA_TEST_FACES_H
+
+//
+// Synthetic gray "faces" for the tests linked with OpenCV: one smooth
+// random pattern per person, noisy samples of it per image.
+//
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+static const int FA_FACE_W = 64, FA_FACE_H = 72;
+
+static inline cv::Mat fa_test_person(unsigned seed)
+{
+    std::mt19937 r(seed);
+    std::uniform_int_distribution<int> px(0, 255);
+    cv::Mat base(FA_FACE_H, FA_FACE_W, CV_8UC1);
+    for (int y = 0; y < FA_FACE_H; ++y)
+        for (int x = 0; x < FA_FACE_W; ++x)
+            base.at<uint8_t>(y, x) = (uint8_t)px(r);
+    cv::GaussianBlur(base, base, cv::Size(0, 0), 3);
+    cv::normalize(base, base, 0, 255, cv::NORM_MINMAX);
+    return base;
+}
+
+static inline cv::Mat fa_test_sample(const cv::Mat &base, std::mt19937 &rng)
+{
+    std::normal_distribution<double> noise(0.0, 12.0);
+    cv::Mat img(FA_FACE_H, FA_FACE_W, CV_8UC1);
+    for (int y = 0; y < FA_FACE_H; ++y)
+        for (int x = 0; x < FA_FACE_W; ++x) {
+            double v = base.at<uint8_t>(y, x) + noise(rng);
+            img.at<uint8_t>(y, x) = (uint8_t)std::min(255.0, std::max(0.0, std::round(v)));
+        }
+    return img;
+}
+
+struct FaTestDataset
+{
+    std::vector<cv::Mat> train;
+    std::vector<int>     labels;
+    std::vector<cv::Mat> probes;    // enrolled people, then strangers
+};
+
+// 8 people with 4 training images and 3 probes each, and 4 strangers.
+static inline FaTestDataset fa_test_dataset(unsigned seed)
+{
+    std::mt19937 rng(seed);
+    FaTestDataset d;
+    for (int i = 0; i < 8; ++i) {
+        cv::Mat base = fa_test_person(100 + i);
+        for (int k = 0; k < 4; ++k) {
+            d.train.push_back(fa_test_sample(base, rng));
+            d.labels.push_back(10 + i);
+        }
+        for (int k = 0; k < 3; ++k)
+            d.probes.push_back(fa_test_sample(base, rng));
+    }
+    for (int k = 0; k < 4; ++k)
+        d.probes.push_back(fa_test_sample(fa_test_person(999 + k), rng));
+    return d;
+}
+
+// Threshold midway between two of the recognizer's distances on probes,
+// so that float rounding cannot move a probe across it.
+template <class Recognizer>
+static inline double fa_test_mid_threshold(const Recognizer &rec,
+                                           const std::vector<cv::Mat> &probes)
+{
+    std::vector<double> dists;
+    for (const cv::Mat &p : probes) {
+        int label = -1;
+        double dist = 0.0;
+        rec.predict(p, label, dist);
+        dists.push_back(dist);
+    }
+    std::sort(dists.begin(), dists.end());
+    size_t mid = dists.size() / 2;
+    return (dists[mid - 1] + dists[mid]) / 2;
+}
+
+#endif // FA_TEST_FACES_H
@@ -0,0 +1,233 @@
+//
+// Config loader: the key table, parsing and error reporting, the
+// in-process snapshot, root's compiled cache and the PAM probe reader.
+//
+// The source is compiled in directly to reach the table and the cache.
+//
+
+#include "../src/libfacialauth.cpp"
+
+#include "fa_test.h"
+
+static void write_file(const std::string &path, const std::string &text)
+{
+    std::ofstream f(path, std::ios::trunc);
+    f << text;
+}
+
+static void test_table()
+{
+    // Names unique, every one found again, every setter takes a number
+    // (the widest value any of them accepts).
+    for (int i = 0; i < NUM_CONFIG_KEYS; ++i) {
+        FA_CHECK_EQ(find_config_key(CONFIG_KEYS[i].name), i);
+        FacialAuthConfig c;
+        FaConfigEntry e;
+        e.id    = (uint16_t)i;
+        e.value = "1";
+        FA_CHECK(apply_config_entry(c, e));
+    }
+    FA_CHECK_EQ(find_config_key("no_such_key"), -1);
+    FA_CHECK_EQ(find_config_key(""), -1);
+
+    FacialAuthConfig c;
+    FaConfigEntry e;
+    e.id = (uint16_t)NUM_CONFIG_KEYS;
+    FA_CHECK(!apply_config_entry(c, e));
+}
+
+static const char *CONFIG_A =
+    "# comment\n"
+    "\n"
+    "basedir = /srv/faces\n"
+    "device=/dev/video7\n"
+    "fallback_device = yes\n"
+    "auth_timeout_ms = 1234\n"
+    "frames = 7\n"
+    "debug = true\n"
+    "metrics = no\n"
+    "sface_threshold = 0.42\n"
+    "sface_int8_threshold = 0.3\n"
+    "detect_custom = /models/custom.onnx\n"
+    "haar_model = /models/haar.xml\n"
+    "width = wide\n"
+    "no equals sign here\n"
+    "bogus_key = 1\n";
+
+static void test_parse(const std::string &dir)
+{
+    std::string path = dir + "/a.conf";
+    write_file(path, CONFIG_A);
+
+    FacialAuthConfig cfg;
+    std::string log;
+    FA_CHECK(fa_load_config(cfg, log, path));
+
+    FA_CHECK(cfg.basedir == "/srv/faces");
+    FA_CHECK(cfg.device == "/dev/video7");
+    FA_CHECK(cfg.fallback_device);
+    FA_CHECK_EQ(cfg.auth_timeout_ms, 1234);
+    FA_CHECK_EQ(cfg.frames, 7);
+    FA_CHECK(cfg.debug);
+    FA_CHECK(!cfg.metrics);
+    FA_CHECK_EQ(cfg.sface_fp32_threshold, 0.42);
+    FA_CHECK_EQ(cfg.sface_int8_threshold, 0.3);      // later line wins
+    FA_CHECK(cfg.detector_models["custom"] == "/models/custom.onnx");
+    FA_CHECK(cfg.haar_cascade_path == "/models/haar.xml");
+
+    // Bad lines are reported and leave the defaults alone.
+    FA_CHECK_EQ(cfg.width, FacialAuthConfig().width);
+    FA_CHECK(log.find("line 14") != std::string::npos);        // width = wide
+    FA_CHECK(log.find("malformed line 15") != std::string::npos);
+    FA_CHECK(log.find("'bogus_key'") != std::string::npos);
+
+    // Defaults of keys not in the file
+    FA_CHECK_EQ(cfg.dedup_similarity, 0.0);
+    FA_CHECK_EQ(cfg.dedup_hash_distance, -1);
+    FA_CHECK_EQ(cfg.sface_batch_max, 1);
+
+    // The probe reader used by the PAM front end agrees.
+    FaProbeConfig probe;
+    FA_CHECK(fa_probe_config(path, probe, log));
+    FA_CHECK(probe.basedir == cfg.basedir);
+    FA_CHECK(probe.device == cfg.device);
+    FA_CHECK_EQ(probe.fallback_device, cfg.fallback_device);
+    FA_CHECK_EQ(probe.auth_timeout_ms, cfg.auth_timeout_ms);
+
+    FA_CHECK(!fa_load_config(cfg, log, dir + "/missing.conf"));
+}
+
+static void test_snapshot(const std::string &dir)
+{
+    std::string path = dir + "/b.conf";
+    write_file(path, "frames = 3\n");
+
+    FacialAuthConfig cfg;
+    std::string log;
+    FA_CHECK(fa_load_config(cfg, log, path));
+    FA_CHECK_EQ(cfg.frames, 3);
+
+    // The copy handed out is the caller's own.
+    cfg.frames = 99;
+    FA_CHECK(fa_load_config(cfg, log, path));
+    FA_CHECK_EQ(cfg.frames, 3);
+
+    // A changed file is parsed again.
+    write_file(path, "frames = 11\nbogus = 1\n");
+    FA_CHECK(fa_load_config(cfg, log, path));
+    FA_CHECK_EQ(cfg.frames, 11);
+    FA_CHECK(log.find("'bogus'") != std::string::npos);
+}
+
+// The snapshot follows the model files as well: installing the detector
+// after the first login must not keep "Model file not found" around.
+static void test_snapshot_models(const std::string &dir)
+{
+    std::string path  = dir + "/m.conf";
+    std::string yunet = dir + "/yunet.onnx";
+    write_file(path, "detector_profile = auto\nyunet_model = " + yunet + "\n");
+
+    FacialAuthConfig cfg;
+    std::string log;
+    FA_CHECK(fa_load_config(cfg, log, path));
+    FA_CHECK_EQ(cfg.detector, FA_DET_NONE);
+    FA_CHECK(log.find("Model file not found: " + yunet) != std::string::npos);
+
+    write_file(yunet, "onnx");
+    FA_CHECK(fa_load_config(cfg, log, path));
+    FA_CHECK_EQ(cfg.detector, FA_DET_YUNET_FP32);
+    FA_CHECK(cfg.detector_path == yunet);
+    FA_CHECK(log.find("Model file not found") == std::string::npos);
+
+    ::unlink(yunet.c_str());
+    FA_CHECK(fa_load_config(cfg, log, path));
+    FA_CHECK_EQ(cfg.detector, FA_DET_NONE);
+}
+
+// Root compiles the file into FACIALAUTH_RUNDIR; a fresh process (here:
+// a dropped snapshot) and the PAM probe read it back from there.
+static void test_cache(const std::string &dir)
+{
+    std::string path = dir + "/c.conf";
+    write_file(path, CONFIG_A);
+
+    FacialAuthConfig parsed, cached;
+    std::string log_parsed, log_cached;
+    FA_CHECK(fa_load_config(parsed, log_parsed, path));
+
+    std::string cache = fa_config_cache_path(path);
+    struct stat sb;
+    if (::geteuid() != 0) {
+        FA_CHECK(::stat(cache.c_str(), &sb) != 0);
+        return;
+    }
+    FA_CHECK(::stat(cache.c_str(), &sb) == 0);
+    FA_CHECK_EQ(sb.st_mode & 0777, (mode_t)0644);
+
+    FaConfigStamp stamp;
+    FA_CHECK(fa_config_stamp(path, stamp));
+    std::vector<FaConfigEntry> entries;
+    std::string log;
+    FA_CHECK(read_config_cache(path, stamp, entries, log));
+    FA_CHECK(log_parsed.compare(0, log.size(), log) == 0);     // resolve appends
+    FA_CHECK(log.find("'bogus_key'") != std::string::npos);
+
+    // A stamp that no longer matches the file is not trusted.
+    FaConfigStamp other = stamp;
+    other.size += 1;
+    FA_CHECK(!read_config_cache(path, other, entries, log));
+
+    {
+        std::lock_guard<std::mutex> lk(g_cfg_mutex);
+        g_cfg_snapshot = ConfigSnapshot();
+    }
+    FA_CHECK(fa_load_config(cached, log_cached, path));
+    FA_CHECK(log_cached == log_parsed);
+    FA_CHECK_EQ(cached.auth_timeout_ms, parsed.auth_timeout_ms);
+    FA_CHECK_EQ(cached.sface_int8_threshold, parsed.sface_int8_threshold);
+    FA_CHECK(cached.detector_models == parsed.detector_models);
+    FA_CHECK(cached.haar_cascade_path == parsed.haar_cascade_path);
+
+    // The PAM probe takes its keys from the cache while it is fresh:
+    // plant one that disagrees with the text to tell them apart.
+    FaConfigEntry e;
+    e.id    = (uint16_t)find_config_key("basedir");
+    e.key   = "basedir";
+    e.value = "/from/cache";
+    fa_write_config_cache(path, stamp, config_schema_hash(), { e }, "");
+    FaProbeConfig probe;
+    FA_CHECK(fa_probe_config(path, probe, log));
+    FA_CHECK(probe.basedir == "/from/cache");
+    FA_CHECK(probe.device.empty());
+    FA_CHECK_EQ(probe.auth_timeout_ms, FaProbeConfig().auth_timeout_ms);
+
+    // Stale: the text is parsed.
+    fa_write_config_cache(path, other, config_schema_hash(), { e }, "");
+    FA_CHECK(fa_probe_config(path, probe, log));
+    FA_CHECK(probe.basedir == parsed.basedir);
+
+    // A cache writable by others is ignored.
+    fa_write_config_cache(path, stamp, config_schema_hash(), { e }, "");
+    FA_CHECK(::chmod(cache.c_str(), 0666) == 0);
+    FA_CHECK(!read_config_cache(path, stamp, entries, log));
+    FA_CHECK(fa_probe_config(path, probe, log));
+    FA_CHECK(probe.basedir == parsed.basedir);
+}
+
+int main()
+{
+    test_table();
+
+    std::string dir = fa_test_tmpdir();
+    FA_CHECK(!dir.empty());
+    if (!dir.empty()) {
+        test_parse(dir);
+        test_snapshot(dir);
+        test_snapshot_models(dir);
+        test_cache(dir);
+        for (const char *name : { "/a.conf", "/b.conf", "/c.conf", "/m.conf" })
+            ::unlink(fa_config_cache_path(dir + name).c_str());
+        fa_test_rmdir(dir);
+    }
+    return FA_TEST_RESULT();
+}
@@ -0,0 +1,240 @@
+//
+// facial_authd protocol: framing helpers over a socketpair and the client
+// against a fake daemon on a temporary socket.
+//
+
+#include "fa_test.h"
+#include "../include/facialauth_ipc.h"
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static void test_copy()
+{
+    char buf[8];
+    fa_ipc_copy(buf, sizeof(buf), "abc");
+    FA_CHECK(std::strcmp(buf, "abc") == 0);
+
+    // Truncated, always terminated.
+    fa_ipc_copy(buf, sizeof(buf), "0123456789");
+    FA_CHECK(std::strcmp(buf, "0123456") == 0);
+
+    buf[0] = 'x';
+    fa_ipc_copy(buf, 0, "ignored");
+    FA_CHECK_EQ(buf[0], 'x');
+}
+
+// A frame written in small pieces is read back whole.
+static void test_read_full_chunked()
+{
+    int sv[2];
+    FA_CHECK(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0);
+
+    FaIpcReply out;
+    std::memset(&out, 0, sizeof(out));
+    out.magic      = FA_IPC_MAGIC;
+    out.version    = FA_IPC_VERSION;
+    out.status     = FA_IPC_REJECT;
+    out.best_label = 3;
+    out.best_conf  = 0.25;
+    fa_ipc_copy(out.log, sizeof(out.log), "hello\n");
+
+    std::thread writer([&] {
+        const char *p = reinterpret_cast<const char *>(&out);
+        size_t left = sizeof(out);
+        while (left > 0) {
+            size_t n = std::min(left, (size_t)97);
+            fa_ipc_write_full(sv[1], p, n);
+            p += n;
+            left -= n;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    FaIpcReply in;
+    FA_CHECK(fa_ipc_read_full(sv[0], &in, sizeof(in), 5000));
+    writer.join();
+    FA_CHECK(std::memcmp(&in, &out, sizeof(in)) == 0);
+
+    ::close(sv[0]);
+    ::close(sv[1]);
+}
+
+static void test_read_full_failures()
+{
+    int sv[2];
+    FA_CHECK(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0);
+    char buf[16];
+
+    // Nothing arrives: timeout.
+    errno = 0;
+    FA_CHECK(!fa_ipc_read_full(sv[0], buf, sizeof(buf), 50));
+    FA_CHECK_EQ(errno, ETIMEDOUT);
+
+    // Cancelled while waiting.
+    int efd = ::eventfd(0, EFD_CLOEXEC);
+    FA_CHECK(efd >= 0);
+    uint64_t one = 1;
+    FA_CHECK(::write(efd, &one, sizeof(one)) == (ssize_t)sizeof(one));
+    errno = 0;
+    FA_CHECK(!fa_ipc_read_full(sv[0], buf, sizeof(buf), 5000, efd));
+    FA_CHECK_EQ(errno, ECANCELED);
+    ::close(efd);
+
+    // Short frame, then the peer hangs up.
+    FA_CHECK(fa_ipc_write_full(sv[1], "short", 5));
+    ::close(sv[1]);
+    FA_CHECK(!fa_ipc_read_full(sv[0], buf, sizeof(buf), 5000));
+    ::close(sv[0]);
+}
+
+static void test_peer_cred()
+{
+    int sv[2];
+    FA_CHECK(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0);
+    pid_t pid = 0;
+    uid_t uid = 0;
+    gid_t gid = 0;
+    FA_CHECK(fa_ipc_peer_cred(sv[0], pid, uid, gid));
+    FA_CHECK_EQ(pid, ::getpid());
+    FA_CHECK_EQ(uid, ::geteuid());
+    FA_CHECK_EQ(gid, ::getegid());
+    ::close(sv[0]);
+    ::close(sv[1]);
+}
+
+static int listen_on(const std::string &path)
+{
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    fa_ipc_copy(addr.sun_path, sizeof(addr.sun_path), path);
+    if (fd < 0 || ::bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        ::listen(fd, 4) != 0) {
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static FaIpcRequest make_request()
+{
+    FaIpcRequest req;
+    std::memset(&req, 0, sizeof(req));
+    req.magic     = FA_IPC_MAGIC;
+    req.version   = FA_IPC_VERSION;
+    req.threshold = -1.0;
+    fa_ipc_copy(req.user, sizeof(req.user), "alice");
+    return req;
+}
+
+// The client against a fake daemon. Only a root daemon is trusted, so as
+// an ordinary user the exchange itself is expected to be refused.
+static void test_client(const std::string &dir)
+{
+    FaIpcRequest req = make_request();
+    FaIpcReply reply;
+    std::string err;
+
+    FA_CHECK_EQ(fa_ipc_authenticate(dir + "/absent.sock", req, reply, 100, err),
+                FA_IPC_CLIENT_NO_DAEMON);
+
+    std::string path = dir + "/daemon.sock";
+    int lfd = listen_on(path);
+    FA_CHECK(lfd >= 0);
+    if (lfd < 0)
+        return;
+
+    // mode 0: answer, 1: bad magic, 2: never answer
+    auto serve = [lfd](int mode) {
+        int cfd = ::accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (cfd < 0)
+            return;
+        FaIpcRequest in;
+        if (fa_ipc_read_full(cfd, &in, sizeof(in), 2000) && mode != 2) {
+            FaIpcReply out;
+            std::memset(&out, 0, sizeof(out));
+            out.magic   = mode == 1 ? 0 : FA_IPC_MAGIC;
+            out.version = FA_IPC_VERSION;
+            out.status  = std::strcmp(in.user, "alice") == 0 ? FA_IPC_ACCEPT : FA_IPC_ERROR;
+            std::memset(out.log, 'x', sizeof(out.log));     // unterminated
+            fa_ipc_write_full(cfd, &out, sizeof(out));
+        }
+        if (mode == 2) {
+            char c;
+            fa_ipc_read_full(cfd, &c, 1, 2000);             // until the client leaves
+        }
+        ::close(cfd);
+    };
+
+    const bool root = ::geteuid() == 0;
+
+    std::thread t0(serve, 0);
+    FaIpcClientResult r = fa_ipc_authenticate(path, req, reply, 2000, err);
+    if (root) {
+        FA_CHECK_EQ(r, FA_IPC_CLIENT_OK);
+        FA_CHECK_EQ(reply.status, (int32_t)FA_IPC_ACCEPT);
+        FA_CHECK_EQ(std::strlen(reply.log), (size_t)FA_IPC_LOG_MAX - 1);
+    } else {
+        FA_CHECK_EQ(r, FA_IPC_CLIENT_FAILED);
+        FA_CHECK(err.find("root") != std::string::npos);
+        int c = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);    // unblock accept
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        fa_ipc_copy(addr.sun_path, sizeof(addr.sun_path), path);
+        ::connect(c, (struct sockaddr *)&addr, sizeof(addr));
+        ::close(c);
+    }
+    t0.join();
+
+    if (root) {
+        std::thread t1(serve, 1);
+        FA_CHECK_EQ(fa_ipc_authenticate(path, req, reply, 2000, err), FA_IPC_CLIENT_FAILED);
+        FA_CHECK(err.find("protocol") != std::string::npos);
+        t1.join();
+
+        std::thread t2(serve, 2);
+        FA_CHECK_EQ(fa_ipc_authenticate(path, req, reply, 100, err), FA_IPC_CLIENT_FAILED);
+        t2.join();
+
+        int efd = ::eventfd(0, EFD_CLOEXEC);
+        std::thread t3(serve, 2);
+        std::thread canceller([efd] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            uint64_t one = 1;
+            (void)::write(efd, &one, sizeof(one));
+        });
+        FA_CHECK_EQ(fa_ipc_authenticate(path, req, reply, 5000, err, efd),
+                    FA_IPC_CLIENT_CANCELLED);
+        canceller.join();
+        t3.join();
+        ::close(efd);
+    }
+
+    ::close(lfd);
+}
+
+int main()
+{
+    test_copy();
+    test_read_full_chunked();
+    test_read_full_failures();
+    test_peer_cred();
+
+    std::string dir = fa_test_tmpdir();
+    FA_CHECK(!dir.empty());
+    if (!dir.empty()) {
+        test_client(dir);
+        fa_test_rmdir(dir);
+    }
+    return FA_TEST_RESULT();
+}
@@ -0,0 +1,265 @@
+//
+// Native LBPH: the kernels picked for this CPU against the scalar ones,
+// and the binary store (round trip, truncated, stale, corrupt files).
+//
+// The source is compiled in directly to reach the static kernels.
+//
+
+#include "../src/facialauth_lbph.cpp"
+
+#include "fa_test.h"
+
+#include <random>
+
+static std::mt19937 rng(42);
+
+static std::vector<uint8_t> random_image(int w, int h)
+{
+    std::uniform_int_distribution<int> px(0, 255);
+    std::vector<uint8_t> img((size_t)w * h);
+    for (auto &p : img)
+        p = (uint8_t)px(rng);
+    return img;
+}
+
+// Flat areas make t == c ties, which the epsilon test must agree on.
+static std::vector<uint8_t> blocky_image(int w, int h)
+{
+    std::uniform_int_distribution<int> px(0, 3);
+    std::vector<uint8_t> img((size_t)w * h);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            img[(size_t)y * w + x] = (uint8_t)(px(rng) * 60 + ((x / 5 + y / 7) & 1));
+    return img;
+}
+
+// Same taps as elbp().
+static ElbpTap make_tap(int radius, int neighbors, int n)
+{
+    float x = static_cast<float>(radius * std::cos(2.0 * M_PI * n / static_cast<float>(neighbors)));
+    float y = static_cast<float>(-radius * std::sin(2.0 * M_PI * n / static_cast<float>(neighbors)));
+
+    ElbpTap tp;
+    tp.fx = static_cast<int>(std::floor(x));
+    tp.fy = static_cast<int>(std::floor(y));
+    tp.cx = static_cast<int>(std::ceil(x));
+    tp.cy = static_cast<int>(std::ceil(y));
+    float ty = y - tp.fy;
+    float tx = x - tp.fx;
+    tp.w1 = (1 - tx) * (1 - ty);
+    tp.w2 =      tx  * (1 - ty);
+    tp.w3 = (1 - tx) *      ty;
+    tp.w4 =      tx  *      ty;
+    tp.bit = n;
+    return tp;
+}
+
+// SIMD and scalar ELBP codes must be bit-identical, tails included.
+static void test_elbp_rows()
+{
+    const LbphKernels &k = kernels();
+    const int sizes[][2] = { { 92, 112 }, { 37, 21 }, { 9, 9 }, { 200, 200 } };
+
+    for (const auto &sz : sizes) {
+        const int w = sz[0], h = sz[1];
+        for (int kind = 0; kind < 2; ++kind) {
+            std::vector<uint8_t> img = kind ? blocky_image(w, h) : random_image(w, h);
+            for (int radius = 1; radius <= 2; ++radius) {
+                const int dw = w - 2 * radius;
+                if (dw <= 0 || h - 2 * radius <= 0)
+                    continue;
+                std::vector<int> fast((size_t)dw), slow((size_t)dw);
+                for (int n = 0; n < 8; ++n) {
+                    ElbpTap tp = make_tap(radius, 8, n);
+                    for (int i = radius; i < h - radius; ++i) {
+                        const uint8_t *r0 = &img[(size_t)i * w];
+                        const uint8_t *rf = &img[(size_t)(i + tp.fy) * w];
+                        const uint8_t *rc = &img[(size_t)(i + tp.cy) * w];
+                        std::fill(fast.begin(), fast.end(), 0);
+                        std::fill(slow.begin(), slow.end(), 0);
+                        k.elbp_row(r0, rf, rc, tp, radius, w - radius, radius, fast.data());
+                        elbp_row_scalar(r0, rf, rc, tp, radius, w - radius, radius, slow.data());
+                        FA_CHECK(fast == slow);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static std::vector<float> histogram_of(const std::vector<uint8_t> &img, int w, int h,
+                                       const FaLbphParams &p)
+{
+    std::vector<float> out(p.bins());
+    fa_lbph_histogram(img.data(), w, h, (size_t)w, p, out.data());
+    return out;
+}
+
+// Chi-square: same value up to float summation order, and the early exit
+// never reports less than the bound it stopped at.
+static void test_chisq()
+{
+    const LbphKernels &k = kernels();
+    FaLbphParams p;
+
+    std::vector<float> a = histogram_of(random_image(92, 112), 92, 112, p);
+    std::vector<float> b = histogram_of(random_image(92, 112), 92, 112, p);
+    const size_t n = p.bins(), block = 256;
+    const double inf = std::numeric_limits<double>::max();
+
+    double ref = chisq_f32_scalar(a.data(), b.data(), n, block, inf);
+    FA_CHECK(ref > 0.0);
+    FA_CHECK_NEAR(k.chisq_f32(a.data(), b.data(), n, block, inf), ref, 1e-5);
+    FA_CHECK_EQ(k.chisq_f32(a.data(), a.data(), n, block, inf), 0.0);
+
+    // Odd lengths exercise the tails.
+    for (size_t len : { (size_t)1, (size_t)7, (size_t)13, (size_t)255, (size_t)1001 })
+        FA_CHECK_NEAR(k.chisq_f32(a.data(), b.data(), len, block, inf),
+                      chisq_f32_scalar(a.data(), b.data(), len, block, inf), 1e-5);
+
+    double bound = ref / 4;
+    FA_CHECK(k.chisq_f32(a.data(), b.data(), n, block, bound) >= bound);
+    FA_CHECK(chisq_f32_scalar(a.data(), b.data(), n, block, bound) >= bound);
+
+    std::vector<uint16_t> q(n);
+    for (size_t i = 0; i < n; ++i)
+        q[i] = (uint16_t)std::lround(std::min(std::max(b[i], 0.0f), 1.0f) * 65535.0f);
+
+    double ref16 = chisq_u16_scalar(a.data(), q.data(), n, block, inf);
+    FA_CHECK_NEAR(k.chisq_u16(a.data(), q.data(), n, block, inf), ref16, 1e-5);
+    FA_CHECK_NEAR(ref16, ref, 1e-3);        // 16-bit storage costs little
+    FA_CHECK(k.chisq_u16(a.data(), q.data(), n, block, ref16 / 4) >= ref16 / 4);
+}
+
+// ----------------------------------------------------------
+// Store
+// ----------------------------------------------------------
+
+struct Trained
+{
+    FaLbphParams                      params;
+    std::vector<std::vector<uint8_t>> faces;
+    std::vector<float>                hist;
+    std::vector<int32_t>              labels;
+};
+
+static Trained train(int rows)
+{
+    Trained t;
+    for (int r = 0; r < rows; ++r) {
+        t.faces.push_back(random_image(92, 112));
+        std::vector<float> h = histogram_of(t.faces.back(), 92, 112, t.params);
+        t.hist.insert(t.hist.end(), h.begin(), h.end());
+        t.labels.push_back(100 + r);
+    }
+    return t;
+}
+
+static bool write_store(const std::string &path, const Trained &t, FaLbphDtype dtype,
+                        double threshold = 1e9)
+{
+    std::string log;
+    return fa_lbph_write(path, t.params, threshold, t.hist.data(), t.labels.data(),
+                         t.labels.size(), dtype, 1234, 5678, log);
+}
+
+static void test_store_round_trip(const std::string &dir)
+{
+    Trained t = train(5);
+
+    for (FaLbphDtype dtype : { FA_LBPH_F32, FA_LBPH_U16 }) {
+        std::string path = dir + "/model.xml.lbph";
+        FA_CHECK(write_store(path, t, dtype));
+
+        FaLbphModel m;
+        std::string log;
+        FA_CHECK(m.open(path, 1234, 5678, log));
+        FA_CHECK_EQ(m.rows(), (size_t)5);
+        FA_CHECK_EQ(m.params().bins(), t.params.bins());
+
+        // Every training face is its own nearest row.
+        for (size_t r = 0; r < t.faces.size(); ++r) {
+            int label = -1;
+            double dist = 0.0;
+            m.predict(t.faces[r].data(), 92, 112, 92, label, dist);
+            FA_CHECK_EQ(label, t.labels[r]);
+            FA_CHECK(dist < 1e-2);
+        }
+    }
+
+    // Beyond the threshold: no label, distance still reported.
+    std::string path = dir + "/strict.xml.lbph";
+    FA_CHECK(write_store(path, t, FA_LBPH_F32, 1e-9));
+    FaLbphModel m;
+    std::string log;
+    FA_CHECK(m.open(path, 1234, 5678, log));
+    std::vector<uint8_t> other = random_image(92, 112);
+    int label = 0;
+    double dist = 0.0;
+    m.predict(other.data(), 92, 112, 92, label, dist);
+    FA_CHECK_EQ(label, -1);
+    FA_CHECK(dist > 0.0);
+}
+
+static void test_store_rejects(const std::string &dir)
+{
+    Trained t = train(3);
+    std::string path = dir + "/reject.xml.lbph";
+    std::string log;
+
+    // Stale: the XML model it mirrors has changed.
+    FA_CHECK(write_store(path, t, FA_LBPH_F32));
+    {
+        FaLbphModel m;
+        FA_CHECK(!m.open(path, 1235, 5678, log));
+        FA_CHECK(!m.open(path, 1234, 5679, log));
+    }
+
+    // Truncated rows, then a truncated header.
+    struct stat st;
+    FA_CHECK(::stat(path.c_str(), &st) == 0);
+    FA_CHECK(::truncate(path.c_str(), st.st_size - 4) == 0);
+    {
+        FaLbphModel m;
+        log.clear();
+        FA_CHECK(!m.open(path, 1234, 5678, log));
+        FA_CHECK(log.find("corrupt") != std::string::npos);
+    }
+    FA_CHECK(::truncate(path.c_str(), sizeof(LbphFileHeader) - 1) == 0);
+    {
+        FaLbphModel m;
+        FA_CHECK(!m.open(path, 1234, 5678, log));
+    }
+
+    // Bad magic.
+    FA_CHECK(write_store(path, t, FA_LBPH_F32));
+    {
+        int fd = ::open(path.c_str(), O_WRONLY);
+        FA_CHECK(fd >= 0);
+        FA_CHECK(::pwrite(fd, "XXXX", 4, 0) == 4);
+        ::close(fd);
+        FaLbphModel m;
+        FA_CHECK(!m.open(path, 1234, 5678, log));
+    }
+
+    // Missing file.
+    FaLbphModel m;
+    FA_CHECK(!m.open(dir + "/missing.lbph", 1234, 5678, log));
+}
+
+int main()
+{
+    std::printf("LBPH kernels: %s\n", fa_lbph_kernel_name());
+
+    test_elbp_rows();
+    test_chisq();
+
+    std::string dir = fa_test_tmpdir();
+    FA_CHECK(!dir.empty());
+    if (!dir.empty()) {
+        test_store_round_trip(dir);
+        test_store_rejects(dir);
+        fa_test_rmdir(dir);
+    }
+    return FA_TEST_RESULT();
+}
@@ -0,0 +1,98 @@
+//
+// Native LBPH against cv::face::LBPHFaceRecognizer: a model trained by
+// OpenCV, saved to the .lbph store the way training does, must predict
+// the same labels with the same distances, for f32 and u16 stores.
+//
+// The source is compiled in directly to reach save_lbph_store().
+//
+
+#include "../src/libfacialauth.cpp"
+
+#include "fa_test.h"
+#include "fa_test_faces.h"
+
+// Saves the store next to xml as training does and opens it.
+static bool open_store(cv::face::LBPHFaceRecognizer &rec, const std::string &xml,
+                       const std::string &dtype, FaLbphModel &m)
+{
+    rec.write(xml);
+
+    FacialAuthConfig cfg;
+    cfg.lbph_store = dtype;
+    std::string log;
+    save_lbph_store(cfg, rec, xml, xml, log);
+
+    int64_t size = 0, mtime_ns = 0;
+    FA_CHECK(stat_stamp(xml, size, mtime_ns));
+    bool ok = m.open(fa_lbph_path(xml), size, mtime_ns, log);
+    if (!ok)
+        std::fprintf(stderr, "%s", log.c_str());
+    return ok;
+}
+
+static void compare(const cv::face::LBPHFaceRecognizer &rec, const FaLbphModel &m,
+                    const std::vector<cv::Mat> &probes, double tol)
+{
+    for (const cv::Mat &p : probes) {
+        int ref_label = -2, label = -2;
+        double ref_dist = 0.0, dist = 0.0;
+        rec.predict(p, ref_label, ref_dist);
+        m.predict(p.ptr<uint8_t>(), p.cols, p.rows, p.step, label, dist);
+        FA_CHECK_EQ(label, ref_label);
+
+        // On a reject OpenCV reports DBL_MAX, the store the real distance.
+        if (ref_label >= 0)
+            FA_CHECK_NEAR(dist, ref_dist, tol);
+    }
+}
+
+static void test_against_opencv(const std::string &dir)
+{
+    FaTestDataset d = fa_test_dataset(11);
+
+    cv::Ptr<cv::face::LBPHFaceRecognizer> rec =
+        cv::face::LBPHFaceRecognizer::create(1, 8, 8, 8, DBL_MAX);
+    rec->train(d.train, d.labels);
+
+    // Same histograms as OpenCV's, bit for bit.
+    std::vector<cv::Mat> hists = rec->getHistograms();
+    FaLbphParams params;
+    std::vector<float> mine(params.bins());
+    for (size_t i = 0; i < d.train.size(); ++i) {
+        const cv::Mat &img = d.train[i];
+        fa_lbph_histogram(img.ptr<uint8_t>(), img.cols, img.rows, img.step, params, mine.data());
+        FA_CHECK(std::memcmp(mine.data(), hists[i].ptr<float>(),
+                             params.bins() * sizeof(float)) == 0);
+    }
+
+    // f32 keeps the trained rows; u16 rounds them to 1/65535.
+    const struct { const char *dtype; double tol; } stores[] = {
+        { "f32", 1e-6 },
+        { "u16", 2e-4 },
+    };
+    for (const auto &s : stores) {
+        FaLbphModel m;
+        FA_CHECK(open_store(*rec, dir + "/lbph_" + s.dtype + ".xml", s.dtype, m));
+        compare(*rec, m, d.probes, s.tol);
+    }
+
+    // With a threshold both reject the same probes.
+    rec->setThreshold(fa_test_mid_threshold(*rec, d.probes));
+    for (const auto &s : stores) {
+        FaLbphModel m;
+        FA_CHECK(open_store(*rec, dir + "/lbph_t_" + s.dtype + ".xml", s.dtype, m));
+        FA_CHECK_EQ(m.threshold(), rec->getThreshold());
+        compare(*rec, m, d.probes, s.tol);
+    }
+}
+
+int main()
+{
+    std::string dir = fa_test_tmpdir();
+    FA_CHECK(!dir.empty());
+    if (!dir.empty()) {
+        test_against_opencv(dir);
+        fa_test_rmdir(dir);
+    }
+    return FA_TEST_RESULT();
+}
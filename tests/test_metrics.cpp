@@ -0,0 +1,174 @@
+//
+// Prometheus textfile rendering: counters, cumulative histogram buckets,
+// merging with the existing file and the spool, and the lock that a
+// flush never waits for.
+//
+
+#include "fa_test.h"
+#include "../include/facialauth_metrics.h"
+
+#include <fstream>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+static std::map<std::string, double> read_prom(const std::string &path, int &types)
+{
+    std::map<std::string, double> out;
+    types = 0;
+    std::ifstream f(path);
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.rfind("# TYPE ", 0) == 0)
+            ++types;
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t sp = line.rfind(' ');
+        out[line.substr(0, sp)] = std::stod(line.substr(sp + 1));
+    }
+    return out;
+}
+
+static const char *ATTEMPTS = "facial_auth_attempts_total{result=\"%s\"}";
+
+static std::string attempts(const char *result)
+{
+    char buf[96];
+    std::snprintf(buf, sizeof(buf), ATTEMPTS, result);
+    return buf;
+}
+
+static std::string bucket(const char *stage, const char *le)
+{
+    return std::string("facial_auth_stage_seconds_bucket{stage=\"") + stage +
+           "\",le=\"" + le + "\"}";
+}
+
+static void test_render(const std::string &dir)
+{
+    std::string path = fa_metrics_path(dir);
+    FA_CHECK(path == dir + "/metrics/facial_auth.prom");
+
+    fa_metrics_result(FA_RESULT_ACCEPT);
+    fa_metrics_result(FA_RESULT_ACCEPT);
+    fa_metrics_result(FA_RESULT_NO_FACE);
+    fa_metrics_result((FaMetricResult)99);                 // ignored
+
+    fa_metrics_observe(FA_METRIC_DETECT, 4000);            // <= 5 ms
+    fa_metrics_observe(FA_METRIC_DETECT, 5000);            // on the bound: same bucket
+    fa_metrics_observe(FA_METRIC_DETECT, 30000);           // <= 50 ms
+    fa_metrics_observe(FA_METRIC_DETECT, 60000000);        // +Inf
+    fa_metrics_observe(FA_METRIC_TOTAL, -5);               // clamped to 0
+    fa_metrics_observe((FaMetricStage)99, 1);              // ignored
+
+    std::string log;
+    FA_CHECK(fa_metrics_flush(path, log));
+
+    struct stat st;
+    FA_CHECK(::stat((path + ".lock").c_str(), &st) == 0);
+    FA_CHECK_EQ(st.st_mode & 0777, (mode_t)0600);
+
+    int types = 0;
+    std::map<std::string, double> m = read_prom(path, types);
+    FA_CHECK_EQ(types, 2);
+    FA_CHECK_EQ(m[attempts("accept")], 2.0);
+    FA_CHECK_EQ(m[attempts("no_face")], 1.0);
+    FA_CHECK_EQ(m[attempts("reject")], 0.0);
+    FA_CHECK_EQ(m.count(attempts("cancelled")), (size_t)1);
+
+    FA_CHECK_EQ(m[bucket("detect", "0.005")], 2.0);
+    FA_CHECK_EQ(m[bucket("detect", "0.025")], 2.0);
+    FA_CHECK_EQ(m[bucket("detect", "0.05")], 3.0);
+    FA_CHECK_EQ(m[bucket("detect", "10")], 3.0);
+    FA_CHECK_EQ(m[bucket("detect", "+Inf")], 4.0);
+    FA_CHECK_EQ(m["facial_auth_stage_seconds_count{stage=\"detect\"}"], 4.0);
+    FA_CHECK_NEAR(m["facial_auth_stage_seconds_sum{stage=\"detect\"}"], 60.039, 1e-12);
+    FA_CHECK_EQ(m[bucket("total", "0.005")], 1.0);
+    FA_CHECK_EQ(m["facial_auth_stage_seconds_sum{stage=\"total\"}"], 0.0);
+    FA_CHECK_EQ(m[bucket("camera_open", "+Inf")], 0.0);
+
+    // Only new samples are added on the next flush.
+    fa_metrics_result(FA_RESULT_REJECT);
+    FA_CHECK(fa_metrics_flush(path, log));
+    m = read_prom(path, types);
+    FA_CHECK_EQ(m[attempts("accept")], 2.0);
+    FA_CHECK_EQ(m[attempts("reject")], 1.0);
+    FA_CHECK_EQ(m[bucket("detect", "+Inf")], 4.0);
+}
+
+// Another process's file and spooled deltas are merged, not overwritten.
+static void test_merge_and_spool(const std::string &dir)
+{
+    std::string path = fa_metrics_path(dir);
+
+    fa_metrics_result(FA_RESULT_TIMEOUT);
+    std::string log;
+    FA_CHECK(fa_metrics_spool(path, log));
+    FA_CHECK_EQ(fa_metrics_spooled(path), (size_t)1);
+
+    // Nothing new since the spool: no second delta.
+    FA_CHECK(fa_metrics_spool(path, log));
+    FA_CHECK_EQ(fa_metrics_spooled(path), (size_t)1);
+
+    struct stat st;
+    FA_CHECK(::stat((dir + "/metrics/spool").c_str(), &st) == 0);
+    FA_CHECK_EQ(st.st_mode & 0777, (mode_t)0700);
+
+    // A delta still being written is neither merged nor removed.
+    std::string partial = dir + "/metrics/spool/tmp.1.2";
+    {
+        std::ofstream f(partial);
+        f << "facial_auth_attempts_total{result=\"timeout\"} 100\n";
+    }
+
+    fa_metrics_result(FA_RESULT_TIMEOUT);
+    FA_CHECK(fa_metrics_flush(path, log));
+    FA_CHECK_EQ(fa_metrics_spooled(path), (size_t)0);
+
+    int types = 0;
+    std::map<std::string, double> m = read_prom(path, types);
+    FA_CHECK_EQ(m[attempts("timeout")], 2.0);          // spooled + in memory
+    FA_CHECK_EQ(m[attempts("accept")], 2.0);           // from the file
+    FA_CHECK(::stat(partial.c_str(), &st) == 0);
+    ::unlink(partial.c_str());
+}
+
+static void test_lock_contention(const std::string &dir)
+{
+    std::string path = fa_metrics_path(dir);
+    int fd = ::open((path + ".lock").c_str(), O_RDWR | O_CLOEXEC);
+    FA_CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+
+    // flock() locks belong to the open file, so this one conflicts with
+    // the flush's own open() even in the same process.
+    FA_CHECK(::flock(fd, LOCK_EX) == 0);
+    fa_metrics_result(FA_RESULT_ERROR);
+    std::string log;
+    FA_CHECK(!fa_metrics_flush(path, log));
+    FA_CHECK(log.find("busy") != std::string::npos);
+    ::flock(fd, LOCK_UN);
+    ::close(fd);
+
+    // The sample was kept for the next flush.
+    FA_CHECK(fa_metrics_flush(path, log));
+    int types = 0;
+    std::map<std::string, double> m = read_prom(path, types);
+    FA_CHECK_EQ(m[attempts("error")], 1.0);
+}
+
+int main()
+{
+    std::string dir = fa_test_tmpdir();
+    FA_CHECK(!dir.empty());
+    if (!dir.empty()) {
+        test_render(dir);
+        test_merge_and_spool(dir);
+        test_lock_contention(dir);
+        fa_test_rmdir(dir);
+    }
+    return FA_TEST_RESULT();
+}
@@ -0,0 +1,147 @@
+//
+// FaBoundedQueue: ordering, capacity, drop-oldest and close/stop.
+//
+
+#include "fa_test.h"
+#include "../include/facialauth_queue.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static void test_capacity()
+{
+    FaBoundedQueue<int> q1(1);
+    FA_CHECK_EQ(q1.capacity(), (size_t)2);
+
+    FaBoundedQueue<int> q5(5);
+    FA_CHECK_EQ(q5.capacity(), (size_t)8);
+
+    FaBoundedQueue<int> q8(8);
+    FA_CHECK_EQ(q8.capacity(), (size_t)8);
+}
+
+static void test_fifo_and_full()
+{
+    FaBoundedQueue<int> q(4);
+    for (int i = 0; i < 4; ++i)
+        FA_CHECK(q.try_push(int(i)));
+    FA_CHECK(!q.try_push(99));
+    FA_CHECK_EQ(q.size(), (size_t)4);
+
+    int v = -1;
+    for (int i = 0; i < 4; ++i) {
+        FA_CHECK(q.try_pop(v));
+        FA_CHECK_EQ(v, i);
+    }
+    FA_CHECK(!q.try_pop(v));
+    FA_CHECK_EQ(q.size(), (size_t)0);
+
+    // Wrap around the ring a few times.
+    for (int round = 0; round < 10; ++round) {
+        FA_CHECK(q.try_push(int(round)));
+        FA_CHECK(q.try_pop(v));
+        FA_CHECK_EQ(v, round);
+    }
+    FA_CHECK_EQ(q.pushed(), (uint64_t)14);
+    FA_CHECK_EQ(q.max_depth(), (size_t)4);
+}
+
+static void test_drop_oldest()
+{
+    FaBoundedQueue<int> q(2);
+    for (int i = 0; i < 5; ++i)
+        q.push_drop_oldest(int(i));
+
+    FA_CHECK_EQ(q.dropped(), (uint64_t)3);
+
+    int v = -1;
+    FA_CHECK(q.try_pop(v));
+    FA_CHECK_EQ(v, 3);
+    FA_CHECK(q.try_pop(v));
+    FA_CHECK_EQ(v, 4);
+    FA_CHECK(!q.try_pop(v));
+}
+
+static void test_close_and_stop()
+{
+    FaBoundedQueue<int> q(4);
+    FA_CHECK(q.try_push(7));
+    q.close();
+
+    int v = -1;
+    FA_CHECK(q.pop_wait(v));            // drains what is left
+    FA_CHECK_EQ(v, 7);
+    FA_CHECK(!q.pop_wait(v));           // then reports the end
+
+    FaBoundedQueue<int> q2(4);
+    std::atomic<bool> stop{true};
+    FA_CHECK(!q2.pop_wait(v, &stop));
+}
+
+// One producer, one consumer: every value arrives once, in order.
+static void test_spsc_order()
+{
+    const int N = 200000;
+    FaBoundedQueue<int> q(8);
+
+    std::thread producer([&] {
+        for (int i = 0; i < N; ++i)
+            while (!q.try_push(int(i)))
+                std::this_thread::yield();
+        q.close();
+    });
+
+    int expected = 0;
+    bool ordered = true;
+    int v;
+    while (q.pop_wait(v)) {
+        if (v != expected)
+            ordered = false;
+        ++expected;
+    }
+    producer.join();
+
+    FA_CHECK(ordered);
+    FA_CHECK_EQ(expected, N);
+}
+
+// Producer that also drops: the consumer sees an increasing subsequence
+// ending with the last value, and nothing is lost or seen twice.
+static void test_drop_oldest_concurrent()
+{
+    const int N = 100000;
+    FaBoundedQueue<int> q(4);
+
+    std::thread producer([&] {
+        for (int i = 0; i < N; ++i)
+            q.push_drop_oldest(int(i));
+        q.close();
+    });
+
+    std::vector<int> seen;
+    int v;
+    while (q.pop_wait(v))
+        seen.push_back(v);
+    producer.join();
+
+    bool increasing = true;
+    for (size_t i = 1; i < seen.size(); ++i)
+        if (seen[i] <= seen[i - 1])
+            increasing = false;
+
+    FA_CHECK(increasing);
+    FA_CHECK(!seen.empty() && seen.back() == N - 1);
+    FA_CHECK_EQ((uint64_t)seen.size() + q.dropped(), (uint64_t)N);
+}
+
+int main()
+{
+    test_capacity();
+    test_fifo_and_full();
+    test_drop_oldest();
+    test_close_and_stop();
+    test_spsc_order();
+    test_drop_oldest_concurrent();
+    return FA_TEST_RESULT();
+}
@@ -0,0 +1,197 @@
+//
+// Native Eigen/Fisher prediction: the kernels picked for this CPU against
+// the scalar ones, and the projection store (round trip, truncated,
+// stale, corrupt files).
+//
+// The source is compiled in directly to reach the static kernels.
+//
+
+#include "../src/facialauth_subspace.cpp"
+
+#include "fa_test.h"
+
+#include <random>
+
+static std::mt19937 rng(7);
+
+static std::vector<float> random_floats(size_t n, float lo, float hi)
+{
+    std::uniform_real_distribution<float> d(lo, hi);
+    std::vector<float> v(n);
+    for (auto &x : v)
+        x = d(rng);
+    return v;
+}
+
+static void test_kernels()
+{
+    const SubspaceKernels &k = kernels();
+    const double inf = std::numeric_limits<double>::max();
+
+    // dot: any length (padded to PROJ_LANES in the store, not here).
+    for (size_t n : { (size_t)16, (size_t)64, (size_t)1000, (size_t)10304, (size_t)40000 }) {
+        std::vector<float> a = random_floats(n, -1.0f, 1.0f);
+        std::vector<float> b = random_floats(n, -128.0f, 128.0f);
+        FA_CHECK_NEAR(k.dot(a.data(), b.data(), n), dot_scalar(a.data(), b.data(), n), 1e-5);
+    }
+
+    // l2sq: multiples of PROJ_LANES, as the store lays rows out.
+    for (size_t n : { (size_t)16, (size_t)48, (size_t)256 }) {
+        std::vector<float> a = random_floats(n, -1000.0f, 1000.0f);
+        std::vector<float> b = random_floats(n, -1000.0f, 1000.0f);
+        double ref = l2sq_scalar(a.data(), b.data(), n, inf);
+        FA_CHECK(ref > 0.0);
+        FA_CHECK_NEAR(k.l2sq(a.data(), b.data(), n, inf), ref, 1e-5);
+        FA_CHECK_EQ(k.l2sq(a.data(), a.data(), n, inf), 0.0);
+
+        // The early exit never reports less than the bound it stopped at.
+        FA_CHECK(k.l2sq(a.data(), b.data(), n, ref / 4) >= ref / 4);
+        FA_CHECK(l2sq_scalar(a.data(), b.data(), n, ref / 4) >= ref / 4);
+    }
+}
+
+// ----------------------------------------------------------
+// Store
+// ----------------------------------------------------------
+
+// A tiny model: 10x12 images, 5 components, one row per training face.
+struct Trained
+{
+    static const int W = 10, H = 12;
+    static const size_t DIM = (size_t)W * H, COMP = 5;
+
+    std::vector<float>                mean, basis, proj;
+    std::vector<int32_t>              labels;
+    std::vector<std::vector<uint8_t>> faces;
+};
+
+static Trained train(int rows)
+{
+    Trained t;
+    t.mean  = random_floats(Trained::DIM, 100.0f, 150.0f);
+    t.basis = random_floats(Trained::DIM * Trained::COMP, -0.1f, 0.1f);
+
+    std::uniform_int_distribution<int> px(0, 255);
+    for (int r = 0; r < rows; ++r) {
+        std::vector<uint8_t> img(Trained::DIM);
+        for (auto &p : img)
+            p = (uint8_t)px(rng);
+
+        // Projection as BasicFaceRecognizer computes it: (x - mean) * basis
+        for (size_t j = 0; j < Trained::COMP; ++j) {
+            double s = 0.0;
+            for (size_t i = 0; i < Trained::DIM; ++i)
+                s += ((double)img[i] - t.mean[i]) * t.basis[i * Trained::COMP + j];
+            t.proj.push_back((float)s);
+        }
+        t.faces.push_back(std::move(img));
+        t.labels.push_back(10 * r);
+    }
+    return t;
+}
+
+static bool write_store(const std::string &path, const Trained &t, double threshold = 1e9)
+{
+    std::string log;
+    return fa_subspace_write(path, Trained::DIM, Trained::COMP, t.mean.data(),
+                             t.basis.data(), t.proj.data(), t.labels.data(),
+                             t.labels.size(), threshold, 42, 4242, log);
+}
+
+static void test_store_round_trip(const std::string &dir)
+{
+    Trained t = train(4);
+    std::string path = dir + "/model.xml.proj";
+    FA_CHECK(write_store(path, t));
+
+    FaSubspaceModel m;
+    std::string log;
+    FA_CHECK(m.open(path, 42, 4242, log));
+    FA_CHECK_EQ(m.dim(), Trained::DIM);
+    FA_CHECK_EQ(m.components(), Trained::COMP);
+    FA_CHECK_EQ(m.rows(), (size_t)4);
+
+    for (size_t r = 0; r < t.faces.size(); ++r) {
+        int label = -1;
+        double dist = 0.0;
+        FA_CHECK(m.predict(t.faces[r].data(), Trained::W, Trained::H, Trained::W, label, dist));
+        FA_CHECK_EQ(label, t.labels[r]);
+        FA_CHECK(dist < 1e-2);
+    }
+
+    // A probe with a different size is refused, not mis-projected.
+    std::vector<uint8_t> wrong((size_t)Trained::W * (Trained::H + 1), 0);
+    int label = 0;
+    double dist = 0.0;
+    FA_CHECK(!m.predict(wrong.data(), Trained::W, Trained::H + 1, Trained::W, label, dist));
+    FA_CHECK_EQ(label, -1);
+
+    // Beyond the threshold: no label.
+    std::string strict = dir + "/strict.xml.proj";
+    FA_CHECK(write_store(strict, t, 1e-9));
+    FaSubspaceModel s;
+    FA_CHECK(s.open(strict, 42, 4242, log));
+    std::vector<uint8_t> probe = t.faces[0];
+    probe[0] ^= 0x80;
+    FA_CHECK(s.predict(probe.data(), Trained::W, Trained::H, Trained::W, label, dist));
+    FA_CHECK_EQ(label, -1);
+}
+
+static void test_store_rejects(const std::string &dir)
+{
+    Trained t = train(3);
+    std::string path = dir + "/reject.xml.proj";
+    std::string log;
+
+    // Stale: the XML model it mirrors has changed.
+    FA_CHECK(write_store(path, t));
+    {
+        FaSubspaceModel m;
+        FA_CHECK(!m.open(path, 43, 4242, log));
+        FA_CHECK(!m.open(path, 42, 4243, log));
+    }
+
+    // Truncated projections, then a truncated header.
+    struct stat st;
+    FA_CHECK(::stat(path.c_str(), &st) == 0);
+    FA_CHECK(::truncate(path.c_str(), st.st_size - 4) == 0);
+    {
+        FaSubspaceModel m;
+        log.clear();
+        FA_CHECK(!m.open(path, 42, 4242, log));
+        FA_CHECK(log.find("corrupt") != std::string::npos);
+    }
+    FA_CHECK(::truncate(path.c_str(), sizeof(ProjFileHeader) - 1) == 0);
+    {
+        FaSubspaceModel m;
+        FA_CHECK(!m.open(path, 42, 4242, log));
+    }
+
+    // Bad magic.
+    FA_CHECK(write_store(path, t));
+    {
+        int fd = ::open(path.c_str(), O_WRONLY);
+        FA_CHECK(fd >= 0);
+        FA_CHECK(::pwrite(fd, "XXXX", 4, 0) == 4);
+        ::close(fd);
+        FaSubspaceModel m;
+        FA_CHECK(!m.open(path, 42, 4242, log));
+    }
+
+    FaSubspaceModel m;
+    FA_CHECK(!m.open(dir + "/missing.proj", 42, 4242, log));
+}
+
+int main()
+{
+    test_kernels();
+
+    std::string dir = fa_test_tmpdir();
+    FA_CHECK(!dir.empty());
+    if (!dir.empty()) {
+        test_store_round_trip(dir);
+        test_store_rejects(dir);
+        fa_test_rmdir(dir);
+    }
+    return FA_TEST_RESULT();
+}
@@ -0,0 +1,82 @@
+//
+// Native Eigen/Fisher against cv::face::EigenFaceRecognizer and
+// FisherFaceRecognizer: a model trained by OpenCV, saved to the
+// .subspace store the way training does, must predict the same labels
+// with the same distances.
+//
+// The source is compiled in directly to reach save_subspace_store().
+//
+
+#include "../src/libfacialauth.cpp"
+
+#include "fa_test.h"
+#include "fa_test_faces.h"
+
+// Saves the store next to xml as training does and opens it.
+static bool open_store(cv::face::BasicFaceRecognizer &rec, const std::string &xml,
+                       FaSubspaceModel &m)
+{
+    rec.write(xml);
+
+    FacialAuthConfig cfg;
+    SubspaceModel sm;
+    subspace_from_recognizer(rec, sm);
+    std::string log;
+    save_subspace_store(cfg, sm, xml, xml, log);
+
+    int64_t size = 0, mtime_ns = 0;
+    FA_CHECK(stat_stamp(xml, size, mtime_ns));
+    bool ok = m.open(fa_subspace_path(xml), size, mtime_ns, log);
+    if (!ok)
+        std::fprintf(stderr, "%s", log.c_str());
+    return ok;
+}
+
+static void compare(const cv::face::BasicFaceRecognizer &rec, const FaSubspaceModel &m,
+                    const std::vector<cv::Mat> &probes, double tol)
+{
+    for (const cv::Mat &p : probes) {
+        int ref_label = -2, label = -2;
+        double ref_dist = 0.0, dist = 0.0;
+        rec.predict(p, ref_label, ref_dist);
+        FA_CHECK(m.predict(p.ptr<uint8_t>(), p.cols, p.rows, p.step, label, dist));
+        FA_CHECK_EQ(label, ref_label);
+
+        // On a reject OpenCV reports DBL_MAX, the store the real distance.
+        // The store keeps the basis in float: compare relative to ref_dist.
+        if (ref_label >= 0)
+            FA_CHECK_NEAR(dist, ref_dist, tol * std::max(1.0, ref_dist));
+    }
+}
+
+static void test_recognizer(cv::Ptr<cv::face::BasicFaceRecognizer> rec,
+                            const std::string &prefix)
+{
+    FaTestDataset d = fa_test_dataset(13);
+    rec->train(d.train, d.labels);
+
+    FaSubspaceModel m;
+    FA_CHECK(open_store(*rec, prefix + ".xml", m));
+    FA_CHECK_EQ(m.dim(), (size_t)(FA_FACE_W * FA_FACE_H));
+    FA_CHECK_EQ(m.rows(), d.train.size());
+    compare(*rec, m, d.probes, 1e-5);
+
+    // With a threshold both reject the same probes.
+    rec->setThreshold(fa_test_mid_threshold(*rec, d.probes));
+    FaSubspaceModel mt;
+    FA_CHECK(open_store(*rec, prefix + "_t.xml", mt));
+    FA_CHECK_EQ(mt.threshold(), rec->getThreshold());
+    compare(*rec, mt, d.probes, 1e-5);
+}
+
+int main()
+{
+    std::string dir = fa_test_tmpdir();
+    FA_CHECK(!dir.empty());
+    if (!dir.empty()) {
+        test_recognizer(cv::face::EigenFaceRecognizer::create(10, DBL_MAX), dir + "/eigen");
+        test_recognizer(cv::face::FisherFaceRecognizer::create(0, DBL_MAX), dir + "/fisher");
+        fa_test_rmdir(dir);
+    }
+    return FA_TEST_RESULT();
+}